@@ -0,0 +1,858 @@
+/*
+* @File: bench.c
+* @Date: 2026-10-17 21:19:07
+* @Last Modified time: 2026-10-17 22:05:36
+* @Description:
+*     Microbenchmarks of the ODR hot paths ("make bench"). Every benchmark
+*     runs on a fresh node (odr_sim.c) with synthetic tables of 10 to
+*     ODR_BENCH_MAXENTRIES entries, whose frames go to a transport that
+*     drops them, on a stopped virtual clock, so nothing but the code under
+*     test is timed and no privileges are needed. Each benchmark is run
+*     ODR_BENCH_ROUNDS times; one tab separated line per benchmark and
+*     table size gives the median and the fastest nanoseconds per
+*     operation, in a fixed order, so two versions can be compared with
+*     diff, join or a spreadsheet.
+*     - long bench_ns(void)
+*         [Wall clock]
+*     - odr_frame *bench_slot(odr_object *obj)
+*         [Benchmark frame output buffer]
+*     - int bench_send(odr_object *obj, int if_index, odr_frame *frame, int len, uchar pkttype)
+*         [Benchmark frame output]
+*     - void bench_flush(odr_object *obj)
+*         [Benchmark frame output flush]
+*     - void bench_deliver(odr_object *obj, odr_apacket *appmsg)
+*         [Benchmark APPMSG delivery]
+*     - odr_object *bench_node(void)
+*         [Benchmark node constructor]
+*     - void bench_neighbor(int k, uchar *mac, struct sockaddr_ll *from)
+*         [Address of a neighbor]
+*     - void bench_ntable(odr_object *obj)
+*         [Fill the neighbor table]
+*     - void bench_routes(odr_object *obj, int n)
+*         [Fill the route table]
+*     - void bench_picks(int *picks, int n)
+*         [Random table entries]
+*     - long bench_rtable_lookup(odr_object *obj, int n, long *ops)
+*         [get_item_rtable]
+*     - long bench_rtable_refresh(odr_object *obj, int n, long *ops)
+*         [InsertOrUpdateRoutingTable, known route]
+*     - long bench_rtable_insert(odr_object *obj, int n, long *ops)
+*         [InsertOrUpdateRoutingTable, new route]
+*     - long bench_ptable_lookup(odr_object *obj, int n, long *ops)
+*         [get_port_ptable]
+*     - long bench_purge_tables(odr_object *obj, int n, long *ops)
+*         [purge_tables]
+*     - long bench_queue_push(odr_object *obj, int n, long *ops)
+*         [queue_push]
+*     - long bench_queue_pending(odr_object *obj, int n, long *ops)
+*         [queue_push and queue_flush, waiting for a route]
+*     - long bench_rreq_handler(odr_object *obj, int n, long *ops)
+*         [RREQ handler]
+*     - long bench_rrep_handler(odr_object *obj, int n, long *ops)
+*         [RREP handler]
+*     - long bench_appmsg_handler(odr_object *obj, int n, long *ops)
+*         [APPMSG handler]
+*     - long bench_build_frame(odr_object *obj, int n, long *ops)
+*         [build_frame]
+*     - long bench_send_packet(odr_object *obj, int n, long *ops)
+*         [send_packet]
+*     - int bench_cmp(const void *a, const void *b)
+*         [Sort compare function]
+*     - void bench_run(const odr_bench *b, int n, int rounds)
+*         [Run and print one benchmark]
+*     + int main(int argc, char **argv)
+*         [Benchmark entry function]
+*/
+
+#include "np.h"
+
+#define BENCH_USAGE "usage: odr_bench [-r rounds] [-m max entries] [benchmark ...]"
+
+// keeps the lookups from being optimized away
+static volatile long bench_sink;
+static odr_frame bench_frame;
+
+/* --------------------------------------------------------------------------
+ *  bench_ns
+ *
+ *  Wall clock
+ *
+ *  @param  : void
+ *  @return : long  [monotonic time (ns)]
+ *
+ *  The ODR clocks are virtual and stopped while benchmarking
+ * --------------------------------------------------------------------------
+ */
+long bench_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/* --------------------------------------------------------------------------
+ *  bench_slot
+ *
+ *  Benchmark frame output buffer
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *  @return : odr_frame *           [the one buffer, frames are dropped]
+ * --------------------------------------------------------------------------
+ */
+odr_frame *bench_slot(odr_object *obj) {
+    return &bench_frame;
+}
+
+/* --------------------------------------------------------------------------
+ *  bench_send
+ *
+ *  Benchmark frame output
+ *
+ *  @param  : odr_object    *obj        [odr object]
+ *            int           if_index    [interface index]
+ *            odr_frame     *frame      [frame]
+ *            int           len         [frame length]
+ *            uchar         pkttype     [packet type]
+ *  @return : int                       [len]
+ *
+ *  Drop the frame; the handlers count it in the statistics
+ * --------------------------------------------------------------------------
+ */
+int bench_send(odr_object *obj, int if_index, odr_frame *frame, int len, uchar pkttype) {
+    return len;
+}
+
+/* --------------------------------------------------------------------------
+ *  bench_flush
+ *
+ *  Benchmark frame output flush
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void bench_flush(odr_object *obj) {
+}
+
+/* --------------------------------------------------------------------------
+ *  bench_deliver
+ *
+ *  Benchmark APPMSG delivery
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            odr_apacket   *appmsg [APPMSG]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void bench_deliver(odr_object *obj, odr_apacket *appmsg) {
+}
+
+// frames and messages are dropped
+static const odr_transport bench_transport = { bench_slot, bench_send, bench_flush, bench_deliver };
+
+/* --------------------------------------------------------------------------
+ *  bench_node
+ *
+ *  Benchmark node constructor
+ *
+ *  @param  : void
+ *  @return : odr_object *  [node 1 with two interfaces and the time
+ *                           server port, free with free_odr_object() and
+ *                           free()]
+ *
+ *  The staleness is long enough that nothing expires unless the clock is
+ *  moved
+ * --------------------------------------------------------------------------
+ */
+odr_object *bench_node(void) {
+    odr_sim_node *node = (odr_sim_node *)Calloc(1, sizeof(odr_sim_node));
+
+    node->id = 1;
+    node->nifs = 2;
+    sim_node(node, ODR_TIMETOLIVE);
+    node->obj.tp = &bench_transport;
+    node->obj.ptable = create_ptable();
+    return &node->obj;
+}
+
+/* --------------------------------------------------------------------------
+ *  bench_neighbor
+ *
+ *  Address of a neighbor
+ *
+ *  @param  : int                   k       [neighbor, 0 ..
+ *                                           ODR_BENCH_NEIGHBORS - 1]
+ *            uchar                 *mac    [MAC address to fill]
+ *            struct sockaddr_ll    *from   [sender information to fill,
+ *                                           or NULL]
+ *  @return : void
+ *
+ *  Neighbors alternate between the two interfaces of the node
+ * --------------------------------------------------------------------------
+ */
+void bench_neighbor(int k, uchar *mac, struct sockaddr_ll *from) {
+    uchar addr[ETH_ALEN] = {0x02, 0x00, 0xff, 0x00, k, 1};
+
+    memcpy(mac, addr, ETH_ALEN);
+    if (from == NULL)
+        return;
+    bzero(from, sizeof(struct sockaddr_ll));
+    from->sll_family = AF_PACKET;
+    from->sll_protocol = htons(PROTOCOL_ID);
+    from->sll_ifindex = 1 + (k & 1);
+    from->sll_halen = ETH_ALEN;
+    memcpy(from->sll_addr, addr, ETH_ALEN);
+}
+
+/* --------------------------------------------------------------------------
+ *  bench_ntable
+ *
+ *  Fill the neighbor table
+ *
+ *  @param  : odr_object    *obj    [benchmark node]
+ *  @return : void
+ *
+ *  Every neighbor speaks v3 and has told its MTU, as handle_frame()
+ *  learns from their frames; otherwise frames would go out in v1
+ * --------------------------------------------------------------------------
+ */
+void bench_ntable(odr_object *obj) {
+    int     k;
+    uchar   mac[ETH_ALEN];
+
+    for (k = 0; k < ODR_BENCH_NEIGHBORS; k++) {
+        bench_neighbor(k, mac, NULL);
+        update_ntable((char *)mac, 1 + (k & 1), ODR_VERSION_V3, ETH_DATA_LEN, obj);
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  bench_routes
+ *
+ *  Fill the route table
+ *
+ *  @param  : odr_object    *obj    [benchmark node]
+ *            int           n       [routes]
+ *  @return : void
+ *
+ *  Route i goes to ODR_SIM_NET + 2 + i, through neighbor
+ *  i % ODR_BENCH_NEIGHBORS, 1 to 8 hops away
+ * --------------------------------------------------------------------------
+ */
+void bench_routes(odr_object *obj, int n) {
+    int     i;
+    uchar   mac[ETH_ALEN];
+
+    if (obj->ntable == NULL)
+        bench_ntable(obj);
+
+    for (i = 0; i < n; i++) {
+        bench_neighbor(i % ODR_BENCH_NEIGHBORS, mac, NULL);
+        InsertOrUpdateRoutingTable(obj, NULL, htonl(ODR_SIM_NET + 2 + i), (char *)mac,
+                                   1 + (i % ODR_BENCH_NEIGHBORS & 1), 1 + i % 8);
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  bench_picks
+ *
+ *  Random table entries
+ *
+ *  @param  : int   *picks  [ODR_BENCH_PICKS entries to fill]
+ *            int   n       [table size]
+ *  @return : void
+ *
+ *  Fixed seed, so every version looks up the same entries
+ * --------------------------------------------------------------------------
+ */
+void bench_picks(int *picks, int n) {
+    int i;
+
+    srand48(n);
+    for (i = 0; i < ODR_BENCH_PICKS; i++)
+        picks[i] = lrand48() % n;
+}
+
+/* --------------------------------------------------------------------------
+ *  bench_rtable_lookup
+ *
+ *  get_item_rtable
+ *
+ *  @param  : odr_object    *obj    [benchmark node]
+ *            int           n       [routes]
+ *            long          *ops    [lookups]
+ *  @return : long                  [elapsed (ns)]
+ * --------------------------------------------------------------------------
+ */
+long bench_rtable_lookup(odr_object *obj, int n, long *ops) {
+    int         i, picks[ODR_BENCH_PICKS];
+    long        start, sum = 0;
+    in_addr_t   keys[ODR_BENCH_PICKS];
+
+    bench_routes(obj, n);
+    bench_picks(picks, n);
+    for (i = 0; i < ODR_BENCH_PICKS; i++)
+        keys[i] = htonl(ODR_SIM_NET + 2 + picks[i]);
+
+    start = bench_ns();
+    for (i = 0; i < *ops; i++)
+        sum += (long)get_item_rtable(keys[i & (ODR_BENCH_PICKS - 1)], obj);
+    start = bench_ns() - start;
+    bench_sink = sum;
+    return start;
+}
+
+/* --------------------------------------------------------------------------
+ *  bench_rtable_refresh
+ *
+ *  InsertOrUpdateRoutingTable, known route
+ *
+ *  @param  : odr_object    *obj    [benchmark node]
+ *            int           n       [routes]
+ *            long          *ops    [updates]
+ *  @return : long                  [elapsed (ns)]
+ *
+ *  The same path again, as every RREQ, RREP and APPMSG from a known
+ *  source does
+ * --------------------------------------------------------------------------
+ */
+long bench_rtable_refresh(odr_object *obj, int n, long *ops) {
+    int         i, picks[ODR_BENCH_PICKS];
+    long        start;
+    odr_rtable  *item, *items[ODR_BENCH_PICKS];
+
+    bench_routes(obj, n);
+    bench_picks(picks, n);
+    for (i = 0; i < ODR_BENCH_PICKS; i++)
+        items[i] = get_item_rtable(htonl(ODR_SIM_NET + 2 + picks[i]), obj);
+
+    start = bench_ns();
+    for (i = 0; i < *ops; i++) {
+        item = items[i & (ODR_BENCH_PICKS - 1)];
+        InsertOrUpdateRoutingTable(obj, item, item->dst, item->nexthop, item->index, item->hopcnt);
+    }
+    return bench_ns() - start;
+}
+
+/* --------------------------------------------------------------------------
+ *  bench_rtable_insert
+ *
+ *  InsertOrUpdateRoutingTable, new route
+ *
+ *  @param  : odr_object    *obj    [benchmark node]
+ *            int           n       [routes]
+ *            long          *ops    [set to n]
+ *  @return : long                  [elapsed (ns)]
+ *
+ *  Fill an empty table, the hash index grows on the way
+ * --------------------------------------------------------------------------
+ */
+long bench_rtable_insert(odr_object *obj, int n, long *ops) {
+    long start;
+
+    bench_ntable(obj);
+    start = bench_ns();
+    bench_routes(obj, n);
+    *ops = n;
+    return bench_ns() - start;
+}
+
+/* --------------------------------------------------------------------------
+ *  bench_ptable_lookup
+ *
+ *  get_port_ptable
+ *
+ *  @param  : odr_object    *obj    [benchmark node]
+ *            int           n       [paths]
+ *            long          *ops    [lookups, fewer for a large table]
+ *  @return : long                  [elapsed (ns)]
+ *
+ *  Paths of clients that already have a port, as every datagram from a
+ *  client looks up. The entries are linked in directly, registering them
+ *  one by one would take quadratic time
+ * --------------------------------------------------------------------------
+ */
+long bench_ptable_lookup(odr_object *obj, int n, long *ops) {
+    int         i, picks[ODR_BENCH_PICKS];
+    long        start, sum = 0;
+    odr_ptable  *item;
+    char        (*paths)[PATHNAME_BUFFSIZE] = Calloc(n, PATHNAME_BUFFSIZE);
+
+    for (i = 0; i < n; i++) {
+        item = (odr_ptable *)Calloc(1, sizeof(odr_ptable));
+        item->port = TIMESERV_PORT + 1 + i;
+        snprintf(paths[i], PATHNAME_BUFFSIZE, "/tmp/14508-61375-timeClient-%06d", i);
+        strcpy(item->path, paths[i]);
+        item->timestamp = timer_time();
+        item->next = obj->ptable->next;
+        item->prev = obj->ptable;
+        if (item->next)
+            item->next->prev = item;
+        obj->ptable->next = item;
+        timer_add(&obj->wheel, &item->timer, item->timestamp + ODR_TIMETOLIVE + 1, ptable_expire);
+    }
+    bench_picks(picks, n);
+    *ops = max(*ops / max(n / 16, 1), 64);
+
+    start = bench_ns();
+    for (i = 0; i < *ops; i++)
+        sum += get_port_ptable(paths[picks[i & (ODR_BENCH_PICKS - 1)]], obj);
+    start = bench_ns() - start;
+    bench_sink = sum;
+    free(paths);
+    return start;
+}
+
+/* --------------------------------------------------------------------------
+ *  bench_purge_tables
+ *
+ *  purge_tables
+ *
+ *  @param  : odr_object    *obj    [benchmark node]
+ *            int           n       [routes]
+ *            long          *ops    [set to n, the routes expired]
+ *  @return : long                  [elapsed (ns)]
+ *
+ *  Move the clock past the staleness and expire every route at once
+ * --------------------------------------------------------------------------
+ */
+long bench_purge_tables(odr_object *obj, int n, long *ops) {
+    long start, now = timer_usec();
+
+    bench_routes(obj, n);
+    timer_virtual(now + (obj->staleness + 2) * 1000000L);
+
+    start = bench_ns();
+    purge_tables(obj);
+    start = bench_ns() - start;
+
+    timer_virtual(now);
+    *ops = n;
+    return start;
+}
+
+/* --------------------------------------------------------------------------
+ *  bench_queue_push
+ *
+ *  queue_push
+ *
+ *  @param  : odr_object    *obj    [benchmark node]
+ *            int           n       [routes]
+ *            long          *ops    [APPMSGs]
+ *  @return : long                  [elapsed (ns)]
+ *
+ *  APPMSGs from a local client to known destinations: route lookup,
+ *  encoding and output
+ * --------------------------------------------------------------------------
+ */
+long bench_queue_push(odr_object *obj, int n, long *ops) {
+    int         i, picks[ODR_BENCH_PICKS];
+    long        start;
+    odr_apacket *packets = (odr_apacket *)Calloc(256, sizeof(odr_apacket));
+
+    bench_routes(obj, n);
+    bench_picks(picks, n);
+    for (i = 0; i < 256; i++) {
+        packets[i].dst = htonl(ODR_SIM_NET + 2 + picks[i]);
+        packets[i].src = obj->addr;
+        packets[i].dst_port = TIMESERV_PORT;
+        packets[i].src_port = TIMESERV_PORT + 1;
+        packets[i].length = packets[i].total = snprintf(packets[i].data, ODR_MSG_MAXLEN, "bench %d", i);
+        packets[i].msg_id = i;
+    }
+
+    start = bench_ns();
+    for (i = 0; i < *ops; i++)
+        queue_push(obj, ODR_FRAME_APPMSG, &packets[i & 255]);
+    start = bench_ns() - start;
+    free(packets);
+    return start;
+}
+
+/* --------------------------------------------------------------------------
+ *  bench_queue_pending
+ *
+ *  queue_push and queue_flush, waiting for a route
+ *
+ *  @param  : odr_object    *obj    [benchmark node]
+ *            int           n       [routes]
+ *            long          *ops    [APPMSGs]
+ *  @return : long                  [elapsed (ns)]
+ *
+ *  APPMSGs from a local client asking for forced discovery, so they are
+ *  copied onto the pending list of their destination, the first one of a
+ *  destination sends the RREQ and the others wait for it. After every 256
+ *  APPMSGs the RREPs are taken as arrived: the pending lists are flushed
+ *  and every APPMSG is sent
+ * --------------------------------------------------------------------------
+ */
+long bench_queue_pending(odr_object *obj, int n, long *ops) {
+    int         i, j, picks[ODR_BENCH_PICKS];
+    long        start;
+    odr_apacket *packets = (odr_apacket *)Calloc(256, sizeof(odr_apacket));
+
+    bench_routes(obj, n);
+    bench_picks(picks, n);
+    for (i = 0; i < 256; i++) {
+        packets[i].dst = htonl(ODR_SIM_NET + 2 + picks[i]);
+        packets[i].src = obj->addr;
+        packets[i].dst_port = TIMESERV_PORT;
+        packets[i].src_port = TIMESERV_PORT + 1;
+        packets[i].frd = 1;
+        packets[i].length = packets[i].total = snprintf(packets[i].data, ODR_MSG_MAXLEN, "bench %d", i);
+        packets[i].msg_id = i;
+    }
+
+    start = bench_ns();
+    for (i = 0; i < *ops; i++) {
+        queue_push(obj, ODR_FRAME_APPMSG, &packets[i & 255]);
+        if ((i & 255) == 255 || i == *ops - 1)
+            for (j = 0; j <= (i & 255); j++)
+                queue_flush(obj, packets[j].dst);
+    }
+    start = bench_ns() - start;
+    free(packets);
+    return start;
+}
+
+/* --------------------------------------------------------------------------
+ *  bench_rreq_handler
+ *
+ *  RREQ handler
+ *
+ *  @param  : odr_object    *obj    [benchmark node]
+ *            int           n       [routes]
+ *            long          *ops    [RREQs]
+ *  @return : long                  [elapsed (ns)]
+ *
+ *  New RREQs (every one has its own broadcast id) from known sources for
+ *  unknown destinations, which are rebroadcast: the common frame of a
+ *  discovery flood. Through handle_frame(), as the socket handler calls it
+ * --------------------------------------------------------------------------
+ */
+long bench_rreq_handler(odr_object *obj, int n, long *ops) {
+    int                 i, k, vbits, picks[ODR_BENCH_PICKS];
+    long                start;
+    uchar               mac[ETH_ALEN], bcast_mac[ETH_ALEN] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    odr_rpacket         rreq;
+    odr_frame           *frames = (odr_frame *)Calloc(256, sizeof(odr_frame));
+    struct sockaddr_ll  *from = (struct sockaddr_ll *)Calloc(256, sizeof(struct sockaddr_ll));
+
+    bench_routes(obj, n);
+    bench_picks(picks, n);
+    for (i = 0; i < 256; i++) {
+        k = picks[i] % ODR_BENCH_NEIGHBORS;
+        bench_neighbor(k, mac, &from[i]);
+        bzero(&rreq, sizeof(rreq));
+        rreq.dst = htonl(ODR_SIM_NET + 2 + n + i);
+        rreq.src = htonl(ODR_SIM_NET + 2 + picks[i]);
+        rreq.flag.req = 1;
+        rreq.hopcnt = 8;
+        rreq.ttl = ODR_TTL_FLOOD;
+        vbits = encode_rpacket(frames[i].data, &rreq, ODR_VERSION_V2);
+        ((odr_rpacket *)frames[i].data)->mtu = htons(ETH_DATA_LEN);
+        build_frame_header(&frames[i], bcast_mac, mac, ODR_FRAME_RREQ | vbits);
+    }
+
+    start = bench_ns();
+    for (i = 0; i < *ops; i++) {
+        ((odr_rpacket *)frames[i & 255].data)->bcast_id = htonl(i + 1);
+        handle_frame(obj, &frames[i & 255], ODR_FRAME_BASELEN, &from[i & 255]);
+    }
+    start = bench_ns() - start;
+    free(frames);
+    free(from);
+    return start;
+}
+
+/* --------------------------------------------------------------------------
+ *  bench_rrep_handler
+ *
+ *  RREP handler
+ *
+ *  @param  : odr_object    *obj    [benchmark node, at least 2 routes]
+ *            int           n       [routes]
+ *            long          *ops    [RREPs]
+ *  @return : long                  [elapsed (ns)]
+ *
+ *  RREPs with a shorter path to a known destination, which update the
+ *  route and are relayed towards their known source
+ * --------------------------------------------------------------------------
+ */
+long bench_rrep_handler(odr_object *obj, int n, long *ops) {
+    int                 i, k, vbits, picks[ODR_BENCH_PICKS];
+    long                start;
+    uchar               mac[ETH_ALEN];
+    odr_rpacket         rrep;
+    odr_rtable          *items[256];
+    odr_frame           *frames = (odr_frame *)Calloc(256, sizeof(odr_frame));
+    struct sockaddr_ll  *from = (struct sockaddr_ll *)Calloc(256, sizeof(struct sockaddr_ll));
+
+    bench_routes(obj, n);
+    bench_picks(picks, n);
+    for (i = 0; i < 256; i++) {
+        k = picks[i] % ODR_BENCH_NEIGHBORS;
+        bench_neighbor(k, mac, &from[i]);
+        bzero(&rrep, sizeof(rrep));
+        rrep.dst = htonl(ODR_SIM_NET + 2 + picks[i]);
+        rrep.src = htonl(ODR_SIM_NET + 2 + (picks[i] + 1) % n);
+        rrep.flag.rep = 1;
+        rrep.flag.res = 1;
+        rrep.hopcnt = 1;
+        rrep.bcast_id = i + 1;
+        vbits = encode_rpacket(frames[i].data, &rrep, ODR_VERSION_V2);
+        ((odr_rpacket *)frames[i].data)->mtu = htons(ETH_DATA_LEN);
+        build_frame_header(&frames[i], (uchar *)get_item_itable(from[i].sll_ifindex, obj)->if_haddr, mac, ODR_FRAME_RREP | vbits);
+        items[i] = get_item_rtable(rrep.dst, obj);
+    }
+
+    start = bench_ns();
+    for (i = 0; i < *ops; i++) {
+        items[i & 255]->hopcnt = 8;
+        handle_frame(obj, &frames[i & 255], ODR_FRAME_BASELEN, &from[i & 255]);
+    }
+    start = bench_ns() - start;
+    free(frames);
+    free(from);
+    return start;
+}
+
+/* --------------------------------------------------------------------------
+ *  bench_appmsg_handler
+ *
+ *  APPMSG handler
+ *
+ *  @param  : odr_object    *obj    [benchmark node, at least 2 routes]
+ *            int           n       [routes]
+ *            long          *ops    [APPMSGs]
+ *  @return : long                  [elapsed (ns)]
+ *
+ *  Transit APPMSGs between known nodes from known neighbors, which take
+ *  the forwarding fast path. Every frame is handled once before timing,
+ *  so the neighbors are in ntable
+ * --------------------------------------------------------------------------
+ */
+long bench_appmsg_handler(odr_object *obj, int n, long *ops) {
+    int                 i, k, vbits, picks[ODR_BENCH_PICKS];
+    long                start;
+    uchar               mac[ETH_ALEN];
+    odr_apacket         appmsg;
+    odr_frame           *frames = (odr_frame *)Calloc(256, sizeof(odr_frame));
+    struct sockaddr_ll  *from = (struct sockaddr_ll *)Calloc(256, sizeof(struct sockaddr_ll));
+
+    bench_routes(obj, n);
+    bench_picks(picks, n);
+    for (i = 0; i < 256; i++) {
+        k = picks[i] % ODR_BENCH_NEIGHBORS;
+        bench_neighbor(k, mac, &from[i]);
+        bzero(&appmsg, offsetof(odr_apacket, data));
+        appmsg.dst = htonl(ODR_SIM_NET + 2 + (picks[i] + 1) % n);
+        appmsg.src = htonl(ODR_SIM_NET + 2 + picks[i]);
+        appmsg.dst_port = TIMESERV_PORT;
+        appmsg.src_port = TIMESERV_PORT + 1;
+        appmsg.hopcnt = 8;
+        appmsg.length = appmsg.total = snprintf(appmsg.data, ODR_MSG_MAXLEN, "bench %d", i);
+        vbits = encode_apacket(frames[i].data, &appmsg, ODR_VERSION_V3);
+        build_frame_header(&frames[i], (uchar *)get_item_itable(from[i].sll_ifindex, obj)->if_haddr, mac, ODR_FRAME_APPMSG | vbits);
+        handle_frame(obj, &frames[i], ODR_FRAME_BASELEN, &from[i]);
+    }
+
+    start = bench_ns();
+    for (i = 0; i < *ops; i++)
+        handle_frame(obj, &frames[i & 255], ODR_FRAME_BASELEN, &from[i & 255]);
+    start = bench_ns() - start;
+    free(frames);
+    free(from);
+    return start;
+}
+
+/* --------------------------------------------------------------------------
+ *  bench_build_frame
+ *
+ *  build_frame
+ *
+ *  @param  : odr_object    *obj    [benchmark node]
+ *            int           n       [unused]
+ *            long          *ops    [frames]
+ *  @return : long                  [elapsed (ns)]
+ *
+ *  The header built field by field and the payload copied in, as before
+ *  the header templates
+ * --------------------------------------------------------------------------
+ */
+long bench_build_frame(odr_object *obj, int n, long *ops) {
+    int         i;
+    long        start;
+    uchar       mac[ETH_ALEN];
+    char        payload[ODR_FRAME_PAYLOAD];
+    odr_rpacket rreq;
+
+    bench_neighbor(0, mac, NULL);
+    bzero(&rreq, sizeof(rreq));
+    rreq.dst = htonl(ODR_SIM_NET + 2);
+    rreq.src = obj->addr;
+    rreq.flag.req = 1;
+    encode_rpacket(payload, &rreq, ODR_VERSION_V2);
+
+    start = bench_ns();
+    for (i = 0; i < *ops; i++)
+        build_frame(&bench_frame, mac, (uchar *)obj->itable->if_haddr, ODR_FRAME_RREQ | ODR_FRAME_V2, payload);
+    start = bench_ns() - start;
+    bench_sink = bench_frame.h_type;
+    return start;
+}
+
+/* --------------------------------------------------------------------------
+ *  bench_send_packet
+ *
+ *  send_packet
+ *
+ *  @param  : odr_object    *obj    [benchmark node]
+ *            int           n       [unused]
+ *            long          *ops    [frames]
+ *  @return : long                  [elapsed (ns)]
+ *
+ *  A v2 RREQ broadcast: version lookup, encoding into the output slot behind
+ *  the header template, and output_frame() up to the transport. The
+ *  sendto() of send_frame() is a system call and not measured here
+ * --------------------------------------------------------------------------
+ */
+long bench_send_packet(odr_object *obj, int n, long *ops) {
+    int         i;
+    long        start;
+    odr_rpacket rreq;
+
+    bzero(&rreq, sizeof(rreq));
+    rreq.dst = htonl(ODR_SIM_NET + 2);
+    rreq.src = obj->addr;
+    rreq.flag.req = 1;
+    bench_ntable(obj);
+
+    start = bench_ns();
+    for (i = 0; i < *ops; i++) {
+        rreq.bcast_id = i;
+        send_packet(obj, obj->itable, NULL, ODR_FRAME_RREQ, &rreq);
+    }
+    return bench_ns() - start;
+}
+
+static const odr_bench bench_list[] = {
+    { "rtable_lookup",  bench_rtable_lookup,    1 },
+    { "rtable_refresh", bench_rtable_refresh,   1 },
+    { "rtable_insert",  bench_rtable_insert,    1 },
+    { "ptable_lookup",  bench_ptable_lookup,    1 },
+    { "purge_tables",   bench_purge_tables,     1 },
+    { "queue_push",     bench_queue_push,       1 },
+    { "queue_pending",  bench_queue_pending,    1 },
+    { "rreq_handler",   bench_rreq_handler,     1 },
+    { "rrep_handler",   bench_rrep_handler,     1 },
+    { "appmsg_handler", bench_appmsg_handler,   1 },
+    { "build_frame",    bench_build_frame,      0 },
+    { "send_packet",    bench_send_packet,      0 },
+};
+
+/* --------------------------------------------------------------------------
+ *  bench_cmp
+ *
+ *  Sort compare function
+ *
+ *  @param  : const void    *a  [double]
+ *            const void    *b  [double]
+ *  @return : int
+ * --------------------------------------------------------------------------
+ */
+int bench_cmp(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* --------------------------------------------------------------------------
+ *  bench_run
+ *
+ *  Run and print one benchmark
+ *
+ *  @param  : const odr_bench   *b      [benchmark]
+ *            int               n       [table size, 0 if not sized]
+ *            int               rounds  [rounds]
+ *  @return : void
+ *
+ *  Every round gets a new node. Prints
+ *      name <tab> entries <tab> ops <tab> median ns/op <tab> min ns/op
+ * --------------------------------------------------------------------------
+ */
+void bench_run(const odr_bench *b, int n, int rounds) {
+    int         r;
+    long        ops = ODR_BENCH_OPS, ns;
+    double      *per = (double *)Calloc(rounds, sizeof(double));
+    odr_object  *obj;
+
+    for (r = 0; r < rounds; r++) {
+        obj = bench_node();
+        ops = ODR_BENCH_OPS;
+        ns = b->fn(obj, n, &ops);
+        per[r] = (double)ns / max(ops, 1);
+        free_odr_object(obj);
+        free(obj);
+    }
+    qsort(per, rounds, sizeof(double), bench_cmp);
+    printf("%s\t%d\t%ld\t%.1f\t%.1f\n", b->name, n, ops, per[rounds / 2], per[0]);
+    fflush(stdout);
+    free(per);
+}
+
+/* --------------------------------------------------------------------------
+ *  main
+ *
+ *  Benchmark entry function
+ *
+ *  @param  : int   argc
+ *            char  **argv
+ *  @return : int
+ *
+ *  Run the benchmarks named on the command line, or all of them, at
+ *  table sizes 10, 100, ... up to the maximum, on a stopped virtual
+ *  clock; errors only are logged
+ * --------------------------------------------------------------------------
+ */
+int main(int argc, char **argv) {
+    int     c, j, n, rounds = ODR_BENCH_ROUNDS, maxn = ODR_BENCH_MAXENTRIES;
+    uint    k;
+
+    while ((c = getopt(argc, argv, "r:m:")) != -1) {
+        switch (c) {
+        case 'r': rounds = atoi(optarg); break;
+        case 'm': maxn = atoi(optarg); break;
+        default: err_quit(BENCH_USAGE);
+        }
+    }
+    if (rounds <= 0 || maxn < 10)
+        err_quit(BENCH_USAGE);
+    for (j = optind; j < argc; j++) {
+        for (k = 0; k < sizeof(bench_list) / sizeof(bench_list[0]); k++)
+            if (strcmp(argv[j], bench_list[k].name) == 0)
+                break;
+        if (k == sizeof(bench_list) / sizeof(bench_list[0]))
+            err_quit("odr_bench: no benchmark %s", argv[j]);
+    }
+
+    log_init(ODR_LOG_ERR);
+    timer_virtual(ODR_SIM_EPOCH * 1000000L);
+
+    printf("benchmark\tentries\tops\tns_per_op\tns_per_op_min\n");
+    for (k = 0; k < sizeof(bench_list) / sizeof(bench_list[0]); k++) {
+        for (j = optind; j < argc; j++)
+            if (strcmp(argv[j], bench_list[k].name) == 0)
+                break;
+        if (optind < argc && j == argc)
+            continue;
+        if (!bench_list[k].sized) {
+            bench_run(&bench_list[k], 0, rounds);
+            continue;
+        }
+        for (n = 10; n <= maxn; n *= 10)
+            bench_run(&bench_list[k], n, rounds);
+    }
+    log_free();
+    return 0;
+}
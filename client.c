@@ -26,10 +26,14 @@
  *     c. If receive a response, print out and start the cycle again;
  *        Else if first timeout, go to step b and try again;
  *        Otherwise, the request is failed, start the cycle again.
+ *     Every request has its own id, a reply with the id of an earlier one
+ *     is late and ignored
+ *  With -s, the shared-memory transport to ODR is used
  * --------------------------------------------------------------------------
  */
 int main(int argc, char **argv) {
     int     i, sockfd, fd, resend = 0, port = 0;
+    uint    req_id = 0, reply_id;
     char    data[ODR_DGRAM_DATALEN];
     char    cli_ipaddr[IPADDR_BUFFSIZE], cli_hostname[HOSTNAME_BUFFSIZE];
     char    srv_ipaddr[IPADDR_BUFFSIZE], srv_hostname[HOSTNAME_BUFFSIZE];
@@ -37,7 +41,7 @@ int main(int argc, char **argv) {
 
     // get IP address of current node
     free_hwa_info(Get_hw_addrs(cli_ipaddr));
-    util_ip_to_hostname(cli_ipaddr, cli_hostname);
+    util_ip_to_hostname(cli_ipaddr, cli_hostname, ODR_RESOLV_WAIT);
 
     bzero(&cliaddr, sizeof(cliaddr));
     cliaddr.sun_family = AF_LOCAL;
@@ -52,6 +56,9 @@ int main(int argc, char **argv) {
     sockfd = Socket(AF_LOCAL, SOCK_DGRAM, 0);
     Bind(sockfd, (SA *)&cliaddr, sizeof(cliaddr));
 
+    if (argc > 1 && strcmp(argv[1], "-s") == 0 && msg_shm_open(sockfd) < 0)
+        printf("client at node %s: shared-memory transport not available\n", cli_hostname);
+
     printf("client at node %s open socket %d on path %s\n", cli_hostname, sockfd, cliaddr.sun_path);
 
     // work cycle
@@ -72,7 +79,7 @@ int main(int argc, char **argv) {
         }
         if (strcmp(srv_hostname, "exit") == 0)
             break;
-        util_hostname_to_ip(srv_hostname, srv_ipaddr);
+        util_hostname_to_ip(srv_hostname, srv_ipaddr, ODR_RESOLV_WAIT);
 
         if (strlen(srv_ipaddr) == 0) {
             printf("Node '%s' does not exist!\n", srv_hostname);
@@ -82,10 +89,13 @@ int main(int argc, char **argv) {
 sendagain:
         strcpy(data, "R");
         printf("client at node %s: send request to server at %s %s\n", cli_hostname, srv_hostname, (resend ? "(forced discovery)" : ""));
-        msg_send(sockfd, srv_ipaddr, TIMESERV_PORT, data, resend);
+        msg_send_req(sockfd, srv_ipaddr, TIMESERV_PORT, data, resend, ++req_id);
 
-        bzero(data, ODR_DGRAM_DATALEN);
-        i = msg_recv(sockfd, data, srv_ipaddr, &port);
+        // a late reply to an earlier request is passed over
+        do {
+            bzero(data, ODR_DGRAM_DATALEN);
+            i = msg_recv_req(sockfd, data, srv_ipaddr, &port, &reply_id);
+        } while (i > 0 && reply_id && reply_id != req_id);
         if (i > 0) {
             printf("client at node %s: received from %s <%s>\n", cli_hostname, srv_hostname, data);
         } else if (i == 0 && resend == 0) {
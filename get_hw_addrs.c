@@ -95,6 +95,11 @@ odr_itable *get_hw_addrs(char *obj_ipaddr) {
         if (ioctl(sockfd, SIOCGIFINDEX, &ifrcopy) < 0)
             perror("SIOCGIFINDEX");  /* get interface index */
         memcpy(&hwa->if_index, &ifrcopy.ifr_ifindex, sizeof(int));
+        if (ioctl(sockfd, SIOCGIFMTU, &ifrcopy) < 0) {
+            perror("SIOCGIFMTU");  /* get MTU */
+            ifrcopy.ifr_mtu = ODR_MTU_MIN;
+        }
+        hwa->if_mtu = min(ifrcopy.ifr_mtu, ODR_MTU_MAX);
     }
     free(buf);
     return(hwahead);  /* pointer to first structure in linked list */
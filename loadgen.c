@@ -0,0 +1,354 @@
+/*
+* @File: loadgen.c
+* @Date: 2026-10-17 21:01:20
+* @Last Modified time: 2026-10-17 21:24:59
+* @Description:
+*     Load generator for the time service. Keeps up to -c requests in
+*     flight to a set of nodes over one domain socket, optionally at a
+*     fixed rate, for a fixed duration, with a share of the requests sent
+*     with the forced discovery flag. At the end it prints throughput and
+*     latency quantiles, split into cold requests (forced discovery, or no
+*     route known to ODR yet) and warm ones (route cached).
+*     Every request carries a request id (odr_api.c) and a reply is matched
+*     to its request by the id, so any number of requests may be in flight
+*     to the same node. With a rate, latency counts from the time a request
+*     was due, not from when a slot became free, so a slow service is not
+*     hidden by the generator waiting for it.
+*     - long load_usec(void)
+*         [Current time in microseconds]
+*     - void load_routes(odr_load *ld)
+*         [Targets ODR already has a route to]
+*     - int load_send(odr_load *ld, long sched)
+*         [Send a request to the next node]
+*     - void load_recv(odr_load *ld)
+*         [Match the pending replies]
+*     - void load_expire(odr_load *ld, long now)
+*         [Count requests without reply as lost]
+*     - void load_report(odr_load *ld, const char *hostname, long usec)
+*         [Print the results]
+*     + int main(int argc, char **argv)
+*         [Load generator entry function]
+*/
+
+#include "np.h"
+
+#define LOADGEN_USAGE "usage: loadgen [-c concurrency] [-r rate] [-d seconds] [-f forced discovery ratio] [-t timeout ms] node ..."
+
+/* --------------------------------------------------------------------------
+ *  load_usec
+ *
+ *  Current time in microseconds
+ *
+ *  @param  : void
+ *  @return : long  [CLOCK_REALTIME, the clock of the kernel timestamps]
+ * --------------------------------------------------------------------------
+ */
+long load_usec(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/* --------------------------------------------------------------------------
+ *  load_routes
+ *
+ *  Targets ODR already has a route to
+ *
+ *  @param  : odr_load  *ld     [load generator]
+ *  @return : void
+ *
+ *  Read the route table on the query socket (odr_query.c), so the first
+ *  request to a node with a cached route counts as warm. If ODR does not
+ *  answer, every node starts cold
+ * --------------------------------------------------------------------------
+ */
+void load_routes(odr_load *ld) {
+    int                 i, j, fd, sockfd;
+    char                buf[ODR_QUERY_MAXLEN];
+    odr_query           q;
+    odr_query_reply     *r = (odr_query_reply *)buf;
+    odr_route_rec       *rec;
+    struct pollfd       pfd;
+    struct sockaddr_un  cliaddr, odraddr;
+
+    bzero(&cliaddr, sizeof(cliaddr));
+    cliaddr.sun_family = AF_LOCAL;
+    strcpy(cliaddr.sun_path, ODR_QUERYCLIE_PATH);
+    fd = mkstemp(cliaddr.sun_path);
+    close(fd);
+    unlink(cliaddr.sun_path);
+
+    bzero(&odraddr, sizeof(odraddr));
+    odraddr.sun_family = AF_LOCAL;
+    strcpy(odraddr.sun_path, ODR_QUERY_PATH);
+
+    sockfd = Socket(AF_LOCAL, SOCK_DGRAM, 0);
+    Bind(sockfd, (SA *)&cliaddr, sizeof(cliaddr));
+
+    bzero(&q, sizeof(q));
+    q.table = ODR_QUERY_ROUTE;
+    pfd.fd = sockfd;
+    pfd.events = POLLIN;
+    do {
+        if (sendto(sockfd, &q, sizeof(q), 0, (SA *)&odraddr, sizeof(odraddr)) < 0 ||
+            poll(&pfd, 1, MSG_RECV_TIMEOUT * 1000) <= 0 ||
+            recv(sockfd, buf, sizeof(buf), 0) < (int)sizeof(odr_query_reply))
+            break;
+        rec = (odr_route_rec *)r->data;
+        for (i = 0; i < r->count; i++, rec++)
+            for (j = 0; j < ld->ntargets; j++)
+                if (ld->targets[j] == rec->dst)
+                    ld->routed[j] = 1;
+        q.cursor = r->cursor;
+    } while (q.cursor != ODR_QUERY_END);
+
+    close(sockfd);
+    unlink(cliaddr.sun_path);
+}
+
+/* --------------------------------------------------------------------------
+ *  load_send
+ *
+ *  Send a request to the next node
+ *
+ *  @param  : odr_load  *ld     [load generator]
+ *            long      sched   [time the request was due (us)]
+ *  @return : int               [0 if sent, -1 if the request table is full]
+ *
+ *  Nodes are taken round robin. A request is cold if it is sent with the
+ *  forced discovery flag or ODR has no route to its node yet
+ * --------------------------------------------------------------------------
+ */
+int load_send(odr_load *ld, long sched) {
+    int             t = ld->next, cold;
+    char            dst[IPADDR_BUFFSIZE], data[2] = "R";
+    odr_req         *req;
+    odr_load_req    *lr;
+
+    cold = (ld->forced > 0 && drand48() < ld->forced);
+    inet_ntop(AF_INET, &ld->targets[t], dst, sizeof(dst));
+    if ((req = msg_req_send(ld->sockfd, &ld->reqs, dst, TIMESERV_PORT, data, cold)) == NULL) {
+        if (errno == EAGAIN)
+            return -1;
+        err_sys("msg_send error");
+    }
+
+    lr = &ld->load[req - ld->reqs.slots];
+    lr->sched = sched;
+    lr->target = t;
+    lr->cold = cold | !ld->routed[t];
+    ld->next = (t + 1) % ld->ntargets;
+    ld->sent++;
+    return 0;
+}
+
+/* --------------------------------------------------------------------------
+ *  load_recv
+ *
+ *  Match the pending replies
+ *
+ *  @param  : odr_load  *ld     [load generator]
+ *  @return : void
+ *
+ *  The latency of a reply runs from the time its request was due to the
+ *  kernel timestamp of the reply. A reply for a request already counted
+ *  lost is stray
+ * --------------------------------------------------------------------------
+ */
+void load_recv(odr_load *ld) {
+    int             i, n;
+    odr_msg         msgs[ODR_MSG_BATCH];
+    odr_req         *req;
+    odr_load_req    *lr;
+
+    while ((n = msg_recv_batch(ld->sockfd, msgs, ODR_MSG_BATCH, 0)) > 0) {
+        for (i = 0; i < n; i++) {
+            if ((req = msg_req_match(&ld->reqs, &msgs[i])) == NULL) {
+                ld->stray++;
+                continue;
+            }
+            lr = &ld->load[req - ld->reqs.slots];
+            hist_add(lr->cold ? &ld->cold : &ld->warm, max(msgs[i].usec - lr->sched, 0));
+            ld->routed[lr->target] = 1;
+            msg_req_done(&ld->reqs, req);
+            ld->received++;
+        }
+    }
+    if (n < 0)
+        err_sys("msg_recv_batch error");
+}
+
+/* --------------------------------------------------------------------------
+ *  load_expire
+ *
+ *  Count requests without reply as lost
+ *
+ *  @param  : odr_load  *ld     [load generator]
+ *            long      now     [current time (us)]
+ *  @return : void
+ *
+ *  The timeout runs from the send time. The node of a lost request counts
+ *  as having no route again
+ * --------------------------------------------------------------------------
+ */
+void load_expire(odr_load *ld, long now) {
+    odr_req *req;
+
+    while ((req = msg_req_expire(&ld->reqs, now)) != NULL) {
+        ld->routed[ld->load[req - ld->reqs.slots].target] = 0;
+        msg_req_done(&ld->reqs, req);
+        ld->lost++;
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  load_report
+ *
+ *  Print the results
+ *
+ *  @param  : odr_load      *ld         [load generator]
+ *            const char    *hostname   [client hostname]
+ *            long          usec        [length of the run (us)]
+ *  @return : void
+ *
+ *  One summary line, then one line per class of request. Latencies are in
+ *  microseconds
+ * --------------------------------------------------------------------------
+ */
+void load_report(odr_load *ld, const char *hostname, long usec) {
+    int         i;
+    double      secs = max(usec, 1) / 1e6;
+    odr_hist    *h;
+
+    printf("loadgen at node %s: %lu sent, %lu received, %lu lost, %lu stray in %.1f s (%.0f/s)\n",
+           hostname, ld->sent, ld->received, ld->lost, ld->stray, secs, ld->received / secs);
+    for (i = 0; i < 2; i++) {
+        h = i ? &ld->warm : &ld->cold;
+        printf("  %s %8lu replies, latency p50 %lu us p99 %lu us p99.9 %lu us max %lu us\n",
+               i ? "warm" : "cold", h->count, hist_quantile(h, 0.5), hist_quantile(h, 0.99),
+               hist_quantile(h, 0.999), h->max);
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  main
+ *
+ *  Load generator entry function
+ *
+ *  @param  : int   argc
+ *            char  **argv
+ *  @return : int
+ *
+ *  1. Parse the options, resolve the nodes
+ *  2. Open the domain socket, bound to a temporary path, with
+ *     SO_TIMESTAMPNS on, and a request table for the concurrency
+ *  3. Until the duration is over, send whenever a request is due (at the
+ *     rate, or as soon as a request completes without one) and fewer than
+ *     the concurrency are in flight; match the replies
+ *  4. Wait for the requests still in flight, print the results and
+ *     remove the socket path
+ * --------------------------------------------------------------------------
+ */
+int main(int argc, char **argv) {
+    int             c, i, fd, on = 1, wait;
+    long            now, start, end, due, last_expire = 0;
+    char            ipaddr[IPADDR_BUFFSIZE], hostname[HOSTNAME_BUFFSIZE];
+    odr_load        *ld = (odr_load *)Calloc(1, sizeof(odr_load));
+    struct pollfd   pfd;
+    struct sockaddr_un cliaddr;
+
+    ld->concurrency = 1;
+    ld->duration = 10;
+    ld->timeout = ODR_LOAD_TIMEOUT;
+    while ((c = getopt(argc, argv, "c:r:d:f:t:")) != -1) {
+        switch (c) {
+        case 'c': ld->concurrency = atoi(optarg); break;
+        case 'r': ld->rate = atoi(optarg); break;
+        case 'd': ld->duration = atoi(optarg); break;
+        case 'f': ld->forced = atof(optarg); break;
+        case 't': ld->timeout = atoi(optarg); break;
+        default: err_quit(LOADGEN_USAGE);
+        }
+    }
+    if (optind == argc || ld->concurrency <= 0 || ld->rate < 0 || ld->duration <= 0 ||
+        ld->forced < 0 || ld->forced > 1 || ld->timeout <= 0)
+        err_quit(LOADGEN_USAGE);
+
+    // get IP address of current node
+    free_hwa_info(Get_hw_addrs(ipaddr));
+    util_ip_to_hostname(ipaddr, hostname, ODR_RESOLV_WAIT);
+
+    ld->ntargets = argc - optind;
+    ld->targets = (in_addr_t *)Calloc(ld->ntargets, sizeof(in_addr_t));
+    ld->routed = (int *)Calloc(ld->ntargets, sizeof(int));
+    for (i = 0; i < ld->ntargets; i++) {
+        if (inet_pton(AF_INET, argv[optind + i], &ld->targets[i]) == 1)
+            continue;
+        if (util_hostname_to_ip(argv[optind + i], ipaddr, ODR_RESOLV_WAIT) < 0 ||
+            inet_pton(AF_INET, ipaddr, &ld->targets[i]) != 1)
+            err_quit("Node '%s' does not exist!", argv[optind + i]);
+    }
+    load_routes(ld);
+
+    bzero(&cliaddr, sizeof(cliaddr));
+    cliaddr.sun_family = AF_LOCAL;
+    strcpy(cliaddr.sun_path, TIMECLIE_PATH);
+    fd = mkstemp(cliaddr.sun_path);
+    close(fd);
+    unlink(cliaddr.sun_path);
+
+    ld->sockfd = Socket(AF_LOCAL, SOCK_DGRAM, 0);
+    Bind(ld->sockfd, (SA *)&cliaddr, sizeof(cliaddr));
+    if (setsockopt(ld->sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0)
+        err_sys("setsockopt SO_TIMESTAMPNS error");
+    pfd.fd = ld->sockfd;
+    pfd.events = POLLIN;
+    msg_req_init(&ld->reqs, ld->concurrency, ld->timeout);
+    ld->load = (odr_load_req *)Calloc(ld->reqs.size, sizeof(odr_load_req));
+
+    printf("loadgen at node %s: %d nodes, %d in flight, %s%d s, %.0f%% forced discovery\n",
+           hostname, ld->ntargets, ld->concurrency, ld->rate ? "" : "closed loop, ",
+           ld->duration, ld->forced * 100);
+    if (ld->rate)
+        printf("loadgen at node %s: %d requests per second\n", hostname, ld->rate);
+    srand48(getpid());
+
+    start = due = load_usec();
+    end = start + ld->duration * 1000000L;
+    while (1) {
+        now = load_usec();
+        if (now < end) {
+            // with a rate, a request that could not go out when it was due
+            // keeps its due time; without one, it is due now
+            while (ld->reqs.count < ld->concurrency && (ld->rate == 0 || due <= now)) {
+                if (load_send(ld, ld->rate ? due : now) < 0)
+                    break;
+                if (ld->rate)
+                    due = start + (long)(ld->sent * (1000000.0 / ld->rate));
+            }
+        } else if (ld->reqs.count == 0) {
+            break;
+        }
+
+        if (now - last_expire >= 100000L) {
+            load_expire(ld, now);
+            last_expire = now;
+        }
+
+        // wake up for the next reply, the next due request or the next
+        // loss check, whichever comes first
+        wait = 100;
+        if (ld->rate && now < end && ld->reqs.count < ld->concurrency)
+            wait = min(wait, max((due - now) / 1000, 0));
+        if (poll(&pfd, 1, wait) < 0 && errno != EINTR)
+            err_sys("poll error");
+        if (pfd.revents & POLLIN)
+            load_recv(ld);
+    }
+
+    load_report(ld, hostname, load_usec() - start);
+    unlink(cliaddr.sun_path);
+    msg_req_free(&ld->reqs);
+    return ld->lost ? 1 : 0;
+}
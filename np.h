@@ -1,6 +1,10 @@
 #ifndef __np_h
 #define __np_h
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /* recvmmsg, sendmmsg */
+#endif
+
 #include <stdio.h>
 #include <stdbool.h>
 #include <errno.h>      /* error numbers */
@@ -11,13 +15,25 @@
 #include <linux/if_packet.h>
 #include <linux/if_ether.h>
 #include <linux/if_arp.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <signal.h>
+#include <ctype.h>
 #include "unp.h"
 
 #define PROTOCOL_ID         61375
 #define ODR_FRAME_LEN       128
 #define ODR_PATH            "/tmp/14508-61375-timeODR"
 
-#define ODR_MAX_NODE        10
 #define ODR_TIMETOLIVE      180
 
 #define TIMESERV_PATH       "/tmp/14508-61375-timeServer"
@@ -25,22 +41,100 @@
 
 #define TIMECLIE_PATH       "/tmp/14508-61375-timeClient-XXXXXX"
 
+#define ODR_CTRL_PATH       "/tmp/14508-61375-ctrlODR"
+#define ODR_QUERY_PATH      "/tmp/14508-61375-queryODR"
+#define ODR_QUERYCLIE_PATH  "/tmp/14508-61375-queryClient-XXXXXX"
+#define ODR_SNAP_PATH       "/tmp/14508-61375-snapODR"
+
 #define IPADDR_BUFFSIZE     20
 #define HWADDR_BUFFSIZE     6
 #define HOSTNAME_BUFFSIZE   10
 #define PATHNAME_BUFFSIZE   108
 
-#define ODR_FRAME_PAYLOAD   (124 - 2 * sizeof(uchar) * ETH_ALEN - 2 * sizeof(ushort))
-#define ODR_RPACKET_PAYLOAD (ODR_FRAME_PAYLOAD - 2 * sizeof(char) * IPADDR_BUFFSIZE - sizeof(odr_rpacket_flag) - 2 * sizeof(uint))
-#define ODR_APACKET_PAYLOAD (ODR_FRAME_PAYLOAD - 2 * sizeof(char) * IPADDR_BUFFSIZE - 4 * sizeof(int)- sizeof(uchar))
+// frames are ODR_FRAME_BASELEN bytes, or up to the MTU of the link when
+// both neighbors know it (learned from RREQ/RREP, see odr_rpacket.mtu)
+#define ODR_FRAME_HDRLEN    (2 * sizeof(uchar) * ETH_ALEN + 2 * sizeof(ushort))
+#define ODR_FRAME_BASELEN   124
+#define ODR_MTU_MIN         (ODR_FRAME_BASELEN - ETH_HLEN)
+#define ODR_MTU_MAX         9000
+#define ODR_FRAME_MAXLEN    (ETH_HLEN + ODR_MTU_MAX)
+
+#define ODR_FRAME_PAYLOAD   (ODR_FRAME_BASELEN - ODR_FRAME_HDRLEN)
+#define ODR_RPACKET_PAYLOAD (ODR_FRAME_PAYLOAD - 2 * sizeof(in_addr_t) - sizeof(odr_rpacket_flag) - 2 * sizeof(ushort) - sizeof(uint) - sizeof(uchar))
+#define ODR_APACKET_PAYLOAD (ODR_FRAME_PAYLOAD - 2 * sizeof(in_addr_t) - 4 * sizeof(ushort) - sizeof(uchar))
+#define ODR_APACKET_V3_PAYLOAD  (ODR_APACKET_PAYLOAD - sizeof(uint))
+
+#define ODR_RPACKET_V1_PAYLOAD  (ODR_FRAME_PAYLOAD - 2 * sizeof(char) * IPADDR_BUFFSIZE - sizeof(odr_rpacket_flag) - 2 * sizeof(uint))
+#define ODR_APACKET_V1_PAYLOAD  (ODR_FRAME_PAYLOAD - 2 * sizeof(char) * IPADDR_BUFFSIZE - 4 * sizeof(int)- sizeof(uchar))
+// bytes of odr_apacket_v1.data that actually fit in the frame (incl. '\0')
+#define ODR_APACKET_V1_DATALEN  (ODR_FRAME_PAYLOAD - offsetof(odr_apacket_v1, data))
 
 #define ODR_FRAME_RREQ      0
 #define ODR_FRAME_RREP      1
 #define ODR_FRAME_APPMSG    2
-#define ODR_FRAME_ROUTE     3
-#define ODR_FRAME_INTERFACE 4
+#define ODR_FRAME_ROUTE     3       /* old debug frame, ignored */
+#define ODR_FRAME_INTERFACE 4       /* old debug frame, ignored */
+#define ODR_FRAME_APPFRAG   5
+
+// frame format version, or'ed into h_type
+//   v1: dotted-quad string addresses, host byte order integers
+//   v2: in_addr_t addresses, network byte order integers
+//   v3: v2, plus the request id in APPMSG/APPFRAG (ODR_FRAME_V2 | V3)
+// v1 nodes ignore frame types they do not know, so v2 frames are safe to
+// put on a mixed segment. v2 nodes only test ODR_FRAME_V2 and read route
+// packets the same way, so a v3 node marks every route packet it sends
+// with ODR_FRAME_V3 (and the rid flag in a v1 one) to advertise the v3
+// APPMSG layout, which it only sends to neighbors that advertised it
+#define ODR_FRAME_V2        0x0100
+#define ODR_FRAME_V3        0x0200
+#define ODR_FRAME_TYPE(t)   ((t) & 0x00ff)
+#define ODR_VERSION_V1      1
+#define ODR_VERSION_V2      2
+#define ODR_VERSION_V3      3
+#define ODR_FRAME_VERSION(t)    (((t) & ODR_FRAME_V2) ? (((t) & ODR_FRAME_V3) ? ODR_VERSION_V3 : ODR_VERSION_V2) : ODR_VERSION_V1)
+
+// APPMSG data up to ODR_MSG_MAXLEN bytes, fragmented to fit the frames
+#define ODR_MSG_MAXLEN      65535
+#define ODR_DGRAM_DATALEN   (ODR_MSG_MAXLEN + 1)
+
+// batch API: at most ODR_MSG_BATCH messages per call, of which the first
+// ODR_MSG_BATCHLEN - 1 data bytes are kept (time requests are tiny)
+#define ODR_MSG_BATCH       64
+#define ODR_MSG_BATCHLEN    256
 
-#define ODR_DGRAM_DATALEN   ODR_APACKET_PAYLOAD
+// server batch mode (-b): throughput and latency report every
+// ODR_SERV_REPORT seconds
+#define ODR_SERV_REPORT     10
+
+// load generator: sockets keep at most one request in flight per target
+// node, so a reply is matched by its source; requests not answered in
+// ODR_LOAD_TIMEOUT ms are counted lost
+#define ODR_LOAD_TIMEOUT    (MSG_RECV_TIMEOUT * 1000)
+
+// reassembly buffers: at most ODR_REASM_MAX messages / ODR_REASM_MAXBYTES
+// bytes, dropped if not complete within ODR_REASM_TIMEOUT seconds
+#define ODR_REASM_MAX       64
+#define ODR_REASM_MAXBYTES  (1 << 20)
+#define ODR_REASM_TIMEOUT   5
+
+// expanding ring search: RREQ radius ODR_TTL_START, doubled up to
+// ODR_TTL_THRESHOLD, then a network-wide flood (ODR_TTL_FLOOD). A ring is
+// given (ttl + ODR_TIMEOUT_BUFFER) per-hop round trips, the flood
+// ODR_NET_DIAMETER; until a round trip is measured, one hop is taken as
+// 2 * ODR_NODE_TRAVERSAL milliseconds, so the rings, the flood and all its
+// retries take about 2 seconds, within QUEUE_TIMEOUT
+#define ODR_TTL_START       1
+#define ODR_TTL_THRESHOLD   4
+#define ODR_TTL_FLOOD       0
+#define ODR_NODE_TRAVERSAL  5
+#define ODR_TIMEOUT_BUFFER  2
+#define ODR_NET_DIAMETER    10
+
+// a flood without RREP is sent again up to ODR_RREQ_RETRIES times, the
+// timeout doubles every time; timeouts stay within [MIN, MAX] milliseconds
+#define ODR_RREQ_RETRIES    3
+#define ODR_RREQ_MIN_RTO    20
+#define ODR_RREQ_MAX_RTO    2000
 
 #define IF_NAME             16
 #define IF_HADDR            6
@@ -49,12 +143,192 @@
 #define MSG_RECV_TIMEOUT    5
 #define QUEUE_TIMEOUT       3
 
+#define ODR_HASH_MINSIZE    16
+#define ODR_NEIGHBOR_TTL    ODR_TIMETOLIVE
+#define ODR_BTABLE_MAXSIZE  65536
+
+#define ODR_EVENT_MAX       16
+
+// log-linear (HDR style) histogram: values below 2^ODR_HIST_SUB_BITS have a
+// bucket each, every power of 2 above is split into 2^ODR_HIST_SUB_BITS
+// buckets, so a bucket is at most 1/2^ODR_HIST_SUB_BITS of its value wide
+#define ODR_HIST_SUB_BITS   3
+#define ODR_HIST_BUCKETS    ((64 - ODR_HIST_SUB_BITS + 1) << ODR_HIST_SUB_BITS)
+
+// timed handlers (odr_stats.handler)
+#define ODR_HANDLER_RREQ    0
+#define ODR_HANDLER_RREP    1
+#define ODR_HANDLER_APPMSG  2
+#define ODR_HANDLER_FORWARD 3
+#define ODR_HANDLER_DGRAM   4
+#define ODR_HANDLER_MAX     5
+
+// frames per recvmmsg/sendmmsg, and seconds between batch size reports
+#define ODR_BATCH_MAX       32
+#define ODR_BATCH_REPORT    60
+
+// PACKET_MMAP rings: TPACKET_V3 receive blocks, TPACKET_V2 transmit slots
+// sized for the largest interface MTU
+#define ODR_RING_BLOCK_SIZE     (1 << 16)
+#define ODR_RING_RX_BLOCK_NR    16
+#define ODR_RING_TX_BLOCK_NR    4
+#define ODR_RING_FRAME_SIZE     256     /* RX frame size hint (TPACKET_V3) */
+#define ODR_RING_TIMEOUT        1       /* block retire timeout in ms */
+
+// shared-memory transport: one ring per direction in a memfd, records are
+// ODR_SHM_ALIGN aligned, a ODR_SHM_WRAP record sends the reader back to 0
+#define ODR_SHM_RINGSIZE    (1 << 20)
+#define ODR_SHM_ALIGN       8
+#define ODR_SHM_WRAP        0xffffffff
+#define ODR_SHM_MAXFD       1024
+#define ODR_DGRAM_SHM       0x10        /* odr_dgram.flag: attach request/ack */
+
+// log levels (syslog.h owns the LOG_* names); debug records are compiled
+// out with NDEBUG. The ring holds ODR_LOG_RINGSIZE records (power of 2)
+#define ODR_LOG_ERR         0
+#define ODR_LOG_WARN        1
+#define ODR_LOG_INFO        2
+#define ODR_LOG_DEBUG       3
+#define ODR_LOG_RINGSIZE    4096
+#define ODR_LOG_ARGLEN      96          /* packed argument bytes */
+#define ODR_LOG_STRLEN      48          /* bytes kept of a %s argument */
+#define ODR_LOG_DRAIN_US    10000       /* drain thread idle sleep */
+
+// table query socket: one datagram per page, tables are walked from a
+// cursor given by the client; ODR_QUERY_END marks the last page
+#define ODR_QUERY_ROUTE     0
+#define ODR_QUERY_PORT      1
+#define ODR_QUERY_INTERFACE 2
+#define ODR_QUERY_MAXLEN    4096
+#define ODR_QUERY_END       0xffffffff
+
+// warm-start snapshot of rtable and btable, written every
+// ODR_SNAP_INTERVAL seconds and on SIGINT/SIGTERM
+#define ODR_SNAP_MAGIC      0x534e5244  /* "DRNS" */
+#define ODR_SNAP_VERSION    1
+#define ODR_SNAP_INTERVAL   30
+
+// resolver cache (utils.c): answers are kept ODR_RESOLV_TTL seconds,
+// failures ODR_RESOLV_NEG_TTL; /etc/hosts entries never expire. A caller
+// that may block waits at most the milliseconds it passes
+#define ODR_HOSTS_PATH      "/etc/hosts"
+#define ODR_RESOLV_SIZE     64
+#define ODR_RESOLV_TTL      300
+#define ODR_RESOLV_NEG_TTL  30
+#define ODR_RESOLV_WAIT     2000
+#define ODR_RESOLV_NOWAIT   0
+#define ODR_RESOLV_FWD      0           /* hostname -> address */
+#define ODR_RESOLV_REV      1           /* address -> hostname */
+#define ODR_RESOLV_NONE     0           /* no answer yet */
+#define ODR_RESOLV_OK       1
+#define ODR_RESOLV_FAIL     2           /* negative entry */
+
+#define ODR_WHEEL_BITS      6
+#define ODR_WHEEL_SIZE      (1 << ODR_WHEEL_BITS)
+#define ODR_WHEEL_LEVELS    4
+
+// fast timer wheel tick (route discovery)
+#define ODR_TICK_MS         10
+
+// copy a header template (odr_frame_hdr) in front of a frame
+#define FRAME_HEADER(frame, tmpl, ftype) \
+    do { memcpy((frame), (tmpl), sizeof(odr_frame_hdr)); (frame)->h_type = (ftype); } while (0)
+
+// table entry that embeds the timer
+#define TIMER_ENTRY(t, type, member)    ((type *)((char *)(t) - offsetof(type, member)))
+
 typedef unsigned char   BITFIELD8;
 typedef unsigned char   uchar;
 typedef unsigned short  ushort;
 typedef unsigned int    uint;
 typedef unsigned long   ulong;
 
+struct odr_object_t;
+struct odr_timer_t;
+typedef void (*odr_timer_fn)(struct odr_object_t *, struct odr_timer_t *);
+
+// Timer, embedded in the table entry it expires
+typedef struct odr_timer_t {
+    long                expire;         /* expiry time              */
+    odr_timer_fn        fire;           /* callback                 */
+    struct odr_timer_t  *next;          /* next timer in slot       */
+    struct odr_timer_t  **pprev;        /* link to this, NULL if idle */
+} odr_timer;
+
+// Hierarchical timer wheel, one tick per level 0 slot
+typedef struct odr_wheel_t {
+    odr_timer   *slots[ODR_WHEEL_LEVELS][ODR_WHEEL_SIZE];
+    long        now;                    /* time processed up to     */
+    uint        count;                  /* scheduled timers         */
+} odr_wheel;
+
+struct odr_event_t;
+typedef void (*odr_event_fn)(struct odr_object_t *, struct odr_event_t *);
+
+// Event loop registration of a descriptor
+typedef struct odr_event_t {
+    int             fd;                 /* descriptor               */
+    odr_event_fn    handler;            /* read handler             */
+} odr_event;
+
+// single-producer single-consumer ring in shared memory
+typedef struct odr_shm_ring_t {
+    uint    head __attribute__((aligned(64)));  /* producer offset (free running) */
+    uint    tail __attribute__((aligned(64)));  /* consumer offset (free running) */
+    char    data[ODR_SHM_RINGSIZE] __attribute__((aligned(64)));
+} odr_shm_ring;
+
+// record in odr_shm_ring
+typedef struct odr_shm_rec_t {
+    uint    len;                        /* payload length, or ODR_SHM_WRAP */
+    uint    unused;
+    char    data[];                     /* payload                  */
+} odr_shm_rec;
+
+// memfd layout
+//   tx: application -> ODR, records are odr_apacket
+//   rx: ODR -> application, records are odr_dgram
+typedef struct odr_shm_area_t {
+    odr_shm_ring    tx;
+    odr_shm_ring    rx;
+} odr_shm_area;
+
+// one end of a shared-memory transport
+typedef struct odr_shm_t {
+    odr_shm_area    *area;              /* mapped memfd             */
+    int             memfd;              /* memfd                    */
+    int             tx_bell;            /* eventfd, tx not empty    */
+    int             rx_bell;            /* eventfd, rx not empty    */
+    int             port;               /* application port (ODR)   */
+    odr_event       event;              /* tx_bell event (ODR)      */
+} odr_shm;
+
+// PACKET_MMAP receive and transmit rings of the PF_PACKET socket
+typedef struct odr_ring_t {
+    int             rx_fd;              /* socket owning the RX ring    */
+    char            *rx_map;            /* TPACKET_V3 blocks            */
+    size_t          rx_len;             /* size of the RX mapping       */
+    uint            rx_cur;             /* next block to read           */
+    int             tx_fd;              /* socket owning the TX ring    */
+    char            *tx_map;            /* TPACKET_V2 frame slots       */
+    size_t          tx_len;             /* size of the TX mapping       */
+    uint            tx_nr;              /* number of slots              */
+    uint            tx_size;            /* slot size                    */
+    uint            tx_per_block;       /* slots per block              */
+    uint            tx_cur;             /* next slot to fill            */
+    uint            tx_pending;         /* slots filled since last kick */
+    int             tx_ifindex;         /* interface of pending slots   */
+} odr_ring;
+
+// Ethernet header of a frame without the frame type; built once per
+// interface (broadcast) and per neighbor (unicast), then copied in front
+// of every frame sent there
+typedef struct odr_frame_hdr_t {
+    uchar   h_dest[ETH_ALEN];           /* destination eth addr */
+    uchar   h_source[ETH_ALEN];         /* source ether addr    */
+    ushort  h_proto;                    /* packet type ID field */
+}__attribute__((packed)) odr_frame_hdr;
+
 // Interface table entry
 // Modified hardware address information
 //   * Ignore interfaces: lo, eth0
@@ -64,24 +338,76 @@ typedef struct hwa_info {
     int     if_index;               /* interface index                      */
     short   ip_alias;               /* 1 if hwa_addr is an alias IP address */
     struct  sockaddr  *ip_addr;     /* IP address                           */
+    int     if_mtu;                 /* MTU, at most ODR_MTU_MAX             */
+    odr_frame_hdr bcast_hdr;        /* broadcast header template            */
     struct  hwa_info  *hwa_next;    /* next of these structures             */
 } odr_itable;
 
 // Route table entry
 typedef struct odr_rtable_t {
-    char    dst[IPADDR_BUFFSIZE];       /* destination IP addr  */
+    in_addr_t dst;                      /* destination IP addr  */
     char    nexthop[HWADDR_BUFFSIZE];   /* next hop MAC address */
     int     index;                      /* interface index      */
     uint    hopcnt;                     /* hop count            */
     long    timestamp;                  /* timestamp of update  */
+    odr_timer timer;                    /* staleness timer      */
+    struct odr_rtable_t *prev;          /* prev entry pointer   */
     struct odr_rtable_t *next;          /* next entry pointer   */
 } odr_rtable;
 
+// Neighbor table entry
+// Remembers which frame version and MTU a directly connected node
+// understands
+typedef struct odr_ntable_t {
+    char    mac[HWADDR_BUFFSIZE];       /* neighbor MAC address */
+    int     index;                      /* interface index      */
+    uchar   version;                    /* frame version        */
+    int     mtu;                        /* neighbor MTU, 0 if unknown */
+    odr_frame_hdr hdr;                  /* unicast header template */
+    long    timestamp;                  /* last frame received  */
+    odr_timer timer;                    /* silence timer        */
+    struct odr_ntable_t *prev;          /* prev entry pointer   */
+    struct odr_ntable_t *next;          /* next entry pointer   */
+} odr_ntable;
+
+// Hash index slot
+typedef struct odr_hash_slot_t {
+    uint    key;                        /* key                  */
+    void    *val;                       /* item, NULL if empty  */
+} odr_hash_slot;
+
+// Hash index (open addressing, linear probing)
+typedef struct odr_hash_t {
+    odr_hash_slot   *slots;             /* slot array           */
+    uint            size;               /* number of slots      */
+    uint            count;              /* number of items      */
+} odr_hash;
+
+// Broadcast ID table entry
+typedef struct odr_bid_t {
+    in_addr_t   src;                    /* RREQ source, 0 if empty  */
+    in_addr_t   dst;                    /* RREQ destination         */
+    uint        bcast_id;               /* last broadcast id seen   */
+    long        timestamp;              /* timestamp of update      */
+} odr_bid;
+
+// Broadcast ID table (open addressing, bounded by ODR_BTABLE_MAXSIZE)
+typedef struct odr_btable_t {
+    odr_bid *slots;                     /* slot array               */
+    uint    size;                       /* number of slots          */
+    uint    count;                      /* number of entries        */
+    ulong   staleness;                  /* entry lifetime           */
+    long    purged;                     /* time of last purge       */
+} odr_btable;
+
 // Port table entry
 typedef struct odr_ptable_t {
     int     port;                       /* port number  */
     char    path[PATHNAME_BUFFSIZE];    /* path name    */
     ulong   timestamp;                  /* timestamp    */
+    odr_timer timer;                    /* TTL timer    */
+    odr_shm *shm;                       /* shared-memory transport */
+    struct odr_ptable_t *prev;          /* prev item    */
     struct odr_ptable_t *next;          /* next item    */
 } odr_ptable;
 
@@ -92,88 +418,717 @@ typedef struct odr_frame_t {
     uchar   h_source[ETH_ALEN];         /* source ether addr    */
     ushort  h_proto;                    /* packet type ID field */
     ushort  h_type;                     /* frame type           */
-    char    data[ODR_FRAME_PAYLOAD];    /* frame payload        */
+    char    data[ODR_FRAME_MAXLEN - ODR_FRAME_HDRLEN];  /* frame payload */
 }__attribute__((packed)) odr_frame;
 
+// Frames moved with one recvmmsg/sendmmsg
+typedef struct odr_batch_t {
+    uint                count;                          /* frames in batch      */
+    odr_frame           frames[ODR_BATCH_MAX];          /* frames               */
+    struct sockaddr_ll  addrs[ODR_BATCH_MAX];           /* peer of each frame   */
+    struct iovec        iov[ODR_BATCH_MAX];             /* frame of each msg    */
+    struct mmsghdr      msgs[ODR_BATCH_MAX];            /* recvmmsg/sendmmsg    */
+    ulong               hist[ODR_BATCH_MAX + 1];        /* batches per size     */
+    ulong               reported;                       /* batches at last report */
+} odr_batch;
+
+// Histogram of one quantity
+typedef struct odr_hist_t {
+    ulong   count;                          /* values recorded          */
+    ulong   sum;                            /* sum of the values        */
+    ulong   max;                            /* largest value            */
+    ulong   buckets[ODR_HIST_BUCKETS];      /* count per bucket         */
+} odr_hist;
+
+// Counters of one thread (main thread or worker), summed when scraped, so
+// that the forwarding path never shares a cache line with another thread
+typedef struct odr_stats_t {
+    ulong       rx[ODR_FRAME_APPFRAG + 1];      /* frames received by type  */
+    ulong       tx[ODR_FRAME_APPFRAG + 1];      /* frames sent by type      */
+    ulong       rreq_suppressed;                /* RREQs not rebroadcast    */
+    ulong       queue_timeouts;                 /* queued items dropped     */
+    ulong       deliver_dropped;                /* APPMSGs not delivered    */
+    ulong       disc_started;                   /* route discoveries        */
+    ulong       disc_completed;                 /* discoveries with a route */
+    odr_hist    disc_latency;                   /* discovery latency (us)   */
+    odr_hist    handler[ODR_HANDLER_MAX];       /* handler time (ns)        */
+} odr_stats;
+
+// statistics of the calling thread
+#define ODR_STATS(obj)      (odr_io ? &odr_io->stats : &(obj)->stats)
+
+// Log record: format string (a literal, never copied) and its arguments
+// packed in binary, rendered to text by the drain thread
+typedef struct odr_log_rec_t {
+    uint                seq;                    /* publish sequence     */
+    uchar               level;                  /* ODR_LOG_*            */
+    uchar               len;                    /* bytes used in args   */
+    long                usec;                   /* CLOCK_REALTIME       */
+    const char          *fmt;                   /* format               */
+    char                args[ODR_LOG_ARGLEN];   /* packed arguments     */
+} __attribute__((aligned(64))) odr_log_rec;
+
+// Forwarding worker, a thread with its own PACKET_FANOUT socket
+typedef struct odr_worker_t {
+    struct odr_object_t *obj;                           /* shared odr object    */
+    pthread_t           tid;                            /* thread id            */
+    int                 id;                             /* worker number        */
+    int                 sockfd;                         /* PF_PACKET socket     */
+    odr_batch           rx_batch;                       /* recvmmsg batch       */
+    odr_batch           tx_batch;                       /* sendmmsg batch       */
+    odr_stats           stats;                          /* worker statistics    */
+} odr_worker;
+
 // route packet flag structure
 typedef struct odr_rpacket_flag_t {
     BITFIELD8   req : 1; /* RREQ flag */
     BITFIELD8   rep : 1; /* RREP flag */
     BITFIELD8   frd : 1; /* forced (re)discovery flag */
     BITFIELD8   res : 1; /* reply already sent flag */
-    BITFIELD8   r04 : 1;
-    BITFIELD8   r05 : 1;
+    BITFIELD8   bin : 1; /* sender accepts v2 (binary address) frames */
+    BITFIELD8   rid : 1; /* sender accepts v3 (request id) frames */
     BITFIELD8   r06 : 1;
     BITFIELD8   r07 : 1;
 } odr_rpacket_flag;
 
-// route packet structure
+// route packet structure (v2)
 // length: ODR_FRAME_PAYLOAD
+// integers are in host byte order in memory, network byte order on wire
 typedef struct odr_rpacket_t {
+    in_addr_t           dst;                    /* destination ip addr  */
+    in_addr_t           src;                    /* source ip addr       */
+    odr_rpacket_flag    flag;                   /* route packet flag    */
+    ushort              hopcnt;                 /* hop count            */
+    uint                bcast_id;               /* broadcast id         */
+    ushort              mtu;                    /* sender interface MTU */
+    uchar               ttl;                    /* hops left, 0: no limit */
+    char                unused[ODR_RPACKET_PAYLOAD];
+}__attribute__((packed)) odr_rpacket;
+
+// application packet (in memory, host byte order)
+// a whole message (offset 0, length == total) or one fragment of it
+typedef struct odr_apacket_t {
+    in_addr_t   dst;                        /* destination IP address   */
+    in_addr_t   src;                        /* source IP address        */
+    ushort      dst_port;                   /* destination port number  */
+    ushort      src_port;                   /* source port number       */
+    ushort      hopcnt;                     /* hop count                */
+    uchar       frd;                        /* forced discovery flag    */
+    ushort      length;                     /* data length              */
+    ushort      msg_id;                     /* message id of the source */
+    ushort      offset;                     /* data offset in message   */
+    ushort      total;                      /* message length           */
+    uint        req_id;                     /* request id of the app,
+                                               echoed by the responder  */
+    char        data[ODR_MSG_MAXLEN + 1];   /* data payload (app), null
+                                               terminated               */
+}__attribute__((packed)) odr_apacket;
+
+// bytes of odr_apacket in use
+#define ODR_APACKET_SIZE(a) (offsetof(odr_apacket, data) + (a)->length + 1)
+// bytes of odr_apacket that hold what one received frame carries
+#define ODR_APACKET_FRAMESIZE   (offsetof(odr_apacket, data) + ODR_FRAME_MAXLEN)
+
+// application packet structure (v2 wire format)
+// length: ODR_FRAME_PAYLOAD
+typedef struct odr_apacket_v2_t {
+    in_addr_t   dst;                        /* destination IP address   */
+    in_addr_t   src;                        /* source IP address        */
+    ushort      dst_port;                   /* destination port number  */
+    ushort      src_port;                   /* source port number       */
+    ushort      hopcnt;                     /* hop count                */
+    uchar       frd;                        /* forced discovery flag    */
+    ushort      length;                     /* data length              */
+    char        data[ODR_APACKET_PAYLOAD];  /* data payload (app)       */
+}__attribute__((packed)) odr_apacket_v2;
+
+// application packet structure (v3 wire format, v2 with the request id)
+// length: ODR_FRAME_PAYLOAD
+typedef struct odr_apacket_v3_t {
+    in_addr_t   dst;                        /* destination IP address   */
+    in_addr_t   src;                        /* source IP address        */
+    ushort      dst_port;                   /* destination port number  */
+    ushort      src_port;                   /* source port number       */
+    ushort      hopcnt;                     /* hop count                */
+    uchar       frd;                        /* forced discovery flag    */
+    ushort      length;                     /* data length              */
+    uint        req_id;                     /* request id of the app    */
+    char        data[ODR_APACKET_V3_PAYLOAD];   /* data payload (app)   */
+}__attribute__((packed)) odr_apacket_v3;
+
+// application fragment structure (v2 wire format, ODR_FRAME_APPFRAG)
+// length: up to the MTU of the link, only sent to neighbors with known MTU
+typedef struct odr_fpacket_t {
+    in_addr_t   dst;                        /* destination IP address   */
+    in_addr_t   src;                        /* source IP address        */
+    ushort      dst_port;                   /* destination port number  */
+    ushort      src_port;                   /* source port number       */
+    ushort      hopcnt;                     /* hop count                */
+    uchar       frd;                        /* forced discovery flag    */
+    ushort      length;                     /* fragment data length     */
+    ushort      msg_id;                     /* message id of the source */
+    ushort      offset;                     /* fragment data offset     */
+    ushort      total;                      /* message length           */
+    char        data[];                     /* fragment data            */
+}__attribute__((packed)) odr_fpacket;
+
+// application fragment structure (v3 wire format, v2 with the request id)
+typedef struct odr_fpacket_v3_t {
+    in_addr_t   dst;                        /* destination IP address   */
+    in_addr_t   src;                        /* source IP address        */
+    ushort      dst_port;                   /* destination port number  */
+    ushort      src_port;                   /* source port number       */
+    ushort      hopcnt;                     /* hop count                */
+    uchar       frd;                        /* forced discovery flag    */
+    ushort      length;                     /* fragment data length     */
+    ushort      msg_id;                     /* message id of the source */
+    ushort      offset;                     /* fragment data offset     */
+    ushort      total;                      /* message length           */
+    uint        req_id;                     /* request id of the app    */
+    char        data[];                     /* fragment data            */
+}__attribute__((packed)) odr_fpacket_v3;
+
+// APPMSG data room and APPFRAG header size in the layout of a version;
+// the layouts agree up to the fragment total length
+#define ODR_APACKET_DATALEN(v)  ((v) == ODR_VERSION_V3 ? ODR_APACKET_V3_PAYLOAD : ODR_APACKET_PAYLOAD)
+#define ODR_FPACKET_HDRLEN(v)   ((v) == ODR_VERSION_V3 ? offsetof(odr_fpacket_v3, data) : offsetof(odr_fpacket, data))
+
+// route packet structure (v1, legacy wire format)
+// length: ODR_FRAME_PAYLOAD
+typedef struct odr_rpacket_v1_t {
     char                dst[IPADDR_BUFFSIZE];   /* destination ip addr  */
     char                src[IPADDR_BUFFSIZE];   /* source ip addr       */
     odr_rpacket_flag    flag;                   /* route packet flag    */
     uint                hopcnt;                 /* hop count            */
     uint                bcast_id;               /* broadcast id         */
-    char                unused[ODR_RPACKET_PAYLOAD];
-} odr_rpacket;
+    char                unused[ODR_RPACKET_V1_PAYLOAD];
+} odr_rpacket_v1;
 
-// application packet structure
-// length: ODR_FRAME_PAYLOAD
-typedef struct odr_apacket_t {
-    char    dst[IPADDR_BUFFSIZE];       /* destination IP address   */
-    int     dst_port;                   /* destination port number  */
-    char    src[IPADDR_BUFFSIZE];       /* source IP address        */
-    int     src_port;                   /* source port number       */
-    uint    hopcnt;                     /* hop count                */
-    uchar   frd;                        /* forced discovery flag    */
-    int     length;                     /* data length              */
-    char    data[ODR_APACKET_PAYLOAD];  /* data payload (app)       */
-} odr_apacket;
+// application packet structure (v1, legacy wire format)
+// length: ODR_FRAME_PAYLOAD (the tail of data does not fit in the frame)
+typedef struct odr_apacket_v1_t {
+    char    dst[IPADDR_BUFFSIZE];           /* destination IP address   */
+    int     dst_port;                       /* destination port number  */
+    char    src[IPADDR_BUFFSIZE];           /* source IP address        */
+    int     src_port;                       /* source port number       */
+    uint    hopcnt;                         /* hop count                */
+    uchar   frd;                            /* forced discovery flag    */
+    int     length;                         /* data length              */
+    char    data[ODR_APACKET_V1_PAYLOAD];   /* data payload (app)       */
+} odr_apacket_v1;
 
 // datagram structure
-// exchange between ODR service and application
+// exchange between ODR service and application, the header is followed by
+// up to ODR_MSG_MAXLEN bytes of data (the datagram length tells how many)
 typedef struct odr_dgram_t {
-    char    ipaddr[IPADDR_BUFFSIZE];    /* IP address                   */
-    int     port;                       /* port number                  */
-    int     flag;                       /* forced discovery flag        */
-    char    data[ODR_DGRAM_DATALEN];    /* data field in odr_apacket    */
+    in_addr_t   ipaddr;                     /* IP address                   */
+    int         port;                       /* port number                  */
+    int         flag;                       /* forced discovery flag        */
+    uint        req_id;                     /* request id, 0 if none; a
+                                               responder sends it back      */
+    char        data[];                     /* data field in odr_apacket    */
 } odr_dgram;
 
+// resolver cache entry, one forward or reverse lookup
+typedef struct odr_resolv_t {
+    uchar       type;                       /* ODR_RESOLV_FWD/REV           */
+    uchar       answer;                     /* ODR_RESOLV_NONE/OK/FAIL      */
+    uchar       queued;                     /* 1 wanted, 2 being resolved   */
+    char        name[HOSTNAME_BUFFSIZE];    /* hostname                     */
+    in_addr_t   addr;                       /* IP address                   */
+    long        expires;                    /* 0 for a hosts file entry     */
+} odr_resolv;
+
+// warm-start snapshot file: header, nroutes odr_snap_route, nbids odr_bid
+typedef struct odr_snap_hdr_t {
+    uint        magic;                      /* ODR_SNAP_MAGIC               */
+    uint        version;                    /* ODR_SNAP_VERSION             */
+    long        written;                    /* time of the snapshot         */
+    uint        bcast_id;                   /* last broadcast id sent       */
+    ushort      msg_id;                     /* last APPMSG id sent          */
+    ushort      unused;
+    uint        nroutes;                    /* route records                */
+    uint        nbids;                      /* broadcast id records         */
+} odr_snap_hdr;
+
+// warm-start snapshot route record
+typedef struct odr_snap_route_t {
+    in_addr_t   dst;                        /* destination IP addr          */
+    char        nexthop[HWADDR_BUFFSIZE];   /* next hop MAC address         */
+    char        if_haddr[IF_HADDR];         /* MAC address of the interface */
+    int         index;                      /* interface index              */
+    uint        hopcnt;                     /* hop count                    */
+    long        timestamp;                  /* timestamp of update          */
+} odr_snap_route;
+
+// table query (request datagram, application -> ODR)
+typedef struct odr_query_t {
+    uchar       table;                      /* ODR_QUERY_*                  */
+    uchar       unused;
+    ushort      max;                        /* records wanted, 0 for a page */
+    uint        cursor;                     /* 0 for the first page         */
+} odr_query;
+
+// table query reply (ODR -> application), header followed by count records
+typedef struct odr_query_reply_t {
+    uchar       table;                      /* ODR_QUERY_*                  */
+    uchar       unused;
+    ushort      count;                      /* records in this page         */
+    uint        start;                      /* cursor of the request        */
+    uint        cursor;                     /* next page, or ODR_QUERY_END  */
+    uint        total;                      /* entries in the table         */
+    char        data[];                     /* records                      */
+} odr_query_reply;
+
+// route record (ODR_QUERY_ROUTE)
+typedef struct odr_route_rec_t {
+    in_addr_t   dst;                        /* destination IP addr          */
+    uchar       nexthop[HWADDR_BUFFSIZE];   /* next hop MAC address         */
+    ushort      index;                      /* interface index              */
+    ushort      hopcnt;                     /* hop count                    */
+    uint        age;                        /* seconds since update         */
+}__attribute__((packed)) odr_route_rec;
+
+// port record (ODR_QUERY_PORT)
+typedef struct odr_port_rec_t {
+    int         port;                       /* port number                  */
+    uint        age;                        /* seconds since last datagram, */
+                                            /* 0 for a permanent entry      */
+    uchar       shm;                        /* shared-memory transport      */
+    char        path[PATHNAME_BUFFSIZE];    /* path name                    */
+}__attribute__((packed)) odr_port_rec;
+
+// interface record (ODR_QUERY_INTERFACE)
+typedef struct odr_iface_rec_t {
+    char        name[IF_NAME];              /* interface name               */
+    uchar       haddr[IF_HADDR];            /* hardware address             */
+    ushort      index;                      /* interface index              */
+    uchar       version;                    /* frame version                */
+    ushort      mtu;                        /* MTU                          */
+}__attribute__((packed)) odr_iface_rec;
+
+// message of a batch (msg_recv_batch/msg_send_batch); the first four
+// fields are laid out as odr_dgram and go on the wire as its header, so a
+// reply built in place of the request keeps its request id
+typedef struct odr_msg_t {
+    in_addr_t   ipaddr;                     /* IP address                   */
+    int         port;                       /* port number                  */
+    int         flag;                       /* forced discovery flag        */
+    uint        req_id;                     /* request id                   */
+    int         len;                        /* data length                  */
+    long        usec;                       /* arrival, CLOCK_REALTIME us   */
+    char        data[ODR_MSG_BATCHLEN];     /* data, null terminated        */
+} odr_msg;
+
+// request in flight on a client socket (msg_req_send), free if req_id is 0
+typedef struct odr_req_t {
+    uint        req_id;                     /* request id, 0 if free        */
+    in_addr_t   ipaddr;                     /* destination IP address       */
+    int         port;                       /* destination port number      */
+    long        sent;                       /* send time, CLOCK_REALTIME us */
+} odr_req;
+
+// requests in flight on a client socket, a reply is matched by its id
+typedef struct odr_reqs_t {
+    odr_req     *slots;                     /* the slot of an id is
+                                               id & (size - 1)              */
+    uint        size;                       /* slots, a power of 2          */
+    uint        count;                      /* requests in flight           */
+    uint        next_id;                    /* next id to give out          */
+    uint        oldest;                     /* no older id is in flight     */
+    long        timeout;                    /* us before a request expires  */
+} odr_reqs;
+
+// load generator request, parallel to the slots of odr_reqs
+typedef struct odr_load_req_t {
+    long        sched;                      /* scheduled send time (us)     */
+    int         target;                     /* target node index            */
+    int         cold;                       /* needs a route discovery      */
+} odr_load_req;
+
+// load generator run
+typedef struct odr_load_t {
+    int         concurrency;                /* requests kept in flight      */
+    int         rate;                       /* requests per second, 0 = as
+                                               fast as replies come back    */
+    int         duration;                   /* seconds of sending           */
+    int         timeout;                    /* ms before a request is lost  */
+    double      forced;                     /* forced discovery ratio       */
+    int         ntargets;                   /* target nodes                 */
+    in_addr_t   *targets;                   /* target node addresses        */
+    int         *routed;                    /* ODR has a route to the node  */
+    int         sockfd;                     /* domain socket                */
+    odr_reqs    reqs;                       /* requests in flight           */
+    odr_load_req *load;                     /* per slot of reqs             */
+    int         next;                       /* round robin target           */
+    ulong       sent, received, lost, stray;
+    odr_hist    cold;                       /* cold request latency (us)    */
+    odr_hist    warm;                       /* warm request latency (us)    */
+} odr_load;
+
 // odr apacket queue (waiting to send)
 typedef struct odr_queue_item_t {
     ushort  type;                       /* frame type       */
     long    timestamp;                  /* queue timestamp  */
-    char    data[ODR_FRAME_PAYLOAD];    /* frame payload    */
     struct odr_queue_item_t *next;
+    char    data[];                     /* odr_apacket or odr_rpacket */
 } odr_queue_item;
+
+// reassembly buffer of a fragmented APPMSG
+typedef struct odr_reasm_t {
+    in_addr_t       src;                /* source IP address        */
+    ushort          msg_id;             /* message id of the source */
+    ushort          total;              /* message length           */
+    uint            received;           /* bytes received           */
+    uchar           *bitmap;            /* one bit per byte received */
+    odr_apacket     *msg;               /* message being rebuilt    */
+    odr_timer       timer;              /* reassembly timeout       */
+    struct odr_reasm_t *prev;           /* prev buffer              */
+    struct odr_reasm_t *next;           /* next buffer              */
+} odr_reasm;
+
+// pending list of one destination (waiting for a route)
+typedef struct odr_pending_t {
+    in_addr_t       dst;                /* destination waiting for route */
+    odr_queue_item  *head;              /* first item                    */
+    odr_queue_item  *tail;              /* last item                     */
+    odr_timer       timer;              /* timeout of head item          */
+    uint            bcast_id;           /* in-flight RREQ, 0 if none     */
+    long            rreq_time;          /* time the RREQ was sent        */
+    uchar           frd;                /* in-flight RREQ is forced      */
+    uchar           ttl;                /* in-flight RREQ radius         */
+    uchar           retry;              /* floods sent again             */
+    long            rreq_usec;          /* send time, timer_usec()       */
+    long            disc_usec;          /* discovery start, 0 if none    */
+    odr_timer       rreq_timer;         /* ring timeout (fast wheel)     */
+    struct odr_pending_t *prev;         /* prev pending destination      */
+    struct odr_pending_t *next;         /* next pending destination      */
+} odr_pending;
+
 typedef struct odr_queue_t {
-    odr_queue_item *head;
-    odr_queue_item *tail;
+    odr_hash        index;              /* dst -> odr_pending            */
+    odr_pending     *head;              /* all pending destinations      */
+    uint            count;              /* number of queued items        */
 } odr_queue;
 
+// simulator: virtual clock start (s), default link latency (us), at most
+// ODR_SIM_MAXIF interfaces per node, nodes are ODR_SIM_NET + number
+#define ODR_SIM_EPOCH       1000000000L
+#define ODR_SIM_LATENCY     100
+#define ODR_SIM_MAXIF       16
+#define ODR_SIM_NET         0x0a000000
+
+// microbenchmarks (bench.c): tables of 10 to ODR_BENCH_MAXENTRIES entries,
+// about ODR_BENCH_OPS operations a round, the median of ODR_BENCH_ROUNDS
+// rounds is reported. Routes go through ODR_BENCH_NEIGHBORS next hops
+#define ODR_BENCH_OPS       (1 << 18)
+#define ODR_BENCH_ROUNDS    5
+#define ODR_BENCH_MAXENTRIES 100000
+#define ODR_BENCH_NEIGHBORS 8
+#define ODR_BENCH_PICKS     4096        /* random picks, power of 2 */
+
+// frame transport of an odr object: the PF_PACKET socket (odr.c) or the
+// simulated network (odr_sim.c). The handlers only send through it
+typedef struct odr_transport_t {
+    odr_frame *(*slot)(struct odr_object_t *);                      /* output buffer        */
+    int (*send)(struct odr_object_t *, int, odr_frame *, int, uchar);   /* queue a frame    */
+    void (*flush)(struct odr_object_t *);                           /* send queued frames   */
+    void (*deliver)(struct odr_object_t *, odr_apacket *);          /* APPMSG reached us    */
+} odr_transport;
+
 // Main ODR information object
 typedef struct odr_object_t {
     unsigned long   staleness;                          /* in seconds           */
     char            ipaddr[IPADDR_BUFFSIZE];            /* IP address           */
+    in_addr_t       addr;                               /* IP address (binary)  */
     char            hostname[HOSTNAME_BUFFSIZE];        /* Host name            */
     odr_itable      *itable;                            /* Hardware information */
     odr_rtable      *rtable;                            /* routing table        */
+    odr_hash        rindex;                             /* rtable hash index    */
+    odr_ntable      *ntable;                            /* neighbor table       */
     odr_ptable      *ptable;                            /* port and path table  */
     odr_queue       queue;                              /* ODR message queue    */
-    uint            b_ids[ODR_MAX_NODE][ODR_MAX_NODE];  /* Broadcast ID table   */
+    odr_wheel       wheel;                              /* Timer wheel (1 s)    */
+    odr_wheel       fast;                               /* Timer wheel (tick)   */
+    odr_btable      btable;                             /* Broadcast ID table   */
+    odr_reasm       *reasm;                             /* reassembly buffers   */
+    uint            reasm_count;                        /* number of buffers    */
+    ulong           reasm_bytes;                        /* memory of buffers    */
+    ushort          msg_id;                             /* last APPMSG id       */
     int             d_sockfd;                           /* Domain socket        */
     int             p_sockfd;                           /* PF_PACKET socket     */
+    int             epfd;                               /* epoll instance       */
+    odr_event       p_event;                            /* PF_PACKET event      */
+    odr_event       d_event;                            /* Domain socket event  */
+    odr_apacket     *d_packet;                          /* Domain datagram buf  */
+    odr_event       t_event;                            /* table wheel timerfd  */
+    odr_event       f_event;                            /* fast wheel timerfd   */
+    odr_event       w_event;                            /* worker wakeup fd     */
+    int             c_sockfd;                           /* control socket       */
+    odr_event       c_event;                            /* control socket event */
+    int             q_sockfd;                           /* table query socket   */
+    odr_event       q_event;                            /* query socket event   */
+    int             s_sigfd;                            /* SIGINT/SIGTERM fd    */
+    odr_event       s_event;                            /* signalfd event       */
+    odr_timer       snap;                               /* snapshot timer       */
+    int             quit;                               /* leave the event loop */
+    odr_stats       stats;                              /* main thread stats    */
+    long            t_armed;                            /* t_event expiry       */
+    long            f_armed;                            /* f_event expiry       */
+    int             use_ring;                           /* PACKET_MMAP enabled  */
+    odr_ring        ring;                               /* PACKET_MMAP rings    */
+    odr_batch       rx_batch;                           /* recvmmsg batch       */
+    odr_batch       tx_batch;                           /* sendmmsg batch       */
+    odr_timer       report;                             /* batch report timer   */
+    pthread_rwlock_t lock;                              /* tables lock          */
+    int             nworkers;                           /* forwarding workers   */
+    odr_worker      *workers;                           /* worker array         */
     uint            bcast_id;                           /* Broadcast ID         */
+    long            rtt_hop;                            /* RREQ RTT/hop (us)    */
+    long            rtt_var;                            /* RTT/hop variation    */
     int             free_port;                          /* free port number     */
+    const odr_transport *tp;                            /* frame transport      */
 } odr_object;
 
+// simulated network (odr_sim.c): nodes joined by broadcast segments, one
+// interface per segment a node is on; all nodes share a virtual clock
+typedef enum {
+    ODR_SIM_FRAME,                          /* frame reaches a node         */
+    ODR_SIM_TIMER,                          /* timer wheels of a node       */
+    ODR_SIM_MSG                             /* application sends an APPMSG  */
+} odr_sim_type;
+
+// event of the simulation, kept in a heap by (usec, seq)
+typedef struct odr_sim_event_t {
+    long            usec;                   /* virtual time                 */
+    ulong           seq;                    /* order of events at one time  */
+    odr_sim_type    type;                   /* event type                   */
+    int             node;                   /* node the event happens at    */
+    int             if_index;               /* FRAME: receiving interface   */
+    int             len;                    /* FRAME: frame length          */
+    in_addr_t       dst;                    /* MSG: destination             */
+    int             frd;                    /* MSG: forced discovery flag   */
+    odr_frame       frame;                  /* FRAME: frame, len bytes kept */
+} odr_sim_event;
+
+// node of the simulation, obj first: the transport gets back to the node
+typedef struct odr_sim_node_t {
+    odr_object      obj;                    /* ODR instance                 */
+    int             id;                     /* node number, from 1          */
+    long            wake;                   /* pending TIMER event, 0 none  */
+    int             nifs;                   /* interfaces                   */
+    int             links[ODR_SIM_MAXIF];   /* segment of each interface    */
+    int             version;                /* frame version of a node not
+                                               upgraded, 0 if current       */
+    odr_frame       out;                    /* output buffer                */
+} odr_sim_node;
+
+// broadcast segment: interface i is interface ifs[i] of node nodes[i]
+typedef struct odr_sim_link_t {
+    int             count;                  /* attached interfaces          */
+    int             *nodes;                 /* node of each interface       */
+    int             *ifs;                   /* interface index on the node  */
+} odr_sim_link;
+
+typedef struct odr_sim_t {
+    int             nnodes;                 /* nodes                        */
+    odr_sim_node    **nodes;                /* nodes[1 .. nnodes]           */
+    int             nlinks;                 /* segments                     */
+    odr_sim_link    *links;                 /* segments                     */
+    long            latency;                /* per hop latency (us)         */
+    long            now;                    /* virtual clock (us)           */
+    ulong           seq;                    /* events scheduled             */
+    odr_sim_event   **heap;                 /* pending events               */
+    uint            count;                  /* pending events               */
+    uint            size;                   /* heap capacity                */
+    ulong           events;                 /* events processed             */
+    ulong           frames;                 /* frames that reached a node   */
+    ulong           sent;                   /* APPMSGs sent by applications */
+    ulong           delivered;              /* APPMSGs delivered            */
+    ulong           req_kept;               /* delivered with their req_id  */
+    int             msglen;                 /* APPMSG data length, at least
+                                               the send time                */
+    odr_hist        msg_latency;            /* APPMSG delivery latency (us) */
+} odr_sim;
+
+// benchmark: runs *ops operations on a node with tables of n entries and
+// returns the nanoseconds they took; setup is not timed, *ops may be
+// changed to what was actually run
+typedef long (*odr_bench_fn)(odr_object *, int, long *);
+
+typedef struct odr_bench_t {
+    const char      *name;                  /* benchmark name               */
+    odr_bench_fn    fn;                     /* benchmark function           */
+    int             sized;                  /* 0 if the tables do not matter */
+} odr_bench;
+
 odr_itable *get_hw_addrs(char *);
 odr_itable *Get_hw_addrs(char *);
 void free_hwa_info(odr_itable *);
 
+uint hash_slot(odr_hash *, uint);
+void hash_init(odr_hash *, uint);
+void *hash_find(odr_hash *, uint);
+void hash_insert(odr_hash *, uint, void *);
+void hash_remove(odr_hash *, uint);
+void hash_free(odr_hash *);
+
+uint btable_slot(odr_btable *, in_addr_t, in_addr_t);
+void btable_init(odr_btable *, ulong);
+uint btable_get(odr_btable *, in_addr_t, in_addr_t);
+void btable_set(odr_btable *, in_addr_t, in_addr_t, uint);
+void btable_free(odr_btable *);
+
 odr_itable *get_item_itable(int, odr_object *);
-odr_rtable *get_item_rtable(const char *, odr_object *);
+odr_rtable *get_item_rtable(in_addr_t, odr_object *);
+odr_ntable *get_item_ntable(const char *, int, odr_object *);
+void update_ntable(const char *, int, int, int, odr_object *);
+int get_version_itable(int, odr_object *);
+
+void build_frame_header(odr_frame *, uchar *, uchar *, ushort);
+void build_frame(odr_frame *, uchar *, uchar *, ushort, void *);
+void build_frame_template(odr_frame_hdr *, uchar *, uchar *);
+int encode_rpacket(char *, odr_rpacket *, int);
+int encode_apacket(char *, odr_apacket *, int);
+void decode_rpacket(odr_frame *, odr_rpacket *);
+void decode_apacket(odr_frame *, odr_apacket *);
+int encode_fpacket(char *, odr_apacket *, int, int, int);
+int decode_fpacket(odr_frame *, int, odr_apacket *);
+
+int util_ip_to_hostname(const char *, char *, int);
+int util_hostname_to_ip(const char *, char *, int);
+const char *util_ntop(in_addr_t);
 odr_ptable *get_item_ptable(int, odr_object *);
+int get_port_ptable(const char *, odr_object *);
+odr_ptable *create_ptable(void);
+
+int send_packet(odr_object *, odr_itable *, char *, ushort, void *);
+void InsertOrUpdateRoutingTable(odr_object *, odr_rtable *, in_addr_t, char *, int, uint);
+void queue_push(odr_object *, ushort, void *);
+void queue_flush(odr_object *, in_addr_t);
+void queue_expire(odr_object *, odr_timer *);
+void queue_ring_expire(odr_object *, odr_timer *);
+void frame_rreq_handler(odr_object *, odr_frame *, struct sockaddr_ll *);
+void frame_rrep_handler(odr_object *, odr_frame *, struct sockaddr_ll *);
+void frame_appmsg_handler(odr_object *, odr_frame *, int, struct sockaddr_ll *);
+int forward_appmsg(odr_object *, odr_frame *, int, struct sockaddr_ll *);
+
+void timer_init(odr_wheel *, long);
+void timer_add(odr_wheel *, odr_timer *, long, odr_timer_fn);
+void timer_del(odr_wheel *, odr_timer *);
+void timer_run(odr_object *, odr_wheel *, long);
+long timer_next(odr_wheel *);
+void timer_virtual(long);
+long timer_time(void);
+long timer_ticks(void);
+long timer_usec(void);
+long timer_nsec(void);
+
+uint hist_index(ulong);
+ulong hist_lower(uint);
+void hist_add(odr_hist *, ulong);
+void hist_merge(odr_hist *, odr_hist *);
+ulong hist_quantile(odr_hist *, double);
+void stats_merge(odr_stats *, odr_stats *);
+void stats_init(odr_object *);
+void stats_free(odr_object *);
+
+void query_init(odr_object *);
+void query_free(odr_object *);
+
+void snap_mask(sigset_t *);
+void snap_load(odr_object *);
+void snap_write(odr_object *);
+void snap_init(odr_object *);
+void snap_free(odr_object *);
+
+int sim_load(odr_sim *, const char *, long);
+void sim_node(odr_sim_node *, ulong);
+void sim_start(odr_sim *, ulong);
+void sim_message(odr_sim *, long, int, int, int);
+void sim_run(odr_sim *, long);
+void sim_stats(odr_sim *, odr_stats *);
+void sim_free(odr_sim *);
+
+typedef void (*odr_frame_fn)(odr_object *, odr_frame *, int, struct sockaddr_ll *);
+
+odr_apacket *reasm_add(odr_object *, odr_apacket *);
+void reasm_free(odr_object *);
+
+void batch_init(odr_batch *);
+int batch_send(odr_batch *, int, int, odr_frame *, int, uchar);
+void batch_flush(odr_batch *, int);
+int batch_recv(odr_batch *, int);
+void batch_report(odr_batch *, const char *);
+
+extern volatile sig_atomic_t odr_log_level;
+void log_init(int);
+void log_write(int, const char *, ...);
+void log_free(void);
+
+#define odr_log(level, ...)     do { if ((level) <= odr_log_level) log_write(level, __VA_ARGS__); } while (0)
+#define log_err(...)            odr_log(ODR_LOG_ERR, __VA_ARGS__)
+#define log_warn(...)           odr_log(ODR_LOG_WARN, __VA_ARGS__)
+#define log_info(...)           odr_log(ODR_LOG_INFO, __VA_ARGS__)
+#ifdef NDEBUG
+#define log_debug(...)          ((void)0)
+#else
+#define log_debug(...)          odr_log(ODR_LOG_DEBUG, __VA_ARGS__)
+#endif
+
+extern __thread odr_worker *odr_io;
+void worker_init(odr_object *);
+void worker_start(odr_object *);
+void worker_free(odr_object *);
+
+int ring_init(odr_ring *, int, int);
+int ring_recv(odr_object *, odr_ring *, odr_frame_fn);
+int ring_send(odr_ring *, int, odr_frame *, int);
+void ring_flush(odr_ring *);
+void ring_free(odr_ring *);
+
+void event_init(odr_object *);
+int msg_send(int, char *, int, char *, int);
+int msg_recv(int, char *, char *, int *);
+int msg_send_req(int, char *, int, char *, int, uint);
+int msg_recv_req(int, char *, char *, int *, uint *);
+int msg_recv_batch(int, odr_msg *, int, int);
+int msg_send_batch(int, odr_msg *, int);
+int msg_shm_open(int);
+char *msg_shm_buffer(int, int);
+void msg_req_init(odr_reqs *, uint, int);
+odr_req *msg_req_send(int, odr_reqs *, char *, int, char *, int);
+odr_req *msg_req_match(odr_reqs *, odr_msg *);
+odr_req *msg_req_expire(odr_reqs *, long);
+void msg_req_done(odr_reqs *, odr_req *);
+void msg_req_free(odr_reqs *);
+
+odr_shm *shm_create(void);
+odr_shm *shm_attach(int, int, int);
+void shm_free(odr_shm *);
+char *shm_reserve(odr_shm_ring *, uint);
+int shm_commit(odr_shm_ring *, uint);
+char *shm_peek(odr_shm_ring *, uint *);
+void shm_release(odr_shm_ring *, uint);
+void shm_ring_bell(int);
+
+odr_frame *batch_slot(odr_batch *, int);
+odr_frame *output_slot(odr_object *);
+int output_frame(odr_object *, int, odr_frame *, int, uchar);
+void flush_frames(odr_object *);
+void send_dgram(odr_object *, odr_apacket *);
+
+void event_add(odr_object *, odr_event *, int, odr_event_fn);
+void event_del(odr_object *, odr_event *);
+void event_wakeup(odr_object *);
+void event_loop(odr_object *);
+
+void handle_frame(odr_object *, odr_frame *, int, struct sockaddr_ll *);
+void purge_tables(odr_object *);
+void free_odr_object(odr_object *);
+void shm_detach(odr_object *, odr_ptable *);
+void rtable_expire(odr_object *, odr_timer *);
+void ptable_expire(odr_object *, odr_timer *);
+void ntable_expire(odr_object *, odr_timer *);
 
 #endif
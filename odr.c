@@ -6,25 +6,65 @@
 *     ODR main program, provides maintenance features of odr_object
 *     + odr_itable *get_item_itable(int index, odr_object *obj)
 *         [ODR itable index finder]
-*     + odr_rtable *get_item_rtable(const char *ipaddr, odr_object *obj)
+*     + odr_rtable *get_item_rtable(in_addr_t ipaddr, odr_object *obj)
 *         [ODR rtable routing path finder]
+*     + odr_ntable *get_item_ntable(const char *mac, int index, odr_object *obj)
+*         [ODR ntable neighbor finder]
+*     + void update_ntable(const char *mac, int index, int version, int mtu, odr_object *obj)
+*         [ODR ntable neighbor version update]
+*     + int get_version_itable(int index, odr_object *obj)
+*         [ODR broadcast frame version of interface]
 *     + odr_ptable *get_item_ptable(int port, odr_object *obj)
 *         [ODR ptable domain path finder]
 *     - int get_port_ptable(const char *path, odr_object *obj)
 *         [ODR ptable path-port finder]
-*     - void purge_tables(odr_object *obj)
+*     + void rtable_expire(odr_object *obj, odr_timer *timer)
+*         [ODR rtable entry timer callback]
+*     - void ptable_expire(odr_object *obj, odr_timer *timer)
+*         [ODR ptable entry timer callback]
+*     - void ntable_expire(odr_object *obj, odr_timer *timer)
+*         [ODR ntable entry timer callback]
+*     + void purge_tables(odr_object *obj)
 *         [ODR service tables purge function]
-*     - void process_frame(odr_object *obj)
+*     + void handle_frame(odr_object *obj, odr_frame *frame, int len, struct sockaddr_ll *from)
+*         [ODR frame dispatcher]
+*     - int process_frame(odr_object *obj)
 *         [ODR PF_PACKET socket frame processor]
-*     - void process_domain_dgram(odr_object *obj)
+*     - int packet_send(odr_object *obj, int if_index, odr_frame *frame, int len, uchar pkttype)
+*         [PF_PACKET frame output]
+*     - odr_frame *packet_slot(odr_object *obj)
+*         [PF_PACKET frame output buffer]
+*     - void packet_flush(odr_object *obj)
+*         [PF_PACKET frame output flush]
+*     + int output_frame(odr_object *obj, int if_index, odr_frame *frame, int len, uchar pkttype)
+*         [ODR frame output]
+*     + odr_frame *output_slot(odr_object *obj)
+*         [ODR frame output buffer]
+*     + void flush_frames(odr_object *obj)
+*         [ODR frame output flush]
+*     - void batch_expire(odr_object *obj, odr_timer *timer)
+*         [ODR batch report timer callback]
+*     - void shm_event(odr_object *obj, odr_event *ev)
+*         [ODR shared-memory doorbell handler]
+*     + void shm_detach(odr_object *obj, odr_ptable *item)
+*         [ODR shared-memory transport destructor]
+*     - void shm_open_dgram(odr_object *obj, struct sockaddr_un *from, int *fds, int nfds)
+*         [ODR shared-memory attach request handler]
+*     - int process_domain_dgram(odr_object *obj)
 *         [ODR Domain socket datagram processor]
+*     - void frame_event(odr_object *obj, odr_event *ev)
+*         [ODR PF_PACKET socket event handler]
+*     - void frame_ring_event(odr_object *obj, odr_event *ev)
+*         [ODR PF_PACKET receive ring event handler]
+*     - void dgram_event(odr_object *obj, odr_event *ev)
+*         [ODR Domain socket event handler]
 *     - odr_ptable *create_ptable()
 *         [odr_ptable constructor]
 *     - void create_sockets(odr_object *obj)
 *         [PF_PACKET socket and domain socket constructor]
 *     - void process_sockets(odr_object *obj)
 *         [ODR Sockets processor]
-*     - void free_odr_object(odr_object *obj)
+*     + void free_odr_object(odr_object *obj)
 *         [odr_object destructor]
 *     + int main(int argc, char **argv)
 *         [ODR service entry function]
@@ -62,20 +102,40 @@ odr_itable *get_item_itable(int index, odr_object *obj) {
  *
  *  Rtable routing path finder
  *
- *  @param  : const char            *ipaddr [Destination IP address]
+ *  @param  : in_addr_t             ipaddr  [Destination IP address]
  *            odr_object            *obj    [odr object]
  *  @return : odr_rtable *          [routing path entry]
  *
  *  Find the routing path entry of the destination IP address
  *  return NULL if destination is currently unreachable
+ *  The lookup goes through obj->rindex, keyed on the binary address
  * --------------------------------------------------------------------------
  */
-odr_rtable *get_item_rtable(const char *ipaddr, odr_object *obj) {
-    odr_rtable *item = obj->rtable;
+odr_rtable *get_item_rtable(in_addr_t ipaddr, odr_object *obj) {
+    // find the item through rtable hash index
+    return (odr_rtable *)hash_find(&obj->rindex, ipaddr);
+}
+
+/* --------------------------------------------------------------------------
+ *  get_item_ntable
+ *
+ *  Ntable neighbor finder
+ *
+ *  @param  : const char            *mac    [Neighbor MAC address]
+ *            int                   index   [Interface index]
+ *            odr_object            *obj    [odr object]
+ *  @return : odr_ntable *          [neighbor entry]
+ *
+ *  Find the neighbor entry of the MAC address on the interface
+ *  return NULL if no frame has been received from the neighbor
+ * --------------------------------------------------------------------------
+ */
+odr_ntable *get_item_ntable(const char *mac, int index, odr_object *obj) {
+    odr_ntable *item = obj->ntable;
 
-    // find the item in rtable
+    // find the item in ntable
     while (item) {
-        if (strcmp(item->dst, ipaddr) == 0)
+        if (item->index == index && memcmp(item->mac, mac, HWADDR_BUFFSIZE) == 0)
             break;
         item = item->next;
     }
@@ -83,6 +143,83 @@ odr_rtable *get_item_rtable(const char *ipaddr, odr_object *obj) {
     return item;
 }
 
+/* --------------------------------------------------------------------------
+ *  update_ntable
+ *
+ *  Ntable neighbor version update
+ *
+ *  @param  : const char            *mac     [Neighbor MAC address]
+ *            int                   index    [Interface index]
+ *            int                   version  [Frame version, 0 if unknown]
+ *            int                   mtu      [Neighbor MTU, 0 if unknown]
+ *            odr_object            *obj     [odr object]
+ *  @return : void
+ *
+ *  Record that a frame was received from the neighbor. An unknown version
+ *  (v1 APPMSG carries no capability bit, a v3 node sends v2 APPMSGs to a
+ *  neighbor it has not learned as v3) keeps the learned one, or v1 for a
+ *  new neighbor. The MTU is only carried by v2 RREQ/RREP. A new neighbor
+ *  gets the header template of the unicast frames sent to it
+ * --------------------------------------------------------------------------
+ */
+void update_ntable(const char *mac, int index, int version, int mtu, odr_object *obj) {
+    odr_ntable *item = get_item_ntable(mac, index, obj);
+    odr_itable *interface;
+
+    if (item == NULL) {
+        item = (odr_ntable *)Calloc(1, sizeof(odr_ntable));
+        memcpy(item->mac, mac, HWADDR_BUFFSIZE);
+        item->index = index;
+        if ((interface = get_item_itable(index, obj)) != NULL)
+            build_frame_template(&item->hdr, (uchar *)mac, (uchar *)interface->if_haddr);
+        item->version = ODR_VERSION_V1;
+        item->prev = NULL;
+        item->next = obj->ntable;
+        if (obj->ntable)
+            obj->ntable->prev = item;
+        obj->ntable = item;
+        item->timestamp = timer_time();
+        timer_add(&obj->wheel, &item->timer, item->timestamp + ODR_NEIGHBOR_TTL + 1, ntable_expire);
+    }
+
+    if (version)
+        item->version = version;
+    if (mtu)
+        item->mtu = mtu;
+    item->timestamp = timer_time();
+}
+
+/* --------------------------------------------------------------------------
+ *  get_version_itable
+ *
+ *  Broadcast frame version of interface
+ *
+ *  @param  : int                   index   [Interface index]
+ *            odr_object            *obj    [odr object]
+ *  @return : int                   [frame version]
+ *
+ *  Broadcast in v2 only if there is at least one known neighbor on the
+ *  interface and all of them understand v2. Otherwise fall back to v1 so
+ *  that nodes not upgraded yet still see the RREQ. The lowest version of
+ *  the neighbors is returned (route packets are the same in v2 and v3)
+ * --------------------------------------------------------------------------
+ */
+int get_version_itable(int index, odr_object *obj) {
+    int version = 0;
+    odr_ntable *item;
+
+    for (item = obj->ntable; item != NULL; item = item->next) {
+        if (item->index != index)
+            continue;
+        if (item->version < ODR_VERSION_V2)
+            return ODR_VERSION_V1;
+        if (version == 0 || item->version < version)
+            version = item->version;
+    }
+
+    return version ? version : ODR_VERSION_V1;
+}
+
 /* --------------------------------------------------------------------------
  *  get_item_ptable
  *
@@ -107,7 +244,7 @@ odr_ptable *get_item_ptable(int port, odr_object *obj) {
     }
 
     if (item && item->timestamp > 0)
-        item->timestamp = time(NULL);
+        item->timestamp = timer_time();
     return item;
 }
 
@@ -138,7 +275,7 @@ int get_port_ptable(const char *path, odr_object *obj) {
     if (item) {
         // if found, update timestamp and return port number
         if (item->timestamp > 0)
-            item->timestamp = time(NULL);
+            item->timestamp = timer_time();
         //printf("[ptable] Path: %s, Port: %d, Timestamp: %ld\n", item->path, item->port, item->timestamp);
         return item->port;
     } else {
@@ -150,15 +287,111 @@ int get_port_ptable(const char *path, odr_object *obj) {
 
         newitem->port = ++obj->free_port;
         strcpy(newitem->path, path);
-        newitem->timestamp = time(NULL);
+        newitem->timestamp = timer_time();
         newitem->next = obj->ptable->next;
+        newitem->prev = obj->ptable;
+        if (newitem->next)
+            newitem->next->prev = newitem;
 
         obj->ptable->next = newitem;
+        timer_add(&obj->wheel, &newitem->timer, newitem->timestamp + ODR_TIMETOLIVE + 1, ptable_expire);
         //printf("[ptable] New Path: %s, Port: %d, Timestamp: %ld\n", newitem->path, newitem->port, newitem->timestamp);
         return newitem->port;
     }
 }
 
+/* --------------------------------------------------------------------------
+ *  rtable_expire
+ *
+ *  Rtable entry timer callback
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            odr_timer     *timer  [timer of the route entry]
+ *  @return : void
+ *
+ *  Remove the route if it has gone stale. A route updated since the timer
+ *  was set is rescheduled instead, so updates never touch the wheel
+ * --------------------------------------------------------------------------
+ */
+void rtable_expire(odr_object *obj, odr_timer *timer) {
+    odr_rtable *item = TIMER_ENTRY(timer, odr_rtable, timer);
+
+    if (item->timestamp + (long)obj->staleness >= obj->wheel.now) {
+        timer_add(&obj->wheel, timer, item->timestamp + obj->staleness + 1, rtable_expire);
+        return;
+    }
+
+    // remove the routing path
+    hash_remove(&obj->rindex, item->dst);
+    if (item->prev)
+        item->prev->next = item->next;
+    else
+        obj->rtable = item->next;
+    if (item->next)
+        item->next->prev = item->prev;
+    free(item);
+}
+
+/* --------------------------------------------------------------------------
+ *  ptable_expire
+ *
+ *  Ptable entry timer callback
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            odr_timer     *timer  [timer of the path-port entry]
+ *  @return : void
+ *
+ *  Remove the path-port that has no communication longer than
+ *  ODR_TIMETOLIVE, otherwise reschedule. The permanent head entry never
+ *  has a timer
+ * --------------------------------------------------------------------------
+ */
+void ptable_expire(odr_object *obj, odr_timer *timer) {
+    odr_ptable *item = TIMER_ENTRY(timer, odr_ptable, timer);
+
+    if ((long)item->timestamp + ODR_TIMETOLIVE >= obj->wheel.now) {
+        timer_add(&obj->wheel, timer, item->timestamp + ODR_TIMETOLIVE + 1, ptable_expire);
+        return;
+    }
+
+    // remove not head
+    shm_detach(obj, item);
+    item->prev->next = item->next;
+    if (item->next)
+        item->next->prev = item->prev;
+    free(item);
+}
+
+/* --------------------------------------------------------------------------
+ *  ntable_expire
+ *
+ *  Ntable entry timer callback
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            odr_timer     *timer  [timer of the neighbor entry]
+ *  @return : void
+ *
+ *  Forget the neighbor that has been silent longer than ODR_NEIGHBOR_TTL,
+ *  otherwise reschedule
+ * --------------------------------------------------------------------------
+ */
+void ntable_expire(odr_object *obj, odr_timer *timer) {
+    odr_ntable *item = TIMER_ENTRY(timer, odr_ntable, timer);
+
+    if (item->timestamp + ODR_NEIGHBOR_TTL >= obj->wheel.now) {
+        timer_add(&obj->wheel, timer, item->timestamp + ODR_NEIGHBOR_TTL + 1, ntable_expire);
+        return;
+    }
+
+    if (item->prev)
+        item->prev->next = item->next;
+    else
+        obj->ntable = item->next;
+    if (item->next)
+        item->next->prev = item->prev;
+    free(item);
+}
+
 /* --------------------------------------------------------------------------
  *  purge_tables
  *
@@ -166,56 +399,111 @@ int get_port_ptable(const char *path, odr_object *obj) {
  *
  *  @param  : odr_object    *obj    [odr object]
  *  @return : void
+ *  @see    : function#timer_run
  *
- *  Purge the entries in rtable that have gone stale
- *  Purge the entries in ptable that have no communication longer than
- *  ODR_TIMETOLIVE
+ *  Run the timer wheel up to now, under the write lock. Every rtable,
+ *  ptable and ntable entry and every pending queue list has a timer, so
+ *  only the entries that actually expire are looked at:
+ *  - routes that have gone stale are purged
+ *  - path-ports with no communication longer than ODR_TIMETOLIVE are purged
+ *  - neighbors silent longer than ODR_NEIGHBOR_TTL are forgotten
+ *  - queued packets older than QUEUE_TIMEOUT are dropped
+ *  then the fast wheel, which drives route discovery
  * --------------------------------------------------------------------------
  */
 void purge_tables(odr_object *obj) {
-    odr_rtable *rtable, *rp;
-    odr_ptable *ptable, *pp;
-    ulong t = time(NULL);
-
-    // remove the route that has been stale
-    rp = obj->rtable;
-    rtable = obj->rtable;
-    while (rtable) {
-        if (rtable->timestamp + obj->staleness < t) {
-            // remove the routing path
-            if (rtable == obj->rtable) {
-                // remove head
-                obj->rtable = rtable->next;
-                free(rtable);
-                rtable = obj->rtable;
-                rp = obj->rtable;
-            } else {
-                // remove not head
-                rp->next = rtable->next;
-                free(rtable);
-                rtable = rp->next;
-            }
-        } else {
-            rp = rtable;
-            rtable = rtable->next;
+    pthread_rwlock_wrlock(&obj->lock);
+    timer_run(obj, &obj->wheel, timer_time());
+    timer_run(obj, &obj->fast, timer_ticks());
+    pthread_rwlock_unlock(&obj->lock);
+}
+
+/* --------------------------------------------------------------------------
+ *  handle_frame
+ *
+ *  ODR service frame dispatcher
+ *
+ *  @param  : odr_object            *obj    [odr object]
+ *            odr_frame             *frame  [received frame]
+ *            int                   len     [received frame length]
+ *            struct sockaddr_ll    *from   [sender information]
+ *  @return : void
+ *
+ *  Learn the frame version and MTU of the sender, then use different
+ *  function to process the frame. Route packets show the version of their
+ *  sender (a v1 one only at hop count 0, see below); a v2 APPMSG only
+ *  raises a v1 neighbor, since a v3 node sends v2 until it learns us. A transit APPMSG is first tried on the
+ *  forwarding fast path under the read lock; all other frames are handled
+ *  under the write lock, so route discovery state stays consistent across
+ *  workers.
+ *  The frame is counted, and the time spent in its handler recorded, in
+ *  the statistics of the calling thread
+ * --------------------------------------------------------------------------
+ */
+void handle_frame(odr_object *obj, odr_frame *frame, int len, struct sockaddr_ll *from) {
+    int         done, version, mtu = 0, type = ODR_FRAME_TYPE(frame->h_type);
+    long        start = timer_nsec();
+    odr_stats   *stats = ODR_STATS(obj);
+    odr_ntable  *neighbor;
+    odr_rpacket_v1 *r1;
+
+    if (type <= ODR_FRAME_APPFRAG)
+        stats->rx[type]++;
+    // old debug broadcasts, the tables are read on the query socket now
+    if (type == ODR_FRAME_ROUTE || type == ODR_FRAME_INTERFACE)
+        return;
+
+    if (type == ODR_FRAME_APPMSG || type == ODR_FRAME_APPFRAG) {
+        pthread_rwlock_rdlock(&obj->lock);
+        done = forward_appmsg(obj, frame, len, from);
+        pthread_rwlock_unlock(&obj->lock);
+        if (done) {
+            hist_add(&stats->handler[ODR_HANDLER_FORWARD], timer_nsec() - start);
+            return;
         }
     }
 
-    // remove the path-port that has been timeout
-    pp = obj->ptable;
-    ptable = obj->ptable;
-    while (ptable) {
-        if (ptable->timestamp != 0 && ptable->timestamp + ODR_TIMETOLIVE < t) {
-            // remove not head
-            pp->next = ptable->next;
-            free(ptable);
-            ptable = pp->next;
-        } else {
-            pp = ptable;
-            ptable = ptable->next;
-        }
+    pthread_rwlock_wrlock(&obj->lock);
+    start = timer_nsec();
+
+    // learn the frame version and MTU the neighbor understands
+    if ((frame->h_type & ODR_FRAME_V2) && ODR_FRAME_TYPE(frame->h_type) <= ODR_FRAME_RREP) {
+        mtu = min(ntohs(((odr_rpacket *)frame->data)->mtu), ODR_MTU_MAX);
+        if (mtu < ODR_MTU_MIN)
+            mtu = 0;
+    }
+    if (frame->h_type & ODR_FRAME_V2) {
+        version = ODR_FRAME_VERSION(frame->h_type);
+        // a v3 node sends v2 APPMSGs to a neighbor it has not learned as v3
+        if (type > ODR_FRAME_RREP && version == ODR_VERSION_V2 &&
+            (neighbor = get_item_ntable(frame->h_source, from->sll_ifindex, obj)) != NULL && neighbor->version > version)
+            version = 0;
+        update_ntable(frame->h_source, from->sll_ifindex, version, mtu, obj);
+    } else if (ODR_FRAME_TYPE(frame->h_type) <= ODR_FRAME_RREP) {
+        // a v1 node relays a route packet with the flags of its originator,
+        // so the bin and rid bits only speak for the sender at hop count 0
+        r1 = (odr_rpacket_v1 *)frame->data;
+        version = r1->flag.bin ? (r1->flag.rid ? ODR_VERSION_V3 : ODR_VERSION_V2) : ODR_VERSION_V1;
+        update_ntable(frame->h_source, from->sll_ifindex, r1->hopcnt ? 0 : version, 0, obj);
+    } else if (ODR_FRAME_TYPE(frame->h_type) == ODR_FRAME_APPMSG) {
+        update_ntable(frame->h_source, from->sll_ifindex, 0, 0, obj);
     }
 
+    switch (type) {
+    case ODR_FRAME_RREQ:
+        frame_rreq_handler(obj, frame, from);
+        hist_add(&stats->handler[ODR_HANDLER_RREQ], timer_nsec() - start);
+        break;
+    case ODR_FRAME_RREP:
+        frame_rrep_handler(obj, frame, from);
+        hist_add(&stats->handler[ODR_HANDLER_RREP], timer_nsec() - start);
+        break;
+    case ODR_FRAME_APPMSG:
+    case ODR_FRAME_APPFRAG:
+        frame_appmsg_handler(obj, frame, len, from);
+        hist_add(&stats->handler[ODR_HANDLER_APPMSG], timer_nsec() - start);
+    }
+    pthread_rwlock_unlock(&obj->lock);
 }
 
 /* --------------------------------------------------------------------------
@@ -224,40 +512,282 @@ void purge_tables(odr_object *obj) {
  *  ODR service frame processor
  *
  *  @param  : odr_object    *obj    [odr object]
+ *  @return : int           [number of frames, -1 if no frame is pending]
+ *  @see    : function#batch_recv
+ *            function#handle_frame
+ *
+ *  Receive a batch of frames from PF_PACKET socket, then dispatch them
+ * --------------------------------------------------------------------------
+ */
+int process_frame(odr_object *obj) {
+    int i, n;
+    odr_batch *batch = &obj->rx_batch;
+
+    n = batch_recv(batch, obj->p_sockfd);
+    for (i = 0; i < n; i++)
+        handle_frame(obj, &batch->frames[i], batch->msgs[i].msg_len, &batch->addrs[i]);
+    return n;
+}
+
+/* --------------------------------------------------------------------------
+ *  packet_send
+ *
+ *  PF_PACKET frame output
+ *
+ *  @param  : odr_object    *obj        [odr object]
+ *            int           if_index    [interface index]
+ *            odr_frame     *frame      [frame]
+ *            int           len         [frame length]
+ *            uchar         pkttype     [packet type]
+ *  @return : int   [the number of bytes that are sent, -1 if failed]
+ *
+ *  The frame is queued into the PACKET_MMAP transmit ring, or into the
+ *  sendmmsg batch when the ring is full or not used, and goes out on the
+ *  next flush_frames(). A forwarding worker queues into its own batch,
+ *  flushed after each receive batch
+ * --------------------------------------------------------------------------
+ */
+int packet_send(odr_object *obj, int if_index, odr_frame *frame, int len, uchar pkttype) {
+    int n;
+
+    if (odr_io)
+        return batch_send(&odr_io->tx_batch, odr_io->sockfd, if_index, frame, len, pkttype);
+
+    if (obj->ring.tx_map && (n = ring_send(&obj->ring, if_index, frame, len)) >= 0)
+        return n;
+    return batch_send(&obj->tx_batch, obj->p_sockfd, if_index, frame, len, pkttype);
+}
+
+/* --------------------------------------------------------------------------
+ *  packet_slot
+ *
+ *  PF_PACKET frame output buffer
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *  @return : odr_frame *           [buffer for the next frame]
+ *
+ *  A frame built in the buffer and handed to output_frame() is queued in
+ *  the sendmmsg batch of the calling thread without another copy
+ * --------------------------------------------------------------------------
+ */
+odr_frame *packet_slot(odr_object *obj) {
+    if (odr_io)
+        return batch_slot(&odr_io->tx_batch, odr_io->sockfd);
+    return batch_slot(&obj->tx_batch, obj->p_sockfd);
+}
+
+/* --------------------------------------------------------------------------
+ *  packet_flush
+ *
+ *  PF_PACKET frame output flush
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void packet_flush(odr_object *obj) {
+    if (obj->ring.tx_map)
+        ring_flush(&obj->ring);
+    batch_flush(&obj->tx_batch, obj->p_sockfd);
+}
+
+// frames go out on the PF_PACKET socket, APPMSGs to the domain socket
+static const odr_transport packet_transport = { packet_slot, packet_send, packet_flush, send_dgram };
+
+/* --------------------------------------------------------------------------
+ *  output_frame
+ *
+ *  ODR service frame output
+ *
+ *  @param  : odr_object    *obj        [odr object]
+ *            int           if_index    [interface index]
+ *            odr_frame     *frame      [frame, from output_slot()]
+ *            int           len         [frame length]
+ *            uchar         pkttype     [packet type]
+ *  @return : int   [the number of bytes that are sent, -1 if failed]
+ *
+ *  Count the frame and hand it to the transport of the object
+ * --------------------------------------------------------------------------
+ */
+int output_frame(odr_object *obj, int if_index, odr_frame *frame, int len, uchar pkttype) {
+    int type = ODR_FRAME_TYPE(frame->h_type);
+
+    if (type <= ODR_FRAME_APPFRAG)
+        ODR_STATS(obj)->tx[type]++;
+    return obj->tp->send(obj, if_index, frame, len, pkttype);
+}
+
+/* --------------------------------------------------------------------------
+ *  output_slot
+ *
+ *  ODR frame output buffer
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *  @return : odr_frame *           [buffer for the next frame]
+ *
+ *  Build the frame in this buffer to spare the transport a copy
+ * --------------------------------------------------------------------------
+ */
+odr_frame *output_slot(odr_object *obj) {
+    return obj->tp->slot(obj);
+}
+
+/* --------------------------------------------------------------------------
+ *  flush_frames
+ *
+ *  ODR service frame output flush
+ *
+ *  @param  : odr_object    *obj    [odr object]
  *  @return : void
  *
- *  When receives a frame from PF_PACKET socket, use different function
- *  to process the frame
+ *  Send the frames queued by output_frame(), called once per event loop
+ *  round
  * --------------------------------------------------------------------------
  */
-void process_frame(odr_object *obj) {
-    int len;
-    struct sockaddr_ll from;
-    bzero(&from, sizeof(struct sockaddr_ll));
-    socklen_t fromlen = sizeof(struct sockaddr_ll);
+void flush_frames(odr_object *obj) {
+    obj->tp->flush(obj);
+}
 
-    odr_frame frame;
-    bzero(&frame, sizeof(frame));
+/* --------------------------------------------------------------------------
+ *  batch_expire
+ *
+ *  ODR batch report timer callback
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            odr_timer     *timer  [report timer]
+ *  @return : void
+ *
+ *  Print the recvmmsg/sendmmsg batch size distribution every
+ *  ODR_BATCH_REPORT seconds
+ * --------------------------------------------------------------------------
+ */
+void batch_expire(odr_object *obj, odr_timer *timer) {
+    int i;
+    char name[16];
 
-    len = recv_frame(obj->p_sockfd, &frame, (SA *)&from, &fromlen);
+    batch_report(&obj->rx_batch, "rx");
+    batch_report(&obj->tx_batch, "tx");
+    for (i = 0; i < obj->nworkers; i++) {
+        sprintf(name, "w%d rx", obj->workers[i].id);
+        batch_report(&obj->workers[i].rx_batch, name);
+        sprintf(name, "w%d tx", obj->workers[i].id);
+        batch_report(&obj->workers[i].tx_batch, name);
+    }
+    timer_add(&obj->wheel, timer, obj->wheel.now + ODR_BATCH_REPORT, batch_expire);
+}
 
-    switch (frame.h_type) {
-    case ODR_FRAME_RREQ:
-        frame_rreq_handler(obj, &frame, &from);
-        break;
-    case ODR_FRAME_RREP:
-        frame_rrep_handler(obj, &frame, &from);
-        break;
-    case ODR_FRAME_APPMSG:
-        frame_appmsg_handler(obj, &frame, &from);
-        break;
-    case ODR_FRAME_ROUTE:
-        debug_route_handler(obj);
-        break;
-    case ODR_FRAME_INTERFACE:
-        debug_interface_handler(obj);
+/* --------------------------------------------------------------------------
+ *  shm_event
+ *
+ *  ODR shared-memory doorbell handler
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            odr_event     *ev     [doorbell event of the transport]
+ *  @return : void
+ *
+ *  Reset the doorbell, then hand every APPMSG in the ring to the queue.
+ *  The APPMSG is used in place: the source is filled into the record and
+ *  the frame is encoded straight from it. The ring is checked again after
+ *  the last record, so a message published meanwhile is not missed
+ * --------------------------------------------------------------------------
+ */
+void shm_event(odr_object *obj, odr_event *ev) {
+    uint        len;
+    uint64_t    bell;
+    odr_shm     *shm = (odr_shm *)((char *)ev - offsetof(odr_shm, event));
+    odr_ptable  *item;
+    odr_apacket *apacket;
+
+    read(ev->fd, &bell, sizeof(bell));
+
+    pthread_rwlock_wrlock(&obj->lock);
+    if ((item = get_item_ptable(shm->port, obj)) && item->timestamp > 0)
+        item->timestamp = timer_time();
+
+    while ((apacket = (odr_apacket *)shm_peek(&shm->area->tx, &len)) != NULL) {
+        if (len > offsetof(odr_apacket, data)) {
+            apacket->length = min(apacket->length, len - offsetof(odr_apacket, data) - 1);
+            apacket->data[apacket->length] = 0;
+            apacket->src = obj->addr;
+            apacket->src_port = shm->port;
+            apacket->hopcnt = 0;
+            apacket->frd = (apacket->frd != 0);
+            apacket->msg_id = ++obj->msg_id;
+            apacket->offset = 0;
+            apacket->total = apacket->length;
+            queue_push(obj, ODR_FRAME_APPMSG, apacket);
+        }
+        shm_release(&shm->area->tx, len);
+    }
+    pthread_rwlock_unlock(&obj->lock);
+}
+
+/* --------------------------------------------------------------------------
+ *  shm_detach
+ *
+ *  ODR shared-memory transport destructor
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            odr_ptable    *item   [path-port entry]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void shm_detach(odr_object *obj, odr_ptable *item) {
+    if (item->shm == NULL)
+        return;
+    event_del(obj, &item->shm->event);
+    shm_free(item->shm);
+    item->shm = NULL;
+}
+
+/* --------------------------------------------------------------------------
+ *  shm_open_dgram
+ *
+ *  ODR shared-memory attach request handler
+ *
+ *  @param  : odr_object            *obj    [odr object]
+ *            struct sockaddr_un    *from   [application path]
+ *            int                   *fds    [received descriptors]
+ *            int                   nfds    [number of descriptors]
+ *  @return : void
+ *
+ *  An attach request carries the memfd and the two doorbells. The
+ *  transport is bound to the path-port entry of the application and the
+ *  request is acknowledged with a ODR_DGRAM_SHM datagram. Descriptors that
+ *  are not used are closed
+ * --------------------------------------------------------------------------
+ */
+void shm_open_dgram(odr_object *obj, struct sockaddr_un *from, int *fds, int nfds) {
+    int i;
+    odr_dgram dgram;
+    odr_shm *shm;
+    odr_ptable *item;
+
+    if (nfds != 3) {
+        for (i = 0; i < nfds; i++)
+            close(fds[i]);
+        log_warn("[shm] Attach request from [%s] without descriptors, ignored.", from->sun_path);
+        return;
     }
+    if ((shm = shm_attach(fds[0], fds[1], fds[2])) == NULL) {
+        log_warn("[shm] Bad attach request from [%s], ignored.", from->sun_path);
+        return;
+    }
+
+    pthread_rwlock_wrlock(&obj->lock);
+    item = get_item_ptable(get_port_ptable(from->sun_path, obj), obj);
+    if (item->shm)
+        shm_detach(obj, item);
+    item->shm = shm;
+    shm->port = item->port;
+    event_add(obj, &shm->event, shm->tx_bell, shm_event);
+    pthread_rwlock_unlock(&obj->lock);
 
+    log_info("[shm] Shared-memory transport attached for [%s] port %d", from->sun_path, shm->port);
+    bzero(&dgram, sizeof(dgram));
+    dgram.flag = ODR_DGRAM_SHM;
+    dgram.port = shm->port;
+    sendto(obj->d_sockfd, &dgram, sizeof(dgram), 0, (SA *)from, sizeof(struct sockaddr_un));
 }
 
 /* --------------------------------------------------------------------------
@@ -265,53 +795,141 @@ void process_frame(odr_object *obj) {
  *
  *  ODR service domain datagram processor
  *
- *  @param  :
- *  @return : void
+ *  @param  : odr_object    *obj    [odr object]
+ *  @return : int           [datagram length, -1 if none is pending]
  *
  *  When receives a datagram from Domain socket, use different function to
- *  handle server/client request
+ *  handle server/client request. The data is received straight into the
+ *  APPMSG (obj->d_packet, too large for the stack), which gets a new
+ *  message id. A datagram carrying descriptors is a shared-memory attach
+ *  request
  * --------------------------------------------------------------------------
  */
-void process_domain_dgram(odr_object *obj) {
-    int n, port;
+int process_domain_dgram(odr_object *obj) {
+    int i, n, port, nfds = 0, *fds = NULL;
     odr_dgram dgram;
     struct sockaddr_un from;
-    socklen_t addrlen = sizeof(from);
+    struct iovec iov[2];
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    union {
+        struct cmsghdr  cm;
+        char            control[CMSG_SPACE(3 * sizeof(int))];
+    } control_un;
+    odr_apacket *apacket = obj->d_packet;
 
-    bzero(&dgram, sizeof(dgram));
-    n = Recvfrom(obj->d_sockfd, &dgram, sizeof(dgram), 0, (SA *)&from, &addrlen);
-    printf("Received from [%s]: %s\n", from.sun_path, dgram.data);
+    bzero(&from, sizeof(from));
+    iov[0].iov_base = &dgram;
+    iov[0].iov_len = sizeof(odr_dgram);
+    iov[1].iov_base = apacket->data;
+    iov[1].iov_len = ODR_MSG_MAXLEN;
+    bzero(&msg, sizeof(msg));
+    msg.msg_name = &from;
+    msg.msg_namelen = sizeof(from);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = control_un.control;
+    msg.msg_controllen = sizeof(control_un.control);
 
+    n = recvmsg(obj->d_sockfd, &msg, MSG_CMSG_CLOEXEC);
+    if (n <= 0)
+        return -1;
+    if ((cmsg = CMSG_FIRSTHDR(&msg)) != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        fds = (int *)CMSG_DATA(cmsg);
+        nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    }
+    if (n < sizeof(odr_dgram) || (dgram.flag & ODR_DGRAM_SHM) == 0) {
+        // descriptors are only expected with an attach request
+        for (i = 0; i < nfds; i++)
+            close(fds[i]);
+        if (n < sizeof(odr_dgram))
+            return n;
+    } else {
+        shm_open_dgram(obj, &from, fds, nfds);
+        return n;
+    }
+    apacket->data[n - sizeof(odr_dgram)] = 0;
+    log_debug("[domain] Received from [%s]: %s", from.sun_path, apacket->data);
+
+    pthread_rwlock_wrlock(&obj->lock);
     port = get_port_ptable(from.sun_path, obj);
 
-    // build apacket item
-    odr_queue_item  *item = (odr_queue_item *)Calloc(1, sizeof(odr_queue_item));
-    odr_apacket     *apacket = (odr_apacket *)item->data;
+    // build apacket
+    bzero(apacket, offsetof(odr_apacket, data));
 
-    strcpy(apacket->dst, dgram.ipaddr);
+    apacket->dst = dgram.ipaddr;
     apacket->dst_port = dgram.port;
-    strcpy(apacket->src, obj->ipaddr);
+    apacket->src = obj->addr;
     apacket->src_port = port;
     apacket->hopcnt = 0;
     apacket->frd = dgram.flag;
-    apacket->length = strlen(dgram.data);
-    strcpy(apacket->data, dgram.data);
+    apacket->req_id = dgram.req_id;
+    apacket->length = strlen(apacket->data);
+    apacket->msg_id = ++obj->msg_id;
+    apacket->offset = 0;
+    apacket->total = apacket->length;
 
-    item->type = ODR_FRAME_APPMSG;
-    item->timestamp = time(NULL);
-    item->next = NULL;
+    log_debug("[domain] Queued up APPMSG (dst: %I:%d src: %I:%d hopcnt: %d frd: %d data[%d]: %s)", apacket->dst, apacket->dst_port, apacket->src, apacket->src_port, apacket->hopcnt, apacket->frd, apacket->length, apacket->data);
 
-    // insert into queue
-    if (obj->queue.head == NULL) {
-        obj->queue.head = item;
-        obj->queue.tail = item;
-    } else {
-        obj->queue.tail->next = item;
-        obj->queue.tail = item;
-    }
-    printf("Queued up APPMSG (dst: %s:%d src: %s:%d hopcnt: %d frd: %d data[%d]: %s)\n", apacket->dst, apacket->dst_port, apacket->src, apacket->src_port, apacket->hopcnt, apacket->frd, apacket->length, apacket->data);
+    queue_push(obj, ODR_FRAME_APPMSG, apacket);
+    pthread_rwlock_unlock(&obj->lock);
+    return n;
+}
+
+/* --------------------------------------------------------------------------
+ *  frame_event
+ *
+ *  PF_PACKET socket event handler
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            odr_event     *ev     [socket event]
+ *  @return : void
+ *
+ *  Process frames until the socket is drained (edge-triggered). A short
+ *  batch means the socket was empty, any later frame raises a new event
+ * --------------------------------------------------------------------------
+ */
+void frame_event(odr_object *obj, odr_event *ev) {
+    while (process_frame(obj) == ODR_BATCH_MAX)
+        ;
+}
+
+/* --------------------------------------------------------------------------
+ *  frame_ring_event
+ *
+ *  PF_PACKET receive ring event handler
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            odr_event     *ev     [socket event]
+ *  @return : void
+ *  @see    : function#ring_recv
+ *
+ *  Process every block the kernel has handed over
+ * --------------------------------------------------------------------------
+ */
+void frame_ring_event(odr_object *obj, odr_event *ev) {
+    ring_recv(obj, &obj->ring, handle_frame);
+}
 
-    queue_handler(obj);
+/* --------------------------------------------------------------------------
+ *  dgram_event
+ *
+ *  Domain socket event handler
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            odr_event     *ev     [socket event]
+ *  @return : void
+ *
+ *  Process datagrams until the socket is drained (edge-triggered)
+ * --------------------------------------------------------------------------
+ */
+void dgram_event(odr_object *obj, odr_event *ev) {
+    long start = timer_nsec();
+
+    while (process_domain_dgram(obj) > 0) {
+        hist_add(&obj->stats.handler[ODR_HANDLER_DGRAM], timer_nsec() - start);
+        start = timer_nsec();
+    }
 }
 
 /* --------------------------------------------------------------------------
@@ -346,15 +964,25 @@ odr_ptable *create_ptable() {
  *  @param  : odr_object    *obj    [odr object]
  *  @return : void
  *
- *  Create a PF_PACKET socket for frame communication
- *  Create a Domain socket for datagram communication
+ *  Create a PF_PACKET socket for frame communication, with PACKET_MMAP
+ *  rings if enabled and supported; a transmit slot holds a frame of the
+ *  largest interface MTU
+ *  Create a Domain socket for datagram communication, and the buffer its
+ *  datagrams are received into
  * --------------------------------------------------------------------------
  */
 void create_sockets(odr_object *obj) {
+    int mtu = ODR_MTU_MIN;
     struct sockaddr_un odraddr;
+    odr_itable *item;
 
     // Create PF_PACKET Socket
     obj->p_sockfd = Socket(PF_PACKET, SOCK_RAW, htons(PROTOCOL_ID));
+    obj->ring.rx_fd = obj->ring.tx_fd = -1;
+    for (item = obj->itable; item != NULL; item = item->hwa_next)
+        mtu = max(mtu, item->if_mtu);
+    if (obj->use_ring && ring_init(&obj->ring, obj->p_sockfd, mtu) < 0)
+        err_msg("[ODR] PACKET_MMAP rings not available, using socket I/O");
 
     bzero(&odraddr, sizeof(odraddr));
     odraddr.sun_family = AF_LOCAL;
@@ -364,6 +992,7 @@ void create_sockets(odr_object *obj) {
     unlink(ODR_PATH);
     obj->d_sockfd = Socket(AF_LOCAL, SOCK_DGRAM, 0);
     Bind(obj->d_sockfd, (SA *)&odraddr, sizeof(odraddr));
+    obj->d_packet = (odr_apacket *)Calloc(1, sizeof(odr_apacket));
 }
 
 /* --------------------------------------------------------------------------
@@ -373,37 +1002,31 @@ void create_sockets(odr_object *obj) {
  *
  *  @param  : odr_object    *obj    [odr object]
  *  @return : void
- *  @see    : function#process_frame
- *            function#process_domain_dgram
+ *  @see    : function#frame_event
+ *            function#frame_ring_event
+ *            function#dgram_event
+ *            function#event_loop
  *
- *  Wait for the message from PF_PACKET socket or Domain socket
- *  then process it
+ *  Register the PF_PACKET socket and Domain socket with the event loop,
+ *  open the statistics and table query sockets and the snapshot signalfd,
+ *  then wait for messages and timers. The timerfd of the event loop runs
+ *  the timer wheel, so the tables are purged on time even when no packet
+ *  arrives
  * --------------------------------------------------------------------------
  */
 void process_sockets(odr_object *obj) {
-    int maxfdp1 = max(obj->p_sockfd, obj->d_sockfd) + 1;
-    int r;
-    fd_set rset;
+    event_init(obj);
+    timer_add(&obj->wheel, &obj->report, obj->wheel.now + ODR_BATCH_REPORT, batch_expire);
+    if (obj->ring.rx_map)
+        event_add(obj, &obj->p_event, obj->p_sockfd, frame_ring_event);
+    else
+        event_add(obj, &obj->p_event, obj->p_sockfd, frame_event);
+    event_add(obj, &obj->d_event, obj->d_sockfd, dgram_event);
+    stats_init(obj);
+    query_init(obj);
+    snap_init(obj);
 
-    FD_ZERO(&rset);
-    while (1) {
-        FD_SET(obj->p_sockfd, &rset);
-        FD_SET(obj->d_sockfd, &rset);
-
-        r = Select(maxfdp1, &rset, NULL, NULL, NULL);
-
-        purge_tables(obj);
-
-        if (FD_ISSET(obj->p_sockfd, &rset)) {
-            // from PF_PACKET Socket
-            process_frame(obj);
-        }
-
-        if (FD_ISSET(obj->d_sockfd, &rset)) {
-            // from Domain Socket
-            process_domain_dgram(obj);
-        }
-    }
+    event_loop(obj);
 }
 
 /* --------------------------------------------------------------------------
@@ -420,9 +1043,18 @@ void process_sockets(odr_object *obj) {
 void free_odr_object(odr_object *obj) {
     odr_rtable *r, *rnext;
     odr_ptable *p, *pnext;
-    odr_queue_item *q, *qnext;
+    odr_ntable *n, *nnext;
+    odr_pending *q, *qnext;
+    odr_queue_item *qi, *qinext;
 
+    worker_free(obj);
+    stats_free(obj);
+    query_free(obj);
+    snap_free(obj);
+    reasm_free(obj);
     free_hwa_info(obj->itable);
+    ring_free(&obj->ring);
+    free(obj->d_packet);
 
     r = obj->rtable;
     while (r) {
@@ -430,10 +1062,20 @@ void free_odr_object(odr_object *obj) {
         free(r);
         r = rnext;
     }
+    hash_free(&obj->rindex);
+    btable_free(&obj->btable);
+
+    n = obj->ntable;
+    while (n) {
+        nnext = n->next;
+        free(n);
+        n = nnext;
+    }
 
     p = obj->ptable;
     while (p) {
         pnext = p->next;
+        shm_detach(obj, p);
         free(p);
         p = pnext;
     }
@@ -441,11 +1083,17 @@ void free_odr_object(odr_object *obj) {
     q = obj->queue.head;
     while (q) {
         qnext = q->next;
+        for (qi = q->head; qi != NULL; qi = qinext) {
+            qinext = qi->next;
+            free(qi);
+        }
         free(q);
         q = qnext;
     }
+    hash_free(&obj->queue.index);
 }
 
+#ifndef ODR_NO_MAIN
 /* --------------------------------------------------------------------------
  *  main
  *
@@ -461,36 +1109,87 @@ void free_odr_object(odr_object *obj) {
  *            function#process_sockets
  *            function#free_odr_object
  *
- *  ODR service entry function
+ *  ODR service entry function. Every interface gets the header template
+ *  of its broadcast frames. The tables are warm started from the snapshot
+ *  of the previous run
+ *  Options:
+ *    -m    use PACKET_MMAP rings for the PF_PACKET socket
+ *    -w n  start n forwarding worker threads
+ *    -v n  log level, 0 (errors) to 3 (debug), default 2 (info)
  * --------------------------------------------------------------------------
  */
 int main(int argc, char **argv) {
-
-    // command argument
-    if (argc != 2)
-        err_quit("usage: ODR_yinlsu <staleness time in seconds>");
+    int c, level = ODR_LOG_INFO;
+    uchar bcast_mac[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    odr_itable *item;
+    sigset_t mask;
 
     odr_object obj;
     bzero(&obj, sizeof(odr_object));
-    obj.staleness = atol(argv[1]);
+
+    // command argument
+    while ((c = getopt(argc, argv, "mw:v:")) != -1) {
+        switch (c) {
+        case 'm':
+            obj.use_ring = 1;
+            break;
+        case 'w':
+            if (!isdigit(optarg[0]))
+                err_quit("ODR: -w takes a worker count, got %s", optarg);
+            obj.nworkers = atoi(optarg);
+            break;
+        case 'v':
+            if (!isdigit(optarg[0]))
+                err_quit("ODR: -v takes a log level, got %s", optarg);
+            level = atoi(optarg);
+            break;
+        default:
+            err_quit("usage: ODR_yinlsu [-m] [-w workers] [-v level] <staleness time in seconds>");
+        }
+    }
+    if (argc - optind != 1)
+        err_quit("usage: ODR_yinlsu [-m] [-w workers] [-v level] <staleness time in seconds>");
+    // SIGINT/SIGTERM are taken by the event loop in every thread
+    snap_mask(&mask);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    log_init(level);
+
+    obj.staleness = atol(argv[optind]);
     obj.bcast_id = 0;
     obj.free_port = TIMESERV_PORT;
+    obj.tp = &packet_transport;
+    timer_init(&obj.wheel, timer_time());
+    timer_init(&obj.fast, timer_ticks());
 
     // Get interface information and canonical IP address / hostname
     obj.itable = Get_hw_addrs(obj.ipaddr);
+    obj.addr = inet_addr(obj.ipaddr);
+    for (item = obj.itable; item != NULL; item = item->hwa_next)
+        build_frame_template(&item->bcast_hdr, bcast_mac, (uchar *)item->if_haddr);
     obj.rtable = NULL;
+    obj.ntable = NULL;
+    btable_init(&obj.btable, obj.staleness);
+    hash_init(&obj.rindex, ODR_HASH_MINSIZE);
     obj.ptable = create_ptable();
-    util_ip_to_hostname(obj.ipaddr, obj.hostname);
+    util_ip_to_hostname(obj.ipaddr, obj.hostname, ODR_RESOLV_WAIT);
 
     obj.queue.head = NULL;
-    obj.queue.tail = NULL;
+    obj.queue.count = 0;
+    hash_init(&obj.queue.index, ODR_HASH_MINSIZE);
+    snap_load(&obj);
 
+    worker_init(&obj);
+    batch_init(&obj.rx_batch);
+    batch_init(&obj.tx_batch);
     create_sockets(&obj);
+    worker_start(&obj);
 
     printf("[ODR] Node IP address: %s, hostname: %s, path: %s\n", obj.ipaddr, obj.hostname, ODR_PATH);
 
     process_sockets(&obj);
 
     free_odr_object(&obj);
+    log_free();
     exit(0);
 }
+#endif
@@ -5,81 +5,656 @@
 * @Last Modified time: 2015-11-19 19:43:43
 * @Description:
 *     ODR API, provides domain socketdatagram communication between ODR
-*     service and client/server
+*     service and client/server. A socket may opt in to the shared-memory
+*     transport (odr_shm.c) with msg_shm_open(); messages then go through
+*     the rings and the socket only carries the attach handshake.
+*     A message may carry a request id, which the responder sends back with
+*     its reply; a client keeps its requests in flight in an odr_reqs table
+*     and matches the replies to them by id, so one socket can have many
+*     requests out to different servers at once
+*     - void msg_shm_addr(struct sockaddr_un *odraddr)
+*         [ODR service address]
+*     - int msg_shm_send(odr_shm *shm, odr_dgram *dgram, char *data)
+*         [Shared-memory message send function]
+*     - int msg_shm_recv(odr_shm *shm, odr_dgram *dgram, char *data)
+*         [Shared-memory message receive function]
+*     + int msg_shm_open(int sockfd)
+*         [Attach the shared-memory transport]
+*     + char *msg_shm_buffer(int sockfd, int len)
+*         [Shared-memory send buffer]
+*     + int msg_send_req(int sockfd, char *dst, int port, char *data, int flag, uint req_id)
+*         [ODR API message send function with request id]
 *     + int msg_send(int sockfd, char *dst, int port, char *data, int flag)
 *         [ODR API message send function]
+*     + int msg_recv_req(int sockfd, char *data, char *src, int *port, uint *req_id)
+*         [ODR API message receive function with request id]
 *     + int msg_recv(int sockfd, char *data, char *src, int *port)
 *         [ODR API message receive function]
+*     + int msg_recv_batch(int sockfd, odr_msg *msgs, int max, int timeout)
+*         [ODR API batch receive function]
+*     + int msg_send_batch(int sockfd, odr_msg *msgs, int n)
+*         [ODR API batch send function]
+*     + void msg_req_init(odr_reqs *r, uint size, int timeout)
+*         [Request table constructor]
+*     + odr_req *msg_req_send(int sockfd, odr_reqs *r, char *dst, int port, char *data, int flag)
+*         [Send a request and keep it in flight]
+*     + odr_req *msg_req_match(odr_reqs *r, odr_msg *msg)
+*         [Request of a reply]
+*     + odr_req *msg_req_expire(odr_reqs *r, long now)
+*         [Oldest request past its timeout]
+*     + void msg_req_done(odr_reqs *r, odr_req *req)
+*         [Free the slot of a request]
+*     + void msg_req_free(odr_reqs *r)
+*         [Request table destructor]
 */
 
 #include "np.h"
 
+// shared-memory transport of each socket, NULL if not attached
+static odr_shm *msg_shm[ODR_SHM_MAXFD];
+
 /* --------------------------------------------------------------------------
- *  msg_send
+ *  msg_shm_addr
  *
- *  ODR API Message send function
+ *  ODR service address
+ *
+ *  @param  : struct sockaddr_un    *odraddr    [address to fill]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void msg_shm_addr(struct sockaddr_un *odraddr) {
+    bzero(odraddr, sizeof(struct sockaddr_un));
+    odraddr->sun_family = AF_LOCAL;
+    strcpy(odraddr->sun_path, ODR_PATH);
+}
+
+/* --------------------------------------------------------------------------
+ *  msg_shm_open
+ *
+ *  Attach the shared-memory transport
+ *
+ *  @param  : int   sockfd  [Socket file descriptor, bound]
+ *  @return : int           [0 if succeed, -1 if failed]
+ *
+ *  Create the memfd and doorbells, pass them to ODR with SCM_RIGHTS and
+ *  wait MSG_RECV_TIMEOUT seconds for the acknowledgement. On failure the
+ *  socket keeps working as before
+ * --------------------------------------------------------------------------
+ */
+int msg_shm_open(int sockfd) {
+    int             r, *fds;
+    fd_set          rset;
+    odr_shm         *shm;
+    odr_dgram       dgram;
+    struct sockaddr_un odraddr;
+    struct iovec    iov;
+    struct msghdr   msg;
+    struct cmsghdr  *cmsg;
+    struct timeval  timeout;
+    union {
+        struct cmsghdr  cm;
+        char            control[CMSG_SPACE(3 * sizeof(int))];
+    } control_un;
+
+    if (sockfd < 0 || sockfd >= ODR_SHM_MAXFD || (shm = shm_create()) == NULL)
+        return -1;
+
+    msg_shm_addr(&odraddr);
+    bzero(&dgram, sizeof(dgram));
+    dgram.flag = ODR_DGRAM_SHM;
+    iov.iov_base = &dgram;
+    iov.iov_len = sizeof(dgram);
+    bzero(&msg, sizeof(msg));
+    msg.msg_name = &odraddr;
+    msg.msg_namelen = sizeof(odraddr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control_un.control;
+    msg.msg_controllen = sizeof(control_un.control);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    fds = (int *)CMSG_DATA(cmsg);
+    fds[0] = shm->memfd;
+    fds[1] = shm->tx_bell;
+    fds[2] = shm->rx_bell;
+
+    if (sendmsg(sockfd, &msg, 0) < 0) {
+        shm_free(shm);
+        return -1;
+    }
+
+    FD_ZERO(&rset);
+    FD_SET(sockfd, &rset);
+    timeout.tv_sec  = MSG_RECV_TIMEOUT;
+    timeout.tv_usec = 0;
+    r = Select(sockfd + 1, &rset, NULL, NULL, &timeout);
+    if (r > 0)
+        r = recvfrom(sockfd, &dgram, sizeof(dgram), 0, NULL, NULL);
+    if (r != sizeof(dgram) || (dgram.flag & ODR_DGRAM_SHM) == 0) {
+        shm_free(shm);
+        return -1;
+    }
+
+    msg_shm[sockfd] = shm;
+    return 0;
+}
+
+/* --------------------------------------------------------------------------
+ *  msg_shm_buffer
+ *
+ *  Shared-memory send buffer
+ *
+ *  @param  : int   sockfd  [Socket file descriptor]
+ *            int   len     [message length]
+ *  @return : char *        [buffer of len + 1 bytes, NULL if the socket has
+ *                           no shared-memory transport or the ring is full]
+ *
+ *  A message built in this buffer and passed to msg_send() is not copied
+ *  again before ODR encodes it into the frame. The buffer is valid until
+ *  the next msg_send() on the socket
+ * --------------------------------------------------------------------------
+ */
+char *msg_shm_buffer(int sockfd, int len) {
+    char *p;
+
+    if (sockfd < 0 || sockfd >= ODR_SHM_MAXFD || msg_shm[sockfd] == NULL || len > ODR_MSG_MAXLEN)
+        return NULL;
+    if ((p = shm_reserve(&msg_shm[sockfd]->area->tx, offsetof(odr_apacket, data) + len + 1)) == NULL)
+        return NULL;
+    return p + offsetof(odr_apacket, data);
+}
+
+/* --------------------------------------------------------------------------
+ *  msg_shm_send
+ *
+ *  Shared-memory message send function
+ *
+ *  @param  : odr_shm   *shm    [transport]
+ *            odr_dgram *dgram  [destination and flag]
+ *            char      *data   [Data payload]
+ *  @return : int           [The number of sent bytes, -1 if the ring is full]
+ *
+ *  The record is an APPMSG with the destination filled in, ODR fills in
+ *  the source. Data already in the msg_shm_buffer() is not copied
+ * --------------------------------------------------------------------------
+ */
+int msg_shm_send(odr_shm *shm, odr_dgram *dgram, char *data) {
+    uint        len = strnlen(data, ODR_MSG_MAXLEN);
+    uint        size = offsetof(odr_apacket, data) + len + 1;
+    odr_apacket *apacket;
+
+    if ((apacket = (odr_apacket *)shm_reserve(&shm->area->tx, size)) == NULL)
+        return -1;
+    if (data != apacket->data)
+        memmove(apacket->data, data, len);
+    apacket->data[len] = 0;
+
+    bzero(apacket, offsetof(odr_apacket, data));
+    apacket->dst = dgram->ipaddr;
+    apacket->dst_port = dgram->port;
+    apacket->frd = dgram->flag;
+    apacket->req_id = dgram->req_id;
+    apacket->length = len;
+
+    if (shm_commit(&shm->area->tx, size))
+        shm_ring_bell(shm->tx_bell);
+    return sizeof(odr_dgram) + len;
+}
+
+/* --------------------------------------------------------------------------
+ *  msg_shm_recv
+ *
+ *  Shared-memory message receive function
+ *
+ *  @param  : odr_shm   *shm    [transport]
+ *            odr_dgram *dgram  [source, filled]
+ *            char      *data   [Data payload, ODR_DGRAM_DATALEN bytes]
+ *  @return : int           [The number of received bytes, 0 if none]
+ * --------------------------------------------------------------------------
+ */
+int msg_shm_recv(odr_shm *shm, odr_dgram *dgram, char *data) {
+    uint        size, len;
+    odr_dgram   *rec;
+
+    if ((rec = (odr_dgram *)shm_peek(&shm->area->rx, &size)) == NULL)
+        return 0;
+
+    len = (size > sizeof(odr_dgram)) ? min(size - sizeof(odr_dgram) - 1, ODR_DGRAM_DATALEN - 1) : 0;
+    memcpy(dgram, rec, sizeof(odr_dgram));
+    memcpy(data, rec->data, len);
+    data[len] = 0;
+    shm_release(&shm->area->rx, size);
+    return sizeof(odr_dgram) + len;
+}
+
+/* --------------------------------------------------------------------------
+ *  msg_send_req
+ *
+ *  ODR API message send function with request id
  *
  *  @param  : int   sockfd  [Socket file descriptor]
  *            char  *dst    [Destination IP address]
  *            int   port    [Destination Port number]
  *            char  *data   [Data payload]
  *            int   flag    [Forced rediscovery flag]
+ *            uint  req_id  [Request id, 0 if none]
  *  @return : int           [The number of sent bytes, -1 if failed]
  *
  *  ODR API function, send message to ODR
+ *  Data longer than ODR_MSG_MAXLEN is truncated; ODR fragments messages
+ *  that do not fit in one frame. With the shared-memory transport the
+ *  message goes through the ring, or the socket if the ring is full.
+ *  The request id reaches the destination only over v2 links; a reply
+ *  passes back the id of its request
  * --------------------------------------------------------------------------
  */
-int msg_send(int sockfd, char *dst, int port, char *data, int flag) {
+int msg_send_req(int sockfd, char *dst, int port, char *data, int flag, uint req_id) {
+    int r;
     struct sockaddr_un odraddr;
+    struct iovec iov[2];
+    struct msghdr msg;
     odr_dgram dgram;
 
-    bzero(&odraddr, sizeof(odraddr));
-    odraddr.sun_family = AF_LOCAL;
-    strcpy(odraddr.sun_path, ODR_PATH);
-
     bzero(&dgram, sizeof(dgram));
-    strcpy(dgram.ipaddr, dst);
+    if (inet_pton(AF_INET, dst, &dgram.ipaddr) != 1)
+        return -1;
     dgram.port = port;
     dgram.flag = flag;
-    strcpy(dgram.data, data);
+    dgram.req_id = req_id;
+
+    if (sockfd >= 0 && sockfd < ODR_SHM_MAXFD && msg_shm[sockfd] &&
+        (r = msg_shm_send(msg_shm[sockfd], &dgram, data)) >= 0)
+        return r;
+
+    msg_shm_addr(&odraddr);
 
-    return sendto(sockfd, &dgram, sizeof(dgram), 0, (SA *)&odraddr, sizeof(odraddr));
+    iov[0].iov_base = &dgram;
+    iov[0].iov_len = sizeof(dgram);
+    iov[1].iov_base = data;
+    iov[1].iov_len = strnlen(data, ODR_MSG_MAXLEN);
+    bzero(&msg, sizeof(msg));
+    msg.msg_name = &odraddr;
+    msg.msg_namelen = sizeof(odraddr);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    return sendmsg(sockfd, &msg, 0);
 }
 
 /* --------------------------------------------------------------------------
- *  msg_recv
+ *  msg_send
  *
- *  ODR API Message receive function
+ *  ODR API Message send function
  *
  *  @param  : int   sockfd  [Socket file descriptor]
+ *            char  *dst    [Destination IP address]
+ *            int   port    [Destination Port number]
  *            char  *data   [Data payload]
+ *            int   flag    [Forced rediscovery flag]
+ *  @return : int           [The number of sent bytes, -1 if failed]
+ *  @see    : function#msg_send_req
+ *
+ *  Send a message without request id
+ * --------------------------------------------------------------------------
+ */
+int msg_send(int sockfd, char *dst, int port, char *data, int flag) {
+    return msg_send_req(sockfd, dst, port, data, flag, 0);
+}
+
+/* --------------------------------------------------------------------------
+ *  msg_recv_req
+ *
+ *  ODR API message receive function with request id
+ *
+ *  @param  : int   sockfd  [Socket file descriptor]
+ *            char  *data   [Data payload, ODR_DGRAM_DATALEN bytes]
  *            char  *src    [Source IP address]
- *            int   port    [Source Port number]
+ *            int   *port   [Source Port number]
+ *            uint  *req_id [Request id of the message, 0 if none]
  *  @return : int           [The number of received bytes, -1 if failed]
  *
  *  ODR API function, receive message from ODR
+ *  The data is received straight into the caller's buffer and null
+ *  terminated. With the shared-memory transport, the ring is checked
+ *  first and its doorbell is waited on together with the socket
  * --------------------------------------------------------------------------
  */
-int msg_recv(int sockfd, char *data, char *src, int *port) {
-    int             r;
+int msg_recv_req(int sockfd, char *data, char *src, int *port, uint *req_id) {
+    int             r, maxfd = sockfd;
+    uint64_t        bell;
     fd_set          rset;
     odr_dgram       dgram;
+    odr_shm         *shm = NULL;
+    struct iovec    iov[2];
+    struct msghdr   msg;
     struct timeval  timeout;
 
-    FD_ZERO(&rset);
-    FD_SET(sockfd, &rset);
     bzero(&dgram, sizeof(dgram));
     timeout.tv_sec  = MSG_RECV_TIMEOUT;
     timeout.tv_usec = 0;
+    data[0] = 0;
 
-    r = Select(sockfd + 1, &rset, NULL, NULL, &timeout);
+    if (sockfd >= 0 && sockfd < ODR_SHM_MAXFD && (shm = msg_shm[sockfd]) != NULL)
+        maxfd = max(sockfd, shm->rx_bell);
 
-    if (r > 0)
-        r = Recvfrom(sockfd, &dgram, sizeof(dgram), 0, NULL, NULL);
+    while (1) {
+        if (shm && (r = msg_shm_recv(shm, &dgram, data)) > 0)
+            break;
+
+        FD_ZERO(&rset);
+        FD_SET(sockfd, &rset);
+        if (shm)
+            FD_SET(shm->rx_bell, &rset);
+        r = Select(maxfd + 1, &rset, NULL, NULL, &timeout);
+        if (r <= 0)
+            break;
+        if (FD_ISSET(sockfd, &rset)) {
+            iov[0].iov_base = &dgram;
+            iov[0].iov_len = sizeof(dgram);
+            iov[1].iov_base = data;
+            iov[1].iov_len = ODR_DGRAM_DATALEN - 1;
+            bzero(&msg, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = 2;
+            if ((r = recvmsg(sockfd, &msg, 0)) < 0)
+                err_sys("recvmsg error");
+            data[(r > (int)sizeof(dgram)) ? r - sizeof(dgram) : 0] = 0;
+            break;
+        }
+        // doorbell only: reset it, then look at the ring again (the
+        // remaining timeout is left in timeout by select)
+        read(shm->rx_bell, &bell, sizeof(bell));
+    }
 
-    strcpy(data, dgram.data);
-    strcpy(src, dgram.ipaddr);
+    if (r > 0)
+        inet_ntop(AF_INET, &dgram.ipaddr, src, IPADDR_BUFFSIZE);
     *port = dgram.port;
+    *req_id = dgram.req_id;
 
     return r;
 }
+
+/* --------------------------------------------------------------------------
+ *  msg_recv
+ *
+ *  ODR API Message receive function
+ *
+ *  @param  : int   sockfd  [Socket file descriptor]
+ *            char  *data   [Data payload, ODR_DGRAM_DATALEN bytes]
+ *            char  *src    [Source IP address]
+ *            int   *port   [Source Port number]
+ *  @return : int           [The number of received bytes, -1 if failed]
+ *  @see    : function#msg_recv_req
+ *
+ *  Receive a message, ignoring its request id
+ * --------------------------------------------------------------------------
+ */
+int msg_recv(int sockfd, char *data, char *src, int *port) {
+    uint req_id;
+
+    return msg_recv_req(sockfd, data, src, port, &req_id);
+}
+
+/* --------------------------------------------------------------------------
+ *  msg_recv_batch
+ *
+ *  ODR API batch receive function
+ *
+ *  @param  : int       sockfd  [Socket file descriptor]
+ *            odr_msg   *msgs   [messages to fill]
+ *            int       max     [size of msgs, at most ODR_MSG_BATCH used]
+ *            int       timeout [milliseconds to wait for the first one]
+ *  @return : int               [number of messages, 0 on timeout, -1 if
+ *                               failed]
+ *
+ *  Wait until the socket is readable, then take every message queued on
+ *  it with one recvmmsg(). The arrival time is the kernel timestamp if
+ *  the socket has SO_TIMESTAMPNS on, the time of the call otherwise. Only
+ *  the domain socket is read, not the shared-memory transport
+ * --------------------------------------------------------------------------
+ */
+int msg_recv_batch(int sockfd, odr_msg *msgs, int max, int timeout) {
+    int             i, n;
+    long            usec;
+    char            ctrl[ODR_MSG_BATCH][CMSG_SPACE(sizeof(struct timespec))];
+    struct pollfd   pfd;
+    struct mmsghdr  mmsg[ODR_MSG_BATCH];
+    struct iovec    iov[ODR_MSG_BATCH][2];
+    struct timespec now, *ts;
+    struct cmsghdr  *cmsg;
+
+    pfd.fd = sockfd;
+    pfd.events = POLLIN;
+    if ((n = poll(&pfd, 1, timeout)) <= 0)
+        return (n < 0 && errno != EINTR) ? -1 : 0;
+
+    max = min(max, ODR_MSG_BATCH);
+    bzero(mmsg, sizeof(struct mmsghdr) * max);
+    for (i = 0; i < max; i++) {
+        iov[i][0].iov_base = &msgs[i].ipaddr;
+        iov[i][0].iov_len = sizeof(odr_dgram);
+        iov[i][1].iov_base = msgs[i].data;
+        iov[i][1].iov_len = ODR_MSG_BATCHLEN - 1;
+        mmsg[i].msg_hdr.msg_iov = iov[i];
+        mmsg[i].msg_hdr.msg_iovlen = 2;
+        mmsg[i].msg_hdr.msg_control = ctrl[i];
+        mmsg[i].msg_hdr.msg_controllen = sizeof(ctrl[i]);
+    }
+    if ((n = recvmmsg(sockfd, mmsg, max, MSG_DONTWAIT, NULL)) <= 0)
+        return (n < 0 && errno != EAGAIN && errno != EINTR) ? -1 : 0;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    usec = now.tv_sec * 1000000L + now.tv_nsec / 1000;
+    for (i = 0; i < n; i++) {
+        msgs[i].len = (mmsg[i].msg_len > sizeof(odr_dgram)) ? mmsg[i].msg_len - sizeof(odr_dgram) : 0;
+        msgs[i].data[msgs[i].len] = 0;
+        msgs[i].usec = usec;
+        for (cmsg = CMSG_FIRSTHDR(&mmsg[i].msg_hdr); cmsg; cmsg = CMSG_NXTHDR(&mmsg[i].msg_hdr, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+                ts = (struct timespec *)CMSG_DATA(cmsg);
+                msgs[i].usec = ts->tv_sec * 1000000L + ts->tv_nsec / 1000;
+            }
+        }
+    }
+    return n;
+}
+
+/* --------------------------------------------------------------------------
+ *  msg_send_batch
+ *
+ *  ODR API batch send function
+ *
+ *  @param  : int       sockfd  [Socket file descriptor]
+ *            odr_msg   *msgs   [messages: destination, port, flag,
+ *                               request id, data and len]
+ *            int       n       [number of messages, at most ODR_MSG_BATCH]
+ *  @return : int               [number of messages sent, -1 if failed]
+ *
+ *  Send the messages to ODR with one sendmmsg(), e.g. the replies to a
+ *  batch from msg_recv_batch() with their data replaced
+ * --------------------------------------------------------------------------
+ */
+int msg_send_batch(int sockfd, odr_msg *msgs, int n) {
+    int                 i, r, sent = 0;
+    struct sockaddr_un  odraddr;
+    struct mmsghdr      mmsg[ODR_MSG_BATCH];
+    struct iovec        iov[ODR_MSG_BATCH][2];
+
+    msg_shm_addr(&odraddr);
+    n = min(n, ODR_MSG_BATCH);
+    bzero(mmsg, sizeof(struct mmsghdr) * n);
+    for (i = 0; i < n; i++) {
+        iov[i][0].iov_base = &msgs[i].ipaddr;
+        iov[i][0].iov_len = sizeof(odr_dgram);
+        iov[i][1].iov_base = msgs[i].data;
+        iov[i][1].iov_len = msgs[i].len;
+        mmsg[i].msg_hdr.msg_name = &odraddr;
+        mmsg[i].msg_hdr.msg_namelen = sizeof(odraddr);
+        mmsg[i].msg_hdr.msg_iov = iov[i];
+        mmsg[i].msg_hdr.msg_iovlen = 2;
+    }
+    // sendmmsg stops at the first message the socket refuses
+    while (sent < n) {
+        if ((r = sendmmsg(sockfd, mmsg + sent, n - sent, 0)) <= 0)
+            return sent ? sent : -1;
+        sent += r;
+    }
+    return sent;
+}
+
+/* --------------------------------------------------------------------------
+ *  msg_req_init
+ *
+ *  Request table constructor
+ *
+ *  @param  : odr_reqs  *r          [request table]
+ *            uint      size        [requests kept in flight at most]
+ *            int       timeout     [ms before a request expires]
+ *  @return : void
+ *
+ *  The slots are rounded up to a power of 2
+ * --------------------------------------------------------------------------
+ */
+void msg_req_init(odr_reqs *r, uint size, int timeout) {
+    bzero(r, sizeof(odr_reqs));
+    for (r->size = 1; r->size < size; r->size <<= 1)
+        ;
+    r->slots = (odr_req *)Calloc(r->size, sizeof(odr_req));
+    r->next_id = r->oldest = 1;
+    r->timeout = timeout * 1000L;
+}
+
+/* --------------------------------------------------------------------------
+ *  msg_req_send
+ *
+ *  Send a request and keep it in flight
+ *
+ *  @param  : int       sockfd  [Socket file descriptor]
+ *            odr_reqs  *r      [request table]
+ *            char      *dst    [Destination IP address]
+ *            int       port    [Destination Port number]
+ *            char      *data   [Data payload]
+ *            int       flag    [Forced rediscovery flag]
+ *  @return : odr_req *         [the request, NULL if failed (errno is
+ *                               EAGAIN if the table is full)]
+ *  @see    : function#msg_send_req
+ *
+ *  Ids are given out in order, skipping 0 and ids whose slot is still in
+ *  use by an older request, so a slot is found in one pass and the ids
+ *  in flight are ordered by send time. The slot stays taken until
+ *  msg_req_done(); its index may key the caller's own per-request data
+ * --------------------------------------------------------------------------
+ */
+odr_req *msg_req_send(int sockfd, odr_reqs *r, char *dst, int port, char *data, int flag) {
+    in_addr_t       ipaddr;
+    odr_req         *req;
+    struct timespec now;
+
+    if (r->count == r->size) {
+        errno = EAGAIN;
+        return NULL;
+    }
+    if (inet_pton(AF_INET, dst, &ipaddr) != 1) {
+        errno = EINVAL;
+        return NULL;
+    }
+    while (r->next_id == 0 || r->slots[r->next_id & (r->size - 1)].req_id)
+        r->next_id++;
+
+    req = &r->slots[r->next_id & (r->size - 1)];
+    if (msg_send_req(sockfd, dst, port, data, flag, r->next_id) < 0)
+        return NULL;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    req->req_id = r->next_id++;
+    req->ipaddr = ipaddr;
+    req->port = port;
+    req->sent = now.tv_sec * 1000000L + now.tv_nsec / 1000;
+    r->count++;
+    return req;
+}
+
+/* --------------------------------------------------------------------------
+ *  msg_req_match
+ *
+ *  Request of a reply
+ *
+ *  @param  : odr_reqs  *r      [request table]
+ *            odr_msg   *msg    [reply, e.g. from msg_recv_batch()]
+ *  @return : odr_req *         [the request in flight, NULL if the reply
+ *                               is stray]
+ *
+ *  The reply must carry the id of the request and come from the node and
+ *  port it was sent to. The request stays in flight until msg_req_done()
+ * --------------------------------------------------------------------------
+ */
+odr_req *msg_req_match(odr_reqs *r, odr_msg *msg) {
+    odr_req *req = &r->slots[msg->req_id & (r->size - 1)];
+
+    if (msg->req_id == 0 || req->req_id != msg->req_id ||
+        req->ipaddr != msg->ipaddr || req->port != msg->port)
+        return NULL;
+    return req;
+}
+
+/* --------------------------------------------------------------------------
+ *  msg_req_expire
+ *
+ *  Oldest request past its timeout
+ *
+ *  @param  : odr_reqs  *r      [request table]
+ *            long      now     [current time, CLOCK_REALTIME us]
+ *  @return : odr_req *         [the request, NULL if none has expired]
+ *
+ *  Requests expire in the order of their ids, so only the oldest one in
+ *  flight is looked at; ids already done are passed over for good. The
+ *  request stays in flight until msg_req_done()
+ * --------------------------------------------------------------------------
+ */
+odr_req *msg_req_expire(odr_reqs *r, long now) {
+    odr_req *req;
+
+    for (; r->oldest != r->next_id; r->oldest++) {
+        req = &r->slots[r->oldest & (r->size - 1)];
+        if (r->oldest == 0 || req->req_id != r->oldest)
+            continue;
+        return (now - req->sent > r->timeout) ? req : NULL;
+    }
+    return NULL;
+}
+
+/* --------------------------------------------------------------------------
+ *  msg_req_done
+ *
+ *  Free the slot of a request
+ *
+ *  @param  : odr_reqs  *r      [request table]
+ *            odr_req   *req    [request answered or expired]
+ *  @return : void
+ *
+ *  A late reply to the request is stray from now on
+ * --------------------------------------------------------------------------
+ */
+void msg_req_done(odr_reqs *r, odr_req *req) {
+    if (req->req_id) {
+        req->req_id = 0;
+        r->count--;
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  msg_req_free
+ *
+ *  Request table destructor
+ *
+ *  @param  : odr_reqs  *r      [request table]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void msg_req_free(odr_reqs *r) {
+    free(r->slots);
+    bzero(r, sizeof(odr_reqs));
+}
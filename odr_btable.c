@@ -0,0 +1,255 @@
+/*
+* @File: odr_btable.c
+* @Date: 2026-10-17 20:13:30
+* @Last Modified time: 2026-10-17 21:34:23
+* @Description:
+*     Broadcast ID table, remembers the last broadcast id seen for a
+*     <source, destination> pair of RREQ. Open addressing with linear
+*     probing. The table grows up to ODR_BTABLE_MAXSIZE slots; entries older
+*     than the staleness are treated as absent and get reclaimed, so memory
+*     stays bounded however many nodes are on the network.
+*     - uint btable_slot(odr_btable *b, in_addr_t src, in_addr_t dst)
+*         [Home slot of a pair]
+*     - int btable_stale(odr_btable *b, odr_bid *bid, long t)
+*         [Stale entry test]
+*     - void btable_delete(odr_btable *b, uint i)
+*         [Delete entry at slot]
+*     - void btable_purge(odr_btable *b, long t)
+*         [Remove all stale entries]
+*     - void btable_resize(odr_btable *b, uint size)
+*         [Rehash into a table of given size]
+*     + void btable_init(odr_btable *b, ulong staleness)
+*         [Broadcast ID table constructor]
+*     + uint btable_get(odr_btable *b, in_addr_t src, in_addr_t dst)
+*         [Broadcast ID lookup]
+*     + void btable_set(odr_btable *b, in_addr_t src, in_addr_t dst, uint bcast_id)
+*         [Broadcast ID insert or update]
+*     + void btable_free(odr_btable *b)
+*         [Broadcast ID table destructor]
+*/
+
+#include "np.h"
+
+/* --------------------------------------------------------------------------
+ *  btable_slot
+ *
+ *  Home slot of a pair
+ *
+ *  @param  : odr_btable    *b      [broadcast id table]
+ *            in_addr_t     src     [RREQ source IP address]
+ *            in_addr_t     dst     [RREQ destination IP address]
+ *  @return : uint                  [slot number]
+ *  @see    : function#hash_slot
+ * --------------------------------------------------------------------------
+ */
+uint btable_slot(odr_btable *b, in_addr_t src, in_addr_t dst) {
+    return ((src * 2654435761u) ^ (dst * 40503u)) >> (__builtin_clz(b->size) + 1);
+}
+
+/* --------------------------------------------------------------------------
+ *  btable_stale
+ *
+ *  Stale entry test
+ *
+ *  @param  : odr_btable    *b      [broadcast id table]
+ *            odr_bid       *bid    [entry]
+ *            long          t       [current time]
+ *  @return : int                   [1 if stale]
+ * --------------------------------------------------------------------------
+ */
+int btable_stale(odr_btable *b, odr_bid *bid, long t) {
+    return bid->timestamp + (long)b->staleness < t;
+}
+
+/* --------------------------------------------------------------------------
+ *  btable_delete
+ *
+ *  Delete entry at slot
+ *
+ *  @param  : odr_btable    *b      [broadcast id table]
+ *            uint          i       [slot number]
+ *  @return : void
+ *
+ *  Backward-shift deletion, see hash_remove()
+ * --------------------------------------------------------------------------
+ */
+void btable_delete(odr_btable *b, uint i) {
+    uint j = i, k, mask = b->size - 1;
+
+    while (1) {
+        j = (j + 1) & mask;
+        if (b->slots[j].src == 0)
+            break;
+        k = btable_slot(b, b->slots[j].src, b->slots[j].dst);
+        if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+        b->slots[i] = b->slots[j];
+        i = j;
+    }
+    bzero(&b->slots[i], sizeof(odr_bid));
+    b->count--;
+}
+
+/* --------------------------------------------------------------------------
+ *  btable_purge
+ *
+ *  Remove all stale entries
+ *
+ *  @param  : odr_btable    *b      [broadcast id table]
+ *            long          t       [current time]
+ *  @return : void
+ *
+ *  Only called when the table is full, and at most once per second
+ * --------------------------------------------------------------------------
+ */
+void btable_purge(odr_btable *b, long t) {
+    uint i = 0;
+
+    b->purged = t;
+    while (i < b->size) {
+        // a deletion may shift the next entry into slot i, look again
+        if (b->slots[i].src != 0 && btable_stale(b, &b->slots[i], t))
+            btable_delete(b, i);
+        else
+            i++;
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  btable_resize
+ *
+ *  Rehash into a table of given size
+ *
+ *  @param  : odr_btable    *b      [broadcast id table]
+ *            uint          size    [new table size, power of 2]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void btable_resize(odr_btable *b, uint size) {
+    odr_bid *old = b->slots;
+    uint i, j, oldsize = b->size;
+
+    b->slots = (odr_bid *)Calloc(size, sizeof(odr_bid));
+    b->size = size;
+
+    for (i = 0; i < oldsize; i++) {
+        if (old[i].src == 0)
+            continue;
+        j = btable_slot(b, old[i].src, old[i].dst);
+        while (b->slots[j].src != 0)
+            j = (j + 1) & (size - 1);
+        b->slots[j] = old[i];
+    }
+    free(old);
+}
+
+/* --------------------------------------------------------------------------
+ *  btable_init
+ *
+ *  Broadcast ID table constructor
+ *
+ *  @param  : odr_btable    *b          [broadcast id table]
+ *            ulong         staleness   [entry lifetime in seconds]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void btable_init(odr_btable *b, ulong staleness) {
+    b->slots = (odr_bid *)Calloc(ODR_HASH_MINSIZE, sizeof(odr_bid));
+    b->size = ODR_HASH_MINSIZE;
+    b->count = 0;
+    b->staleness = staleness;
+}
+
+/* --------------------------------------------------------------------------
+ *  btable_get
+ *
+ *  Broadcast ID lookup
+ *
+ *  @param  : odr_btable    *b      [broadcast id table]
+ *            in_addr_t     src     [RREQ source IP address]
+ *            in_addr_t     dst     [RREQ destination IP address]
+ *  @return : uint                  [last broadcast id, 0 if never seen or
+ *                                   stale]
+ * --------------------------------------------------------------------------
+ */
+uint btable_get(odr_btable *b, in_addr_t src, in_addr_t dst) {
+    uint i = btable_slot(b, src, dst);
+
+    while (b->slots[i].src != 0) {
+        if (b->slots[i].src == src && b->slots[i].dst == dst)
+            return btable_stale(b, &b->slots[i], timer_time()) ? 0 : b->slots[i].bcast_id;
+        i = (i + 1) & (b->size - 1);
+    }
+    return 0;
+}
+
+/* --------------------------------------------------------------------------
+ *  btable_set
+ *
+ *  Broadcast ID insert or update
+ *
+ *  @param  : odr_btable    *b          [broadcast id table]
+ *            in_addr_t     src         [RREQ source IP address]
+ *            in_addr_t     dst         [RREQ destination IP address]
+ *            uint          bcast_id    [broadcast id]
+ *  @return : void
+ *
+ *  When the table is half full, grow it up to ODR_BTABLE_MAXSIZE. At the
+ *  maximum size, reclaim stale entries first; past 3/4 load the oldest
+ *  entry of the probe sequence is overwritten
+ * --------------------------------------------------------------------------
+ */
+void btable_set(odr_btable *b, in_addr_t src, in_addr_t dst, uint bcast_id) {
+    uint i, oldest;
+    long t = timer_time();
+
+    if (src == 0)
+        return;
+
+    if ((b->count + 1) * 2 > b->size) {
+        if (b->size < ODR_BTABLE_MAXSIZE)
+            btable_resize(b, b->size * 2);
+        else if (b->purged != t)
+            btable_purge(b, t);
+    }
+
+    i = btable_slot(b, src, dst);
+    oldest = i;
+    while (b->slots[i].src != 0) {
+        if (b->slots[i].src == src && b->slots[i].dst == dst)
+            break;
+        if (b->slots[i].timestamp < b->slots[oldest].timestamp)
+            oldest = i;
+        i = (i + 1) & (b->size - 1);
+    }
+
+    if (b->slots[i].src == 0) {
+        if ((b->count + 1) * 4 > b->size * 3 && oldest != i) {
+            // still full after purge, evict
+            i = oldest;
+        } else {
+            b->count++;
+        }
+    }
+
+    b->slots[i].src = src;
+    b->slots[i].dst = dst;
+    b->slots[i].bcast_id = bcast_id;
+    b->slots[i].timestamp = t;
+}
+
+/* --------------------------------------------------------------------------
+ *  btable_free
+ *
+ *  Broadcast ID table destructor
+ *
+ *  @param  : odr_btable    *b      [broadcast id table]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void btable_free(odr_btable *b) {
+    free(b->slots);
+    b->slots = NULL;
+    b->size = 0;
+    b->count = 0;
+}
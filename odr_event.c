@@ -0,0 +1,268 @@
+/*
+* @File: odr_event.c
+* @Date: 2026-10-17 20:18:20
+* @Last Modified time: 2026-10-17 21:57:32
+* @Description:
+*     ODR event loop, edge-triggered epoll over any number of descriptors
+*     plus a timerfd per timer wheel that fires when the wheel is due
+*     - void timer_event(odr_object *obj, odr_event *ev)
+*         [Timerfd handler]
+*     - void wakeup_event(odr_object *obj, odr_event *ev)
+*         [Wakeup eventfd handler]
+*     - void event_settime(odr_event *ev, long next, long *armed)
+*         [Arm one timerfd]
+*     - void event_arm_timer(odr_object *obj)
+*         [Arm the timerfds for the next timer expiry]
+*     + void event_init(odr_object *obj)
+*         [Event loop constructor]
+*     + void event_wakeup(odr_object *obj)
+*         [Wake the event loop from a worker]
+*     + void event_add(odr_object *obj, odr_event *ev, int fd, odr_event_fn handler)
+*         [Register a descriptor]
+*     + void event_del(odr_object *obj, odr_event *ev)
+*         [Unregister a descriptor]
+*     + void event_loop(odr_object *obj)
+*         [Event loop]
+*/
+
+#include "np.h"
+
+/* --------------------------------------------------------------------------
+ *  timer_event
+ *
+ *  Timerfd handler
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            odr_event     *ev     [timerfd event]
+ *  @return : void
+ *  @see    : function#purge_tables
+ *
+ *  Consume the expiration count and run the timer wheels
+ * --------------------------------------------------------------------------
+ */
+void timer_event(odr_object *obj, odr_event *ev) {
+    uint64_t expirations;
+
+    while (read(ev->fd, &expirations, sizeof(expirations)) > 0)
+        ;
+    if (ev == &obj->f_event)
+        obj->f_armed = 0;
+    else
+        obj->t_armed = 0;
+    purge_tables(obj);
+}
+
+/* --------------------------------------------------------------------------
+ *  wakeup_event
+ *
+ *  Wakeup eventfd handler
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            odr_event     *ev     [wakeup eventfd event]
+ *  @return : void
+ *  @see    : function#event_wakeup
+ *
+ *  Only consume the counter; the loop re-arms the timerfds after the round
+ * --------------------------------------------------------------------------
+ */
+void wakeup_event(odr_object *obj, odr_event *ev) {
+    uint64_t count;
+
+    while (read(ev->fd, &count, sizeof(count)) > 0)
+        ;
+}
+
+/* --------------------------------------------------------------------------
+ *  event_settime
+ *
+ *  Arm one timerfd
+ *
+ *  @param  : odr_event     *ev     [timerfd event]
+ *            long          next    [absolute time in milliseconds on the
+ *                                   clock of the timerfd, 0 disarms it]
+ *            long          *armed  [time the timerfd is armed for]
+ *  @return : void
+ *
+ *  The timerfd is only touched when the time changes
+ * --------------------------------------------------------------------------
+ */
+void event_settime(odr_event *ev, long next, long *armed) {
+    struct itimerspec its;
+
+    if (next == *armed)
+        return;
+
+    bzero(&its, sizeof(its));
+    its.it_value.tv_sec = next / 1000;
+    its.it_value.tv_nsec = (next % 1000) * 1000000L;
+    if (timerfd_settime(ev->fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+        err_sys("timerfd_settime error");
+    *armed = next;
+}
+
+/* --------------------------------------------------------------------------
+ *  event_arm_timer
+ *
+ *  Arm the timerfds for the next timer expiry
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *  @return : void
+ *  @see    : function#event_settime
+ *
+ *  Each wheel has its own timerfd on the clock it runs on: the table wheel
+ *  on CLOCK_REALTIME (timer_time()), the fast wheel on CLOCK_MONOTONIC
+ *  (timer_ticks()). Each is set to the absolute time (in milliseconds) its
+ *  wheel needs to run next. With forwarding workers the table wheel also
+ *  changes behind the loop's back, so the loop runs at least every second;
+ *  a worker that arms a fast timer wakes the loop with event_wakeup()
+ * --------------------------------------------------------------------------
+ */
+void event_arm_timer(odr_object *obj) {
+    long next, fast;
+
+    pthread_rwlock_rdlock(&obj->lock);
+    next = timer_next(&obj->wheel);
+    next = (next < 0) ? 0 : (obj->wheel.now + next) * 1000;
+    if (obj->nworkers && (next == 0 || next > (obj->wheel.now + 1) * 1000))
+        next = (obj->wheel.now + 1) * 1000;
+    fast = timer_next(&obj->fast);
+    fast = (fast < 0) ? 0 : (obj->fast.now + fast) * ODR_TICK_MS;
+    pthread_rwlock_unlock(&obj->lock);
+
+    event_settime(&obj->t_event, next, &obj->t_armed);
+    event_settime(&obj->f_event, fast, &obj->f_armed);
+}
+
+/* --------------------------------------------------------------------------
+ *  event_init
+ *
+ *  Event loop constructor
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *  @return : void
+ *
+ *  Create the epoll instance and register the timerfds of the table wheel
+ *  and of the fast wheel, and the eventfd the workers wake the loop with
+ * --------------------------------------------------------------------------
+ */
+void event_init(odr_object *obj) {
+    int tfd, efd;
+
+    if ((obj->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        err_sys("epoll_create1 error");
+
+    if ((tfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+        err_sys("timerfd_create error");
+    obj->t_armed = 0;
+    event_add(obj, &obj->t_event, tfd, timer_event);
+
+    if ((tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+        err_sys("timerfd_create error");
+    obj->f_armed = 0;
+    event_add(obj, &obj->f_event, tfd, timer_event);
+
+    if ((efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        err_sys("eventfd error");
+    event_add(obj, &obj->w_event, efd, wakeup_event);
+}
+
+/* --------------------------------------------------------------------------
+ *  event_wakeup
+ *
+ *  Wake the event loop from a worker
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *  @return : void
+ *  @see    : function#event_arm_timer
+ *
+ *  The timerfds are only armed by the loop, between two epoll_wait()
+ *  rounds. A worker that adds a timer the loop has not seen makes it run
+ *  a round, so event_arm_timer() picks the timer up
+ * --------------------------------------------------------------------------
+ */
+void event_wakeup(odr_object *obj) {
+    uint64_t one = 1;
+
+    if (write(obj->w_event.fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        log_warn("[event_wakeup] eventfd write error: %s", strerror(errno));
+}
+
+/* --------------------------------------------------------------------------
+ *  event_add
+ *
+ *  Register a descriptor
+ *
+ *  @param  : odr_object    *obj        [odr object]
+ *            odr_event     *ev         [event, must outlive registration]
+ *            int           fd          [descriptor]
+ *            odr_event_fn  handler     [read handler]
+ *  @return : void
+ *
+ *  The descriptor is switched to non-blocking mode and registered
+ *  edge-triggered, so the handler must read until EAGAIN
+ * --------------------------------------------------------------------------
+ */
+void event_add(odr_object *obj, odr_event *ev, int fd, odr_event_fn handler) {
+    struct epoll_event ee;
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    ev->fd = fd;
+    ev->handler = handler;
+
+    bzero(&ee, sizeof(ee));
+    ee.events = EPOLLIN | EPOLLET;
+    ee.data.ptr = ev;
+    if (epoll_ctl(obj->epfd, EPOLL_CTL_ADD, fd, &ee) < 0)
+        err_sys("epoll_ctl error");
+}
+
+/* --------------------------------------------------------------------------
+ *  event_del
+ *
+ *  Unregister a descriptor
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            odr_event     *ev     [event]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void event_del(odr_object *obj, odr_event *ev) {
+    epoll_ctl(obj->epfd, EPOLL_CTL_DEL, ev->fd, NULL);
+}
+
+/* --------------------------------------------------------------------------
+ *  event_loop
+ *
+ *  Event loop
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *  @return : void
+ *
+ *  Wait for events and call the handler of every ready descriptor. After
+ *  each round, send the frames the handlers queued and re-arm the timerfds
+ *  in case the handlers scheduled an earlier timer
+ * --------------------------------------------------------------------------
+ */
+void event_loop(odr_object *obj) {
+    int i, n;
+    odr_event *ev;
+    struct epoll_event events[ODR_EVENT_MAX];
+
+    while (!obj->quit) {
+        flush_frames(obj);
+        event_arm_timer(obj);
+
+        n = epoll_wait(obj->epfd, events, ODR_EVENT_MAX, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            err_sys("epoll_wait error");
+        }
+
+        for (i = 0; i < n; i++) {
+            ev = (odr_event *)events[i].data.ptr;
+            ev->handler(obj, ev);
+        }
+    }
+}
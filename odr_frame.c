@@ -7,6 +7,8 @@
 *     ODR frame functions, provides frame builder and frame send/recv function
 *     - void build_frame_header(odr_frame *frame, uchar *dst_mac, uchar *src_mac, ushort ftype)
 *         [Frame header builder]
+*     + void build_frame_template(odr_frame_hdr *hdr, uchar *dst_mac, uchar *src_mac)
+*         [Frame header template builder]
 *     + void build_frame(odr_frame *frame, uchar *dst_mac, uchar *src_mac, ushort ftype, void *data)
 *         [Frame builder]
 *     + void build_bcast_frame(odr_frame *frame, uchar *src_mac, ushort ftype, void *data)
@@ -15,6 +17,30 @@
 *         [Frame send function]
 *     + int recv_frame(int sockfd, odr_frame *frame, struct sockaddr *from, socklen_t *fromlen)
 *         [Frame receive function]
+*     + void batch_init(odr_batch *batch)
+*         [Frame batch constructor]
+*     + odr_frame *batch_slot(odr_batch *batch, int sockfd)
+*         [Next free frame of the batch]
+*     + int batch_send(odr_batch *batch, int sockfd, int if_index, odr_frame *frame, int len, uchar pkttype)
+*         [Queue a frame into the send batch]
+*     + void batch_flush(odr_batch *batch, int sockfd)
+*         [Send the batch]
+*     + int batch_recv(odr_batch *batch, int sockfd)
+*         [Receive a batch of frames]
+*     + void batch_report(odr_batch *batch, const char *name)
+*         [Print the batch size distribution]
+*     + int encode_rpacket(char *data, odr_rpacket *rpacket, int version)
+*         [Route packet encoder]
+*     + int encode_apacket(char *data, odr_apacket *apacket, int version)
+*         [Application packet encoder]
+*     + void decode_rpacket(odr_frame *frame, odr_rpacket *rpacket)
+*         [Route packet decoder]
+*     + void decode_apacket(odr_frame *frame, odr_apacket *apacket)
+*         [Application packet decoder]
+*     + int encode_fpacket(char *data, odr_apacket *apacket, int offset, int length, int version)
+*         [Application fragment encoder]
+*     + int decode_fpacket(odr_frame *frame, int len, odr_apacket *apacket)
+*         [Application fragment decoder]
 */
 
 #include "np.h"
@@ -42,6 +68,26 @@ void build_frame_header(odr_frame *frame, uchar *dst_mac, uchar *src_mac, ushort
     frame->h_type = ftype;
 }
 
+/* --------------------------------------------------------------------------
+ *  build_frame_template
+ *
+ *  Frame header template builder
+ *
+ *  @param  : odr_frame_hdr *hdr        [template]
+ *            uchar         *dst_mac    [Destination MAC address]
+ *            uchar         *src_mac    [Source MAC address]
+ *  @return : void
+ *
+ *  Build the header once for a destination; FRAME_HEADER() then stamps it
+ *  on a frame with one copy
+ * --------------------------------------------------------------------------
+ */
+void build_frame_template(odr_frame_hdr *hdr, uchar *dst_mac, uchar *src_mac) {
+    memcpy(hdr->h_dest, dst_mac, ETH_ALEN);
+    memcpy(hdr->h_source, src_mac, ETH_ALEN);
+    hdr->h_proto = htons(PROTOCOL_ID);
+}
+
 /* --------------------------------------------------------------------------
  *  build_frame
  *
@@ -96,7 +142,7 @@ void build_bcast_frame(odr_frame *frame, uchar *src_mac, ushort ftype, void *dat
  *  @return : int   [the number of bytes that are sent, -1 if failed]
  *
  *  Set the sockaddr_ll structure and send the frame through PF_PACKET
- *  socket
+ *  socket. The frame is ODR_FRAME_BASELEN bytes long
  * --------------------------------------------------------------------------
  */
 int send_frame(int sockfd, int if_index, odr_frame *frame, uchar pkttype) {
@@ -117,7 +163,7 @@ int send_frame(int sockfd, int if_index, odr_frame *frame, uchar pkttype) {
     socket_address.sll_addr[6]  = 0x00;
     socket_address.sll_addr[7]  = 0x00;
 
-    return sendto(sockfd, frame, sizeof(*frame), 0,
+    return sendto(sockfd, frame, ODR_FRAME_BASELEN, 0,
           (struct sockaddr*)&socket_address, sizeof(socket_address));
 }
 
@@ -138,3 +184,479 @@ int send_frame(int sockfd, int if_index, odr_frame *frame, uchar pkttype) {
 int recv_frame(int sockfd, odr_frame *frame, struct sockaddr *from, socklen_t *fromlen) {
     return recvfrom(sockfd, frame, sizeof(odr_frame), 0, from, fromlen);
 }
+
+/* --------------------------------------------------------------------------
+ *  batch_init
+ *
+ *  Frame batch constructor
+ *
+ *  @param  : odr_batch     *batch  [frame batch]
+ *  @return : void
+ *
+ *  Point every message of the batch at its frame and address slot once,
+ *  so sending and receiving only have to fill them
+ * --------------------------------------------------------------------------
+ */
+void batch_init(odr_batch *batch) {
+    int i;
+
+    bzero(batch, sizeof(odr_batch));
+    for (i = 0; i < ODR_BATCH_MAX; i++) {
+        batch->iov[i].iov_base = &batch->frames[i];
+        batch->iov[i].iov_len = sizeof(odr_frame);
+        batch->msgs[i].msg_hdr.msg_iov = &batch->iov[i];
+        batch->msgs[i].msg_hdr.msg_iovlen = 1;
+        batch->msgs[i].msg_hdr.msg_name = &batch->addrs[i];
+        batch->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_ll);
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  batch_slot
+ *
+ *  Next free frame of the batch
+ *
+ *  @param  : odr_batch     *batch      [frame batch]
+ *            int           sockfd      [socket file descriptor]
+ *  @return : odr_frame *               [frame buffer]
+ *
+ *  A frame built here is queued by batch_send() without a copy. A full
+ *  batch is sent first so that the buffer stays valid
+ * --------------------------------------------------------------------------
+ */
+odr_frame *batch_slot(odr_batch *batch, int sockfd) {
+    if (batch->count == ODR_BATCH_MAX)
+        batch_flush(batch, sockfd);
+    return &batch->frames[batch->count];
+}
+
+/* --------------------------------------------------------------------------
+ *  batch_send
+ *
+ *  Queue a frame into the send batch
+ *
+ *  @param  : odr_batch     *batch      [frame batch]
+ *            int           sockfd      [socket file descriptor]
+ *            int           if_index    [interface index]
+ *            odr_frame     *frame      [frame]
+ *            int           len         [frame length]
+ *            uchar         pkttype     [packet type]
+ *  @return : int   [the number of bytes queued]
+ *  @see    : function#send_frame
+ *
+ *  The frame goes out on the next batch_flush(), or right away if the
+ *  batch is full. A frame built in batch_slot() is not copied
+ * --------------------------------------------------------------------------
+ */
+int batch_send(odr_batch *batch, int sockfd, int if_index, odr_frame *frame, int len, uchar pkttype) {
+    struct sockaddr_ll *socket_address;
+
+    if (batch->count == ODR_BATCH_MAX)
+        batch_flush(batch, sockfd);
+
+    socket_address = &batch->addrs[batch->count];
+    bzero(socket_address, sizeof(struct sockaddr_ll));
+    socket_address->sll_family   = PF_PACKET;
+    socket_address->sll_protocol = htons(PROTOCOL_ID);
+    socket_address->sll_ifindex  = if_index;
+    socket_address->sll_hatype   = ARPHRD_ETHER;
+    socket_address->sll_pkttype  = pkttype;
+    socket_address->sll_halen    = ETH_ALEN;
+    memcpy(socket_address->sll_addr, frame->h_dest, ETH_ALEN);
+
+    if (frame != &batch->frames[batch->count])
+        memcpy(&batch->frames[batch->count], frame, len);
+    batch->iov[batch->count].iov_len = len;
+    batch->count++;
+    return len;
+}
+
+/* --------------------------------------------------------------------------
+ *  batch_flush
+ *
+ *  Send the batch
+ *
+ *  @param  : odr_batch     *batch  [frame batch]
+ *            int           sockfd  [socket file descriptor]
+ *  @return : void
+ *
+ *  One sendmmsg() for all queued frames, repeated only if the kernel takes
+ *  part of the batch. Frames the kernel refuses are dropped like a failed
+ *  sendto()
+ * --------------------------------------------------------------------------
+ */
+void batch_flush(odr_batch *batch, int sockfd) {
+    int n, sent = 0;
+
+    if (batch->count == 0)
+        return;
+
+    batch->hist[batch->count]++;
+    while (sent < batch->count) {
+        n = sendmmsg(sockfd, &batch->msgs[sent], batch->count - sent, 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            err_ret("[batch_flush] sendmmsg error, %d frames dropped", batch->count - sent);
+            break;
+        }
+        sent += n;
+    }
+    batch->count = 0;
+}
+
+/* --------------------------------------------------------------------------
+ *  batch_recv
+ *
+ *  Receive a batch of frames
+ *
+ *  @param  : odr_batch     *batch  [frame batch]
+ *            int           sockfd  [socket file descriptor]
+ *  @return : int   [the number of frames received, -1 if none is pending]
+ *
+ *  Drain up to ODR_BATCH_MAX frames with one recvmmsg(). A blocking socket
+ *  waits for the first frame only, a non-blocking one returns -1 with
+ *  EAGAIN if there is nothing to read. The frames and
+ *  sender information are left in batch->frames and batch->addrs, the
+ *  lengths in batch->msgs; frames shorter than ODR_FRAME_BASELEN are padded
+ *  with zeros
+ * --------------------------------------------------------------------------
+ */
+int batch_recv(odr_batch *batch, int sockfd) {
+    int i, n;
+
+    for (i = 0; i < ODR_BATCH_MAX; i++)
+        batch->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_ll);
+
+    n = recvmmsg(sockfd, batch->msgs, ODR_BATCH_MAX, MSG_WAITFORONE, NULL);
+    if (n <= 0)
+        return -1;
+
+    for (i = 0; i < n; i++)
+        if (batch->msgs[i].msg_len < ODR_FRAME_BASELEN)
+            bzero((char *)&batch->frames[i] + batch->msgs[i].msg_len,
+                  ODR_FRAME_BASELEN - batch->msgs[i].msg_len);
+
+    batch->hist[n]++;
+    batch->count = n;
+    return n;
+}
+
+/* --------------------------------------------------------------------------
+ *  batch_report
+ *
+ *  Print the batch size distribution
+ *
+ *  @param  : odr_batch     *batch  [frame batch]
+ *            const char    *name   [batch name]
+ *  @return : void
+ *
+ *  Print "size:count" for every batch size seen and the mean size. Nothing
+ *  is printed if no batch was made since the last report
+ * --------------------------------------------------------------------------
+ */
+void batch_report(odr_batch *batch, const char *name) {
+    int i;
+    ulong batches = 0, frames = 0;
+
+    for (i = 1; i <= ODR_BATCH_MAX; i++) {
+        batches += batch->hist[i];
+        frames += batch->hist[i] * i;
+    }
+    if (batches == batch->reported)
+        return;
+    batch->reported = batches;
+
+    printf("[ODR] %s batches: %lu, frames: %lu, mean %.2f, size:count", name, batches, frames, (double)frames / batches);
+    for (i = 1; i <= ODR_BATCH_MAX; i++)
+        if (batch->hist[i])
+            printf(" %d:%lu", i, batch->hist[i]);
+    printf("\n");
+}
+
+/* --------------------------------------------------------------------------
+ *  encode_rpacket
+ *
+ *  Route packet encoder
+ *
+ *  @param  : char          *data       [frame payload]
+ *            odr_rpacket   *rpacket    [route packet, host byte order]
+ *            int           version     [frame version]
+ *  @return : int   [frame type version bits]
+ *
+ *  Write the route packet into frame payload in wire format of the given
+ *  version. The caller or's the return value into the frame type. v2 and
+ *  v3 route packets are the same; both are marked v3 (and a v1 one gets
+ *  the rid flag) to tell the neighbor this node reads v3 APPMSGs
+ * --------------------------------------------------------------------------
+ */
+int encode_rpacket(char *data, odr_rpacket *rpacket, int version) {
+    odr_rpacket     *r2 = (odr_rpacket *)data;
+    odr_rpacket_v1  *r1 = (odr_rpacket_v1 *)data;
+
+    if (version >= ODR_VERSION_V2) {
+        bzero(r2, sizeof(odr_rpacket));
+        r2->dst         = rpacket->dst;
+        r2->src         = rpacket->src;
+        r2->flag        = rpacket->flag;
+        r2->flag.bin    = 1;
+        r2->flag.rid    = 1;
+        r2->hopcnt      = htons(rpacket->hopcnt);
+        r2->bcast_id    = htonl(rpacket->bcast_id);
+        r2->ttl         = rpacket->ttl;
+        return ODR_FRAME_V2 | ODR_FRAME_V3;
+    }
+
+    bzero(r1, ODR_FRAME_PAYLOAD);
+    inet_ntop(AF_INET, &rpacket->dst, r1->dst, IPADDR_BUFFSIZE);
+    inet_ntop(AF_INET, &rpacket->src, r1->src, IPADDR_BUFFSIZE);
+    r1->flag        = rpacket->flag;
+    r1->flag.bin    = 1;
+    r1->flag.rid    = 1;
+    r1->hopcnt      = rpacket->hopcnt;
+    r1->bcast_id    = rpacket->bcast_id;
+    return 0;
+}
+
+/* --------------------------------------------------------------------------
+ *  encode_apacket
+ *
+ *  Application packet encoder
+ *
+ *  @param  : char          *data       [frame payload]
+ *            odr_apacket   *apacket    [application packet, host order]
+ *            int           version     [frame version]
+ *  @return : int   [frame type version bits, -1 if data does not fit]
+ *
+ *  Write the application packet into frame payload in wire format of the
+ *  given version. Only v3 carries the request id; v1 frames also have less
+ *  room for data, a longer message can not be carried to a v1 neighbor.
+ *  The caller makes sure the data fits (ODR_APACKET_DATALEN), see
+ *  function#encode_fpacket for longer messages
+ * --------------------------------------------------------------------------
+ */
+int encode_apacket(char *data, odr_apacket *apacket, int version) {
+    odr_apacket_v3  *a3 = (odr_apacket_v3 *)data;
+    odr_apacket_v2  *a2 = (odr_apacket_v2 *)data;
+    odr_apacket_v1  *a1 = (odr_apacket_v1 *)data;
+
+    if (version == ODR_VERSION_V3) {
+        a3->dst         = apacket->dst;
+        a3->src         = apacket->src;
+        a3->dst_port    = htons(apacket->dst_port);
+        a3->src_port    = htons(apacket->src_port);
+        a3->hopcnt      = htons(apacket->hopcnt);
+        a3->frd         = apacket->frd;
+        a3->length      = htons(apacket->length);
+        a3->req_id      = htonl(apacket->req_id);
+        memcpy(a3->data, apacket->data, apacket->length);
+        bzero(a3->data + apacket->length, ODR_APACKET_V3_PAYLOAD - apacket->length);
+        return ODR_FRAME_V2 | ODR_FRAME_V3;
+    }
+
+    if (version == ODR_VERSION_V2) {
+        a2->dst         = apacket->dst;
+        a2->src         = apacket->src;
+        a2->dst_port    = htons(apacket->dst_port);
+        a2->src_port    = htons(apacket->src_port);
+        a2->hopcnt      = htons(apacket->hopcnt);
+        a2->frd         = apacket->frd;
+        a2->length      = htons(apacket->length);
+        memcpy(a2->data, apacket->data, apacket->length);
+        bzero(a2->data + apacket->length, ODR_APACKET_PAYLOAD - apacket->length);
+        return ODR_FRAME_V2;
+    }
+
+    if (apacket->length >= ODR_APACKET_V1_DATALEN)
+        return -1;
+
+    bzero(a1, ODR_FRAME_PAYLOAD);
+    inet_ntop(AF_INET, &apacket->dst, a1->dst, IPADDR_BUFFSIZE);
+    inet_ntop(AF_INET, &apacket->src, a1->src, IPADDR_BUFFSIZE);
+    a1->dst_port    = apacket->dst_port;
+    a1->src_port    = apacket->src_port;
+    a1->hopcnt      = apacket->hopcnt;
+    a1->frd         = apacket->frd;
+    a1->length      = apacket->length;
+    memcpy(a1->data, apacket->data, apacket->length);
+    return 0;
+}
+
+/* --------------------------------------------------------------------------
+ *  decode_rpacket
+ *
+ *  Route packet decoder
+ *
+ *  @param  : odr_frame     *frame      [received frame]
+ *            odr_rpacket   *rpacket    [route packet, host byte order]
+ *  @return : void
+ *
+ *  Read the route packet of either frame version
+ * --------------------------------------------------------------------------
+ */
+void decode_rpacket(odr_frame *frame, odr_rpacket *rpacket) {
+    odr_rpacket     *r2 = (odr_rpacket *)frame->data;
+    odr_rpacket_v1  *r1 = (odr_rpacket_v1 *)frame->data;
+
+    bzero(rpacket, sizeof(odr_rpacket));
+    if (frame->h_type & ODR_FRAME_V2) {
+        rpacket->dst        = r2->dst;
+        rpacket->src        = r2->src;
+        rpacket->flag       = r2->flag;
+        rpacket->hopcnt     = ntohs(r2->hopcnt);
+        rpacket->bcast_id   = ntohl(r2->bcast_id);
+        rpacket->ttl        = r2->ttl;
+    } else {
+        r1->dst[IPADDR_BUFFSIZE - 1] = 0;
+        r1->src[IPADDR_BUFFSIZE - 1] = 0;
+        rpacket->dst        = inet_addr(r1->dst);
+        rpacket->src        = inet_addr(r1->src);
+        rpacket->flag       = r1->flag;
+        rpacket->hopcnt     = r1->hopcnt;
+        rpacket->bcast_id   = r1->bcast_id;
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  decode_apacket
+ *
+ *  Application packet decoder
+ *
+ *  @param  : odr_frame     *frame      [received frame]
+ *            odr_apacket   *apacket    [application packet, host order]
+ *  @return : void
+ *
+ *  Read the application packet of any frame version. It is always a whole
+ *  message, and the data is null terminated; the request id is 0 unless
+ *  the frame is v3
+ * --------------------------------------------------------------------------
+ */
+void decode_apacket(odr_frame *frame, odr_apacket *apacket) {
+    odr_apacket_v3  *a3 = (odr_apacket_v3 *)frame->data;
+    odr_apacket_v2  *a2 = (odr_apacket_v2 *)frame->data;
+    odr_apacket_v1  *a1 = (odr_apacket_v1 *)frame->data;
+    uint            length;
+
+    bzero(apacket, offsetof(odr_apacket, data));
+    if (ODR_FRAME_VERSION(frame->h_type) == ODR_VERSION_V3) {
+        apacket->dst        = a3->dst;
+        apacket->src        = a3->src;
+        apacket->dst_port   = ntohs(a3->dst_port);
+        apacket->src_port   = ntohs(a3->src_port);
+        apacket->hopcnt     = ntohs(a3->hopcnt);
+        apacket->frd        = a3->frd;
+        apacket->req_id     = ntohl(a3->req_id);
+        length              = min(ntohs(a3->length), ODR_APACKET_V3_PAYLOAD - 1);
+        memcpy(apacket->data, a3->data, length);
+    } else if (frame->h_type & ODR_FRAME_V2) {
+        apacket->dst        = a2->dst;
+        apacket->src        = a2->src;
+        apacket->dst_port   = ntohs(a2->dst_port);
+        apacket->src_port   = ntohs(a2->src_port);
+        apacket->hopcnt     = ntohs(a2->hopcnt);
+        apacket->frd        = a2->frd;
+        length              = min(ntohs(a2->length), ODR_APACKET_PAYLOAD - 1);
+        memcpy(apacket->data, a2->data, length);
+    } else {
+        a1->dst[IPADDR_BUFFSIZE - 1] = 0;
+        a1->src[IPADDR_BUFFSIZE - 1] = 0;
+        apacket->dst        = inet_addr(a1->dst);
+        apacket->src        = inet_addr(a1->src);
+        apacket->dst_port   = a1->dst_port;
+        apacket->src_port   = a1->src_port;
+        apacket->hopcnt     = a1->hopcnt;
+        apacket->frd        = a1->frd;
+        length              = min((uint)a1->length, ODR_APACKET_V1_DATALEN - 1);
+        memcpy(apacket->data, a1->data, length);
+    }
+    apacket->data[length] = 0;
+    apacket->length = length;
+    apacket->total = length;
+}
+
+/* --------------------------------------------------------------------------
+ *  encode_fpacket
+ *
+ *  Application fragment encoder
+ *
+ *  @param  : char          *data       [frame payload]
+ *            odr_apacket   *apacket    [message or fragment, host order]
+ *            int           offset      [offset of the piece in apacket]
+ *            int           length      [length of the piece]
+ *            int           version     [frame version, v2 or v3]
+ *  @return : int   [frame type version bits]
+ *
+ *  Write a piece of the application packet as ODR_FRAME_APPFRAG payload.
+ *  The offset is relative to apacket, which may itself be a fragment; the
+ *  frame carries the offset in the whole message. The piece starts
+ *  ODR_FPACKET_HDRLEN(version) bytes into the payload; only v3 carries the
+ *  request id, which follows the fields the layouts share
+ * --------------------------------------------------------------------------
+ */
+int encode_fpacket(char *data, odr_apacket *apacket, int offset, int length, int version) {
+    odr_fpacket *f = (odr_fpacket *)data;
+
+    f->dst          = apacket->dst;
+    f->src          = apacket->src;
+    f->dst_port     = htons(apacket->dst_port);
+    f->src_port     = htons(apacket->src_port);
+    f->hopcnt       = htons(apacket->hopcnt);
+    f->frd          = apacket->frd;
+    f->length       = htons(length);
+    f->msg_id       = htons(apacket->msg_id);
+    f->offset       = htons(apacket->offset + offset);
+    f->total        = htons(apacket->total);
+    if (version == ODR_VERSION_V3) {
+        ((odr_fpacket_v3 *)data)->req_id = htonl(apacket->req_id);
+        memcpy(((odr_fpacket_v3 *)data)->data, apacket->data + offset, length);
+        return ODR_FRAME_V2 | ODR_FRAME_V3;
+    }
+    memcpy(f->data, apacket->data + offset, length);
+    return ODR_FRAME_V2;
+}
+
+/* --------------------------------------------------------------------------
+ *  decode_fpacket
+ *
+ *  Application fragment decoder
+ *
+ *  @param  : odr_frame     *frame      [received frame]
+ *            int           len         [received frame length]
+ *            odr_apacket   *apacket    [fragment, host order]
+ *  @return : int   [0 if succeed, -1 if the fragment is malformed]
+ *
+ *  The fragment must lie within the frame and within the message. No more
+ *  than ODR_FRAME_MAXLEN bytes of the frame are read, so apacket may be an
+ *  ODR_APACKET_FRAMESIZE buffer. The request id is 0 unless the frame is v3
+ * --------------------------------------------------------------------------
+ */
+int decode_fpacket(odr_frame *frame, int len, odr_apacket *apacket) {
+    odr_fpacket *f = (odr_fpacket *)frame->data;
+    int         version = ODR_FRAME_VERSION(frame->h_type);
+    int         hdrlen = ODR_FRAME_HDRLEN + ODR_FPACKET_HDRLEN(version);
+
+    if (len < hdrlen)
+        return -1;
+
+    bzero(apacket, offsetof(odr_apacket, data));
+    apacket->dst        = f->dst;
+    apacket->src        = f->src;
+    apacket->dst_port   = ntohs(f->dst_port);
+    apacket->src_port   = ntohs(f->src_port);
+    apacket->hopcnt     = ntohs(f->hopcnt);
+    apacket->frd        = f->frd;
+    apacket->length     = ntohs(f->length);
+    apacket->msg_id     = ntohs(f->msg_id);
+    apacket->offset     = ntohs(f->offset);
+    apacket->total      = ntohs(f->total);
+    if (version == ODR_VERSION_V3)
+        apacket->req_id = ntohl(((odr_fpacket_v3 *)f)->req_id);
+
+    if (hdrlen + apacket->length > min(len, ODR_FRAME_MAXLEN) ||
+        (uint)apacket->offset + apacket->length > apacket->total)
+        return -1;
+
+    memcpy(apacket->data, frame->data + hdrlen - ODR_FRAME_HDRLEN, apacket->length);
+    apacket->data[apacket->length] = 0;
+    return 0;
+}
@@ -4,58 +4,194 @@
 * @Last Modified time: 2015-11-22 22:17:03
 * @Description:
 *     ODR frame and queued packet handler
-*     - void send_rreq(odr_object *obj, char *dst, char *src, uint hopcnt, uint bcast_id, int frdflag, int resflag)
+*     - int send_fragments(odr_object *obj, odr_itable *interface, odr_ntable *neighbor, odr_apacket *apacket, int mtu)
+*         [APPMSG fragment send function]
+*     - int send_packet(odr_object *obj, odr_itable *interface, char *nexthop, ushort ftype, void *packet)
+*         [Packet send function]
+*     - void send_rreq(odr_object *obj, in_addr_t dst, in_addr_t src, uint hopcnt, uint bcast_id, int frdflag, int resflag, int ttl)
 *         [RREQ send function]
-*     - void send_rrep(odr_object *obj, char *dst, char *src, uint hopcnt, int frdflag)
+*     - void send_rrep(odr_object *obj, in_addr_t dst, in_addr_t src, uint hopcnt, uint bcast_id, int frdflag)
 *         [RREP send function]
 *     - int cmp_hwaddrs(char *addr1, char *addr2)
 *         [MAC address compare function]
-*     - void send_dgram(odr_object *obj, odr_apacket *appmsg)
+*     + void send_dgram(odr_object *obj, odr_apacket *appmsg)
 *         [Dgram APPMSG send function]
-*     - void InsertOrUpdateRoutingTable(odr_object *obj, odr_rtable *item, char *dst, char *nexthop, int index, uint hopcnt)
+*     - void InsertOrUpdateRoutingTable(odr_object *obj, odr_rtable *item, in_addr_t dst, char *nexthop, int index, uint hopcnt)
 *         [Insert or update routing table]
-*     + void queue_handler(odr_object *obj)
+*     - void queue_send_item(odr_object *obj, ushort type, void *packet, odr_rtable *route)
+*         [Queued packet send function]
+*     - void queue_remove_pending(odr_object *obj, odr_pending *pending)
+*         [Pending list destructor]
+*     - long queue_rto(odr_object *obj, int ttl, int retry)
+*         [Discovery ring timeout]
+*     - void queue_rtt_sample(odr_object *obj, odr_rpacket *rrep)
+*         [Discovery round trip estimator]
+*     - void queue_discover(odr_object *obj, odr_pending *pending, int frd, int ttl)
+*         [Start a route discovery ring]
+*     - void queue_ring_expire(odr_object *obj, odr_timer *timer)
+*         [Discovery ring timer callback]
+*     + void queue_push(odr_object *obj, ushort type, void *packet)
 *         [Queue handler]
+*     + void queue_flush(odr_object *obj, in_addr_t dst)
+*         [Pending list flush function]
+*     + void queue_expire(odr_object *obj, odr_timer *timer)
+*         [Pending list timer callback]
 *     + void frame_rreq_handler(odr_object *obj, odr_frame *frame, struct sockaddr_ll *from)
 *         [Frame RREQ handler]
 *     + void frame_rrep_handler(odr_object *obj, odr_frame *frame, struct sockaddr_ll *from)
 *         [Frame RREP handler]
-*     + void frame_appmsg_handler(odr_object *obj, odr_frame *frame, struct sockaddr_ll *from)
+*     - int decode_appmsg(odr_frame *frame, int len, odr_apacket *appmsg)
+*         [APPMSG/APPFRAG decoder]
+*     + void frame_appmsg_handler(odr_object *obj, odr_frame *frame, int len, struct sockaddr_ll *from)
 *         [Frame APPMSG handler]
-*     + void debug_route_handler(odr_object *obj)
-*         [Debug function to print route table]
-*     + void debug_interface_handler(odr_object *obj)
-*         [Debug function to print interface table]
+*     - int relay_frame(odr_object *obj, odr_itable *interface, odr_ntable *neighbor, odr_frame *frame, int len)
+*         [Received frame relay function]
+*     + int forward_appmsg(odr_object *obj, odr_frame *frame, int len, struct sockaddr_ll *from)
+*         [Transit APPMSG fast path]
 */
 
 #include "np.h"
 
+/* --------------------------------------------------------------------------
+ *  send_fragments
+ *
+ *  APPMSG fragment send function
+ *
+ *  @param  : odr_object    *obj        [odr object]
+ *            odr_itable    *interface  [outgoing interface]
+ *            odr_ntable    *neighbor   [next hop]
+ *            odr_apacket   *apacket    [message or fragment]
+ *            int           mtu         [MTU towards the next hop]
+ *  @return : int   [the number of bytes that are sent]
+ *
+ *  Cut the APPMSG into ODR_FRAME_APPFRAG frames as large as the MTU allows,
+ *  in the layout of the neighbor (v2 or v3). A fragment received from a
+ *  link with a larger MTU is cut again, the offsets stay relative to the
+ *  whole message
+ * --------------------------------------------------------------------------
+ */
+int send_fragments(odr_object *obj, odr_itable *interface, odr_ntable *neighbor, odr_apacket *apacket, int mtu) {
+    int         off, len, vbits, sent = 0;
+    int         hdrlen = ODR_FRAME_HDRLEN + ODR_FPACKET_HDRLEN(neighbor->version);
+    int         room = ETH_HLEN + mtu - hdrlen;
+    odr_frame   *frame;
+
+    off = 0;
+    do {
+        len = min(room, apacket->length - off);
+        frame = output_slot(obj);
+        vbits = encode_fpacket(frame->data, apacket, off, len, neighbor->version);
+        FRAME_HEADER(frame, &neighbor->hdr, ODR_FRAME_APPFRAG | vbits);
+        if (output_frame(obj, interface->if_index, frame, hdrlen + len, PACKET_OTHERHOST) > 0)
+            sent += len;
+        off += len;
+    } while (off < apacket->length);
+
+    return sent;
+}
+
+/* --------------------------------------------------------------------------
+ *  send_packet
+ *
+ *  Packet send function
+ *
+ *  @param  : odr_object    *obj        [odr object]
+ *            odr_itable    *interface  [outgoing interface]
+ *            char          *nexthop    [Next hop MAC address, NULL for
+ *                                       broadcast]
+ *            ushort        ftype       [frame type]
+ *            void          *packet     [odr_rpacket or odr_apacket]
+ *  @return : int   [the number of bytes that are sent, -1 if failed]
+ *
+ *  Encode the packet in the frame version the receiver understands, then
+ *  send it via the interface
+ *  - unicast: version learned from the next hop in ntable
+ *  - broadcast: v2 only if every known neighbor on the interface is v2
+ *  v2 route packets advertise the MTU of the interface. An APPMSG carries
+ *  the request id only to a v3 next hop. An APPMSG that does not fit a
+ *  ODR_FRAME_BASELEN frame of that version (or is a fragment) is sent as
+ *  fragments as large as the next hop MTU, or ODR_MTU_MIN for a v2 next hop
+ *  that has only sent v1 route packets; a v1 next hop drops it.
+ *  Frames are encoded straight into the output buffer, behind the header
+ *  template of the neighbor or of the interface broadcast
+ * --------------------------------------------------------------------------
+ */
+int send_packet(odr_object *obj, odr_itable *interface, char *nexthop, ushort ftype, void *packet) {
+    int         version, vbits, mtu = 0;
+    odr_frame   *frame;
+    odr_ntable  *neighbor = NULL;
+    odr_apacket *apacket = (odr_apacket *)packet;
+
+    if (nexthop) {
+        neighbor = get_item_ntable(nexthop, interface->if_index, obj);
+        version = neighbor ? neighbor->version : ODR_VERSION_V1;
+        if (neighbor && neighbor->mtu)
+            mtu = min(neighbor->mtu, interface->if_mtu);
+        else if (version >= ODR_VERSION_V2)
+            mtu = ODR_MTU_MIN;
+    } else {
+        version = get_version_itable(interface->if_index, obj);
+    }
+
+    if (ftype == ODR_FRAME_APPMSG) {
+        if (apacket->length != apacket->total || apacket->length >= ODR_APACKET_DATALEN(version)) {
+            if (mtu >= ODR_MTU_MIN)
+                return send_fragments(obj, interface, neighbor, apacket, mtu);
+            log_warn("[send_packet] APPMSG does not fit in frame and next hop is v1, dropped.");
+            return -1;
+        }
+        frame = output_slot(obj);
+        vbits = encode_apacket(frame->data, apacket, version);
+    } else {
+        frame = output_slot(obj);
+        vbits = encode_rpacket(frame->data, (odr_rpacket *)packet, version);
+        if (vbits & ODR_FRAME_V2)
+            ((odr_rpacket *)frame->data)->mtu = htons(interface->if_mtu);
+    }
+
+    if (vbits < 0) {
+        log_warn("[send_packet] APPMSG does not fit in v1 frame, dropped.");
+        return -1;
+    }
+
+    if (neighbor) {
+        FRAME_HEADER(frame, &neighbor->hdr, ftype | vbits);
+        return output_frame(obj, interface->if_index, frame, ODR_FRAME_BASELEN, PACKET_OTHERHOST);
+    } else if (nexthop) {
+        build_frame_header(frame, nexthop, interface->if_haddr, ftype | vbits);
+        return output_frame(obj, interface->if_index, frame, ODR_FRAME_BASELEN, PACKET_OTHERHOST);
+    }
+    FRAME_HEADER(frame, &interface->bcast_hdr, ftype | vbits);
+    return output_frame(obj, interface->if_index, frame, ODR_FRAME_BASELEN, PACKET_BROADCAST);
+}
+
 /* --------------------------------------------------------------------------
  *  send_rreq
  *
  *  RREQ send function
  *
  *  @param  : odr_object    *obj        [odr object]
- *            char          *dst        [Destionation IP address]
- *            char          *src        [Source IP address]
+ *            in_addr_t     dst         [Destionation IP address]
+ *            in_addr_t     src         [Source IP address]
  *            uint          hopcnt      [Hop count]
  *            uint          bcast_id    [Broadcast ID]
  *            int           frdflag     [Forced discovery flag]
  *            int           resflag     [Replay already sent flag]
+ *            int           ttl         [Hops the RREQ may still travel,
+ *                                       ODR_TTL_FLOOD for no limit]
  *  @return : void
  *
  *  Send RREQ via all interfaces
  * --------------------------------------------------------------------------
  */
-void send_rreq(odr_object *obj, char *dst, char *src, uint hopcnt, uint bcast_id, int frdflag, int resflag) {
-    odr_frame   frame;
+void send_rreq(odr_object *obj, in_addr_t dst, in_addr_t src, uint hopcnt, uint bcast_id, int frdflag, int resflag, int ttl) {
     odr_rpacket rreq;
     odr_itable  *itable;
     bzero(&rreq, sizeof(rreq));
 
     // fill the RREQ information
-    strcpy(rreq.dst, dst);
-    strcpy(rreq.src, src);
+    rreq.dst = dst;
+    rreq.src = src;
     rreq.flag.req = 1;
     rreq.flag.rep = 0;
     rreq.flag.frd = frdflag;
@@ -63,17 +199,14 @@ void send_rreq(odr_object *obj, char *dst, char *src, uint hopcnt, uint bcast_id
 
     rreq.hopcnt = hopcnt;
     rreq.bcast_id = bcast_id;
+    rreq.ttl = ttl;
 
-    printf("[send_rreq] RREQ (dst: %s src: %s frd: %d res: %d hopcnt: %d bcast_id: %d)\n", rreq.dst, rreq.src, rreq.flag.frd, rreq.flag.res, rreq.hopcnt, rreq.bcast_id);
-    printf("            broadcast via interface: ");
+    log_debug("[send_rreq] RREQ (dst: %I src: %I frd: %d res: %d hopcnt: %d bcast_id: %u ttl: %d)", rreq.dst, rreq.src, rreq.flag.frd, rreq.flag.res, rreq.hopcnt, rreq.bcast_id, rreq.ttl);
     // send the frame via all interfaces
     for (itable = obj->itable; itable != NULL; itable = itable->hwa_next) {
-        bzero(&frame, sizeof(frame));
-        build_bcast_frame(&frame, itable->if_haddr, ODR_FRAME_RREQ, &rreq);
-        send_frame(obj->p_sockfd, itable->if_index, &frame, PACKET_BROADCAST);
-        printf("%d ", itable->if_index);
+        send_packet(obj, itable, NULL, ODR_FRAME_RREQ, &rreq);
+        log_debug("[send_rreq] broadcast via interface %d", itable->if_index);
     }
-    printf("\n");
 }
 
 /* --------------------------------------------------------------------------
@@ -82,46 +215,40 @@ void send_rreq(odr_object *obj, char *dst, char *src, uint hopcnt, uint bcast_id
  *  RREP send function
  *
  *  @param  : odr_object    *obj        [odr object]
- *            char          *dst        [Destionation IP address]
- *            char          *src        [Source IP address]
+ *            in_addr_t     dst         [Destionation IP address]
+ *            in_addr_t     src         [Source IP address]
  *            uint          hopcnt      [Hop count]
+ *            uint          bcast_id    [Broadcast ID of the RREQ answered]
  *            int           frdflag     [Forced discovery flag]
  *  @return : void
  *
- *  Send RREP via route interface
+ *  Send RREP via route interface. The broadcast id is echoed so that the
+ *  source knows which of its RREQs got answered
  * --------------------------------------------------------------------------
  */
-void send_rrep(odr_object *obj, char *dst, char *src, uint hopcnt, int frdflag) {
-    int i;
-    odr_frame   frame;
+void send_rrep(odr_object *obj, in_addr_t dst, in_addr_t src, uint hopcnt, uint bcast_id, int frdflag) {
     odr_rpacket rrep;
     odr_itable  *itable;
     odr_rtable  *rtable;
     bzero(&rrep, sizeof(rrep));
 
     // fill the RREP information
-    strcpy(rrep.dst, dst);
-    strcpy(rrep.src, src);
+    rrep.dst = dst;
+    rrep.src = src;
     rrep.flag.req = 0;
     rrep.flag.rep = 1;
     rrep.flag.frd = frdflag;
     rrep.flag.res = 1;
 
     rrep.hopcnt = hopcnt;
-    rrep.bcast_id = 0;
+    rrep.bcast_id = bcast_id;
 
     rtable = get_item_rtable(src, obj);
     itable = get_item_itable(rtable->index, obj);
 
-    printf("[send_rrep] RREP (dst: %s src: %s frd: %d res: %d hopcnt: %d)\n", rrep.dst, rrep.src, rrep.flag.frd, rrep.flag.res, rrep.hopcnt);
     // send the frame via the interface
-    bzero(&frame, sizeof(frame));
-    build_frame(&frame, rtable->nexthop, itable->if_haddr, ODR_FRAME_RREP, &rrep);
-    send_frame(obj->p_sockfd, rtable->index, &frame, PACKET_OTHERHOST);
-    printf("            unicast via interface %d to ", rtable->index);
-    for (i = 0; i < 6; i++)
-        printf("%.2x%s", rtable->nexthop[i] & 0xff, (i < 5) ? ":" : "\n");
-
+    send_packet(obj, itable, rtable->nexthop, ODR_FRAME_RREP, &rrep);
+    log_debug("[send_rrep] RREP (dst: %I src: %I frd: %d res: %d hopcnt: %d) unicast via interface %d to %M", rrep.dst, rrep.src, rrep.flag.frd, rrep.flag.res, rrep.hopcnt, rtable->index, rtable->nexthop);
 }
 
 /* --------------------------------------------------------------------------
@@ -153,31 +280,71 @@ int cmp_hwaddrs(char *addr1, char *addr2) {
  *            odr_apacket   *appmsg     [APPMSG]
  *  @return : void
  *
- *  Send APPMSG to local domain path
+ *  Send APPMSG to local domain path. The data goes out of the APPMSG
+ *  directly, behind the datagram header. An application attached with
+ *  the shared-memory transport gets it through its receive ring. This is
+ *  the deliver function of the PF_PACKET transport. The domain socket is
+ *  non-blocking, so a client whose receive queue is full loses the
+ *  datagram; every APPMSG that is not delivered is counted
  * --------------------------------------------------------------------------
  */
 void send_dgram(odr_object *obj, odr_apacket *appmsg) {
     // APPMSG reach destination, send to domain socket
     int port = appmsg->dst_port;
     struct sockaddr_un addr;
-    odr_dgram   dgram;
+    struct iovec iov[2];
+    struct msghdr msg;
+    odr_dgram   dgram, *rec;
     odr_ptable  *pitem = get_item_ptable(port, obj);
 
     if (pitem == NULL) {
-        printf("[send_dgram] Error: Port number not available.\n");
+        log_warn("[send_dgram] Port number %d not available, dropped.", port);
+        ODR_STATS(obj)->deliver_dropped++;
         return;
     }
+
+    if (pitem->shm) {
+        // shared-memory transport: build the datagram in the ring
+        if ((rec = (odr_dgram *)shm_reserve(&pitem->shm->area->rx, sizeof(odr_dgram) + appmsg->length + 1)) == NULL) {
+            log_warn("[send_dgram] Shared-memory ring of port %d full, dropped.", port);
+            ODR_STATS(obj)->deliver_dropped++;
+            return;
+        }
+        rec->ipaddr = appmsg->src;
+        rec->port = appmsg->src_port;
+        rec->flag = appmsg->frd;
+        rec->req_id = appmsg->req_id;
+        memcpy(rec->data, appmsg->data, appmsg->length);
+        rec->data[appmsg->length] = 0;
+        if (shm_commit(&pitem->shm->area->rx, sizeof(odr_dgram) + appmsg->length + 1))
+            shm_ring_bell(pitem->shm->rx_bell);
+        return;
+    }
+
     bzero(&addr, sizeof(addr));
     addr.sun_family = AF_LOCAL;
     strcpy(addr.sun_path, pitem->path);
 
     bzero(&dgram, sizeof(dgram));
-    strcpy(dgram.ipaddr, appmsg->src);
+    dgram.ipaddr = appmsg->src;
     dgram.port = appmsg->src_port;
     dgram.flag = appmsg->frd;
-    strcpy(dgram.data, appmsg->data);
+    dgram.req_id = appmsg->req_id;
+
+    iov[0].iov_base = &dgram;
+    iov[0].iov_len = sizeof(dgram);
+    iov[1].iov_base = appmsg->data;
+    iov[1].iov_len = appmsg->length;
+    bzero(&msg, sizeof(msg));
+    msg.msg_name = &addr;
+    msg.msg_namelen = sizeof(addr);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
 
-    sendto(obj->d_sockfd, &dgram, sizeof(dgram), 0, (SA *)&addr, sizeof(addr));
+    if (sendmsg(obj->d_sockfd, &msg, 0) < 0) {
+        log_warn("[send_dgram] Send to port %d failed (%s), dropped.", port, strerror(errno));
+        ODR_STATS(obj)->deliver_dropped++;
+    }
 }
 
 /* --------------------------------------------------------------------------
@@ -187,134 +354,421 @@ void send_dgram(odr_object *obj, odr_apacket *appmsg) {
  *
  *  @param  : odr_object    *obj        [odr object]
  *            odr_rtable    *item       [route entry need to update/insert]
- *            char          *dst        [destination IP address]
+ *            in_addr_t     dst         [destination IP address]
  *            char          *nexthop    [next hop MAC address]
  *            int           index       [interface index]
  *            uint          hopcnt      [hop count]
  *  @return : void
  *
  *  Insert or update routing table
+ *  A new route is also added to the rtable hash index (obj->rindex) and
+ *  gets its staleness timer
+ *  Then flush the packets pending for the destination
  * --------------------------------------------------------------------------
  */
-void InsertOrUpdateRoutingTable(odr_object *obj, odr_rtable *item, char *dst, char *nexthop, int index, uint hopcnt) {
-    int i;
+void InsertOrUpdateRoutingTable(odr_object *obj, odr_rtable *item, in_addr_t dst, char *nexthop, int index, uint hopcnt) {
+    int changed = item == NULL || item->index != index || item->hopcnt != hopcnt
+                  || memcmp(item->nexthop, nexthop, HWADDR_BUFFSIZE) != 0;
+
     if (item == NULL)
     {
         // insert a new route
         item = (odr_rtable *)Calloc(1, sizeof(odr_rtable));
+        item->prev = NULL;
         item->next = obj->rtable;
+        if (obj->rtable)
+            obj->rtable->prev = item;
         obj->rtable = item;
+        item->dst = dst;
+        hash_insert(&obj->rindex, item->dst, item);
+        timer_add(&obj->wheel, &item->timer, timer_time() + obj->staleness + 1, rtable_expire);
     }
 
     // modify the route
-    memcpy(item->dst, dst, IPADDR_BUFFSIZE);
     memcpy(item->nexthop, nexthop, HWADDR_BUFFSIZE);
     item->index = index;
     item->hopcnt = hopcnt;
-    item->timestamp = time(NULL);
+    item->timestamp = timer_time();
 
-    printf("[Route Table] dst: %s, nexthop: ", item->dst);
-    for (i = 0; i < 6; i++)
-        printf("%.2x%s", item->nexthop[i] & 0xff, (i == 5 ? ", ": ":"));
-    printf("index: %d, hopcnt: %d\n", item->index, item->hopcnt);
+    // a refresh of the same path is only worth a debug record
+    odr_log(changed ? ODR_LOG_INFO : ODR_LOG_DEBUG, "[Route Table] dst: %I, nexthop: %M, index: %d, hopcnt: %d", item->dst, item->nexthop, item->index, item->hopcnt);
+
+    // the destination may have packets waiting for this route
+    queue_flush(obj, item->dst);
 }
 
 /* --------------------------------------------------------------------------
- *  queue_handler
+ *  queue_send_item
  *
- *  Queue handler
+ *  Queued packet send function
+ *
+ *  @param  : odr_object        *obj    [odr object]
+ *            ushort            type    [ODR_FRAME_APPMSG or ODR_FRAME_RREP]
+ *            void              *packet [APPMSG/RREP]
+ *            odr_rtable        *route  [route to the pending destination]
+ *  @return : void
+ *
+ *  Send the APPMSG/RREP via the routing interface
+ * --------------------------------------------------------------------------
+ */
+void queue_send_item(odr_object *obj, ushort type, void *packet, odr_rtable *route) {
+    odr_itable *interface = get_item_itable(route->index, obj);
+
+    log_debug("[queue_handler] Send %s via interface %d to %M", (type == ODR_FRAME_APPMSG) ? "APPMSG" : "RREP", route->index, route->nexthop);
+    send_packet(obj, interface, route->nexthop, type, packet);
+}
+
+/* --------------------------------------------------------------------------
+ *  queue_remove_pending
+ *
+ *  Pending list destructor
+ *
+ *  @param  : odr_object    *obj        [odr object]
+ *            odr_pending   *pending    [pending list of a destination]
+ *  @return : void
+ *
+ *  Unlink the pending list from the queue and free it with its items
+ * --------------------------------------------------------------------------
+ */
+void queue_remove_pending(odr_object *obj, odr_pending *pending) {
+    odr_queue_item *item, *next;
+
+    for (item = pending->head; item != NULL; item = next) {
+        next = item->next;
+        free(item);
+        obj->queue.count--;
+    }
+
+    hash_remove(&obj->queue.index, pending->dst);
+    timer_del(&obj->wheel, &pending->timer);
+    timer_del(&obj->fast, &pending->rreq_timer);
+    if (pending->prev)
+        pending->prev->next = pending->next;
+    else
+        obj->queue.head = pending->next;
+    if (pending->next)
+        pending->next->prev = pending->prev;
+    free(pending);
+}
+
+/* --------------------------------------------------------------------------
+ *  queue_rto
+ *
+ *  Discovery ring timeout
  *
  *  @param  : odr_object    *obj    [odr object]
+ *            int           ttl     [ring radius, ODR_TTL_FLOOD for the
+ *                                   whole network]
+ *            int           retry   [times the flood was sent again]
+ *  @return : long                  [timeout in milliseconds]
+ *
+ *  (radius + ODR_TIMEOUT_BUFFER) per-hop round trips, with the per-hop
+ *  round trip taken as srtt + 4 * rttvar (2 * ODR_NODE_TRAVERSAL until
+ *  measured), doubled for every retry
+ * --------------------------------------------------------------------------
+ */
+long queue_rto(odr_object *obj, int ttl, int retry) {
+    long hop_usec, rto;
+
+    hop_usec = obj->rtt_hop ? obj->rtt_hop + 4 * obj->rtt_var : 2000L * ODR_NODE_TRAVERSAL;
+    if (ttl == ODR_TTL_FLOOD)
+        ttl = ODR_NET_DIAMETER;
+    rto = (hop_usec * (ttl + ODR_TIMEOUT_BUFFER) / 1000) << retry;
+    return min(max(rto, ODR_RREQ_MIN_RTO), ODR_RREQ_MAX_RTO);
+}
+
+/* --------------------------------------------------------------------------
+ *  queue_rtt_sample
+ *
+ *  Discovery round trip estimator
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            odr_rpacket   *rrep   [RREP that reached this node, the source]
  *  @return : void
  *
- *  For the APPMSG/RREP in queue, find the destination routing path in rtable
- *  - If the destination is currently unreachable, send RREQ
- *  - If the forced discovery flag is set, send RREQ with flag.frd
- *  - Otherwise, send the frame via routing interface
+ *  Only a RREP that echoes the broadcast id of the latest RREQ is a valid
+ *  sample (an answer to an earlier ring, or from a node that does not echo
+ *  the id, is ambiguous). The round trip is divided by the hop count and
+ *  smoothed as in TCP: srtt += (rtt - srtt) / 8, rttvar += (|rtt - srtt| -
+ *  rttvar) / 4
  * --------------------------------------------------------------------------
  */
-void queue_handler(odr_object *obj) {
-    int i, freeflag = 0;
-    odr_rtable *route;
-    odr_itable *interface;
-    odr_rpacket *rpacket;
-    odr_apacket *apacket;
-    odr_frame frame;
-
-    // return if the queue is empty
-    if (obj->queue.head == NULL)
+void queue_rtt_sample(odr_object *obj, odr_rpacket *rrep) {
+    odr_pending *pending;
+    long        rtt, delta;
+
+    pending = (odr_pending *)hash_find(&obj->queue.index, rrep->dst);
+    if (pending == NULL || pending->bcast_id == 0 || rrep->bcast_id != pending->bcast_id)
         return;
 
-    if (obj->queue.head->timestamp + QUEUE_TIMEOUT <= time(NULL)) {
-        // queue timeout, fail and remove
-        freeflag = 1;
-    } else if (obj->queue.head->type == ODR_FRAME_APPMSG) {
-        apacket = (odr_apacket *)obj->queue.head->data;
-        printf("[queue_handler] Processing APPMSG (dst: %s:%d src: %s:%d hopcnt: %d frd: %d data[%d]: %s)\n", apacket->dst, apacket->dst_port, apacket->src, apacket->src_port, apacket->hopcnt, apacket->frd, apacket->length, apacket->data);
-        route = get_item_rtable(apacket->dst, obj);
+    rtt = (timer_usec() - pending->rreq_usec) / (rrep->hopcnt + 1);
+    if (obj->rtt_hop == 0) {
+        obj->rtt_hop = max(rtt, 1);
+        obj->rtt_var = rtt / 2;
+    } else {
+        delta = rtt - obj->rtt_hop;
+        obj->rtt_hop += delta / 8;
+        obj->rtt_var += (labs(delta) - obj->rtt_var) / 4;
+    }
+    log_debug("[queue_handler] Discovery round trip %ld us/hop (srtt %ld rttvar %ld).", rtt, obj->rtt_hop, obj->rtt_var);
+}
 
-        if (strcmp(obj->ipaddr, apacket->dst) == 0) {
-            // APPMSG reach destination
-            printf("[queue_handler] APPMSG reach destination, send to domain socket.\n");
-            send_dgram(obj, apacket);
-            freeflag = 1;
-        } else if (route == NULL || apacket->frd == 1) {
-            // destination is currently unreachable, send RREQ
-            // or forced discovery, send rreq with flag.frd = 1
-            printf("[queue_handler] Destination is currently unreachable, send RREQ.\n");
-            send_rreq(obj, apacket->dst, obj->ipaddr, 0, ++obj->bcast_id, apacket->frd, 0);
-        } else {
-            // found entry in rtable, send apacket via interface
-            interface = get_item_itable(route->index, obj);
-
-            printf("[queue_handler] Send APPMSG via interface %d to ", route->index);
-            for (i = 0; i < 6; i++)
-                printf("%.2x%s", route->nexthop[i] & 0xff, (i < 5) ? ":" : "\n");
-            bzero(&frame, sizeof(frame));
-            build_frame(&frame, route->nexthop, interface->if_haddr, ODR_FRAME_APPMSG, apacket);
-            send_frame(obj->p_sockfd, route->index, &frame, PACKET_OTHERHOST);
-
-            freeflag = 1;
-        }
-    } else if (obj->queue.head->type == ODR_FRAME_RREP) {
-        rpacket = (odr_rpacket *)obj->queue.head->data;
-        printf("[queue_handler] Processing RREP (dst: %s src: %s hopcnt: %d)\n", rpacket->dst, rpacket->src, rpacket->hopcnt);
-        route = get_item_rtable(rpacket->src, obj);
-
-        if (route == NULL) {
-            printf("[queue_handler] Source is currently unreachable, send RREQ.\n");
-            send_rreq(obj, rpacket->src, obj->ipaddr, 0, ++obj->bcast_id, 0, 0);
-        } else {
-            interface = get_item_itable(route->index, obj);
-
-            printf("[queue_handler] Send RREP via interface %d to ", route->index);
-            for (i = 0; i < 6; i++)
-                printf("%.2x%s", route->nexthop[i] & 0xff, (i < 5) ? ":" : "\n");
-            bzero(&frame, sizeof(frame));
-            build_frame(&frame, route->nexthop, interface->if_haddr, ODR_FRAME_RREP, rpacket);
-            send_frame(obj->p_sockfd, route->index, &frame, PACKET_OTHERHOST);
-
-            freeflag = 1;
+/* --------------------------------------------------------------------------
+ *  queue_discover
+ *
+ *  Start a route discovery ring
+ *
+ *  @param  : odr_object    *obj        [odr object]
+ *            odr_pending   *pending    [pending list of the destination]
+ *            int           frd         [forced discovery flag]
+ *            int           ttl         [ring radius, ODR_TTL_FLOOD for the
+ *                                       whole network]
+ *  @return : void
+ *
+ *  Send a RREQ with a new broadcast id, so that every ring is processed
+ *  again by the nodes the previous one reached, and arm the ring timeout
+ *  (queue_rto()) on the fast wheel; a worker wakes the event loop so the
+ *  fast timerfd is armed for it. pending->retry counts the floods sent
+ *  again and must be set by the caller
+ * --------------------------------------------------------------------------
+ */
+void queue_discover(odr_object *obj, odr_pending *pending, int frd, int ttl) {
+    pending->bcast_id = ++obj->bcast_id;
+    pending->rreq_time = timer_time();
+    pending->rreq_usec = timer_usec();
+    pending->frd = frd;
+    pending->ttl = ttl;
+    send_rreq(obj, pending->dst, obj->addr, 0, pending->bcast_id, frd, 0, ttl);
+
+    timer_add(&obj->fast, &pending->rreq_timer,
+              timer_ticks() + queue_rto(obj, ttl, pending->retry) / ODR_TICK_MS, queue_ring_expire);
+    if (odr_io)
+        event_wakeup(obj);
+}
+
+/* --------------------------------------------------------------------------
+ *  queue_ring_expire
+ *
+ *  Discovery ring timer callback
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            odr_timer     *timer  [ring timer of the pending list]
+ *  @return : void
+ *
+ *  No RREP came back from the ring: double the radius, or flood the
+ *  network once the radius would pass ODR_TTL_THRESHOLD. A flood without
+ *  answer is sent again with a doubled timeout, at most ODR_RREQ_RETRIES
+ *  times; then discovery stops and the next packet to the destination
+ *  starts a new one. Queued packets wait for QUEUE_TIMEOUT, or until
+ *  discovery gives up if it takes longer
+ * --------------------------------------------------------------------------
+ */
+void queue_ring_expire(odr_object *obj, odr_timer *timer) {
+    odr_pending *pending = TIMER_ENTRY(timer, odr_pending, rreq_timer);
+    int         ttl = pending->ttl * 2;
+
+    if (pending->ttl == ODR_TTL_FLOOD) {
+        if (pending->retry >= ODR_RREQ_RETRIES) {
+            log_warn("[queue_handler] No RREP for %I after %d retries, give up.", pending->dst, pending->retry);
+            pending->bcast_id = 0;
+            pending->disc_usec = 0;
+            // drop what queue_expire() kept while discovery was running
+            timer_del(&obj->wheel, &pending->timer);
+            queue_expire(obj, &pending->timer);
+            return;
         }
+        pending->retry++;
+        log_info("[queue_handler] No RREP for %I, send RREQ again (retry %d).", pending->dst, pending->retry);
+        queue_discover(obj, pending, pending->frd, ODR_TTL_FLOOD);
+        return;
     }
 
-    if (freeflag) {
-        // free the head of queue
-        if (obj->queue.head == obj->queue.tail) {
-            free(obj->queue.head);
-            obj->queue.head = NULL;
-            obj->queue.tail = NULL;
-        } else {
-            odr_queue_item *next = obj->queue.head->next;
-            free(obj->queue.head);
-            obj->queue.head = next;
+    if (ttl > ODR_TTL_THRESHOLD)
+        ttl = ODR_TTL_FLOOD;
+    log_info("[queue_handler] No RREP for %I within %d hops, expand ring to %d.", pending->dst, pending->ttl, ttl);
+    queue_discover(obj, pending, pending->frd, ttl);
+}
+
+/* --------------------------------------------------------------------------
+ *  queue_push
+ *
+ *  Queue handler
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            ushort        type    [ODR_FRAME_APPMSG or ODR_FRAME_RREP]
+ *            void          *packet [odr_apacket or odr_rpacket]
+ *  @return : void
+ *
+ *  Hand an APPMSG/RREP to the queue. The pending destination is the APPMSG
+ *  destination, or the RREP source (RREP travels back to the source)
+ *  - If the APPMSG reaches destination, send to domain socket
+ *  - If there is a route and nothing is pending for the destination, send
+ *    the frame via routing interface right away
+ *  - Otherwise append to the pending list of the destination. If the
+ *    destination is currently unreachable, send RREQ; if the forced
+ *    discovery flag is set, send RREQ with flag.frd
+ *  Pending lists are independent, a destination waiting for a route never
+ *  delays traffic to other destinations. Discovery is coalesced: while a
+ *  RREQ for the destination is in flight (younger than QUEUE_TIMEOUT, and
+ *  forced if this packet asks for forced discovery), the packet just waits
+ *  for its RREP together with the others. Discovery is an expanding ring
+ *  search, see queue_discover()
+ * --------------------------------------------------------------------------
+ */
+void queue_push(odr_object *obj, ushort type, void *packet) {
+    int             frd = 0, size;
+    in_addr_t       dst;
+    odr_rtable      *route;
+    odr_pending     *pending;
+    odr_queue_item  *item;
+    odr_apacket     *apacket;
+    odr_rpacket     *rpacket;
+
+    if (type == ODR_FRAME_APPMSG) {
+        apacket = (odr_apacket *)packet;
+        log_debug("[queue_handler] Processing APPMSG (dst: %I:%d src: %I:%d hopcnt: %d frd: %d data[%d]: %s)", apacket->dst, apacket->dst_port, apacket->src, apacket->src_port, apacket->hopcnt, apacket->frd, apacket->length, apacket->data);
+        if (obj->addr == apacket->dst) {
+            // APPMSG reach destination
+            log_debug("[queue_handler] APPMSG reach destination, send to domain socket.");
+            obj->tp->deliver(obj, apacket);
+            return;
         }
+        dst = apacket->dst;
+        frd = apacket->frd;
+    } else {
+        rpacket = (odr_rpacket *)packet;
+        log_debug("[queue_handler] Processing RREP (dst: %I src: %I hopcnt: %d)", rpacket->dst, rpacket->src, rpacket->hopcnt);
+        dst = rpacket->src;
+    }
 
-        // if there is at least one apacket still in queue, try to handle it
+    route = get_item_rtable(dst, obj);
+    pending = (odr_pending *)hash_find(&obj->queue.index, dst);
+
+    if (route != NULL && pending == NULL && frd == 0) {
+        // found entry in rtable, send via interface
+        queue_send_item(obj, type, packet, route);
+        return;
+    }
+
+    // only a packet that has to wait is copied
+    size = (type == ODR_FRAME_APPMSG) ? ODR_APACKET_SIZE(apacket) : sizeof(odr_rpacket);
+    item = (odr_queue_item *)Calloc(1, sizeof(odr_queue_item) + size);
+    item->type = type;
+    item->timestamp = timer_time();
+    item->next = NULL;
+    memcpy(item->data, packet, size);
+
+    if (pending == NULL) {
+        pending = (odr_pending *)Calloc(1, sizeof(odr_pending));
+        pending->dst = dst;
+        pending->prev = NULL;
+        pending->next = obj->queue.head;
         if (obj->queue.head)
-            queue_handler(obj);
+            obj->queue.head->prev = pending;
+        obj->queue.head = pending;
+        hash_insert(&obj->queue.index, dst, pending);
+        timer_add(&obj->wheel, &pending->timer, item->timestamp + QUEUE_TIMEOUT, queue_expire);
+    }
+    if (pending->tail)
+        pending->tail->next = item;
+    else
+        pending->head = item;
+    pending->tail = item;
+    obj->queue.count++;
+
+    if (route == NULL || frd == 1) {
+        if (pending->bcast_id && pending->rreq_time + QUEUE_TIMEOUT > item->timestamp && pending->frd >= frd) {
+            // RREQ already in flight, wait for the same RREP
+            log_debug("[queue_handler] Route discovery to %I in flight, wait for its RREP.", dst);
+            return;
+        }
+        // destination is currently unreachable, send RREQ
+        // or forced discovery, send rreq with flag.frd = 1
+        log_info("[queue_handler] Destination %I is currently unreachable, send RREQ.", dst);
+        if (pending->disc_usec == 0) {
+            pending->disc_usec = timer_usec();
+            ODR_STATS(obj)->disc_started++;
+        }
+        pending->retry = 0;
+        queue_discover(obj, pending, frd, ODR_TTL_START);
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  queue_flush
+ *
+ *  Pending list flush function
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            in_addr_t     dst     [destination that got a route]
+ *  @return : void
+ *
+ *  Called when a route to dst is installed or confirmed. Send every
+ *  APPMSG/RREP pending for dst in order; other destinations are untouched
+ * --------------------------------------------------------------------------
+ */
+void queue_flush(odr_object *obj, in_addr_t dst) {
+    odr_rtable      *route;
+    odr_pending     *pending;
+    odr_queue_item  *item;
+
+    pending = (odr_pending *)hash_find(&obj->queue.index, dst);
+    if (pending == NULL)
+        return;
+    route = get_item_rtable(dst, obj);
+    if (route == NULL)
+        return;
+
+    if (pending->disc_usec) {
+        ODR_STATS(obj)->disc_completed++;
+        hist_add(&ODR_STATS(obj)->disc_latency, timer_usec() - pending->disc_usec);
+    }
+    for (item = pending->head; item != NULL; item = item->next)
+        queue_send_item(obj, item->type, item->data, route);
+    queue_remove_pending(obj, pending);
+}
+
+/* --------------------------------------------------------------------------
+ *  queue_expire
+ *
+ *  Pending list timer callback
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            odr_timer     *timer  [timer of the pending list]
+ *  @return : void
+ *
+ *  Remove the APPMSG/RREP that have been waiting longer than QUEUE_TIMEOUT.
+ *  Items of a pending list are in arrival order, so the timer is always
+ *  set for the head item. While a discovery ring or flood retry of the
+ *  destination is still armed (slow measured round trips), nothing is
+ *  removed: the items wait for its RREP, and queue_ring_expire() calls
+ *  here again when it gives up
+ * --------------------------------------------------------------------------
+ */
+void queue_expire(odr_object *obj, odr_timer *timer) {
+    odr_pending     *pending = TIMER_ENTRY(timer, odr_pending, timer);
+    odr_queue_item  *item;
+
+    if (pending->rreq_timer.pprev) {
+        timer_add(&obj->wheel, timer, obj->wheel.now + 1, queue_expire);
+        return;
+    }
+
+    while ((item = pending->head) != NULL && item->timestamp + QUEUE_TIMEOUT <= obj->wheel.now) {
+        // queue timeout, fail and remove
+        log_warn("[queue_handler] Timeout on %s to %I, dropped.", (item->type == ODR_FRAME_APPMSG) ? "APPMSG" : "RREP", pending->dst);
+        pending->head = item->next;
+        free(item);
+        obj->queue.count--;
+        ODR_STATS(obj)->queue_timeouts++;
     }
 
+    if (pending->head == NULL) {
+        pending->tail = NULL;
+        queue_remove_pending(obj, pending);
+    } else {
+        timer_add(&obj->wheel, timer, pending->head->timestamp + QUEUE_TIMEOUT, queue_expire);
+    }
 }
 
 /* --------------------------------------------------------------------------
@@ -336,35 +790,32 @@ void frame_rreq_handler(odr_object *obj, odr_frame *frame, struct sockaddr_ll *f
     uchar       newsflag = 0;           // new S flag
     uchar       newrreqflag = 0;        // new RREQ flag
     uchar       newhopflag = 0;         // new path having smaller hopcnt flag
-    int         s, d, i;                // node number of src and dst
-    odr_rpacket *rreq;
+    odr_rpacket rpacket, *rreq = &rpacket;
     odr_rtable  *src_ritem, *dst_ritem;
 
     // get rpacket in frame
-    rreq = (odr_rpacket *)frame->data;
-    printf("[rreq_handler] Received RREQ (dst: %s src: %s frd: %d res: %d hopcnt: %d bcast_id: %d)\n", rreq->dst, rreq->src, rreq->flag.frd, rreq->flag.res, rreq->hopcnt, rreq->bcast_id);
-    printf("               from interface %d mac: ", from->sll_ifindex);
-    for (i = 0; i < 6; i++)
-        printf("%.2x%s", frame->h_source[i] & 0xff, (i < 5) ? ":" : "\n");
+    decode_rpacket(frame, rreq);
+    log_debug("[rreq_handler] Received RREQ (dst: %I src: %I frd: %d res: %d hopcnt: %d bcast_id: %u ttl: %d) from interface %d mac: %M", rreq->dst, rreq->src, rreq->flag.frd, rreq->flag.res, rreq->hopcnt, rreq->bcast_id, rreq->ttl, from->sll_ifindex, frame->h_source);
 
-    if (strcmp(obj->ipaddr, rreq->src) == 0) {
-        printf("[rreq_handler] RREQ was sent by local node, ignored.\n");
+    if (obj->addr == rreq->src) {
+        log_debug("[rreq_handler] RREQ was sent by local node, ignored.");
         return;
     }
     // find routing items in rtable
     src_ritem = get_item_rtable(rreq->src, obj);
     dst_ritem = get_item_rtable(rreq->dst, obj);
-    // get the broadcast id for ss, ds
-    s = util_ip_to_index(rreq->src);
-    d = util_ip_to_index(rreq->dst);
 
+    // broadcast id table keeps <src, src> for the latest RREQ from src
+    // and <src, dst> for the latest RREQ from src to dst
     if (src_ritem == NULL)
         newsflag = 1;
-    if (rreq->bcast_id > obj->b_ids[s][s]) {
+    if (rreq->bcast_id > btable_get(&obj->btable, rreq->src, rreq->src)) {
         // insert or update a new routing path (reverse route back)
         InsertOrUpdateRoutingTable(obj, src_ritem, rreq->src, frame->h_source, from->sll_ifindex, rreq->hopcnt + 1);
-        obj->b_ids[s][s] = rreq->bcast_id;
+        btable_set(&obj->btable, rreq->src, rreq->src, rreq->bcast_id);
         newrreqflag = 1;
+    } else if (src_ritem == NULL) {
+        // reverse route has gone stale, nothing to compare with
     } else if (rreq->flag.frd == 1                          // forced discovery = true
         || rreq->hopcnt + 1 < src_ritem->hopcnt             // shorter path
         || (rreq->hopcnt + 1 == src_ritem->hopcnt
@@ -373,48 +824,56 @@ void frame_rreq_handler(odr_object *obj, odr_frame *frame, struct sockaddr_ll *f
         if (rreq->hopcnt + 1 < src_ritem->hopcnt)
             newhopflag = 1;
         InsertOrUpdateRoutingTable(obj, src_ritem, rreq->src, frame->h_source, from->sll_ifindex, rreq->hopcnt + 1);
-        obj->b_ids[s][s] = rreq->bcast_id;
+        btable_set(&obj->btable, rreq->src, rreq->src, rreq->bcast_id);
     }
 
     // TODO: check
-    if (strcmp(rreq->dst, obj->ipaddr) == 0 && rreq->bcast_id > obj->b_ids[d][s]) {
+    if (rreq->dst == obj->addr && rreq->bcast_id > btable_get(&obj->btable, rreq->src, rreq->dst)) {
         // destination, send RREP back
-        obj->b_ids[d][s] = rreq->bcast_id;
-        printf("[rreq_handler] RREQ reached destination, send back RREP\n");
-        send_rrep(obj, rreq->dst, rreq->src, 0, rreq->flag.frd);
+        btable_set(&obj->btable, rreq->src, rreq->dst, rreq->bcast_id);
+        log_debug("[rreq_handler] RREQ reached destination, send back RREP");
+        send_rrep(obj, rreq->dst, rreq->src, 0, rreq->bcast_id, rreq->flag.frd);
         resflag = 1;
         return;
     } else {
         // intermediate node
-        if (rreq->bcast_id > obj->b_ids[d][s]) {
-            obj->b_ids[d][s] = rreq->bcast_id;
+        if (rreq->bcast_id > btable_get(&obj->btable, rreq->src, rreq->dst)) {
+            btable_set(&obj->btable, rreq->src, rreq->dst, rreq->bcast_id);
             if (dst_ritem != NULL                                       // have routing path to destionation
                 && rreq->flag.frd == 0                                  // forced discovery = false
                 && rreq->flag.res == 0                                  // reply already sent = false
                 && cmp_hwaddrs(dst_ritem->nexthop, frame->h_source) == 0) {  // split horizon
                 // intermediate node, send RREP back
-                printf("[rreq_handler] RREQ reached intermediate, send back RREP\n");
-                send_rrep(obj, rreq->dst, rreq->src, dst_ritem->hopcnt, rreq->flag.frd);
+                log_debug("[rreq_handler] RREQ reached intermediate, send back RREP");
+                send_rrep(obj, rreq->dst, rreq->src, dst_ritem->hopcnt, rreq->bcast_id, rreq->flag.frd);
                 resflag = 1;
             }
         } else if (dst_ritem != NULL
             && newhopflag == 1) {
-            printf("[rreq_handler] RREQ reached intermediate, send back RREP\n");
-            send_rrep(obj, rreq->dst, rreq->src, dst_ritem->hopcnt, rreq->flag.frd);
+            log_debug("[rreq_handler] RREQ reached intermediate, send back RREP");
+            send_rrep(obj, rreq->dst, rreq->src, dst_ritem->hopcnt, rreq->bcast_id, rreq->flag.frd);
             resflag = 1;
         }
     }
 
-    if (dst_ritem == NULL && (newrreqflag == 1 || newhopflag == 1)) {
-        // send out rreq
-        printf("[rreq_handler] Broadcast RREQ\n");
-        send_rreq(obj, rreq->dst, rreq->src, rreq->hopcnt + 1, rreq->bcast_id, rreq->flag.frd, resflag);
+    if (rreq->ttl == 1) {
+        // end of the ring, the source expands it if nobody answered
+        log_debug("[rreq_handler] RREQ TTL exhausted, not rebroadcast.");
+        ODR_STATS(obj)->rreq_suppressed++;
+        return;
     }
 
-    if (dst_ritem != NULL && (newsflag == 1 || newhopflag == 1)) {
+    if (dst_ritem == NULL && (newrreqflag == 1 || newhopflag == 1)) {
         // send out rreq
-        printf("[rreq_handler] Broadcast RREQ\n");
-        send_rreq(obj, rreq->dst, rreq->src, rreq->hopcnt + 1, rreq->bcast_id, rreq->flag.frd, resflag);
+        log_debug("[rreq_handler] Broadcast RREQ");
+        send_rreq(obj, rreq->dst, rreq->src, rreq->hopcnt + 1, rreq->bcast_id, rreq->flag.frd, resflag, rreq->ttl ? rreq->ttl - 1 : ODR_TTL_FLOOD);
+    } else if (dst_ritem != NULL && (newsflag == 1 || newhopflag == 1)) {
+        // send out rreq
+        log_debug("[rreq_handler] Broadcast RREQ");
+        send_rreq(obj, rreq->dst, rreq->src, rreq->hopcnt + 1, rreq->bcast_id, rreq->flag.frd, resflag, rreq->ttl ? rreq->ttl - 1 : ODR_TTL_FLOOD);
+    } else {
+        // duplicate, or nothing new to tell the neighbors
+        ODR_STATS(obj)->rreq_suppressed++;
     }
 }
 
@@ -433,50 +892,55 @@ void frame_rreq_handler(odr_object *obj, odr_frame *frame, struct sockaddr_ll *f
  * --------------------------------------------------------------------------
  */
 void frame_rrep_handler(odr_object *obj, odr_frame *frame, struct sockaddr_ll *from) {
-    int idx = 0, i;
+    int idx = 0;
     bool needReply = false;
 
-    odr_rpacket *rrep = (odr_rpacket *)frame->data;
-    printf("[rrep_handler] Received RREP (dst: %s src: %s hopcnt: %d)\n", rrep->dst, rrep->src, rrep->hopcnt);
-    printf("               from interface %d mac: ", from->sll_ifindex);
-    for (i = 0; i < 6; i++)
-        printf("%.2x%s", frame->h_source[i] & 0xff, (i < 5) ? ":" : "\n");
+    odr_rpacket rpacket, *rrep = &rpacket;
+    decode_rpacket(frame, rrep);
+    log_debug("[rrep_handler] Received RREP (dst: %I src: %I hopcnt: %d bcast_id: %u) from interface %d mac: %M", rrep->dst, rrep->src, rrep->hopcnt, rrep->bcast_id, from->sll_ifindex, frame->h_source);
     // get the 'forward' route from routing table
     odr_rtable *dst_ritem = get_item_rtable(rrep->dst, obj);
 
+    // before the route is installed, which flushes the pending list
+    if (obj->addr == rrep->src)
+        queue_rtt_sample(obj, rrep);
+
     if (dst_ritem == NULL || dst_ritem->hopcnt > rrep->hopcnt + 1) {
         InsertOrUpdateRoutingTable(obj, dst_ritem, rrep->dst, from->sll_addr, from->sll_ifindex, rrep->hopcnt + 1);
-        if (strcmp(obj->ipaddr, rrep->src) != 0)
+        if (obj->addr != rrep->src)
             needReply = true;
         else
-            printf("[rrep_handler] RREP reached source node (%s)\n", rrep->src);
+            log_debug("[rrep_handler] RREP reached source node (%I)", rrep->src);
     }
 
     if (needReply)
     {
-        // build apacket item
-        odr_queue_item  *item = (odr_queue_item *)Calloc(1, sizeof(odr_queue_item));
+        // relay RREP towards the source
         rrep->hopcnt ++;
-
-        memcpy(item->data, rrep, ODR_FRAME_PAYLOAD);
-
-        item->type = ODR_FRAME_RREP;
-        item->timestamp = time(NULL);
-        item->next = NULL;
-
-        // insert into queue
-        if (obj->queue.head == NULL) {
-            obj->queue.head = item;
-            obj->queue.tail = item;
-        } else {
-            obj->queue.tail->next = item;
-            obj->queue.tail = item;
-        }
-        printf("Queued up rrep_packet [DST: %s SRC: %s HOPCNT: %d FRD:%d]\n", rrep->dst, rrep->src, rrep->hopcnt, rrep->flag.frd);
-
+        log_debug("[rrep_handler] Queued up RREP (dst: %I src: %I hopcnt: %d frd: %d)", rrep->dst, rrep->src, rrep->hopcnt, rrep->flag.frd);
+        queue_push(obj, ODR_FRAME_RREP, rrep);
+    } else if (obj->addr == rrep->src) {
+        // route confirmed (e.g. forced discovery with the same path)
+        queue_flush(obj, rrep->dst);
     }
+}
 
-    queue_handler(obj);
+/* --------------------------------------------------------------------------
+ *  decode_appmsg
+ *
+ *  APPMSG/APPFRAG decoder
+ *
+ *  @param  : odr_frame     *frame  [received frame]
+ *            int           len     [received frame length]
+ *            odr_apacket   *appmsg [decoded message or fragment]
+ *  @return : int                   [0 if succeed, -1 if malformed]
+ * --------------------------------------------------------------------------
+ */
+int decode_appmsg(odr_frame *frame, int len, odr_apacket *appmsg) {
+    if (ODR_FRAME_TYPE(frame->h_type) == ODR_FRAME_APPFRAG)
+        return decode_fpacket(frame, len, appmsg);
+    decode_apacket(frame, appmsg);
+    return 0;
 }
 
 /* --------------------------------------------------------------------------
@@ -486,117 +950,160 @@ void frame_rrep_handler(odr_object *obj, odr_frame *frame, struct sockaddr_ll *f
  *
  *  @param  : odr_object            *obj    [odr object]
  *            odr_frame             *frame  [received frame]
+ *            int                   len     [received frame length]
  *            struct sockaddr_ll    *from   [socket sender address]
  *  @return : void
  *
- *  Handle received APPMSG
+ *  Handle received APPMSG or APPMSG fragment
  *  1. Insert or update route path if possible
- *  2. If APPMSG reaches destination, send to domain socket
- *  3. Otherwise, put APPMSG into queue
+ *  2. If APPMSG reaches destination, send to domain socket; a fragment is
+ *     reassembled first
+ *  3. Otherwise, hand APPMSG to the queue for relay; fragments are relayed
+ *     as they come
+ *  A frame carries at most ODR_FRAME_MAXLEN bytes, so it is decoded into a
+ *  buffer of that size rather than a whole odr_apacket
  * --------------------------------------------------------------------------
  */
-void frame_appmsg_handler(odr_object *obj, odr_frame *frame, struct sockaddr_ll *from) {
-    int i;
+void frame_appmsg_handler(odr_object *obj, odr_frame *frame, int len, struct sockaddr_ll *from) {
+    odr_apacket *msg;
+    char        buf[ODR_APACKET_FRAMESIZE];
 
-    odr_apacket *appmsg = (odr_apacket *)frame->data;
-    printf("[appmsg_handler] Received APPMSG (dst: %s:%d src: %s:%d hopcnt: %d frd: %d data(%d): %s)\n", appmsg->dst, appmsg->dst_port, appmsg->src, appmsg->src_port, appmsg->hopcnt, appmsg->frd, appmsg->length, appmsg->data);
-    printf("                 from interface %d mac: ", from->sll_ifindex);
-    for (i = 0; i < 6; i++)
-        printf("%.2x%s", frame->h_source[i] & 0xff, (i < 5) ? ":" : "\n");
+    odr_apacket *appmsg = (odr_apacket *)buf;
+    if (decode_appmsg(frame, len, appmsg) < 0) {
+        log_warn("[appmsg_handler] Malformed APPMSG fragment, dropped.");
+        return;
+    }
+    log_debug("[appmsg_handler] Received APPMSG (dst: %I:%d src: %I:%d hopcnt: %d frd: %d data(%d): %s) from interface %d mac: %M", appmsg->dst, appmsg->dst_port, appmsg->src, appmsg->src_port, appmsg->hopcnt, appmsg->frd, appmsg->length, appmsg->data, from->sll_ifindex, frame->h_source);
 
     // insert or update route path
     odr_rtable *ritem = get_item_rtable(appmsg->src, obj);
     if (ritem == NULL || ritem->hopcnt > appmsg->hopcnt + 1) {
-        printf("[appmsg_handler] APPMSG route path insert/update.\n");
+        log_debug("[appmsg_handler] APPMSG route path insert/update.");
         InsertOrUpdateRoutingTable(obj, ritem, appmsg->src, from->sll_addr, from->sll_ifindex, appmsg->hopcnt + 1);
     }
 
-    if (strcmp(obj->ipaddr, appmsg->dst) == 0) {
-        // APPMSG reach destination
-        printf("[appmsg_handler] APPMSG reach destination, send to domain socket.\n");
-        send_dgram(obj, appmsg);
+    if (obj->addr == appmsg->dst) {
+        if (appmsg->length == appmsg->total) {
+            // APPMSG reach destination
+            log_debug("[appmsg_handler] APPMSG reach destination, send to domain socket.");
+            obj->tp->deliver(obj, appmsg);
+        } else if ((msg = reasm_add(obj, appmsg)) != NULL) {
+            log_debug("[appmsg_handler] APPMSG reassembled (%d bytes), send to domain socket.", msg->length);
+            obj->tp->deliver(obj, msg);
+            free(msg);
+        }
     } else {
-        // APPMSG queue up
-        odr_queue_item  *item = (odr_queue_item *)Calloc(1, sizeof(odr_queue_item));
+        // APPMSG relay
         appmsg->hopcnt ++;
-
-        memcpy(item->data, appmsg, ODR_FRAME_PAYLOAD);
-
-        item->type = ODR_FRAME_APPMSG;
-        item->timestamp = time(NULL);
-        item->next = NULL;
-
-        // insert into queue
-        if (obj->queue.head == NULL) {
-            obj->queue.head = item;
-            obj->queue.tail = item;
-        } else {
-            obj->queue.tail->next = item;
-            obj->queue.tail = item;
-        }
-        //printf("Queued up appmsg [DST: %s SRC: %s HOPCNT: %d FRD:%d]\n", rrep->dst, rrep->src, rrep->hopcnt, rrep->flag.frd);
-        queue_handler(obj);
+        queue_push(obj, ODR_FRAME_APPMSG, appmsg);
     }
 
 }
 
 /* --------------------------------------------------------------------------
- *  debug_route_handler
+ *  relay_frame
  *
- *  Debug function to print route table
+ *  Received frame relay function
  *
- *  @param  : odr_object    *obj    [odr object]
- *  @return : void
+ *  @param  : odr_object    *obj        [odr object]
+ *            odr_itable    *interface  [outgoing interface]
+ *            odr_ntable    *neighbor   [next hop, understands the frame]
+ *            odr_frame     *frame      [received v2 APPMSG/APPFRAG frame]
+ *            int           len         [frame length]
+ *  @return : int   [the number of bytes that are sent, -1 if failed]
  *
- *  Print all content in route table
+ *  Copy the frame payload once, straight into the output buffer, then put
+ *  the header template of the next hop in front and count the hop in
+ *  place. APPMSG and APPFRAG of v2 and v3 share the header up to the hop
+ *  count
  * --------------------------------------------------------------------------
  */
-void debug_route_handler(odr_object *obj) {
-    // print out all route items
-    int i;
-    odr_rtable *r = obj->rtable;
-
-    printf("\n");
-    printf("+----- IP address -----+---- Next hop -----+- I -+- H -+\n");
-    while (r) {
-        printf("| %-*s | ", IPADDR_BUFFSIZE, r->dst);
-        for (i = 0; i < 6; i++)
-            printf("%.2x%s", r->nexthop[i] & 0xff, (i < 5) ? ":" : " | ");
-        printf("%3d | ", r->index);
-        printf("%3d | ", r->hopcnt);
-        //printf("%4d | ", r->bcast_id);
-        printf("\n");
-        r = r->next;
-    }
-    printf("+----------------------+-------------------+-----+-----+\n");
+int relay_frame(odr_object *obj, odr_itable *interface, odr_ntable *neighbor, odr_frame *frame, int len) {
+    odr_frame       *out = output_slot(obj);
+    odr_apacket_v2  *a2 = (odr_apacket_v2 *)out->data;
+
+    memcpy(out->data, frame->data, len - ODR_FRAME_HDRLEN);
+    a2->hopcnt = htons(ntohs(a2->hopcnt) + 1);
+    FRAME_HEADER(out, &neighbor->hdr, frame->h_type);
+    return output_frame(obj, interface->if_index, out, len, PACKET_OTHERHOST);
 }
 
 /* --------------------------------------------------------------------------
- *  debug_interface_handler
+ *  forward_appmsg
  *
- *  Debug function to print interface table
+ *  Transit APPMSG fast path
  *
- *  @param  : odr_object    *obj    [odr object]
- *  @return : void
+ *  @param  : odr_object            *obj    [odr object]
+ *            odr_frame             *frame  [received frame]
+ *            int                   len     [received frame length]
+ *            struct sockaddr_ll    *from   [socket sender address]
+ *  @return : int   [1 if relayed, 0 if frame_appmsg_handler() is needed]
+ *  @see    : function#relay_frame
  *
- *  Print all content in interface table
+ *  Called with obj->lock held for reading, so no table may change. Relay
+ *  the APPMSG right away when frame_appmsg_handler() would do nothing but
+ *  send it: the sender is a known neighbor, the reverse route is already
+ *  as good, the destination is another node with a route and nothing
+ *  pending, and no forced discovery is asked for. Only the header is read,
+ *  in place, and the frame goes out as it came, so the next hop must read
+ *  its layout (a v2 frame goes to v2 and v3 nodes, a v3 one only to v3)
+ *  and, for a fragment, have an MTU the frame fits; anything else is left
+ *  to frame_appmsg_handler(), which re-encodes it. The sender must be
+ *  known with at least the version of the frame, so nothing is learned
+ *  from it. Only the neighbor timestamp is
+ *  refreshed, with an atomic store. Fragments are never reassembled in
+ *  transit
  * --------------------------------------------------------------------------
  */
-void debug_interface_handler(odr_object *obj) {
-    // print all interface items
-    int i;
-    odr_itable *item = obj->itable;
-
-    printf("\n");
-    printf("+- Interface name -+--- MAC address ---+ I +\n");
-    while (item) {
-        printf("| %-*s | ", IF_NAME, item->if_name);
-        for (i = 0; i < 6; i++)
-            printf("%.2x%s", item->if_haddr[i] & 0xff, (i < 5) ? ":" : " | ");
-        printf("%1d |\n", item->if_index);
-        item = item->hwa_next;
+int forward_appmsg(odr_object *obj, odr_frame *frame, int len, struct sockaddr_ll *from) {
+    uint            hopcnt;
+    int             hdrlen, version = ODR_FRAME_VERSION(frame->h_type);
+    odr_apacket_v2  *a2 = (odr_apacket_v2 *)frame->data;
+    odr_fpacket     *f = (odr_fpacket *)frame->data;
+    odr_ntable      *neighbor, *next;
+    odr_rtable      *route, *ritem;
+    odr_itable      *interface;
+
+    if (version < ODR_VERSION_V2)
+        return 0;
+    if (ODR_FRAME_TYPE(frame->h_type) == ODR_FRAME_APPFRAG) {
+        // a malformed fragment is dropped by frame_appmsg_handler()
+        hdrlen = ODR_FRAME_HDRLEN + ODR_FPACKET_HDRLEN(version);
+        if (len < hdrlen || hdrlen + ntohs(f->length) > len ||
+            (uint)ntohs(f->offset) + ntohs(f->length) > ntohs(f->total))
+            return 0;
+        len = hdrlen + ntohs(f->length);
+    } else {
+        if (ntohs(a2->length) >= ODR_APACKET_DATALEN(version))
+            return 0;
+        len = ODR_FRAME_BASELEN;
     }
-    printf("+------------------+-------------------+---+\n");
-}
+    if (a2->frd || obj->addr == a2->dst)
+        return 0;
+    hopcnt = ntohs(a2->hopcnt);
+
+    neighbor = get_item_ntable(frame->h_source, from->sll_ifindex, obj);
+    if (neighbor == NULL || neighbor->version < version)
+        return 0;
+
+    ritem = get_item_rtable(a2->src, obj);
+    if (ritem == NULL || ritem->hopcnt > hopcnt + 1)
+        return 0;
 
+    route = get_item_rtable(a2->dst, obj);
+    if (route == NULL || hash_find(&obj->queue.index, a2->dst) != NULL)
+        return 0;
+    if ((interface = get_item_itable(route->index, obj)) == NULL)
+        return 0;
+    next = get_item_ntable(route->nexthop, route->index, obj);
+    if (next == NULL || next->version < version)
+        return 0;
+    if (len > ODR_FRAME_BASELEN && (next->mtu == 0 || len > ETH_HLEN + min(next->mtu, interface->if_mtu)))
+        return 0;
 
+    __atomic_store_n(&neighbor->timestamp, timer_time(), __ATOMIC_RELAXED);
+
+    log_debug("[appmsg_handler] Relay APPMSG (dst: %I:%d src: %I:%d hopcnt: %d len: %d) via interface %d", a2->dst, ntohs(a2->dst_port), a2->src, ntohs(a2->src_port), hopcnt, len, route->index);
+    relay_frame(obj, interface, next, frame, len);
+    return 1;
+}
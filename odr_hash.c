@@ -0,0 +1,196 @@
+/*
+* @File: odr_hash.c
+* @Date: 2026-10-17 20:09:21
+* @Last Modified time: 2026-10-17 21:32:24
+* @Description:
+*     Open-addressing hash index, maps an unsigned integer key to an item
+*     pointer. Linear probing with backward-shift deletion, so lookups never
+*     walk over tombstones and the cost stays flat as the table grows.
+*     - uint hash_slot(odr_hash *h, uint key)
+*         [Home slot of key]
+*     - void hash_resize(odr_hash *h, uint size)
+*         [Rehash into a table of given size]
+*     + void hash_init(odr_hash *h, uint size)
+*         [Hash index constructor]
+*     + void *hash_find(odr_hash *h, uint key)
+*         [Hash index lookup]
+*     + void hash_insert(odr_hash *h, uint key, void *val)
+*         [Hash index insert or replace]
+*     + void hash_remove(odr_hash *h, uint key)
+*         [Hash index remove]
+*     + void hash_free(odr_hash *h)
+*         [Hash index destructor]
+*/
+
+#include "np.h"
+
+/* --------------------------------------------------------------------------
+ *  hash_slot
+ *
+ *  Home slot of key
+ *
+ *  @param  : odr_hash  *h      [hash index]
+ *            uint      key     [key]
+ *  @return : uint              [slot number]
+ *
+ *  Fibonacci hashing, spreads sequential addresses over the table. The
+ *  slot is the top bits of the product: the low bits depend only on the
+ *  low bits of the key, which for addresses in network byte order are
+ *  the network part, the same for a whole subnet
+ * --------------------------------------------------------------------------
+ */
+uint hash_slot(odr_hash *h, uint key) {
+    return (key * 2654435761u) >> (__builtin_clz(h->size) + 1);
+}
+
+/* --------------------------------------------------------------------------
+ *  hash_resize
+ *
+ *  Rehash into a table of given size
+ *
+ *  @param  : odr_hash  *h      [hash index]
+ *            uint      size    [new table size, power of 2]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void hash_resize(odr_hash *h, uint size) {
+    odr_hash_slot *old = h->slots;
+    uint i, oldsize = h->size;
+
+    h->slots = (odr_hash_slot *)Calloc(size, sizeof(odr_hash_slot));
+    h->size = size;
+    h->count = 0;
+
+    for (i = 0; i < oldsize; i++)
+        if (old[i].val)
+            hash_insert(h, old[i].key, old[i].val);
+    free(old);
+}
+
+/* --------------------------------------------------------------------------
+ *  hash_init
+ *
+ *  Hash index constructor
+ *
+ *  @param  : odr_hash  *h      [hash index]
+ *            uint      size    [initial size, rounded up to power of 2]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void hash_init(odr_hash *h, uint size) {
+    uint n = ODR_HASH_MINSIZE;
+
+    while (n < size)
+        n <<= 1;
+    h->slots = (odr_hash_slot *)Calloc(n, sizeof(odr_hash_slot));
+    h->size = n;
+    h->count = 0;
+}
+
+/* --------------------------------------------------------------------------
+ *  hash_find
+ *
+ *  Hash index lookup
+ *
+ *  @param  : odr_hash  *h      [hash index]
+ *            uint      key     [key]
+ *  @return : void *            [item, NULL if not found]
+ * --------------------------------------------------------------------------
+ */
+void *hash_find(odr_hash *h, uint key) {
+    uint i = hash_slot(h, key);
+
+    while (h->slots[i].val) {
+        if (h->slots[i].key == key)
+            return h->slots[i].val;
+        i = (i + 1) & (h->size - 1);
+    }
+    return NULL;
+}
+
+/* --------------------------------------------------------------------------
+ *  hash_insert
+ *
+ *  Hash index insert or replace
+ *
+ *  @param  : odr_hash  *h      [hash index]
+ *            uint      key     [key]
+ *            void      *val    [item, must not be NULL]
+ *  @return : void
+ *
+ *  Grow the table when it is half full to keep probe sequences short
+ * --------------------------------------------------------------------------
+ */
+void hash_insert(odr_hash *h, uint key, void *val) {
+    uint i;
+
+    if ((h->count + 1) * 2 > h->size)
+        hash_resize(h, h->size * 2);
+
+    i = hash_slot(h, key);
+    while (h->slots[i].val) {
+        if (h->slots[i].key == key) {
+            h->slots[i].val = val;
+            return;
+        }
+        i = (i + 1) & (h->size - 1);
+    }
+    h->slots[i].key = key;
+    h->slots[i].val = val;
+    h->count++;
+}
+
+/* --------------------------------------------------------------------------
+ *  hash_remove
+ *
+ *  Hash index remove
+ *
+ *  @param  : odr_hash  *h      [hash index]
+ *            uint      key     [key]
+ *  @return : void
+ *
+ *  Remove the key, then shift back the following entries of the probe
+ *  sequence that would become unreachable through the hole
+ * --------------------------------------------------------------------------
+ */
+void hash_remove(odr_hash *h, uint key) {
+    uint i = hash_slot(h, key), j, k, mask = h->size - 1;
+
+    while (h->slots[i].val && h->slots[i].key != key)
+        i = (i + 1) & mask;
+    if (h->slots[i].val == NULL)
+        return;
+
+    j = i;
+    while (1) {
+        j = (j + 1) & mask;
+        if (h->slots[j].val == NULL)
+            break;
+        k = hash_slot(h, h->slots[j].key);
+        // skip the entry if its home slot lies cyclically in (i, j]
+        if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+        h->slots[i] = h->slots[j];
+        i = j;
+    }
+    h->slots[i].val = NULL;
+    h->count--;
+}
+
+/* --------------------------------------------------------------------------
+ *  hash_free
+ *
+ *  Hash index destructor
+ *
+ *  @param  : odr_hash  *h      [hash index]
+ *  @return : void
+ *
+ *  Free the slots only, items belong to the owner table
+ * --------------------------------------------------------------------------
+ */
+void hash_free(odr_hash *h) {
+    free(h->slots);
+    h->slots = NULL;
+    h->size = 0;
+    h->count = 0;
+}
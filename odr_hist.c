@@ -0,0 +1,128 @@
+/*
+* @File: odr_hist.c
+* @Date: 2026-10-17 20:58:29
+* @Last Modified time: 2026-10-17 20:58:29
+* @Description:
+*     Log-linear (HDR style) latency histograms, shared by the ODR
+*     statistics and the time server. Values below 2^ODR_HIST_SUB_BITS
+*     have a bucket each, every power of 2 above is split into
+*     2^ODR_HIST_SUB_BITS buckets: recording is a few instructions and a
+*     quantile is known to within 1/2^ODR_HIST_SUB_BITS of its value.
+*     + uint hist_index(ulong v)
+*         [Bucket of a value]
+*     + ulong hist_lower(uint idx)
+*         [Smallest value of a bucket]
+*     + void hist_add(odr_hist *h, ulong v)
+*         [Record a value]
+*     + void hist_merge(odr_hist *dst, odr_hist *src)
+*         [Add a histogram to another]
+*     + ulong hist_quantile(odr_hist *h, double q)
+*         [Value at a quantile]
+*/
+
+#include "np.h"
+
+/* --------------------------------------------------------------------------
+ *  hist_index
+ *
+ *  Bucket of a value
+ *
+ *  @param  : ulong v       [value]
+ *  @return : uint          [bucket index]
+ *
+ *  The top ODR_HIST_SUB_BITS bits under the leading 1 select the bucket
+ *  within the power of 2 of the value
+ * --------------------------------------------------------------------------
+ */
+uint hist_index(ulong v) {
+    int msb;
+
+    if (v < (1UL << ODR_HIST_SUB_BITS))
+        return v;
+    msb = 63 - __builtin_clzl(v);
+    return ((msb - ODR_HIST_SUB_BITS + 1) << ODR_HIST_SUB_BITS)
+           + ((v >> (msb - ODR_HIST_SUB_BITS)) & ((1 << ODR_HIST_SUB_BITS) - 1));
+}
+
+/* --------------------------------------------------------------------------
+ *  hist_lower
+ *
+ *  Smallest value of a bucket
+ *
+ *  @param  : uint  idx     [bucket index]
+ *  @return : ulong         [smallest value that falls into the bucket]
+ * --------------------------------------------------------------------------
+ */
+ulong hist_lower(uint idx) {
+    int msb;
+
+    if (idx < (1U << ODR_HIST_SUB_BITS))
+        return idx;
+    msb = (idx >> ODR_HIST_SUB_BITS) + ODR_HIST_SUB_BITS - 1;
+    return ((1UL << ODR_HIST_SUB_BITS) + (idx & ((1 << ODR_HIST_SUB_BITS) - 1))) << (msb - ODR_HIST_SUB_BITS);
+}
+
+/* --------------------------------------------------------------------------
+ *  hist_add
+ *
+ *  Record a value
+ *
+ *  @param  : odr_hist  *h  [histogram of the calling thread]
+ *            ulong     v   [value]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void hist_add(odr_hist *h, ulong v) {
+    h->count++;
+    h->sum += v;
+    if (v > h->max)
+        h->max = v;
+    h->buckets[hist_index(v)]++;
+}
+
+/* --------------------------------------------------------------------------
+ *  hist_merge
+ *
+ *  Add a histogram to another
+ *
+ *  @param  : odr_hist  *dst    [sum]
+ *            odr_hist  *src    [histogram to add]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void hist_merge(odr_hist *dst, odr_hist *src) {
+    int i;
+
+    dst->count += src->count;
+    dst->sum += src->sum;
+    dst->max = max(dst->max, src->max);
+    for (i = 0; i < ODR_HIST_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+}
+
+/* --------------------------------------------------------------------------
+ *  hist_quantile
+ *
+ *  Value at a quantile
+ *
+ *  @param  : odr_hist  *h  [histogram]
+ *            double    q   [quantile, 0 to 1]
+ *  @return : ulong         [largest value of the bucket the quantile falls
+ *                           in, never above the maximum; 0 if empty]
+ * --------------------------------------------------------------------------
+ */
+ulong hist_quantile(odr_hist *h, double q) {
+    int     i;
+    ulong   cum = 0, rank = (ulong)(q * h->count);
+
+    if (h->count == 0)
+        return 0;
+    if (rank == 0 || rank < q * h->count)
+        rank++;
+    for (i = 0; i < ODR_HIST_BUCKETS - 1; i++) {
+        cum += h->buckets[i];
+        if (cum >= rank)
+            return min(hist_lower(i + 1) - 1, h->max);
+    }
+    return h->max;
+}
@@ -0,0 +1,400 @@
+/*
+* @File: odr_log.c
+* @Date: 2026-10-17 20:45:12
+* @Last Modified time: 2026-10-17 20:45:12
+* @Description:
+*     Asynchronous logging. A log call stores the format pointer and its
+*     arguments, packed in binary, into a lock-free multi-producer ring
+*     (one slot per record, published by its sequence number); a drain
+*     thread formats the records and writes them to stdout. The caller
+*     never formats text or touches stdio, and never blocks: when the ring
+*     is full the record is dropped and counted.
+*     Conversions: %d %u %x %c (int), %ld %lu %lx (long), %s (string, at
+*     most ODR_LOG_STRLEN bytes kept), %I (in_addr_t), %M (6-byte MAC
+*     address), with printf flags and width.
+*     The level is set with -v and changed at runtime with SIGUSR1 (more
+*     verbose) and SIGUSR2 (less verbose).
+*     - const char *log_spec(const char *p, char *spec, int *lng)
+*         [Parse one conversion]
+*     - int log_pack(char *args, const char *fmt, va_list ap)
+*         [Pack the arguments of a record]
+*     - void log_render(FILE *fp, odr_log_rec *rec)
+*         [Format a record]
+*     - int log_drain(void)
+*         [Write out the published records]
+*     - void *log_main(void *arg)
+*         [Drain thread]
+*     - void log_signal(int signo)
+*         [Runtime level change]
+*     + void log_init(int level)
+*         [Logger constructor]
+*     + void log_write(int level, const char *fmt, ...)
+*         [Queue a record]
+*     + void log_free(void)
+*         [Logger destructor]
+*/
+
+#include "np.h"
+
+// records at or below this level are queued
+volatile sig_atomic_t odr_log_level = ODR_LOG_INFO;
+
+static odr_log_rec  log_ring[ODR_LOG_RINGSIZE];
+static uint         log_head;           /* next slot to claim (producers) */
+static uint         log_tail;           /* next slot to read (drain)      */
+static ulong        log_dropped;        /* records lost to a full ring    */
+static int          log_running;
+static pthread_t    log_tid;
+
+static const char *log_names[] = { "ERR", "WARN", "INFO", "DEBUG" };
+
+/* --------------------------------------------------------------------------
+ *  log_spec
+ *
+ *  Parse one conversion
+ *
+ *  @param  : const char    *p      [the '%' of the conversion]
+ *            char          *spec   [printf spec without the conversion
+ *                                   character, e.g. "%-5l"]
+ *            int           *lng    [1 if the 'l' modifier is given]
+ *  @return : const char *          [the conversion character]
+ * --------------------------------------------------------------------------
+ */
+const char *log_spec(const char *p, char *spec, int *lng) {
+    int n = 0;
+
+    spec[n++] = *p++;
+    while (*p && strchr("-+ #0123456789.", *p) && n < 14)
+        spec[n++] = *p++;
+    *lng = 0;
+    if (*p == 'l') {
+        *lng = 1;
+        spec[n++] = *p++;
+    }
+    spec[n] = 0;
+    return p;
+}
+
+/* --------------------------------------------------------------------------
+ *  log_pack
+ *
+ *  Pack the arguments of a record
+ *
+ *  @param  : char          *args   [record argument area]
+ *            const char    *fmt    [format]
+ *            va_list       ap      [arguments]
+ *  @return : int                   [bytes used]
+ *
+ *  Arguments that do not fit in ODR_LOG_ARGLEN are left out and rendered
+ *  as '?'
+ * --------------------------------------------------------------------------
+ */
+int log_pack(char *args, const char *fmt, va_list ap) {
+    int         len = 0, lng, n;
+    int         ival;
+    long        lval;
+    in_addr_t   addr;
+    const char  *p, *s;
+    char        spec[16];
+
+    for (p = fmt; *p; p++) {
+        if (*p != '%')
+            continue;
+        p = log_spec(p, spec, &lng);
+        switch (*p) {
+        case 'd': case 'u': case 'x': case 'c':
+            if (lng) {
+                lval = va_arg(ap, long);
+                if (len + sizeof(long) > ODR_LOG_ARGLEN)
+                    return len;
+                memcpy(args + len, &lval, sizeof(long));
+                len += sizeof(long);
+            } else {
+                ival = va_arg(ap, int);
+                if (len + sizeof(int) > ODR_LOG_ARGLEN)
+                    return len;
+                memcpy(args + len, &ival, sizeof(int));
+                len += sizeof(int);
+            }
+            break;
+        case 'I':
+            addr = va_arg(ap, in_addr_t);
+            if (len + sizeof(in_addr_t) > ODR_LOG_ARGLEN)
+                return len;
+            memcpy(args + len, &addr, sizeof(in_addr_t));
+            len += sizeof(in_addr_t);
+            break;
+        case 'M':
+            s = va_arg(ap, const char *);
+            if (len + ETH_ALEN > ODR_LOG_ARGLEN)
+                return len;
+            memcpy(args + len, s, ETH_ALEN);
+            len += ETH_ALEN;
+            break;
+        case 's':
+            s = va_arg(ap, const char *);
+            n = strnlen(s, ODR_LOG_STRLEN - 1);
+            if (len + n + 1 > ODR_LOG_ARGLEN)
+                return len;
+            memcpy(args + len, s, n);
+            args[len + n] = 0;
+            len += n + 1;
+            break;
+        case 0:
+            return len;
+        default:
+            break;
+        }
+    }
+    return len;
+}
+
+/* --------------------------------------------------------------------------
+ *  log_render
+ *
+ *  Format a record
+ *
+ *  @param  : FILE          *fp     [output]
+ *            odr_log_rec   *rec    [record]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void log_render(FILE *fp, odr_log_rec *rec) {
+    int         off = 0, lng, ival;
+    long        lval;
+    in_addr_t   addr;
+    time_t      sec = rec->usec / 1000000;
+    struct tm   tm;
+    const char  *p, *s;
+    char        spec[20], str[INET_ADDRSTRLEN];
+    uchar       *mac;
+
+    localtime_r(&sec, &tm);
+    fprintf(fp, "%02d:%02d:%02d.%06ld %-5s ", tm.tm_hour, tm.tm_min, tm.tm_sec, rec->usec % 1000000, log_names[rec->level]);
+
+    for (p = rec->fmt; *p; p++) {
+        if (*p != '%') {
+            fputc(*p, fp);
+            continue;
+        }
+        p = log_spec(p, spec, &lng);
+        switch (*p) {
+        case 'd': case 'u': case 'x': case 'c':
+            strncat(spec, p, 1);
+            if (lng && off + sizeof(long) <= rec->len) {
+                memcpy(&lval, rec->args + off, sizeof(long));
+                off += sizeof(long);
+                fprintf(fp, spec, lval);
+            } else if (!lng && off + sizeof(int) <= rec->len) {
+                memcpy(&ival, rec->args + off, sizeof(int));
+                off += sizeof(int);
+                fprintf(fp, spec, ival);
+            } else {
+                fputc('?', fp);
+            }
+            break;
+        case 'I':
+            if (off + sizeof(in_addr_t) > rec->len) {
+                fputc('?', fp);
+                break;
+            }
+            memcpy(&addr, rec->args + off, sizeof(in_addr_t));
+            off += sizeof(in_addr_t);
+            inet_ntop(AF_INET, &addr, str, sizeof(str));
+            strcat(spec, "s");
+            fprintf(fp, spec, str);
+            break;
+        case 'M':
+            if (off + ETH_ALEN > rec->len) {
+                fputc('?', fp);
+                break;
+            }
+            mac = (uchar *)rec->args + off;
+            off += ETH_ALEN;
+            fprintf(fp, "%.2x:%.2x:%.2x:%.2x:%.2x:%.2x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+            break;
+        case 's':
+            if (off >= rec->len) {
+                fputc('?', fp);
+                break;
+            }
+            s = rec->args + off;
+            off += strlen(s) + 1;
+            strcat(spec, "s");
+            fprintf(fp, spec, s);
+            break;
+        case '%':
+            fputc('%', fp);
+            break;
+        case 0:
+            p--;
+            break;
+        default:
+            fputs(spec, fp);
+            fputc(*p, fp);
+            break;
+        }
+    }
+    fputc('\n', fp);
+}
+
+/* --------------------------------------------------------------------------
+ *  log_drain
+ *
+ *  Write out the published records
+ *
+ *  @param  : void
+ *  @return : int       [number of records written]
+ *
+ *  Called by the drain thread only. A slot is given back to the producers
+ *  by moving its sequence one lap ahead
+ * --------------------------------------------------------------------------
+ */
+int log_drain(void) {
+    int         n = 0;
+    ulong       dropped;
+    odr_log_rec *rec;
+
+    while (1) {
+        rec = &log_ring[log_tail & (ODR_LOG_RINGSIZE - 1)];
+        if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != log_tail + 1)
+            break;
+        log_render(stdout, rec);
+        __atomic_store_n(&rec->seq, log_tail + ODR_LOG_RINGSIZE, __ATOMIC_RELEASE);
+        log_tail++;
+        n++;
+    }
+
+    if ((dropped = __atomic_exchange_n(&log_dropped, 0, __ATOMIC_RELAXED)) > 0)
+        fprintf(stdout, "[log] %lu records dropped, ring full\n", dropped);
+    if (n > 0 || dropped > 0)
+        fflush(stdout);
+    return n;
+}
+
+/* --------------------------------------------------------------------------
+ *  log_main
+ *
+ *  Drain thread
+ *
+ *  @param  : void      *arg    [unused]
+ *  @return : void *
+ *
+ *  Drain the ring, sleep ODR_LOG_DRAIN_US when it is empty
+ * --------------------------------------------------------------------------
+ */
+void *log_main(void *arg) {
+    while (__atomic_load_n(&log_running, __ATOMIC_ACQUIRE)) {
+        if (log_drain() == 0)
+            usleep(ODR_LOG_DRAIN_US);
+    }
+    log_drain();
+    return NULL;
+}
+
+/* --------------------------------------------------------------------------
+ *  log_signal
+ *
+ *  Runtime level change
+ *
+ *  @param  : int   signo   [SIGUSR1: more verbose, SIGUSR2: less verbose]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void log_signal(int signo) {
+    if (signo == SIGUSR1 && odr_log_level < ODR_LOG_DEBUG)
+        odr_log_level++;
+    else if (signo == SIGUSR2 && odr_log_level > ODR_LOG_ERR)
+        odr_log_level--;
+}
+
+/* --------------------------------------------------------------------------
+ *  log_init
+ *
+ *  Logger constructor
+ *
+ *  @param  : int   level   [initial level, ODR_LOG_*]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void log_init(int level) {
+    uint i;
+
+    odr_log_level = min(max(level, ODR_LOG_ERR), ODR_LOG_DEBUG);
+    for (i = 0; i < ODR_LOG_RINGSIZE; i++)
+        log_ring[i].seq = i;
+    log_head = log_tail = 0;
+
+    Signal(SIGUSR1, log_signal);
+    Signal(SIGUSR2, log_signal);
+
+    log_running = 1;
+    Pthread_create(&log_tid, NULL, log_main, NULL);
+}
+
+/* --------------------------------------------------------------------------
+ *  log_write
+ *
+ *  Queue a record
+ *
+ *  @param  : int           level   [ODR_LOG_*]
+ *            const char    *fmt    [format, must be a string literal]
+ *            ...                   [arguments]
+ *  @return : void
+ *  @see    : macro#odr_log
+ *
+ *  Use the odr_log/log_* macros, which skip the call below the current
+ *  level. A slot is claimed by moving log_head past it, if its sequence
+ *  shows the drain thread has released it; the record is published by
+ *  setting the sequence to slot + 1
+ * --------------------------------------------------------------------------
+ */
+void log_write(int level, const char *fmt, ...) {
+    uint            pos, seq;
+    odr_log_rec     *rec;
+    struct timespec ts;
+    va_list         ap;
+
+    pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+    while (1) {
+        rec = &log_ring[pos & (ODR_LOG_RINGSIZE - 1)];
+        seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(&log_head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if ((int)(seq - pos) < 0) {
+            // the drain thread is a lap behind
+            __atomic_fetch_add(&log_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+        }
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    rec->level = level;
+    rec->usec = ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+    rec->fmt = fmt;
+    va_start(ap, fmt);
+    rec->len = log_pack(rec->args, fmt, ap);
+    va_end(ap);
+    __atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+/* --------------------------------------------------------------------------
+ *  log_free
+ *
+ *  Logger destructor
+ *
+ *  @param  : void
+ *  @return : void
+ *
+ *  Stop the drain thread after it has written out every record
+ * --------------------------------------------------------------------------
+ */
+void log_free(void) {
+    if (!log_running)
+        return;
+    __atomic_store_n(&log_running, 0, __ATOMIC_RELEASE);
+    pthread_join(log_tid, NULL);
+}
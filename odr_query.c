@@ -0,0 +1,234 @@
+/*
+* @File: odr_query.c
+* @Date: 2026-10-17 20:51:07
+* @Last Modified time: 2026-10-17 21:59:30
+* @Description:
+*     Table query socket. A local application (test_route) sends an
+*     odr_query datagram to ODR_QUERY_PATH and gets one page of a table
+*     back as packed binary records (odr_route_rec, odr_port_rec,
+*     odr_iface_rec) behind an odr_query_reply header. The reply carries
+*     the cursor of the next page, so a large table is read one datagram
+*     at a time: every request costs the event loop one page under the
+*     read lock, never a walk of the whole table.
+*     The route table is paged by rtable hash index slot, the port and
+*     interface tables (a handful of entries) by position. Pages are not
+*     a consistent snapshot: a route added or removed between two pages,
+*     or a resize of the index, may show up twice or not at all.
+*     - int query_route(odr_object *obj, odr_query *q, odr_query_reply *r, int max)
+*         [Page of the route table]
+*     - int query_port(odr_object *obj, odr_query *q, odr_query_reply *r, int max)
+*         [Page of the port table]
+*     - int query_interface(odr_object *obj, odr_query *q, odr_query_reply *r, int max)
+*         [Page of the interface table]
+*     - void query_event(odr_object *obj, odr_event *ev)
+*         [Query socket read handler]
+*     + void query_init(odr_object *obj)
+*         [Query socket constructor]
+*     + void query_free(odr_object *obj)
+*         [Query socket destructor]
+*/
+
+#include "np.h"
+
+/* --------------------------------------------------------------------------
+ *  query_route
+ *
+ *  Page of the route table
+ *
+ *  @param  : odr_object        *obj    [odr object, read locked]
+ *            odr_query         *q      [request]
+ *            odr_query_reply   *r      [reply to fill]
+ *            int               max     [records that fit in the reply]
+ *  @return : int                       [bytes of records]
+ *
+ *  The cursor is the next rtable hash index slot to look at
+ * --------------------------------------------------------------------------
+ */
+int query_route(odr_object *obj, odr_query *q, odr_query_reply *r, int max) {
+    uint            i;
+    long            now = timer_time();
+    odr_rtable      *item;
+    odr_route_rec   *rec = (odr_route_rec *)r->data;
+
+    r->total = obj->rindex.count;
+    for (i = q->cursor; i < obj->rindex.size && r->count < max; i++) {
+        if ((item = (odr_rtable *)obj->rindex.slots[i].val) == NULL)
+            continue;
+        rec->dst = item->dst;
+        memcpy(rec->nexthop, item->nexthop, HWADDR_BUFFSIZE);
+        rec->index = item->index;
+        rec->hopcnt = item->hopcnt;
+        rec->age = now - item->timestamp;
+        rec++;
+        r->count++;
+    }
+    r->cursor = (i < obj->rindex.size) ? i : ODR_QUERY_END;
+    return r->count * sizeof(odr_route_rec);
+}
+
+/* --------------------------------------------------------------------------
+ *  query_port
+ *
+ *  Page of the port table
+ *
+ *  @param  : odr_object        *obj    [odr object, read locked]
+ *            odr_query         *q      [request]
+ *            odr_query_reply   *r      [reply to fill]
+ *            int               max     [records that fit in the reply]
+ *  @return : int                       [bytes of records]
+ *
+ *  The cursor is the position in ptable
+ * --------------------------------------------------------------------------
+ */
+int query_port(odr_object *obj, odr_query *q, odr_query_reply *r, int max) {
+    uint            i = 0;
+    long            now = timer_time();
+    odr_ptable      *item;
+    odr_port_rec    *rec = (odr_port_rec *)r->data;
+
+    for (item = obj->ptable; item != NULL; item = item->next, i++) {
+        r->total++;
+        if (i < q->cursor || r->count >= max)
+            continue;
+        rec->port = item->port;
+        rec->age = item->timestamp ? now - item->timestamp : 0;
+        rec->shm = item->shm != NULL;
+        memcpy(rec->path, item->path, PATHNAME_BUFFSIZE);
+        rec++;
+        r->count++;
+    }
+    r->cursor = (q->cursor + r->count < r->total) ? q->cursor + r->count : ODR_QUERY_END;
+    return r->count * sizeof(odr_port_rec);
+}
+
+/* --------------------------------------------------------------------------
+ *  query_interface
+ *
+ *  Page of the interface table
+ *
+ *  @param  : odr_object        *obj    [odr object, read locked]
+ *            odr_query         *q      [request]
+ *            odr_query_reply   *r      [reply to fill]
+ *            int               max     [records that fit in the reply]
+ *  @return : int                       [bytes of records]
+ *
+ *  The cursor is the position in itable
+ * --------------------------------------------------------------------------
+ */
+int query_interface(odr_object *obj, odr_query *q, odr_query_reply *r, int max) {
+    uint            i = 0;
+    odr_itable      *item;
+    odr_iface_rec   *rec = (odr_iface_rec *)r->data;
+
+    for (item = obj->itable; item != NULL; item = item->hwa_next, i++) {
+        r->total++;
+        if (i < q->cursor || r->count >= max)
+            continue;
+        memcpy(rec->name, item->if_name, IF_NAME);
+        memcpy(rec->haddr, item->if_haddr, IF_HADDR);
+        rec->index = item->if_index;
+        rec->version = get_version_itable(item->if_index, obj);
+        rec->mtu = item->if_mtu;
+        rec++;
+        r->count++;
+    }
+    r->cursor = (q->cursor + r->count < r->total) ? q->cursor + r->count : ODR_QUERY_END;
+    return r->count * sizeof(odr_iface_rec);
+}
+
+/* --------------------------------------------------------------------------
+ *  query_event
+ *
+ *  Query socket read handler
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            odr_event     *ev     [query socket event]
+ *  @return : void
+ *
+ *  Answer every pending request with one page. The reply echoes the table
+ *  and the cursor of the request. It is sent without blocking; if the
+ *  client is not reading, the page is dropped and the client asks again
+ *  with the same cursor
+ * --------------------------------------------------------------------------
+ */
+void query_event(odr_object *obj, odr_event *ev) {
+    int                 n, len;
+    char                buf[ODR_QUERY_MAXLEN];
+    odr_query           q;
+    odr_query_reply     *r = (odr_query_reply *)buf;
+    struct sockaddr_un  cliaddr;
+    socklen_t           clilen;
+
+    while (1) {
+        clilen = sizeof(cliaddr);
+        if ((n = recvfrom(ev->fd, &q, sizeof(q), 0, (SA *)&cliaddr, &clilen)) < 0)
+            break;
+        if (n < (int)sizeof(q) || clilen <= offsetof(struct sockaddr_un, sun_path))
+            continue;
+
+        bzero(r, sizeof(odr_query_reply));
+        r->table = q.table;
+        r->start = q.cursor;
+        pthread_rwlock_rdlock(&obj->lock);
+        switch (q.table) {
+        case ODR_QUERY_ROUTE:
+            n = (ODR_QUERY_MAXLEN - sizeof(odr_query_reply)) / sizeof(odr_route_rec);
+            len = query_route(obj, &q, r, (q.max && q.max < n) ? q.max : n);
+            break;
+        case ODR_QUERY_PORT:
+            n = (ODR_QUERY_MAXLEN - sizeof(odr_query_reply)) / sizeof(odr_port_rec);
+            len = query_port(obj, &q, r, (q.max && q.max < n) ? q.max : n);
+            break;
+        case ODR_QUERY_INTERFACE:
+            n = (ODR_QUERY_MAXLEN - sizeof(odr_query_reply)) / sizeof(odr_iface_rec);
+            len = query_interface(obj, &q, r, (q.max && q.max < n) ? q.max : n);
+            break;
+        default:
+            // unknown table: empty last page
+            r->cursor = ODR_QUERY_END;
+            len = 0;
+        }
+        pthread_rwlock_unlock(&obj->lock);
+
+        if (sendto(ev->fd, buf, sizeof(odr_query_reply) + len, MSG_DONTWAIT, (SA *)&cliaddr, clilen) < 0)
+            log_warn("[query] sendto %s error: %s", cliaddr.sun_path, strerror(errno));
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  query_init
+ *
+ *  Query socket constructor
+ *
+ *  @param  : odr_object    *obj    [odr object, event loop initialized]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void query_init(odr_object *obj) {
+    struct sockaddr_un addr;
+
+    bzero(&addr, sizeof(addr));
+    addr.sun_family = AF_LOCAL;
+    strcpy(addr.sun_path, ODR_QUERY_PATH);
+
+    unlink(ODR_QUERY_PATH);
+    obj->q_sockfd = Socket(AF_LOCAL, SOCK_DGRAM, 0);
+    Bind(obj->q_sockfd, (SA *)&addr, sizeof(addr));
+    event_add(obj, &obj->q_event, obj->q_sockfd, query_event);
+}
+
+/* --------------------------------------------------------------------------
+ *  query_free
+ *
+ *  Query socket destructor
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void query_free(odr_object *obj) {
+    if (obj->q_sockfd > 0) {
+        close(obj->q_sockfd);
+        unlink(ODR_QUERY_PATH);
+    }
+}
@@ -0,0 +1,176 @@
+/*
+* @File: odr_reasm.c
+* @Date: 2026-10-17 20:29:56
+* @Last Modified time: 2026-10-17 20:45:12
+* @Description:
+*     Reassembly of fragmented APPMSGs at the destination. A buffer is kept
+*     per <source, message id> in a list, newest first. Memory is bounded:
+*     at most ODR_REASM_MAX buffers and ODR_REASM_MAXBYTES of message data,
+*     the oldest buffer is dropped to make room. A message that is not
+*     complete within ODR_REASM_TIMEOUT seconds is dropped.
+*     - odr_reasm *reasm_find(odr_object *obj, in_addr_t src, ushort msg_id)
+*         [Reassembly buffer lookup]
+*     - void reasm_remove(odr_object *obj, odr_reasm *r)
+*         [Unlink and release a reassembly buffer]
+*     - void reasm_expire(odr_object *obj, odr_timer *timer)
+*         [Reassembly timer callback]
+*     + odr_apacket *reasm_add(odr_object *obj, odr_apacket *frag)
+*         [Add a fragment]
+*     + void reasm_free(odr_object *obj)
+*         [Reassembly destructor]
+*/
+
+#include "np.h"
+
+/* --------------------------------------------------------------------------
+ *  reasm_find
+ *
+ *  Reassembly buffer lookup
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            in_addr_t     src     [source IP address]
+ *            ushort        msg_id  [message id of the source]
+ *  @return : odr_reasm *           [buffer, NULL if not found]
+ * --------------------------------------------------------------------------
+ */
+odr_reasm *reasm_find(odr_object *obj, in_addr_t src, ushort msg_id) {
+    odr_reasm *r;
+
+    for (r = obj->reasm; r; r = r->next)
+        if (r->src == src && r->msg_id == msg_id)
+            return r;
+    return NULL;
+}
+
+/* --------------------------------------------------------------------------
+ *  reasm_remove
+ *
+ *  Unlink and release a reassembly buffer
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            odr_reasm     *r      [buffer]
+ *  @return : void
+ *
+ *  The message is released too, unless the caller took it (r->msg NULL)
+ * --------------------------------------------------------------------------
+ */
+void reasm_remove(odr_object *obj, odr_reasm *r) {
+    timer_del(&obj->wheel, &r->timer);
+
+    if (r->prev)
+        r->prev->next = r->next;
+    else
+        obj->reasm = r->next;
+    if (r->next)
+        r->next->prev = r->prev;
+
+    obj->reasm_count--;
+    obj->reasm_bytes -= r->total;
+
+    free(r->msg);
+    free(r->bitmap);
+    free(r);
+}
+
+/* --------------------------------------------------------------------------
+ *  reasm_expire
+ *
+ *  Reassembly timer callback
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            odr_timer     *timer  [buffer timer]
+ *  @return : void
+ *
+ *  Drop a message whose fragments did not all arrive in time
+ * --------------------------------------------------------------------------
+ */
+void reasm_expire(odr_object *obj, odr_timer *timer) {
+    odr_reasm *r = TIMER_ENTRY(timer, odr_reasm, timer);
+
+    log_warn("[reasm] Timeout on APPMSG %d from %I (%d/%d bytes), dropped.", r->msg_id, r->src, r->received, r->total);
+    reasm_remove(obj, r);
+}
+
+/* --------------------------------------------------------------------------
+ *  reasm_add
+ *
+ *  Add a fragment
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            odr_apacket   *frag   [fragment, reached its destination]
+ *  @return : odr_apacket *         [the whole message once the last byte
+ *                                   arrives, NULL otherwise; the caller
+ *                                   frees it]
+ *
+ *  Duplicated bytes (a fragment resent, or cut differently on another
+ *  path) are only counted once. A fragment that disagrees on the message
+ *  length is dropped
+ * --------------------------------------------------------------------------
+ */
+odr_apacket *reasm_add(odr_object *obj, odr_apacket *frag) {
+    int         i;
+    odr_reasm   *r, *tail;
+    odr_apacket *msg;
+
+    if ((r = reasm_find(obj, frag->src, frag->msg_id)) == NULL) {
+        // make room, oldest first
+        while (obj->reasm && (obj->reasm_count >= ODR_REASM_MAX || obj->reasm_bytes + frag->total > ODR_REASM_MAXBYTES)) {
+            for (tail = obj->reasm; tail->next; tail = tail->next)
+                ;
+            log_warn("[reasm] Buffer full, APPMSG %d from %I dropped.", tail->msg_id, tail->src);
+            reasm_remove(obj, tail);
+        }
+
+        r = (odr_reasm *)Calloc(1, sizeof(odr_reasm));
+        r->src = frag->src;
+        r->msg_id = frag->msg_id;
+        r->total = frag->total;
+        r->bitmap = (uchar *)Calloc((frag->total + 7) / 8, 1);
+        r->msg = (odr_apacket *)Calloc(1, offsetof(odr_apacket, data) + frag->total + 1);
+        memcpy(r->msg, frag, offsetof(odr_apacket, data));
+        r->msg->offset = 0;
+        r->msg->length = frag->total;
+
+        r->next = obj->reasm;
+        if (obj->reasm)
+            obj->reasm->prev = r;
+        obj->reasm = r;
+        obj->reasm_count++;
+        obj->reasm_bytes += r->total;
+        timer_add(&obj->wheel, &r->timer, obj->wheel.now + ODR_REASM_TIMEOUT, reasm_expire);
+    } else if (r->total != frag->total) {
+        log_warn("[reasm] APPMSG %d from %I length mismatch, fragment dropped.", frag->msg_id, frag->src);
+        return NULL;
+    }
+
+    memcpy(r->msg->data + frag->offset, frag->data, frag->length);
+    for (i = frag->offset; i < frag->offset + frag->length; i++) {
+        if ((r->bitmap[i >> 3] & (1 << (i & 7))) == 0) {
+            r->bitmap[i >> 3] |= 1 << (i & 7);
+            r->received++;
+        }
+    }
+
+    if (r->received < r->total)
+        return NULL;
+
+    msg = r->msg;
+    msg->data[msg->length] = 0;
+    r->msg = NULL;
+    reasm_remove(obj, r);
+    return msg;
+}
+
+/* --------------------------------------------------------------------------
+ *  reasm_free
+ *
+ *  Reassembly destructor
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void reasm_free(odr_object *obj) {
+    while (obj->reasm)
+        reasm_remove(obj, obj->reasm);
+}
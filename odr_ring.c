@@ -0,0 +1,298 @@
+/*
+* @File: odr_ring.c
+* @Date: 2026-10-17 20:20:46
+* @Last Modified time: 2026-10-17 21:55:59
+* @Description:
+*     PACKET_MMAP rings for the PF_PACKET socket. Frames are received from a
+*     TPACKET_V3 ring one block at a time and handed to the frame processor
+*     in place; frames to send are written into a TPACKET_V2 ring and the
+*     kernel is kicked once per batch. The TX ring lives on a second socket
+*     bound to no protocol, since the ring version is per socket.
+*     - int ring_setup_rx(odr_ring *ring, int fd)
+*         [Map the receive ring]
+*     - int ring_setup_tx(odr_ring *ring, int mtu)
+*         [Map the transmit ring]
+*     + int ring_init(odr_ring *ring, int fd, int mtu)
+*         [Ring constructor]
+*     + int ring_recv(odr_object *obj, odr_ring *ring, odr_frame_fn fn)
+*         [Process all received blocks]
+*     + int ring_send(odr_ring *ring, int if_index, odr_frame *frame, int len)
+*         [Queue a frame into the transmit ring]
+*     + void ring_flush(odr_ring *ring)
+*         [Transmit the queued frames]
+*     + void ring_free(odr_ring *ring)
+*         [Ring destructor]
+*/
+
+#include "np.h"
+
+/* --------------------------------------------------------------------------
+ *  ring_setup_rx
+ *
+ *  Map the receive ring
+ *
+ *  @param  : odr_ring  *ring   [ring]
+ *            int       fd      [PF_PACKET socket]
+ *  @return : int               [0 if succeed, -1 if failed]
+ *
+ *  A block is handed to user space when it is full, or when it has frames
+ *  and ODR_RING_TIMEOUT milliseconds have passed
+ * --------------------------------------------------------------------------
+ */
+int ring_setup_rx(odr_ring *ring, int fd) {
+    int version = TPACKET_V3;
+    struct tpacket_req3 req;
+
+    if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+        return -1;
+
+    bzero(&req, sizeof(req));
+    req.tp_block_size = ODR_RING_BLOCK_SIZE;
+    req.tp_block_nr = ODR_RING_RX_BLOCK_NR;
+    req.tp_frame_size = ODR_RING_FRAME_SIZE;
+    req.tp_frame_nr = ODR_RING_BLOCK_SIZE / ODR_RING_FRAME_SIZE * ODR_RING_RX_BLOCK_NR;
+    req.tp_retire_blk_tov = ODR_RING_TIMEOUT;
+    if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+        return -1;
+    ring->rx_fd = fd;
+
+    ring->rx_len = (size_t)req.tp_block_size * req.tp_block_nr;
+    ring->rx_map = mmap(NULL, ring->rx_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring->rx_map == MAP_FAILED) {
+        ring->rx_map = NULL;
+        return -1;
+    }
+    ring->rx_cur = 0;
+    return 0;
+}
+
+/* --------------------------------------------------------------------------
+ *  ring_setup_tx
+ *
+ *  Map the transmit ring
+ *
+ *  @param  : odr_ring  *ring   [ring]
+ *            int       mtu     [largest interface MTU]
+ *  @return : int               [0 if succeed, -1 if failed]
+ *
+ *  A slot holds the slot header and a frame of mtu bytes, so fragments as
+ *  large as the link allows go through the ring too. Slots do not cross
+ *  blocks
+ * --------------------------------------------------------------------------
+ */
+int ring_setup_tx(odr_ring *ring, int mtu) {
+    int version = TPACKET_V2;
+    struct tpacket_req req;
+
+    // protocol 0: the socket only transmits
+    if ((ring->tx_fd = socket(PF_PACKET, SOCK_RAW, 0)) < 0)
+        return -1;
+    if (setsockopt(ring->tx_fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+        return -1;
+
+    ring->tx_size = TPACKET_ALIGN(TPACKET2_HDRLEN - sizeof(struct sockaddr_ll) + ETH_HLEN + mtu);
+    ring->tx_per_block = ODR_RING_BLOCK_SIZE / ring->tx_size;
+
+    bzero(&req, sizeof(req));
+    req.tp_block_size = ODR_RING_BLOCK_SIZE;
+    req.tp_block_nr = ODR_RING_TX_BLOCK_NR;
+    req.tp_frame_size = ring->tx_size;
+    req.tp_frame_nr = ring->tx_per_block * ODR_RING_TX_BLOCK_NR;
+    if (setsockopt(ring->tx_fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0)
+        return -1;
+
+    ring->tx_len = (size_t)req.tp_block_size * req.tp_block_nr;
+    ring->tx_map = mmap(NULL, ring->tx_len, PROT_READ | PROT_WRITE, MAP_SHARED, ring->tx_fd, 0);
+    if (ring->tx_map == MAP_FAILED) {
+        ring->tx_map = NULL;
+        return -1;
+    }
+    ring->tx_nr = req.tp_frame_nr;
+    ring->tx_cur = 0;
+    ring->tx_pending = 0;
+    ring->tx_ifindex = 0;
+    return 0;
+}
+
+/* --------------------------------------------------------------------------
+ *  ring_init
+ *
+ *  Ring constructor
+ *
+ *  @param  : odr_ring  *ring   [ring]
+ *            int       fd      [PF_PACKET socket, receives into the ring]
+ *            int       mtu     [largest interface MTU]
+ *  @return : int               [0 if succeed, -1 if the kernel does not
+ *                               support the rings]
+ *
+ *  On failure nothing is left mapped and the caller keeps using the plain
+ *  socket functions
+ * --------------------------------------------------------------------------
+ */
+int ring_init(odr_ring *ring, int fd, int mtu) {
+    bzero(ring, sizeof(odr_ring));
+    ring->rx_fd = -1;
+    ring->tx_fd = -1;
+
+    if (ring_setup_rx(ring, fd) < 0 || ring_setup_tx(ring, mtu) < 0) {
+        ring_free(ring);
+        return -1;
+    }
+    return 0;
+}
+
+/* --------------------------------------------------------------------------
+ *  ring_recv
+ *
+ *  Process all received blocks
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            odr_ring      *ring   [ring]
+ *            odr_frame_fn  fn      [frame processor]
+ *  @return : int                   [number of frames processed]
+ *
+ *  Walk every block owned by user space, call fn for each frame in it, then
+ *  give the block back to the kernel. A frame of at least ODR_FRAME_BASELEN
+ *  bytes is passed in place, a short one is copied into a zeroed frame
+ *  first
+ * --------------------------------------------------------------------------
+ */
+int ring_recv(odr_object *obj, odr_ring *ring, odr_frame_fn fn) {
+    int i, n = 0;
+    odr_frame frame;
+    struct tpacket_block_desc *bd;
+    struct tpacket3_hdr *hdr;
+    struct sockaddr_ll *from;
+
+    while (1) {
+        bd = (struct tpacket_block_desc *)(ring->rx_map + (size_t)ring->rx_cur * ODR_RING_BLOCK_SIZE);
+        if ((bd->hdr.bh1.block_status & TP_STATUS_USER) == 0)
+            break;
+        __sync_synchronize();
+
+        hdr = (struct tpacket3_hdr *)((char *)bd + bd->hdr.bh1.offset_to_first_pkt);
+        for (i = 0; i < bd->hdr.bh1.num_pkts; i++) {
+            from = (struct sockaddr_ll *)((char *)hdr + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+            if (hdr->tp_snaplen >= ODR_FRAME_BASELEN) {
+                fn(obj, (odr_frame *)((char *)hdr + hdr->tp_mac), hdr->tp_snaplen, from);
+            } else {
+                bzero(&frame, ODR_FRAME_BASELEN);
+                memcpy(&frame, (char *)hdr + hdr->tp_mac, hdr->tp_snaplen);
+                fn(obj, &frame, hdr->tp_snaplen, from);
+            }
+            hdr = (struct tpacket3_hdr *)((char *)hdr + hdr->tp_next_offset);
+        }
+        n += bd->hdr.bh1.num_pkts;
+
+        __sync_synchronize();
+        bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+        ring->rx_cur = (ring->rx_cur + 1) % ODR_RING_RX_BLOCK_NR;
+    }
+    return n;
+}
+
+/* --------------------------------------------------------------------------
+ *  ring_send
+ *
+ *  Queue a frame into the transmit ring
+ *
+ *  @param  : odr_ring      *ring       [ring]
+ *            int           if_index    [interface index]
+ *            odr_frame     *frame      [frame]
+ *            int           len         [frame length]
+ *  @return : int   [the number of bytes queued, -1 if the ring is full or
+ *                   the frame does not fit a slot]
+ *
+ *  The kernel sends a whole batch through one interface, so a frame for
+ *  another interface flushes the batch first. The destination MAC address
+ *  is already in the frame header
+ * --------------------------------------------------------------------------
+ */
+int ring_send(odr_ring *ring, int if_index, odr_frame *frame, int len) {
+    struct tpacket2_hdr *hdr;
+
+    if (TPACKET2_HDRLEN - sizeof(struct sockaddr_ll) + len > ring->tx_size)
+        return -1;
+
+    if (ring->tx_pending && ring->tx_ifindex != if_index)
+        ring_flush(ring);
+
+    hdr = (struct tpacket2_hdr *)(ring->tx_map + (size_t)(ring->tx_cur / ring->tx_per_block) * ODR_RING_BLOCK_SIZE +
+                                  (size_t)(ring->tx_cur % ring->tx_per_block) * ring->tx_size);
+    if (hdr->tp_status != TP_STATUS_AVAILABLE) {
+        ring_flush(ring);
+        if (hdr->tp_status != TP_STATUS_AVAILABLE)
+            return -1;
+    }
+
+    memcpy((char *)hdr + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll), frame, len);
+    hdr->tp_len = len;
+    __sync_synchronize();
+    hdr->tp_status = TP_STATUS_SEND_REQUEST;
+
+    ring->tx_cur = (ring->tx_cur + 1) % ring->tx_nr;
+    ring->tx_ifindex = if_index;
+    ring->tx_pending++;
+    return len;
+}
+
+/* --------------------------------------------------------------------------
+ *  ring_flush
+ *
+ *  Transmit the queued frames
+ *
+ *  @param  : odr_ring  *ring   [ring]
+ *  @return : void
+ *
+ *  One syscall for the whole batch; it returns when the frames are sent and
+ *  their slots are available again
+ * --------------------------------------------------------------------------
+ */
+void ring_flush(odr_ring *ring) {
+    struct sockaddr_ll socket_address;
+
+    if (ring->tx_pending == 0)
+        return;
+
+    bzero(&socket_address, sizeof(socket_address));
+    socket_address.sll_family   = PF_PACKET;
+    socket_address.sll_protocol = htons(PROTOCOL_ID);
+    socket_address.sll_ifindex  = ring->tx_ifindex;
+    socket_address.sll_halen    = ETH_ALEN;
+
+    if (sendto(ring->tx_fd, NULL, 0, 0, (SA *)&socket_address, sizeof(socket_address)) < 0)
+        err_ret("[ring_flush] sendto error");
+    ring->tx_pending = 0;
+}
+
+/* --------------------------------------------------------------------------
+ *  ring_free
+ *
+ *  Ring destructor
+ *
+ *  @param  : odr_ring  *ring   [ring]
+ *  @return : void
+ *
+ *  Unmap both rings and close the transmit socket. The receive socket
+ *  belongs to the caller, its ring is released so that recvfrom() works on
+ *  it again
+ * --------------------------------------------------------------------------
+ */
+void ring_free(odr_ring *ring) {
+    struct tpacket_req3 req;
+
+    if (ring->rx_map)
+        munmap(ring->rx_map, ring->rx_len);
+    if (ring->rx_fd >= 0) {
+        bzero(&req, sizeof(req));
+        setsockopt(ring->rx_fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));
+    }
+    if (ring->tx_map)
+        munmap(ring->tx_map, ring->tx_len);
+    if (ring->tx_fd >= 0)
+        close(ring->tx_fd);
+    ring->rx_map = NULL;
+    ring->tx_map = NULL;
+    ring->rx_fd = -1;
+    ring->tx_fd = -1;
+}
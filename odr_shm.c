@@ -0,0 +1,232 @@
+/*
+* @File: odr_shm.c
+* @Date: 2026-10-17 20:35:01
+* @Last Modified time: 2026-10-17 20:35:01
+* @Description:
+*     Shared-memory transport between an application and the ODR service.
+*     The application creates a memfd holding two single-producer
+*     single-consumer rings (odr_shm_area) and two eventfd doorbells, and
+*     hands the descriptors to ODR over the domain socket (SCM_RIGHTS).
+*     Records are written in place and published by moving the head; the
+*     doorbell is only rung when a ring goes from empty to non-empty, so a
+*     busy consumer costs no system call per message.
+*     + odr_shm *shm_create(void)
+*         [Create a transport (application side)]
+*     + odr_shm *shm_attach(int memfd, int tx_bell, int rx_bell)
+*         [Map a received transport (ODR side)]
+*     + void shm_free(odr_shm *shm)
+*         [Transport destructor]
+*     + char *shm_reserve(odr_shm_ring *ring, uint len)
+*         [Reserve a record (producer)]
+*     + int shm_commit(odr_shm_ring *ring, uint len)
+*         [Publish the reserved record (producer)]
+*     + char *shm_peek(odr_shm_ring *ring, uint *len)
+*         [Next record (consumer)]
+*     + void shm_release(odr_shm_ring *ring, uint len)
+*         [Consume the record (consumer)]
+*     + void shm_ring_bell(int fd)
+*         [Ring a doorbell]
+*/
+
+#include "np.h"
+
+// ring bytes taken by a record with len bytes of payload
+#define SHM_RECLEN(len) ((sizeof(odr_shm_rec) + (len) + ODR_SHM_ALIGN - 1) & ~(ODR_SHM_ALIGN - 1))
+
+/* --------------------------------------------------------------------------
+ *  shm_create
+ *
+ *  Create a transport (application side)
+ *
+ *  @param  : void
+ *  @return : odr_shm *     [transport, NULL if failed]
+ * --------------------------------------------------------------------------
+ */
+odr_shm *shm_create(void) {
+    odr_shm *shm = (odr_shm *)Calloc(1, sizeof(odr_shm));
+
+    shm->memfd = memfd_create("odr_shm", MFD_CLOEXEC);
+    shm->tx_bell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    shm->rx_bell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    shm->area = MAP_FAILED;
+    if (shm->memfd >= 0 && ftruncate(shm->memfd, sizeof(odr_shm_area)) == 0)
+        shm->area = mmap(NULL, sizeof(odr_shm_area), PROT_READ | PROT_WRITE, MAP_SHARED, shm->memfd, 0);
+
+    if (shm->area == MAP_FAILED || shm->tx_bell < 0 || shm->rx_bell < 0) {
+        shm->area = NULL;
+        shm_free(shm);
+        return NULL;
+    }
+    return shm;
+}
+
+/* --------------------------------------------------------------------------
+ *  shm_attach
+ *
+ *  Map a received transport (ODR side)
+ *
+ *  @param  : int   memfd   [memfd of the application]
+ *            int   tx_bell [eventfd, application -> ODR]
+ *            int   rx_bell [eventfd, ODR -> application]
+ *  @return : odr_shm *     [transport, NULL if the memfd is too small]
+ *
+ *  The transport owns the descriptors, they are closed on failure too
+ * --------------------------------------------------------------------------
+ */
+odr_shm *shm_attach(int memfd, int tx_bell, int rx_bell) {
+    struct stat st;
+    odr_shm *shm = (odr_shm *)Calloc(1, sizeof(odr_shm));
+
+    shm->memfd = memfd;
+    shm->tx_bell = tx_bell;
+    shm->rx_bell = rx_bell;
+    if (fstat(memfd, &st) < 0 || st.st_size < (off_t)sizeof(odr_shm_area) ||
+        (shm->area = mmap(NULL, sizeof(odr_shm_area), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0)) == MAP_FAILED) {
+        shm->area = NULL;
+        shm_free(shm);
+        return NULL;
+    }
+    return shm;
+}
+
+/* --------------------------------------------------------------------------
+ *  shm_free
+ *
+ *  Transport destructor
+ *
+ *  @param  : odr_shm   *shm    [transport]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void shm_free(odr_shm *shm) {
+    if (shm->area)
+        munmap(shm->area, sizeof(odr_shm_area));
+    if (shm->memfd >= 0)
+        close(shm->memfd);
+    if (shm->tx_bell >= 0)
+        close(shm->tx_bell);
+    if (shm->rx_bell >= 0)
+        close(shm->rx_bell);
+    free(shm);
+}
+
+/* --------------------------------------------------------------------------
+ *  shm_reserve
+ *
+ *  Reserve a record (producer)
+ *
+ *  @param  : odr_shm_ring  *ring   [ring]
+ *            uint          len     [payload length]
+ *  @return : char *                [payload, NULL if the ring is full]
+ *
+ *  The payload is written in place and published with shm_commit() with
+ *  the same length. A record never wraps: if it does not fit before the
+ *  end of the ring, it goes to the start
+ * --------------------------------------------------------------------------
+ */
+char *shm_reserve(odr_shm_ring *ring, uint len) {
+    uint head = ring->head;
+    uint tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint off = head % ODR_SHM_RINGSIZE;
+    uint need = SHM_RECLEN(len);
+
+    if (need > ODR_SHM_RINGSIZE / 2)
+        return NULL;
+    if (ODR_SHM_RINGSIZE - off < need) {
+        need += ODR_SHM_RINGSIZE - off;
+        off = 0;
+    }
+    if (ODR_SHM_RINGSIZE - (head - tail) < need)
+        return NULL;
+    return ((odr_shm_rec *)(ring->data + off))->data;
+}
+
+/* --------------------------------------------------------------------------
+ *  shm_commit
+ *
+ *  Publish the reserved record (producer)
+ *
+ *  @param  : odr_shm_ring  *ring   [ring]
+ *            uint          len     [payload length given to shm_reserve()]
+ *  @return : int   [1 if the ring was empty, the doorbell must be rung]
+ * --------------------------------------------------------------------------
+ */
+int shm_commit(odr_shm_ring *ring, uint len) {
+    uint head = ring->head, start = ring->head;
+    uint off = head % ODR_SHM_RINGSIZE;
+    odr_shm_rec *rec;
+
+    if (ODR_SHM_RINGSIZE - off < SHM_RECLEN(len)) {
+        ((odr_shm_rec *)(ring->data + off))->len = ODR_SHM_WRAP;
+        head += ODR_SHM_RINGSIZE - off;
+        off = 0;
+    }
+    rec = (odr_shm_rec *)(ring->data + off);
+    rec->len = len;
+    head += SHM_RECLEN(len);
+
+    // pairs with the consumer: it stores tail, then loads head
+    __atomic_store_n(&ring->head, head, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == start;
+}
+
+/* --------------------------------------------------------------------------
+ *  shm_peek
+ *
+ *  Next record (consumer)
+ *
+ *  @param  : odr_shm_ring  *ring   [ring]
+ *            uint          *len    [payload length]
+ *  @return : char *                [payload, NULL if the ring is empty or
+ *                                   the producer wrote garbage]
+ * --------------------------------------------------------------------------
+ */
+char *shm_peek(odr_shm_ring *ring, uint *len) {
+    uint tail = ring->tail, off;
+    odr_shm_rec *rec;
+
+    while (tail != __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST)) {
+        off = tail % ODR_SHM_RINGSIZE;
+        rec = (odr_shm_rec *)(ring->data + off);
+        if (rec->len == ODR_SHM_WRAP) {
+            tail += ODR_SHM_RINGSIZE - off;
+            __atomic_store_n(&ring->tail, tail, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        *len = rec->len;
+        if (*len > ODR_SHM_RINGSIZE || SHM_RECLEN(*len) > ODR_SHM_RINGSIZE - off)
+            return NULL;
+        return rec->data;
+    }
+    return NULL;
+}
+
+/* --------------------------------------------------------------------------
+ *  shm_release
+ *
+ *  Consume the record (consumer)
+ *
+ *  @param  : odr_shm_ring  *ring   [ring]
+ *            uint          len     [payload length given by shm_peek()]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void shm_release(odr_shm_ring *ring, uint len) {
+    __atomic_store_n(&ring->tail, ring->tail + SHM_RECLEN(len), __ATOMIC_SEQ_CST);
+}
+
+/* --------------------------------------------------------------------------
+ *  shm_ring_bell
+ *
+ *  Ring a doorbell
+ *
+ *  @param  : int   fd  [eventfd]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void shm_ring_bell(int fd) {
+    uint64_t one = 1;
+
+    if (write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        err_ret("[shm_ring_bell] write error");
+}
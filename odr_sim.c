@@ -0,0 +1,790 @@
+/*
+* @File: odr_sim.c
+* @Date: 2026-10-17 21:11:48
+* @Last Modified time: 2026-10-17 22:05:36
+* @Description:
+*     Network simulator. Runs any number of odr_object instances in one
+*     process, joined by broadcast segments, on the virtual clock of
+*     odr_timer.c. The nodes run the real handlers; only the transport is
+*     replaced: a frame sent on an interface becomes an event that hands a
+*     copy to every other interface of the segment (or to the one with the
+*     destination MAC address) after the link latency, and an APPMSG that
+*     reaches its destination is counted instead of going to a domain
+*     socket. Events are processed in (time, sequence) order and nothing
+*     depends on the system clocks, so a run is deterministic and takes
+*     only as long as the handlers do, not as long as the virtual time.
+*     Before any event at a node the node's timer wheels are run up to the
+*     event time, as the event loop does every round; a TIMER event is
+*     scheduled for the next expiry of each node's wheels.
+*     Topology: a file with one segment per line, listing the numbers of
+*     the nodes on it ('#' starts a comment), or "grid:WxH", W * H nodes
+*     with a two-node segment between horizontal and vertical neighbors.
+*     Node n has address ODR_SIM_NET + n and MAC address 02:00:n:i for its
+*     interface i. A file line "v1 n ..." makes those nodes (already on a
+*     segment) behave as nodes not upgraded to the v2 frame format, to
+*     try a rolling upgrade: they drop v2 frames, do not read the bin bit
+*     and send their own route packets without it. A line "v2 n ..." makes
+*     them v2 nodes from before the request id (v3): they do not see the
+*     ODR_FRAME_V3 bit or the rid flag, and do not send them.
+*     Every delivered message is checked against what was sent, so a frame
+*     read in the wrong layout counts as lost.
+*     - void sim_push(odr_sim *sim, odr_sim_event *ev)
+*         [Schedule an event]
+*     - odr_sim_event *sim_pop(odr_sim *sim)
+*         [Take the earliest event]
+*     - odr_sim_event *sim_event(odr_sim *sim, odr_sim_type type, int node, long usec, int len)
+*         [Event constructor]
+*     - odr_frame *sim_slot(odr_object *obj)
+*         [Simulated frame output buffer]
+*     - int sim_send(odr_object *obj, int if_index, odr_frame *frame, int len, uchar pkttype)
+*         [Simulated frame output]
+*     - void sim_flush(odr_object *obj)
+*         [Simulated frame output flush]
+*     - void sim_deliver(odr_object *obj, odr_apacket *appmsg)
+*         [Simulated APPMSG delivery]
+*     - void sim_wake(odr_sim *sim, odr_sim_node *node)
+*         [Schedule the next timer event of a node]
+*     - void sim_frame(odr_sim_node *node, odr_sim_event *ev)
+*         [Frame event]
+*     - void sim_msg(odr_sim *sim, odr_sim_node *node, odr_sim_event *ev)
+*         [Application message event]
+*     - int sim_attach(odr_sim *sim, int link, int node)
+*         [Put a node on a segment]
+*     - int sim_load_old(odr_sim *sim, char *p, int version)
+*         [Nodes not upgraded]
+*     - int sim_load_grid(odr_sim *sim, int w, int h)
+*         [Grid topology]
+*     - int sim_load_file(odr_sim *sim, const char *path)
+*         [Topology file]
+*     + int sim_load(odr_sim *sim, const char *spec, long latency)
+*         [Simulator constructor]
+*     + void sim_node(odr_sim_node *node, ulong staleness)
+*         [Create a node]
+*     + void sim_start(odr_sim *sim, ulong staleness)
+*         [Create the nodes]
+*     + void sim_message(odr_sim *sim, long usec, int src, int dst, int frd)
+*         [Schedule an application message]
+*     + void sim_run(odr_sim *sim, long until)
+*         [Run the simulation]
+*     + void sim_stats(odr_sim *sim, odr_stats *sum)
+*         [Statistics of all nodes]
+*     + void sim_free(odr_sim *sim)
+*         [Simulator destructor]
+*/
+
+#include "np.h"
+
+// the simulation the transport functions belong to
+static odr_sim *sim_net;
+
+/* --------------------------------------------------------------------------
+ *  sim_push
+ *
+ *  Schedule an event
+ *
+ *  @param  : odr_sim       *sim    [simulator]
+ *            odr_sim_event *ev     [event, usec and seq set]
+ *  @return : void
+ *
+ *  Binary min-heap on (usec, seq)
+ * --------------------------------------------------------------------------
+ */
+void sim_push(odr_sim *sim, odr_sim_event *ev) {
+    uint            i, parent;
+    odr_sim_event   *p;
+
+    if (sim->count == sim->size) {
+        sim->size = sim->size ? sim->size * 2 : 1024;
+        if ((sim->heap = (odr_sim_event **)realloc(sim->heap, sim->size * sizeof(odr_sim_event *))) == NULL)
+            err_quit("[sim] out of memory");
+    }
+    for (i = sim->count++; i > 0; i = parent) {
+        parent = (i - 1) / 2;
+        p = sim->heap[parent];
+        if (p->usec < ev->usec || (p->usec == ev->usec && p->seq < ev->seq))
+            break;
+        sim->heap[i] = p;
+    }
+    sim->heap[i] = ev;
+}
+
+/* --------------------------------------------------------------------------
+ *  sim_pop
+ *
+ *  Take the earliest event
+ *
+ *  @param  : odr_sim       *sim    [simulator, at least one event]
+ *  @return : odr_sim_event *       [event, to be freed by the caller]
+ * --------------------------------------------------------------------------
+ */
+odr_sim_event *sim_pop(odr_sim *sim) {
+    uint            i, child;
+    odr_sim_event   *top = sim->heap[0], *last = sim->heap[--sim->count], *c;
+
+    for (i = 0; (child = 2 * i + 1) < sim->count; i = child) {
+        c = sim->heap[child];
+        if (child + 1 < sim->count &&
+            (sim->heap[child + 1]->usec < c->usec || (sim->heap[child + 1]->usec == c->usec && sim->heap[child + 1]->seq < c->seq)))
+            c = sim->heap[++child];
+        if (last->usec < c->usec || (last->usec == c->usec && last->seq < c->seq))
+            break;
+        sim->heap[i] = c;
+    }
+    sim->heap[i] = last;
+    return top;
+}
+
+/* --------------------------------------------------------------------------
+ *  sim_event
+ *
+ *  Event constructor
+ *
+ *  @param  : odr_sim       *sim    [simulator]
+ *            odr_sim_type  type    [event type]
+ *            int           node    [node number]
+ *            long          usec    [virtual time]
+ *            int           len     [frame length, 0 if no frame]
+ *  @return : odr_sim_event *       [event, scheduled]
+ *
+ *  Only the first len bytes of the frame (at least a ODR_FRAME_BASELEN
+ *  frame, which the decoders read whole) are allocated
+ * --------------------------------------------------------------------------
+ */
+odr_sim_event *sim_event(odr_sim *sim, odr_sim_type type, int node, long usec, int len) {
+    odr_sim_event *ev = (odr_sim_event *)Calloc(1, offsetof(odr_sim_event, frame) + max(len, ODR_FRAME_BASELEN));
+
+    ev->usec = usec;
+    ev->seq = sim->seq++;
+    ev->type = type;
+    ev->node = node;
+    ev->len = len;
+    sim_push(sim, ev);
+    return ev;
+}
+
+/* --------------------------------------------------------------------------
+ *  sim_slot
+ *
+ *  Simulated frame output buffer
+ *
+ *  @param  : odr_object    *obj    [odr object of a node]
+ *  @return : odr_frame *           [buffer of the node]
+ *
+ *  sim_send() copies the frame out before the next one is built
+ * --------------------------------------------------------------------------
+ */
+odr_frame *sim_slot(odr_object *obj) {
+    return &((odr_sim_node *)obj)->out;
+}
+
+/* --------------------------------------------------------------------------
+ *  sim_send
+ *
+ *  Simulated frame output
+ *
+ *  @param  : odr_object    *obj        [odr object of a node]
+ *            int           if_index    [interface index]
+ *            odr_frame     *frame      [frame]
+ *            int           len         [frame length]
+ *            uchar         pkttype     [packet type]
+ *  @return : int   [the number of bytes that are sent, -1 if failed]
+ *
+ *  A broadcast reaches every other interface of the segment, a unicast
+ *  the interface with the destination MAC address, after the latency.
+ *  A v1 node originates route packets without the bin bit; one it relays
+ *  keeps the bit, as a v1 node copies the flags of the packet it relays
+ *  (the originators are v2 in the topologies this is used for). A v2 node
+ *  sends neither the ODR_FRAME_V3 bit nor the rid flag
+ * --------------------------------------------------------------------------
+ */
+int sim_send(odr_object *obj, int if_index, odr_frame *frame, int len, uchar pkttype) {
+    int             i;
+    odr_sim_node    *node = (odr_sim_node *)obj, *peer;
+    odr_sim_link    *link;
+    odr_sim_event   *ev;
+    odr_itable      *interface;
+    odr_rpacket_v1  *r1;
+
+    if (if_index < 1 || if_index > node->nifs)
+        return -1;
+    r1 = (odr_rpacket_v1 *)frame->data;
+    if (node->version == ODR_VERSION_V1 && (frame->h_type & ODR_FRAME_V2) == 0 && ODR_FRAME_TYPE(frame->h_type) <= ODR_FRAME_RREP && r1->hopcnt == 0)
+        r1->flag.bin = 0;
+    if (node->version == ODR_VERSION_V2) {
+        if ((frame->h_type & ODR_FRAME_V2) == 0 && ODR_FRAME_TYPE(frame->h_type) <= ODR_FRAME_RREP)
+            r1->flag.rid = 0;
+        frame->h_type &= ~ODR_FRAME_V3;
+    }
+    link = &sim_net->links[node->links[if_index - 1]];
+    for (i = 0; i < link->count; i++) {
+        if (link->nodes[i] == node->id)
+            continue;
+        peer = sim_net->nodes[link->nodes[i]];
+        interface = get_item_itable(link->ifs[i], &peer->obj);
+        if (pkttype != PACKET_BROADCAST && memcmp(frame->h_dest, interface->if_haddr, ETH_ALEN) != 0)
+            continue;
+        ev = sim_event(sim_net, ODR_SIM_FRAME, peer->id, sim_net->now + sim_net->latency, len);
+        ev->if_index = link->ifs[i];
+        memcpy(&ev->frame, frame, len);
+    }
+    return len;
+}
+
+/* --------------------------------------------------------------------------
+ *  sim_flush
+ *
+ *  Simulated frame output flush
+ *
+ *  @param  : odr_object    *obj    [odr object of a node]
+ *  @return : void
+ *
+ *  Nothing to do, sim_send() schedules the frames at once
+ * --------------------------------------------------------------------------
+ */
+void sim_flush(odr_object *obj) {
+}
+
+/* --------------------------------------------------------------------------
+ *  sim_deliver
+ *
+ *  Simulated APPMSG delivery
+ *
+ *  @param  : odr_object    *obj    [odr object of the destination]
+ *            odr_apacket   *appmsg [APPMSG]
+ *  @return : void
+ *
+ *  The data of a message sent by sim_msg() is its send time padded with
+ *  spaces, so the delivery latency is known here. A message whose data is
+ *  anything else was decoded in the wrong layout and is not counted; one
+ *  that kept its request id (the send time too) is
+ * --------------------------------------------------------------------------
+ */
+void sim_deliver(odr_object *obj, odr_apacket *appmsg) {
+    char    *end;
+    long    sent = strtol(appmsg->data, &end, 10);
+
+    while (*end == ' ')
+        end++;
+    if (end == appmsg->data || *end != 0 || end - appmsg->data != appmsg->length) {
+        log_warn("[sim] APPMSG from %I arrived corrupt (%d bytes), not counted.", appmsg->src, appmsg->length);
+        return;
+    }
+    sim_net->delivered++;
+    if (appmsg->req_id == (uint)sent)
+        sim_net->req_kept++;
+    hist_add(&sim_net->msg_latency, max(sim_net->now - sent, 0));
+}
+
+// frames go to the other nodes of the segment, APPMSGs are counted
+static const odr_transport sim_transport = { sim_slot, sim_send, sim_flush, sim_deliver };
+
+/* --------------------------------------------------------------------------
+ *  sim_wake
+ *
+ *  Schedule the next timer event of a node
+ *
+ *  @param  : odr_sim       *sim    [simulator]
+ *            odr_sim_node  *node   [node, wheels run up to now]
+ *  @return : void
+ *
+ *  The next expiry of the fast wheel or the table wheel, whichever comes
+ *  first. A TIMER event already scheduled earlier is kept; one that has
+ *  been overtaken is ignored when it comes up (node->wake differs)
+ * --------------------------------------------------------------------------
+ */
+void sim_wake(odr_sim *sim, odr_sim_node *node) {
+    long t = 0, n;
+
+    if ((n = timer_next(&node->obj.fast)) >= 0)
+        t = (node->obj.fast.now + n) * ODR_TICK_MS * 1000L;
+    if ((n = timer_next(&node->obj.wheel)) >= 0 && (t == 0 || (node->obj.wheel.now + n) * 1000000L < t))
+        t = (node->obj.wheel.now + n) * 1000000L;
+    if (t == 0 || (node->wake > sim->now && node->wake <= t))
+        return;
+
+    node->wake = max(t, sim->now + 1);
+    sim_event(sim, ODR_SIM_TIMER, node->id, node->wake, 0);
+}
+
+/* --------------------------------------------------------------------------
+ *  sim_frame
+ *
+ *  Frame event
+ *
+ *  @param  : odr_sim_node  *node   [receiving node]
+ *            odr_sim_event *ev     [frame event]
+ *  @return : void
+ *
+ *  Hand the frame to the dispatcher as the PF_PACKET socket would. A v1
+ *  node drops v2 frames, whose type it does not know, and does not see
+ *  the bin bit, so it never learns a v2 neighbor and only sends v1. A v2
+ *  node does not see the ODR_FRAME_V3 bit or the rid flag, so it never
+ *  learns a v3 neighbor; a v3 APPMSG would be read in the v2 layout
+ * --------------------------------------------------------------------------
+ */
+void sim_frame(odr_sim_node *node, odr_sim_event *ev) {
+    struct sockaddr_ll from;
+
+    if (node->version == ODR_VERSION_V1) {
+        if (ev->frame.h_type & ODR_FRAME_V2)
+            return;
+        if (ODR_FRAME_TYPE(ev->frame.h_type) <= ODR_FRAME_RREP)
+            ((odr_rpacket_v1 *)ev->frame.data)->flag.bin = 0;
+    }
+    if (node->version == ODR_VERSION_V2) {
+        if ((ev->frame.h_type & ODR_FRAME_V2) == 0 && ODR_FRAME_TYPE(ev->frame.h_type) <= ODR_FRAME_RREP)
+            ((odr_rpacket_v1 *)ev->frame.data)->flag.rid = 0;
+        ev->frame.h_type &= ~ODR_FRAME_V3;
+    }
+    bzero(&from, sizeof(from));
+    from.sll_family = AF_PACKET;
+    from.sll_protocol = htons(PROTOCOL_ID);
+    from.sll_ifindex = ev->if_index;
+    from.sll_halen = ETH_ALEN;
+    from.sll_pkttype = (ev->frame.h_dest[0] & 1) ? PACKET_BROADCAST : PACKET_HOST;
+    memcpy(from.sll_addr, ev->frame.h_source, ETH_ALEN);
+    handle_frame(&node->obj, &ev->frame, ev->len, &from);
+}
+
+/* --------------------------------------------------------------------------
+ *  sim_msg
+ *
+ *  Application message event
+ *
+ *  @param  : odr_sim       *sim    [simulator]
+ *            odr_sim_node  *node   [source node]
+ *            odr_sim_event *ev     [message event]
+ *  @return : void
+ *
+ *  Queue an APPMSG from the time client port to the time server of the
+ *  destination, as the domain socket handler does; the data is the send
+ *  time, padded with spaces to sim->msglen bytes, so a long message is
+ *  fragmented. The request id is the send time too
+ * --------------------------------------------------------------------------
+ */
+void sim_msg(odr_sim *sim, odr_sim_node *node, odr_sim_event *ev) {
+    int         len;
+    odr_object  *obj = &node->obj;
+    odr_apacket *apacket = (odr_apacket *)Calloc(1, offsetof(odr_apacket, data) + max(sim->msglen, 32) + 1);
+
+    len = snprintf(apacket->data, 32, "%ld", ev->usec);
+    if (sim->msglen > len) {
+        memset(apacket->data + len, ' ', sim->msglen - len);
+        len = sim->msglen;
+    }
+    apacket->dst = ev->dst;
+    apacket->dst_port = TIMESERV_PORT;
+    apacket->src = obj->addr;
+    apacket->src_port = TIMESERV_PORT + 1;
+    apacket->frd = ev->frd;
+    apacket->length = len;
+    apacket->msg_id = ++obj->msg_id;
+    apacket->total = apacket->length;
+    apacket->req_id = (uint)ev->usec;
+
+    pthread_rwlock_wrlock(&obj->lock);
+    queue_push(obj, ODR_FRAME_APPMSG, apacket);
+    pthread_rwlock_unlock(&obj->lock);
+    free(apacket);
+    sim->sent++;
+}
+
+/* --------------------------------------------------------------------------
+ *  sim_attach
+ *
+ *  Put a node on a segment
+ *
+ *  @param  : odr_sim   *sim    [simulator]
+ *            int       link    [segment]
+ *            int       node    [node number]
+ *  @return : int               [0 if succeed, -1 if the node has
+ *                               ODR_SIM_MAXIF interfaces already]
+ *
+ *  The node gets a new interface on the segment. sim->nnodes grows to the
+ *  highest node number; the nodes themselves are created by sim_start()
+ * --------------------------------------------------------------------------
+ */
+int sim_attach(odr_sim *sim, int link, int node) {
+    odr_sim_link *l = &sim->links[link];
+
+    if (node > sim->nnodes) {
+        sim->nodes = (odr_sim_node **)realloc(sim->nodes, (node + 1) * sizeof(odr_sim_node *));
+        if (sim->nodes == NULL)
+            err_quit("[sim] out of memory");
+        bzero(sim->nodes + sim->nnodes + 1, (node - sim->nnodes) * sizeof(odr_sim_node *));
+        sim->nnodes = node;
+    }
+    if (sim->nodes[node] == NULL) {
+        sim->nodes[node] = (odr_sim_node *)Calloc(1, sizeof(odr_sim_node));
+        sim->nodes[node]->id = node;
+    }
+    if (sim->nodes[node]->nifs == ODR_SIM_MAXIF)
+        return -1;
+
+    l->nodes = (int *)realloc(l->nodes, (l->count + 1) * sizeof(int));
+    l->ifs = (int *)realloc(l->ifs, (l->count + 1) * sizeof(int));
+    if (l->nodes == NULL || l->ifs == NULL)
+        err_quit("[sim] out of memory");
+    l->nodes[l->count] = node;
+    sim->nodes[node]->links[sim->nodes[node]->nifs] = link;
+    l->ifs[l->count++] = ++sim->nodes[node]->nifs;
+    return 0;
+}
+
+/* --------------------------------------------------------------------------
+ *  sim_load_old
+ *
+ *  Nodes not upgraded
+ *
+ *  @param  : odr_sim   *sim        [simulator]
+ *            char      *p          [node numbers, after "v1" or "v2"]
+ *            int       version     [frame version they run]
+ *  @return : int                   [0 if succeed, -1 if a number is not a
+ *                                   node on a segment]
+ * --------------------------------------------------------------------------
+ */
+int sim_load_old(odr_sim *sim, char *p, int version) {
+    int     n;
+    char    *end;
+
+    for (; ; p = end) {
+        n = strtol(p, &end, 10);
+        if (end == p)
+            break;
+        if (n <= 0 || n > sim->nnodes || sim->nodes[n] == NULL)
+            return -1;
+        sim->nodes[n]->version = version;
+    }
+    while (isspace(*p))
+        p++;
+    return *p == 0 ? 0 : -1;
+}
+
+/* --------------------------------------------------------------------------
+ *  sim_load_grid
+ *
+ *  Grid topology
+ *
+ *  @param  : odr_sim   *sim    [simulator]
+ *            int       w       [columns]
+ *            int       h       [rows]
+ *  @return : int               [0 if succeed, -1 if the grid is empty]
+ *
+ *  Node r * w + c + 1 is at row r, column c
+ * --------------------------------------------------------------------------
+ */
+int sim_load_grid(odr_sim *sim, int w, int h) {
+    int r, c, n;
+
+    if (w <= 0 || h <= 0 || w * h < 2)
+        return -1;
+    sim->links = (odr_sim_link *)Calloc(2 * w * h, sizeof(odr_sim_link));
+    for (r = 0; r < h; r++) {
+        for (c = 0; c < w; c++) {
+            n = r * w + c + 1;
+            if (c + 1 < w) {
+                sim_attach(sim, sim->nlinks, n);
+                sim_attach(sim, sim->nlinks++, n + 1);
+            }
+            if (r + 1 < h) {
+                sim_attach(sim, sim->nlinks, n);
+                sim_attach(sim, sim->nlinks++, n + w);
+            }
+        }
+    }
+    // a 1 x 1 row or column still gets its node
+    if (sim->nnodes < w * h)
+        return -1;
+    return 0;
+}
+
+/* --------------------------------------------------------------------------
+ *  sim_load_file
+ *
+ *  Topology file
+ *
+ *  @param  : odr_sim       *sim    [simulator]
+ *            const char    *path   [topology file]
+ *  @return : int                   [0 if succeed, -1 if the file cannot be
+ *                                   read or a line is invalid]
+ *
+ *  One segment per line, node numbers separated by blanks; a segment
+ *  with fewer than two nodes is an error. Every number from 1 to the
+ *  highest must be used. A line "v1 n ..." or "v2 n ..." marks nodes not
+ *  upgraded
+ * --------------------------------------------------------------------------
+ */
+int sim_load_file(odr_sim *sim, const char *path) {
+    int     n, lineno = 0, size = 0;
+    char    line[4096], *p, *end;
+    FILE    *fp;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+        err_ret("[sim] open %s error", path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineno++;
+        if ((p = strchr(line, '#')) != NULL)
+            *p = 0;
+        for (p = line; isspace(*p); p++)
+            ;
+        if (strncmp(p, "v1", 2) == 0 || strncmp(p, "v2", 2) == 0) {
+            if (sim_load_old(sim, p + 2, p[1] - '0') < 0) {
+                err_msg("[sim] %s:%d: %.2s takes nodes already on a segment", path, lineno, p);
+                fclose(fp);
+                return -1;
+            }
+            continue;
+        }
+        if (sim->nlinks == size) {
+            size = size ? size * 2 : 64;
+            if ((sim->links = (odr_sim_link *)realloc(sim->links, size * sizeof(odr_sim_link))) == NULL)
+                err_quit("[sim] out of memory");
+        }
+        bzero(&sim->links[sim->nlinks], sizeof(odr_sim_link));
+        for (p = line; ; p = end) {
+            n = strtol(p, &end, 10);
+            if (end == p)
+                break;
+            if (n <= 0 || sim_attach(sim, sim->nlinks, n) < 0) {
+                err_msg("[sim] %s:%d: bad node %d, or more than %d interfaces", path, lineno, n, ODR_SIM_MAXIF);
+                fclose(fp);
+                return -1;
+            }
+        }
+        while (isspace(*p))
+            p++;
+        if (*p != 0 || sim->links[sim->nlinks].count == 1) {
+            err_msg("[sim] %s:%d: a segment is two or more node numbers", path, lineno);
+            fclose(fp);
+            return -1;
+        }
+        if (sim->links[sim->nlinks].count > 0)
+            sim->nlinks++;
+    }
+    fclose(fp);
+
+    for (n = 1; n <= sim->nnodes; n++) {
+        if (sim->nodes[n] == NULL) {
+            err_msg("[sim] %s: node %d is on no segment", path, n);
+            return -1;
+        }
+    }
+    return sim->nnodes >= 2 ? 0 : -1;
+}
+
+/* --------------------------------------------------------------------------
+ *  sim_load
+ *
+ *  Simulator constructor
+ *
+ *  @param  : odr_sim       *sim        [simulator to fill]
+ *            const char    *spec       [topology file, or "grid:WxH"]
+ *            long          latency     [per hop latency (us)]
+ *  @return : int                       [0 if succeed, -1 if the topology
+ *                                       is invalid]
+ *
+ *  Build the segments and switch the process to the virtual clock, at
+ *  ODR_SIM_EPOCH seconds
+ * --------------------------------------------------------------------------
+ */
+int sim_load(odr_sim *sim, const char *spec, long latency) {
+    int w, h;
+
+    bzero(sim, sizeof(odr_sim));
+    sim->latency = max(latency, 1);
+    sim->now = ODR_SIM_EPOCH * 1000000L;
+    timer_virtual(sim->now);
+
+    if (sscanf(spec, "grid:%dx%d", &w, &h) == 2)
+        return sim_load_grid(sim, w, h);
+    return sim_load_file(sim, spec);
+}
+
+/* --------------------------------------------------------------------------
+ *  sim_node
+ *
+ *  Create a node
+ *
+ *  @param  : odr_sim_node  *node       [node, id and nifs set]
+ *            ulong         staleness   [route staleness (s)]
+ *  @return : void
+ *
+ *  Set the node up as main() sets up ODR, with the simulated transport
+ *  and nifs interfaces, and no socket
+ * --------------------------------------------------------------------------
+ */
+void sim_node(odr_sim_node *node, ulong staleness) {
+    int         k, id = node->id;
+    uchar       bcast_mac[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    odr_object  *obj = &node->obj;
+    odr_itable  *item, **tail;
+
+    obj->staleness = staleness;
+    obj->addr = htonl(ODR_SIM_NET + id);
+    inet_ntop(AF_INET, &obj->addr, obj->ipaddr, IPADDR_BUFFSIZE);
+    snprintf(obj->hostname, HOSTNAME_BUFFSIZE, "n%d", id);
+    obj->d_sockfd = obj->p_sockfd = -1;
+    obj->ring.rx_fd = obj->ring.tx_fd = -1;
+    obj->free_port = TIMESERV_PORT;
+    obj->tp = &sim_transport;
+    pthread_rwlock_init(&obj->lock, NULL);
+    timer_init(&obj->wheel, timer_time());
+    timer_init(&obj->fast, timer_ticks());
+
+    tail = &obj->itable;
+    for (k = 0; k < node->nifs; k++) {
+        item = (odr_itable *)Calloc(1, sizeof(odr_itable));
+        snprintf(item->if_name, IF_NAME, "eth%d", k + 1);
+        item->if_haddr[0] = 0x02;
+        item->if_haddr[2] = (id >> 16) & 0xff;
+        item->if_haddr[3] = (id >> 8) & 0xff;
+        item->if_haddr[4] = id & 0xff;
+        item->if_haddr[5] = k + 1;
+        item->if_index = k + 1;
+        item->if_mtu = ETH_DATA_LEN;
+        build_frame_template(&item->bcast_hdr, bcast_mac, (uchar *)item->if_haddr);
+        *tail = item;
+        tail = &item->hwa_next;
+    }
+
+    btable_init(&obj->btable, staleness);
+    hash_init(&obj->rindex, ODR_HASH_MINSIZE);
+    hash_init(&obj->queue.index, ODR_HASH_MINSIZE);
+}
+
+/* --------------------------------------------------------------------------
+ *  sim_start
+ *
+ *  Create the nodes
+ *
+ *  @param  : odr_sim   *sim        [simulator, loaded]
+ *            ulong     staleness   [route staleness (s)]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void sim_start(odr_sim *sim, ulong staleness) {
+    int i;
+
+    sim_net = sim;
+    for (i = 1; i <= sim->nnodes; i++)
+        sim_node(sim->nodes[i], staleness);
+}
+
+/* --------------------------------------------------------------------------
+ *  sim_message
+ *
+ *  Schedule an application message
+ *
+ *  @param  : odr_sim   *sim    [simulator, started]
+ *            long      usec    [virtual send time, not before sim->now]
+ *            int       src     [source node]
+ *            int       dst     [destination node]
+ *            int       frd     [forced discovery flag]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void sim_message(odr_sim *sim, long usec, int src, int dst, int frd) {
+    odr_sim_event *ev = sim_event(sim, ODR_SIM_MSG, src, max(usec, sim->now), 0);
+
+    ev->dst = htonl(ODR_SIM_NET + dst);
+    ev->frd = frd;
+}
+
+/* --------------------------------------------------------------------------
+ *  sim_run
+ *
+ *  Run the simulation
+ *
+ *  @param  : odr_sim   *sim    [simulator, started]
+ *            long      until   [virtual time to stop at (us)]
+ *  @return : void
+ *
+ *  Process the events due up to until in order, then leave the clock at
+ *  until. Messages scheduled for later stay pending
+ * --------------------------------------------------------------------------
+ */
+void sim_run(odr_sim *sim, long until) {
+    odr_sim_event   *ev;
+    odr_sim_node    *node;
+
+    while (sim->count > 0 && sim->heap[0]->usec <= until) {
+        ev = sim_pop(sim);
+        sim->now = ev->usec;
+        timer_virtual(sim->now);
+        node = sim->nodes[ev->node];
+
+        if (ev->type == ODR_SIM_TIMER && ev->usec != node->wake) {
+            // overtaken by an earlier wake up
+            free(ev);
+            continue;
+        }
+        if (ev->type == ODR_SIM_TIMER)
+            node->wake = 0;
+        purge_tables(&node->obj);
+
+        if (ev->type == ODR_SIM_FRAME) {
+            sim_frame(node, ev);
+            sim->frames++;
+        } else if (ev->type == ODR_SIM_MSG) {
+            sim_msg(sim, node, ev);
+        }
+        sim_wake(sim, node);
+        sim->events++;
+        free(ev);
+    }
+    sim->now = max(sim->now, until);
+    timer_virtual(sim->now);
+}
+
+/* --------------------------------------------------------------------------
+ *  sim_stats
+ *
+ *  Statistics of all nodes
+ *
+ *  @param  : odr_sim   *sim    [simulator]
+ *            odr_stats *sum    [sum, zeroed by the caller]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void sim_stats(odr_sim *sim, odr_stats *sum) {
+    int i;
+
+    for (i = 1; i <= sim->nnodes; i++)
+        stats_merge(sum, &sim->nodes[i]->obj.stats);
+}
+
+/* --------------------------------------------------------------------------
+ *  sim_free
+ *
+ *  Simulator destructor
+ *
+ *  @param  : odr_sim   *sim    [simulator]
+ *  @return : void
+ *
+ *  Free the nodes, the segments and the pending events; the process
+ *  stays on the virtual clock
+ * --------------------------------------------------------------------------
+ */
+void sim_free(odr_sim *sim) {
+    int i;
+
+    while (sim->count > 0)
+        free(sim_pop(sim));
+    free(sim->heap);
+    for (i = 1; i <= sim->nnodes; i++) {
+        if (sim->nodes[i] == NULL)
+            continue;
+        if (sim->nodes[i]->obj.tp)
+            free_odr_object(&sim->nodes[i]->obj);
+        free(sim->nodes[i]);
+    }
+    free(sim->nodes);
+    for (i = 0; i < sim->nlinks; i++) {
+        free(sim->links[i].nodes);
+        free(sim->links[i].ifs);
+    }
+    free(sim->links);
+    sim_net = NULL;
+}
@@ -0,0 +1,280 @@
+/*
+* @File: odr_snap.c
+* @Date: 2026-10-17 20:54:19
+* @Last Modified time: 2026-10-17 21:11:48
+* @Description:
+*     Warm start. The route table, the broadcast id table and the last
+*     broadcast / APPMSG ids are written to ODR_SNAP_PATH every
+*     ODR_SNAP_INTERVAL seconds and when ODR is stopped with SIGINT or
+*     SIGTERM; a restarted ODR loads what is still within the staleness
+*     and was learned on an interface that is still there, so an upgrade
+*     does not make every node flood RREQs for every destination at once.
+*     The file is an odr_snap_hdr followed by the records, written
+*     through a shared mapping of a temporary file that is then renamed
+*     over the old snapshot, so a reader never sees half a file.
+*     - void snap_expire(odr_object *obj, odr_timer *timer)
+*         [Snapshot timer callback]
+*     - void snap_signal(odr_object *obj, odr_event *ev)
+*         [SIGINT/SIGTERM handler]
+*     + void snap_mask(sigset_t *mask)
+*         [Signals that stop ODR]
+*     + void snap_load(odr_object *obj)
+*         [Load the snapshot]
+*     + void snap_write(odr_object *obj)
+*         [Write the snapshot]
+*     + void snap_init(odr_object *obj)
+*         [Snapshot timer and signalfd constructor]
+*     + void snap_free(odr_object *obj)
+*         [Signalfd destructor]
+*/
+
+#include "np.h"
+
+/* --------------------------------------------------------------------------
+ *  snap_mask
+ *
+ *  Signals that stop ODR
+ *
+ *  @param  : sigset_t  *mask   [set to fill]
+ *  @return : void
+ *
+ *  They are blocked in every thread and read from a signalfd by the event
+ *  loop, so the snapshot is written before ODR exits
+ * --------------------------------------------------------------------------
+ */
+void snap_mask(sigset_t *mask) {
+    sigemptyset(mask);
+    sigaddset(mask, SIGINT);
+    sigaddset(mask, SIGTERM);
+}
+
+/* --------------------------------------------------------------------------
+ *  snap_load
+ *
+ *  Load the snapshot
+ *
+ *  @param  : odr_object    *obj    [odr object, tables initialized]
+ *  @return : void
+ *
+ *  A route is restored if it is still within the staleness and its
+ *  interface index still has the same MAC address in itable; it keeps its
+ *  timestamp, so it expires when it would have. Broadcast ids are
+ *  restored with the same age test. The ids this node sends continue
+ *  where they stopped, so neighbors do not drop our next RREQs as old
+ * --------------------------------------------------------------------------
+ */
+void snap_load(odr_object *obj) {
+    int             fd;
+    uint            i, routes = 0;
+    long            now = timer_time();
+    char            *map;
+    struct stat     st;
+    odr_snap_hdr    *hdr;
+    odr_snap_route  *rec;
+    odr_bid         *bid;
+    odr_itable      *interface;
+    odr_rtable      *item;
+
+    if ((fd = open(ODR_SNAP_PATH, O_RDONLY | O_CLOEXEC)) < 0)
+        return;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(odr_snap_hdr) ||
+        (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        return;
+    }
+    close(fd);
+
+    hdr = (odr_snap_hdr *)map;
+    if (hdr->magic != ODR_SNAP_MAGIC || hdr->version != ODR_SNAP_VERSION ||
+        st.st_size < (off_t)(sizeof(odr_snap_hdr) + (ulong)hdr->nroutes * sizeof(odr_snap_route) + (ulong)hdr->nbids * sizeof(odr_bid))) {
+        log_warn("[snapshot] %s is not a valid snapshot, ignored.", ODR_SNAP_PATH);
+        munmap(map, st.st_size);
+        return;
+    }
+
+    obj->bcast_id = hdr->bcast_id;
+    obj->msg_id = hdr->msg_id;
+
+    rec = (odr_snap_route *)(map + sizeof(odr_snap_hdr));
+    for (i = 0; i < hdr->nroutes; i++, rec++) {
+        if (rec->timestamp + (long)obj->staleness < now || rec->dst == obj->addr || get_item_rtable(rec->dst, obj))
+            continue;
+        interface = get_item_itable(rec->index, obj);
+        if (interface == NULL || memcmp(interface->if_haddr, rec->if_haddr, IF_HADDR) != 0)
+            continue;
+
+        item = (odr_rtable *)Calloc(1, sizeof(odr_rtable));
+        item->dst = rec->dst;
+        memcpy(item->nexthop, rec->nexthop, HWADDR_BUFFSIZE);
+        item->index = rec->index;
+        item->hopcnt = rec->hopcnt;
+        item->timestamp = rec->timestamp;
+        item->next = obj->rtable;
+        if (obj->rtable)
+            obj->rtable->prev = item;
+        obj->rtable = item;
+        hash_insert(&obj->rindex, item->dst, item);
+        timer_add(&obj->wheel, &item->timer, item->timestamp + obj->staleness + 1, rtable_expire);
+        routes++;
+    }
+
+    bid = (odr_bid *)rec;
+    for (i = 0; i < hdr->nbids; i++, bid++)
+        if (bid->timestamp + (long)obj->staleness >= now)
+            btable_set(&obj->btable, bid->src, bid->dst, bid->bcast_id);
+
+    log_info("[snapshot] Restored %u of %u routes, saved %ld seconds ago.", routes, hdr->nroutes, now - hdr->written);
+    munmap(map, st.st_size);
+}
+
+/* --------------------------------------------------------------------------
+ *  snap_write
+ *
+ *  Write the snapshot
+ *
+ *  @param  : odr_object    *obj    [odr object, write locked]
+ *  @return : void
+ *
+ *  Size the temporary file for the worst case, fill it through a shared
+ *  mapping, cut it to the records actually written and rename it over
+ *  ODR_SNAP_PATH. Stale broadcast ids are left out
+ * --------------------------------------------------------------------------
+ */
+void snap_write(odr_object *obj) {
+    int             fd;
+    uint            i;
+    long            now = timer_time();
+    char            *map, path[PATHNAME_BUFFSIZE];
+    size_t          len, maplen;
+    odr_snap_hdr    *hdr;
+    odr_snap_route  *rec;
+    odr_bid         *bid;
+    odr_rtable      *item;
+    odr_itable      *interface;
+
+    maplen = sizeof(odr_snap_hdr) + obj->rindex.count * sizeof(odr_snap_route) + obj->btable.count * sizeof(odr_bid);
+    snprintf(path, sizeof(path), "%s.tmp", ODR_SNAP_PATH);
+    if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0) {
+        log_warn("[snapshot] open %s error: %s", path, strerror(errno));
+        return;
+    }
+    if (ftruncate(fd, maplen) < 0 || (map = mmap(NULL, maplen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        log_warn("[snapshot] map %s error: %s", path, strerror(errno));
+        close(fd);
+        unlink(path);
+        return;
+    }
+
+    hdr = (odr_snap_hdr *)map;
+    hdr->magic = ODR_SNAP_MAGIC;
+    hdr->version = ODR_SNAP_VERSION;
+    hdr->written = now;
+    hdr->bcast_id = obj->bcast_id;
+    hdr->msg_id = obj->msg_id;
+
+    rec = (odr_snap_route *)(map + sizeof(odr_snap_hdr));
+    for (item = obj->rtable; item != NULL && hdr->nroutes < obj->rindex.count; item = item->next) {
+        if ((interface = get_item_itable(item->index, obj)) == NULL)
+            continue;
+        rec->dst = item->dst;
+        memcpy(rec->nexthop, item->nexthop, HWADDR_BUFFSIZE);
+        memcpy(rec->if_haddr, interface->if_haddr, IF_HADDR);
+        rec->index = item->index;
+        rec->hopcnt = item->hopcnt;
+        rec->timestamp = item->timestamp;
+        rec++;
+        hdr->nroutes++;
+    }
+
+    bid = (odr_bid *)rec;
+    for (i = 0; i < obj->btable.size && hdr->nbids < obj->btable.count; i++) {
+        if (obj->btable.slots[i].src == 0 || obj->btable.slots[i].timestamp + (long)obj->staleness < now)
+            continue;
+        *bid++ = obj->btable.slots[i];
+        hdr->nbids++;
+    }
+
+    len = (char *)bid - map;
+    munmap(map, maplen);
+    if (ftruncate(fd, len) < 0 || rename(path, ODR_SNAP_PATH) < 0) {
+        log_warn("[snapshot] write %s error: %s", ODR_SNAP_PATH, strerror(errno));
+        unlink(path);
+    }
+    close(fd);
+}
+
+/* --------------------------------------------------------------------------
+ *  snap_expire
+ *
+ *  Snapshot timer callback
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            odr_timer     *timer  [snapshot timer]
+ *  @return : void
+ *
+ *  Write the snapshot every ODR_SNAP_INTERVAL seconds, so a crash loses
+ *  at most that much
+ * --------------------------------------------------------------------------
+ */
+void snap_expire(odr_object *obj, odr_timer *timer) {
+    snap_write(obj);
+    timer_add(&obj->wheel, timer, obj->wheel.now + ODR_SNAP_INTERVAL, snap_expire);
+}
+
+/* --------------------------------------------------------------------------
+ *  snap_signal
+ *
+ *  SIGINT/SIGTERM handler
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            odr_event     *ev     [signalfd event]
+ *  @return : void
+ *
+ *  Write the snapshot and leave the event loop
+ * --------------------------------------------------------------------------
+ */
+void snap_signal(odr_object *obj, odr_event *ev) {
+    struct signalfd_siginfo si;
+
+    while (read(ev->fd, &si, sizeof(si)) == sizeof(si)) {
+        log_info("[snapshot] Signal %d, save tables and exit.", si.ssi_signo);
+        pthread_rwlock_wrlock(&obj->lock);
+        snap_write(obj);
+        pthread_rwlock_unlock(&obj->lock);
+        obj->quit = 1;
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  snap_init
+ *
+ *  Snapshot timer and signalfd constructor
+ *
+ *  @param  : odr_object    *obj    [odr object, event loop initialized,
+ *                                   snap_mask() signals blocked]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void snap_init(odr_object *obj) {
+    sigset_t mask;
+
+    snap_mask(&mask);
+    if ((obj->s_sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+        err_sys("signalfd error");
+    event_add(obj, &obj->s_event, obj->s_sigfd, snap_signal);
+    timer_add(&obj->wheel, &obj->snap, obj->wheel.now + ODR_SNAP_INTERVAL, snap_expire);
+}
+
+/* --------------------------------------------------------------------------
+ *  snap_free
+ *
+ *  Signalfd destructor
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void snap_free(odr_object *obj) {
+    if (obj->s_sigfd > 0)
+        close(obj->s_sigfd);
+}
@@ -0,0 +1,220 @@
+/*
+* @File: odr_stats.c
+* @Date: 2026-10-17 20:47:58
+* @Last Modified time: 2026-10-17 21:11:48
+* @Description:
+*     Runtime statistics. Every thread counts into its own odr_stats (the
+*     main thread in odr_object, a worker in odr_worker) with plain
+*     increments; a scrape sums them, so the forwarding path takes no lock
+*     and shares no cache line. A scrape may see a counter a few increments
+*     behind, which is fine for monitoring.
+*     Latencies go into log-linear histograms (odr_hist.c). The control
+*     socket (ODR_CTRL_PATH, stream) answers every connection with a
+*     snapshot in the Prometheus text format and closes it.
+*     + void stats_merge(odr_stats *dst, odr_stats *src)
+*         [Add the statistics of a thread]
+*     - void stats_print_hist(FILE *fp, const char *name, const char *label, odr_hist *h, double unit)
+*         [Write a histogram]
+*     - void stats_print(FILE *fp, odr_object *obj)
+*         [Write a snapshot]
+*     - void stats_event(odr_object *obj, odr_event *ev)
+*         [Control socket read handler]
+*     + void stats_init(odr_object *obj)
+*         [Control socket constructor]
+*     + void stats_free(odr_object *obj)
+*         [Control socket destructor]
+*/
+
+#include "np.h"
+
+static const char *stats_frame_names[] = { "rreq", "rrep", "appmsg", "route", "interface", "appfrag" };
+static const char *stats_handler_names[] = { "rreq", "rrep", "appmsg", "forward", "dgram" };
+
+/* --------------------------------------------------------------------------
+ *  stats_merge
+ *
+ *  Add the statistics of a thread
+ *
+ *  @param  : odr_stats *dst    [sum]
+ *            odr_stats *src    [statistics of a thread]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void stats_merge(odr_stats *dst, odr_stats *src) {
+    int i;
+
+    for (i = 0; i <= ODR_FRAME_APPFRAG; i++) {
+        dst->rx[i] += src->rx[i];
+        dst->tx[i] += src->tx[i];
+    }
+    dst->rreq_suppressed += src->rreq_suppressed;
+    dst->queue_timeouts += src->queue_timeouts;
+    dst->deliver_dropped += src->deliver_dropped;
+    dst->disc_started += src->disc_started;
+    dst->disc_completed += src->disc_completed;
+    hist_merge(&dst->disc_latency, &src->disc_latency);
+    for (i = 0; i < ODR_HANDLER_MAX; i++)
+        hist_merge(&dst->handler[i], &src->handler[i]);
+}
+
+/* --------------------------------------------------------------------------
+ *  stats_print_hist
+ *
+ *  Write a histogram
+ *
+ *  @param  : FILE          *fp     [output]
+ *            const char    *name   [metric name]
+ *            const char    *label  [extra label, e.g. handler="rreq", or ""]
+ *            odr_hist      *h      [histogram]
+ *            double        unit    [seconds per recorded unit]
+ *  @return : void
+ *
+ *  Cumulative buckets as Prometheus expects them; empty buckets are left
+ *  out, the upper bound of a bucket is its largest value
+ * --------------------------------------------------------------------------
+ */
+void stats_print_hist(FILE *fp, const char *name, const char *label, odr_hist *h, double unit) {
+    int         i;
+    ulong       cum = 0, upper;
+    const char  *sep = label[0] ? "," : "";
+
+    for (i = 0; i < ODR_HIST_BUCKETS; i++) {
+        if (h->buckets[i] == 0)
+            continue;
+        cum += h->buckets[i];
+        upper = (i + 1 < ODR_HIST_BUCKETS) ? hist_lower(i + 1) - 1 : ULONG_MAX;
+        fprintf(fp, "%s_bucket{%s%sle=\"%g\"} %lu\n", name, label, sep, upper * unit, cum);
+    }
+    fprintf(fp, "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, label, sep, h->count);
+    if (label[0]) {
+        fprintf(fp, "%s_sum{%s} %g\n", name, label, h->sum * unit);
+        fprintf(fp, "%s_count{%s} %lu\n", name, label, h->count);
+    } else {
+        fprintf(fp, "%s_sum %g\n", name, h->sum * unit);
+        fprintf(fp, "%s_count %lu\n", name, h->count);
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  stats_print
+ *
+ *  Write a snapshot
+ *
+ *  @param  : FILE          *fp     [output]
+ *            odr_object    *obj    [odr object]
+ *  @return : void
+ *
+ *  Sum the statistics of all threads and write them in the Prometheus
+ *  text format. Queue depth and route table size are read as they are
+ * --------------------------------------------------------------------------
+ */
+void stats_print(FILE *fp, odr_object *obj) {
+    int         i;
+    char        label[32];
+    odr_stats   *s = (odr_stats *)Calloc(1, sizeof(odr_stats));
+
+    stats_merge(s, &obj->stats);
+    for (i = 0; i < obj->nworkers && obj->workers; i++)
+        stats_merge(s, &obj->workers[i].stats);
+
+    fprintf(fp, "# TYPE odr_frames_received_total counter\n");
+    for (i = 0; i <= ODR_FRAME_APPFRAG; i++)
+        fprintf(fp, "odr_frames_received_total{type=\"%s\"} %lu\n", stats_frame_names[i], s->rx[i]);
+    fprintf(fp, "# TYPE odr_frames_sent_total counter\n");
+    for (i = 0; i <= ODR_FRAME_APPFRAG; i++)
+        fprintf(fp, "odr_frames_sent_total{type=\"%s\"} %lu\n", stats_frame_names[i], s->tx[i]);
+    fprintf(fp, "# TYPE odr_rreq_suppressed_total counter\n");
+    fprintf(fp, "odr_rreq_suppressed_total %lu\n", s->rreq_suppressed);
+    fprintf(fp, "# TYPE odr_queue_depth gauge\n");
+    fprintf(fp, "odr_queue_depth %u\n", obj->queue.count);
+    fprintf(fp, "# TYPE odr_queue_timeouts_total counter\n");
+    fprintf(fp, "odr_queue_timeouts_total %lu\n", s->queue_timeouts);
+    fprintf(fp, "# TYPE odr_deliver_dropped_total counter\n");
+    fprintf(fp, "odr_deliver_dropped_total %lu\n", s->deliver_dropped);
+    fprintf(fp, "# TYPE odr_discoveries_started_total counter\n");
+    fprintf(fp, "odr_discoveries_started_total %lu\n", s->disc_started);
+    fprintf(fp, "# TYPE odr_discoveries_completed_total counter\n");
+    fprintf(fp, "odr_discoveries_completed_total %lu\n", s->disc_completed);
+    fprintf(fp, "# TYPE odr_routes gauge\n");
+    fprintf(fp, "odr_routes %u\n", obj->rindex.count);
+
+    fprintf(fp, "# TYPE odr_discovery_latency_seconds histogram\n");
+    stats_print_hist(fp, "odr_discovery_latency_seconds", "", &s->disc_latency, 1e-6);
+    fprintf(fp, "# TYPE odr_handler_seconds histogram\n");
+    for (i = 0; i < ODR_HANDLER_MAX; i++) {
+        snprintf(label, sizeof(label), "handler=\"%s\"", stats_handler_names[i]);
+        stats_print_hist(fp, "odr_handler_seconds", label, &s->handler[i], 1e-9);
+    }
+    free(s);
+}
+
+/* --------------------------------------------------------------------------
+ *  stats_event
+ *
+ *  Control socket read handler
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            odr_event     *ev     [control socket event]
+ *  @return : void
+ *
+ *  Accept every pending connection, send it a snapshot and close it. The
+ *  snapshot is sent without blocking; a reader that does not keep up gets
+ *  a truncated one rather than stalling the event loop
+ * --------------------------------------------------------------------------
+ */
+void stats_event(odr_object *obj, odr_event *ev) {
+    int     fd;
+    char    *buf;
+    size_t  len;
+    FILE    *fp;
+
+    while ((fd = accept4(ev->fd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+        if ((fp = open_memstream(&buf, &len)) != NULL) {
+            stats_print(fp, obj);
+            fclose(fp);
+            if (send(fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+                log_warn("[stats] send error: %s", strerror(errno));
+            free(buf);
+        }
+        close(fd);
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  stats_init
+ *
+ *  Control socket constructor
+ *
+ *  @param  : odr_object    *obj    [odr object, event loop initialized]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void stats_init(odr_object *obj) {
+    struct sockaddr_un addr;
+
+    bzero(&addr, sizeof(addr));
+    addr.sun_family = AF_LOCAL;
+    strcpy(addr.sun_path, ODR_CTRL_PATH);
+
+    unlink(ODR_CTRL_PATH);
+    obj->c_sockfd = Socket(AF_LOCAL, SOCK_STREAM, 0);
+    Bind(obj->c_sockfd, (SA *)&addr, sizeof(addr));
+    Listen(obj->c_sockfd, LISTENQ);
+    event_add(obj, &obj->c_event, obj->c_sockfd, stats_event);
+}
+
+/* --------------------------------------------------------------------------
+ *  stats_free
+ *
+ *  Control socket destructor
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void stats_free(odr_object *obj) {
+    if (obj->c_sockfd > 0) {
+        close(obj->c_sockfd);
+        unlink(ODR_CTRL_PATH);
+    }
+}
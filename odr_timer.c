@@ -0,0 +1,324 @@
+/*
+* @File: odr_timer.c
+* @Date: 2026-10-17 20:16:34
+* @Last Modified time: 2026-10-17 21:37:16
+* @Description:
+*     Hierarchical timer wheel. Level 0 has one slot per tick, each upper
+*     level slot covers a whole turn of the level below; timers are cascaded
+*     down as time reaches them. Adding and removing a timer is O(1), and
+*     advancing the wheel only touches the timers that expire (plus an
+*     occasional cascade). The table wheel ticks once a second, the fast
+*     wheel (route discovery) every ODR_TICK_MS milliseconds.
+*     ODR reads the time only through timer_time(), timer_ticks() and
+*     timer_usec(). They follow the system clocks, or the virtual clock of
+*     the simulator (odr_sim.c) once it is set with timer_virtual().
+*     - void timer_link(odr_wheel *w, odr_timer *t)
+*         [Put timer into its slot]
+*     - void timer_cascade(odr_wheel *w, int level)
+*         [Move the timers of the current upper level slot down]
+*     + void timer_init(odr_wheel *w, long now)
+*         [Timer wheel constructor]
+*     + void timer_add(odr_wheel *w, odr_timer *t, long expire, odr_timer_fn fire)
+*         [Schedule a timer]
+*     + void timer_del(odr_wheel *w, odr_timer *t)
+*         [Cancel a timer]
+*     + void timer_run(odr_object *obj, odr_wheel *w, long now)
+*         [Advance the wheel and fire expired timers]
+*     + long timer_next(odr_wheel *w)
+*         [Ticks until the wheel needs to run again]
+*     + void timer_virtual(long usec)
+*         [Switch to the virtual clock]
+*     + long timer_time(void)
+*         [Current time in seconds]
+*     + long timer_ticks(void)
+*         [Current time in fast wheel ticks]
+*     + long timer_usec(void)
+*         [Monotonic time in microseconds]
+*     + long timer_nsec(void)
+*         [Monotonic time in nanoseconds]
+*/
+
+#include "np.h"
+
+#define WHEEL_MASK  (ODR_WHEEL_SIZE - 1)
+#define WHEEL_SHIFT(level)  ((level) * ODR_WHEEL_BITS)
+
+// virtual clock in microseconds, -1 while the system clocks are used
+static long timer_vusec = -1;
+
+/* --------------------------------------------------------------------------
+ *  timer_link
+ *
+ *  Put timer into its slot
+ *
+ *  @param  : odr_wheel     *w      [timer wheel]
+ *            odr_timer     *t      [timer, t->expire >= w->now]
+ *  @return : void
+ *
+ *  The level is chosen by the distance to expiry, the slot by the expiry
+ *  time itself
+ * --------------------------------------------------------------------------
+ */
+void timer_link(odr_wheel *w, odr_timer *t) {
+    int level;
+    long expire = t->expire, delta = t->expire - w->now;
+    odr_timer **slot;
+
+    for (level = 0; level < ODR_WHEEL_LEVELS - 1; level++)
+        if (delta < (1L << WHEEL_SHIFT(level + 1)))
+            break;
+
+    // beyond the range of the top level, park at its farthest slot
+    if (level == ODR_WHEEL_LEVELS - 1 && delta >= (1L << WHEEL_SHIFT(ODR_WHEEL_LEVELS)))
+        expire = w->now + (1L << WHEEL_SHIFT(ODR_WHEEL_LEVELS)) - 1;
+
+    slot = &w->slots[level][(expire >> WHEEL_SHIFT(level)) & WHEEL_MASK];
+    t->next = *slot;
+    if (*slot)
+        (*slot)->pprev = &t->next;
+    t->pprev = slot;
+    *slot = t;
+}
+
+/* --------------------------------------------------------------------------
+ *  timer_cascade
+ *
+ *  Move the timers of the current upper level slot down
+ *
+ *  @param  : odr_wheel     *w      [timer wheel]
+ *            int           level   [upper level, >= 1]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void timer_cascade(odr_wheel *w, int level) {
+    odr_timer *t, *next;
+    odr_timer **slot = &w->slots[level][(w->now >> WHEEL_SHIFT(level)) & WHEEL_MASK];
+
+    t = *slot;
+    *slot = NULL;
+    while (t) {
+        next = t->next;
+        timer_link(w, t);
+        t = next;
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  timer_init
+ *
+ *  Timer wheel constructor
+ *
+ *  @param  : odr_wheel     *w      [timer wheel]
+ *            long          now     [current time]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void timer_init(odr_wheel *w, long now) {
+    bzero(w, sizeof(odr_wheel));
+    w->now = now;
+}
+
+/* --------------------------------------------------------------------------
+ *  timer_add
+ *
+ *  Schedule a timer
+ *
+ *  @param  : odr_wheel     *w      [timer wheel]
+ *            odr_timer     *t      [timer, embedded in a table entry]
+ *            long          expire  [expiry time]
+ *            odr_timer_fn  fire    [callback]
+ *  @return : void
+ *
+ *  A timer already scheduled is moved. An expiry time that has already
+ *  passed fires on the next tick
+ * --------------------------------------------------------------------------
+ */
+void timer_add(odr_wheel *w, odr_timer *t, long expire, odr_timer_fn fire) {
+    timer_del(w, t);
+
+    t->expire = max(expire, w->now + 1);
+    t->fire = fire;
+    timer_link(w, t);
+    w->count++;
+}
+
+/* --------------------------------------------------------------------------
+ *  timer_del
+ *
+ *  Cancel a timer
+ *
+ *  @param  : odr_wheel     *w      [timer wheel]
+ *            odr_timer     *t      [timer]
+ *  @return : void
+ *
+ *  Nothing happens if the timer is not scheduled
+ * --------------------------------------------------------------------------
+ */
+void timer_del(odr_wheel *w, odr_timer *t) {
+    if (t->pprev == NULL)
+        return;
+
+    *t->pprev = t->next;
+    if (t->next)
+        t->next->pprev = t->pprev;
+    t->next = NULL;
+    t->pprev = NULL;
+    w->count--;
+}
+
+/* --------------------------------------------------------------------------
+ *  timer_run
+ *
+ *  Advance the wheel and fire expired timers
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *            odr_wheel     *w      [timer wheel]
+ *            long          now     [current time, in ticks of the wheel]
+ *  @return : void
+ *
+ *  Process every tick between the last run and now. A callback may add
+ *  or delete any timer, including re-adding the one that fired. An empty
+ *  wheel jumps to now at once
+ * --------------------------------------------------------------------------
+ */
+void timer_run(odr_object *obj, odr_wheel *w, long now) {
+    int level;
+    odr_timer *t, **slot;
+
+    while (w->now < now) {
+        if (w->count == 0) {
+            w->now = now;
+            break;
+        }
+        w->now++;
+
+        // cascade from the highest level whose turn is complete
+        for (level = 1; level < ODR_WHEEL_LEVELS; level++)
+            if ((w->now >> WHEEL_SHIFT(level - 1)) & WHEEL_MASK)
+                break;
+        while (--level >= 1)
+            timer_cascade(w, level);
+
+        slot = &w->slots[0][w->now & WHEEL_MASK];
+        while ((t = *slot) != NULL) {
+            timer_del(w, t);
+            t->fire(obj, t);
+        }
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  timer_next
+ *
+ *  Ticks until the wheel needs to run again
+ *
+ *  @param  : odr_wheel     *w      [timer wheel]
+ *  @return : long          [ticks, -1 if no timer is scheduled]
+ *
+ *  The next non-empty level 0 slot, or the next cascade if it comes first
+ * --------------------------------------------------------------------------
+ */
+long timer_next(odr_wheel *w) {
+    long delta, cascade = ODR_WHEEL_SIZE - (w->now & WHEEL_MASK);
+
+    if (w->count == 0)
+        return -1;
+
+    for (delta = 1; delta < cascade; delta++)
+        if (w->slots[0][(w->now + delta) & WHEEL_MASK])
+            return delta;
+    return cascade;
+}
+
+/* --------------------------------------------------------------------------
+ *  timer_virtual
+ *
+ *  Switch to the virtual clock
+ *
+ *  @param  : long  usec    [virtual time in microseconds]
+ *  @return : void
+ *
+ *  From now on the clock only moves when this is called again; the
+ *  simulator sets it to the time of every event it processes
+ * --------------------------------------------------------------------------
+ */
+void timer_virtual(long usec) {
+    timer_vusec = usec;
+}
+
+/* --------------------------------------------------------------------------
+ *  timer_time
+ *
+ *  Current time in seconds
+ *
+ *  @param  : void
+ *  @return : long          [time(), or the virtual clock]
+ *
+ *  The clock of the table wheel and of every table timestamp
+ * --------------------------------------------------------------------------
+ */
+long timer_time(void) {
+    if (timer_vusec >= 0)
+        return timer_vusec / 1000000L;
+    return time(NULL);
+}
+
+/* --------------------------------------------------------------------------
+ *  timer_ticks
+ *
+ *  Current time in fast wheel ticks
+ *
+ *  @param  : void
+ *  @return : long          [CLOCK_MONOTONIC in ODR_TICK_MS units]
+ *
+ *  The ring timeouts are a few ticks long and must not jump with the wall
+ *  clock; the fast wheel has a CLOCK_MONOTONIC timerfd of its own
+ * --------------------------------------------------------------------------
+ */
+long timer_ticks(void) {
+    struct timespec ts;
+
+    if (timer_vusec >= 0)
+        return timer_vusec / 1000L / ODR_TICK_MS;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000L + ts.tv_nsec / 1000000L) / ODR_TICK_MS;
+}
+
+/* --------------------------------------------------------------------------
+ *  timer_usec
+ *
+ *  Monotonic time in microseconds
+ *
+ *  @param  : void
+ *  @return : long          [CLOCK_MONOTONIC in microseconds]
+ *
+ *  For round trip measurements, which must not jump with the wall clock
+ * --------------------------------------------------------------------------
+ */
+long timer_usec(void) {
+    struct timespec ts;
+
+    if (timer_vusec >= 0)
+        return timer_vusec;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000L;
+}
+
+/* --------------------------------------------------------------------------
+ *  timer_nsec
+ *
+ *  Monotonic time in nanoseconds
+ *
+ *  @param  : void
+ *  @return : long          [CLOCK_MONOTONIC in nanoseconds]
+ *
+ *  Always the system clock: it times the handlers, which costs CPU time
+ *  under the simulator too
+ * --------------------------------------------------------------------------
+ */
+long timer_nsec(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
@@ -0,0 +1,162 @@
+/*
+* @File: odr_worker.c
+* @Date: 2026-10-17 20:23:44
+* @Last Modified time: 2026-10-17 20:29:56
+* @Description:
+*     ODR forwarding workers. Each worker owns a PF_PACKET socket in the same
+*     PACKET_FANOUT group as the main socket, so the kernel spreads received
+*     frames across the threads. The tables stay shared behind obj->lock:
+*     transit APPMSGs are relayed under the read lock, everything that
+*     changes route discovery state takes the write lock.
+*     - void worker_fanout(int sockfd)
+*         [Join the PACKET_FANOUT group]
+*     - void *worker_main(void *arg)
+*         [Worker thread]
+*     + void worker_init(odr_object *obj)
+*         [Table lock constructor]
+*     + void worker_start(odr_object *obj)
+*         [Start the workers]
+*     + void worker_free(odr_object *obj)
+*         [Worker destructor]
+*/
+
+#include "np.h"
+
+// I/O context of the calling thread, NULL in the main thread
+__thread odr_worker *odr_io = NULL;
+
+/* --------------------------------------------------------------------------
+ *  worker_fanout
+ *
+ *  Join the PACKET_FANOUT group
+ *
+ *  @param  : int       sockfd  [PF_PACKET socket]
+ *  @return : void
+ *
+ *  The group id is taken from the process id, so several ODR processes on
+ *  one host do not share frames. Frames are spread round-robin: ODR frames
+ *  have no flow the kernel can hash on
+ * --------------------------------------------------------------------------
+ */
+void worker_fanout(int sockfd) {
+    int arg = (getpid() & 0xffff) | (PACKET_FANOUT_LB << 16);
+
+    if (setsockopt(sockfd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) < 0)
+        err_sys("[worker_fanout] setsockopt PACKET_FANOUT error");
+}
+
+/* --------------------------------------------------------------------------
+ *  worker_main
+ *
+ *  Worker thread
+ *
+ *  @param  : void      *arg    [odr_worker]
+ *  @return : void *
+ *  @see    : function#handle_frame
+ *
+ *  Block until frames arrive, dispatch the batch, then send the frames the
+ *  handlers queued with one sendmmsg()
+ * --------------------------------------------------------------------------
+ */
+void *worker_main(void *arg) {
+    int i, n;
+    odr_worker *w = (odr_worker *)arg;
+
+    odr_io = w;
+    while (1) {
+        n = batch_recv(&w->rx_batch, w->sockfd);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            err_sys("[worker_main] recvmmsg error");
+        }
+        for (i = 0; i < n; i++)
+            handle_frame(w->obj, &w->rx_batch.frames[i], w->rx_batch.msgs[i].msg_len, &w->rx_batch.addrs[i]);
+        batch_flush(&w->tx_batch, w->sockfd);
+    }
+    return NULL;
+}
+
+/* --------------------------------------------------------------------------
+ *  worker_init
+ *
+ *  Table lock constructor
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *  @return : void
+ *
+ *  Writers are preferred, so a steady stream of relayed APPMSGs cannot hold
+ *  off route discovery and table expiry
+ * --------------------------------------------------------------------------
+ */
+void worker_init(odr_object *obj) {
+    pthread_rwlockattr_t attr;
+
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&obj->lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+}
+
+/* --------------------------------------------------------------------------
+ *  worker_start
+ *
+ *  Start the workers
+ *
+ *  @param  : odr_object    *obj    [odr object, obj->nworkers set]
+ *  @return : void
+ *
+ *  Put the main PF_PACKET socket into the fanout group, then create a
+ *  socket in the same group and a thread for every worker. Nothing happens
+ *  if no worker is configured
+ * --------------------------------------------------------------------------
+ */
+void worker_start(odr_object *obj) {
+    int i;
+    odr_worker *w;
+
+    if (obj->nworkers == 0)
+        return;
+
+    worker_fanout(obj->p_sockfd);
+
+    obj->workers = (odr_worker *)Calloc(obj->nworkers, sizeof(odr_worker));
+    for (i = 0; i < obj->nworkers; i++) {
+        w = &obj->workers[i];
+        w->obj = obj;
+        w->id = i + 1;
+        w->sockfd = Socket(PF_PACKET, SOCK_RAW, htons(PROTOCOL_ID));
+        worker_fanout(w->sockfd);
+        batch_init(&w->rx_batch);
+        batch_init(&w->tx_batch);
+    }
+
+    for (i = 0; i < obj->nworkers; i++)
+        Pthread_create(&obj->workers[i].tid, NULL, worker_main, &obj->workers[i]);
+
+    printf("[ODR] %d forwarding workers started\n", obj->nworkers);
+}
+
+/* --------------------------------------------------------------------------
+ *  worker_free
+ *
+ *  Worker destructor
+ *
+ *  @param  : odr_object    *obj    [odr object]
+ *  @return : void
+ *
+ *  Cancel the worker threads and release their sockets
+ * --------------------------------------------------------------------------
+ */
+void worker_free(odr_object *obj) {
+    int i;
+
+    for (i = 0; i < obj->nworkers && obj->workers; i++) {
+        pthread_cancel(obj->workers[i].tid);
+        pthread_join(obj->workers[i].tid, NULL);
+        close(obj->workers[i].sockfd);
+    }
+    free(obj->workers);
+    obj->workers = NULL;
+    pthread_rwlock_destroy(&obj->lock);
+}
@@ -1,14 +1,103 @@
 /*
 * @File: server.c
 * @Date: 2015-11-08 20:56:53
-* @Last Modified time: 2015-11-22 19:44:21
+* @Last Modified time: 2026-10-17 21:59:42
 * @Description:
+*     - void serve_report(const char *hostname, odr_hist *lat, ulong batches, long start)
+*         [Print the batch mode counters]
+*     - void serve_batch(int sockfd, const char *hostname)
+*         [Batch mode work cycle]
 *     + int main(int argc, char **argv)
 *         [Server entry function]
 */
 
 #include "np.h"
 
+/* --------------------------------------------------------------------------
+ *  serve_report
+ *
+ *  Print the batch mode counters
+ *
+ *  @param  : const char    *hostname   [server hostname]
+ *            odr_hist      *lat        [reply latency, microseconds]
+ *            ulong         batches     [batches answered]
+ *            long          start       [start of the period, seconds]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void serve_report(const char *hostname, odr_hist *lat, ulong batches, long start) {
+    long secs = max(time(NULL) - start, 1);
+
+    printf("server at node %s: %lu requests in %ld s (%lu/s), %lu batches (%.1f per batch), "
+           "latency p50 %lu us p99 %lu us p99.9 %lu us max %lu us\n",
+           hostname, lat->count, secs, lat->count / secs, batches,
+           batches ? (double)lat->count / batches : 0.0,
+           hist_quantile(lat, 0.5), hist_quantile(lat, 0.99), hist_quantile(lat, 0.999), lat->max);
+}
+
+/* --------------------------------------------------------------------------
+ *  serve_batch
+ *
+ *  Batch mode work cycle
+ *
+ *  @param  : int           sockfd      [Socket file descriptor, bound]
+ *            const char    *hostname   [server hostname]
+ *  @return : void
+ *
+ *  Every wakeup takes all pending requests with one msg_recv_batch() and
+ *  answers them with one msg_send_batch(); a reply is built in place of
+ *  its request, so it keeps the request id. The time string is formatted
+ *  once per second, nothing is looked up or printed per request. The
+ *  latency of a reply is counted from the kernel timestamp of its
+ *  request; throughput and latency quantiles are printed every
+ *  ODR_SERV_REPORT seconds
+ * --------------------------------------------------------------------------
+ */
+void serve_batch(int sockfd, const char *hostname) {
+    int             i, n, on = 1, len = 0;
+    long            now, usec, last = 0, start = time(NULL);
+    ulong           batches = 0;
+    char            daytime[ODR_MSG_BATCHLEN];
+    odr_msg         *msgs = (odr_msg *)Calloc(ODR_MSG_BATCH, sizeof(odr_msg));
+    odr_hist        *lat = (odr_hist *)Calloc(1, sizeof(odr_hist));
+    struct timespec ts;
+
+    if (setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0)
+        err_ret("setsockopt SO_TIMESTAMPNS error");
+    printf("server at node %s: batch mode, up to %d requests per wakeup\n", hostname, ODR_MSG_BATCH);
+
+    while (1) {
+        n = msg_recv_batch(sockfd, msgs, ODR_MSG_BATCH, ODR_SERV_REPORT * 1000);
+        now = time(NULL);
+
+        if (n > 0) {
+            if (now != last) {
+                len = snprintf(daytime, sizeof(daytime), "%.24s", ctime(&now));
+                last = now;
+            }
+            for (i = 0; i < n; i++) {
+                memcpy(msgs[i].data, daytime, len + 1);
+                msgs[i].len = len;
+                msgs[i].flag = 0;
+            }
+            msg_send_batch(sockfd, msgs, n);
+
+            clock_gettime(CLOCK_REALTIME, &ts);
+            usec = ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+            for (i = 0; i < n; i++)
+                hist_add(lat, max(usec - msgs[i].usec, 0));
+            batches++;
+        }
+
+        if (now - start >= ODR_SERV_REPORT) {
+            serve_report(hostname, lat, batches, start);
+            bzero(lat, sizeof(odr_hist));
+            batches = 0;
+            start = now;
+        }
+    }
+}
+
 /* --------------------------------------------------------------------------
  *  main
  *
@@ -19,10 +108,14 @@
  *  @return : int
  *
  *  Server entry function
+ *  A reply carries the request id of its request back
+ *  With -s, the shared-memory transport to ODR is used
+ *  With -b, requests are answered in batches (serve_batch)
  * --------------------------------------------------------------------------
  */
 int main(int argc, char **argv) {
     int     r, sockfd, port = 0;
+    uint    req_id;
     time_t  ticks;
     char    data[ODR_DGRAM_DATALEN];
     char    cli_ipaddr[IPADDR_BUFFSIZE], cli_hostname[HOSTNAME_BUFFSIZE];
@@ -38,25 +131,33 @@ int main(int argc, char **argv) {
 
     // get IP address of current node
     free_hwa_info(Get_hw_addrs(srv_ipaddr));
-    util_ip_to_hostname(srv_ipaddr, srv_hostname);
+    util_ip_to_hostname(srv_ipaddr, srv_hostname, ODR_RESOLV_WAIT);
 
     // create and bind domain socket
     sockfd = Socket(AF_LOCAL, SOCK_DGRAM, 0);
 
     Bind(sockfd, (SA *)&servaddr, sizeof(servaddr));
 
+    if (argc > 1 && strcmp(argv[1], "-b") == 0)
+        serve_batch(sockfd, srv_hostname);
+
+    if (argc > 1 && strcmp(argv[1], "-s") == 0 && msg_shm_open(sockfd) < 0)
+        printf("server at node %s: shared-memory transport not available\n", srv_hostname);
+
     // receive request from domain socket
     while (1) {
-        r = msg_recv(sockfd, data, cli_ipaddr, &port);
+        r = msg_recv_req(sockfd, data, cli_ipaddr, &port, &req_id);
         if (r <= 0)
             continue;
-        util_ip_to_hostname(cli_ipaddr, cli_hostname);
+        // never wait for the resolver here, an unknown name is printed
+        // as the address (the cache fills in the background)
+        util_ip_to_hostname(cli_ipaddr, cli_hostname, ODR_RESOLV_NOWAIT);
 
         ticks = time(NULL);
         snprintf(data, ODR_DGRAM_DATALEN, "%.24s", ctime(&ticks));
 
-        r = msg_send(sockfd, cli_ipaddr, port, data, 0);
-        printf("server at node %s: responding to request from %s\n", srv_hostname, cli_hostname);
+        r = msg_send_req(sockfd, cli_ipaddr, port, data, 0, req_id);
+        printf("server at node %s: responding to request from %s\n", srv_hostname, cli_hostname[0] ? cli_hostname : cli_ipaddr);
     }
 
     unlink(servaddr.sun_path);
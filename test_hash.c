@@ -0,0 +1,162 @@
+/*
+* @File: test_hash.c
+* @Date: 2026-10-17 21:32:24
+* @Last Modified time: 2026-10-17 21:34:23
+* @Description:
+*     Check that the route table hash index (odr_hash.c) and the
+*     broadcast id table (odr_btable.c) keep probe sequences short for the
+*     keys ODR really has: IPv4 addresses in network byte order, where a
+*     whole subnet shares the low bits. One /16 worth of addresses is
+*     inserted, every one must be found, and the mean and longest distance
+*     from the home slot must stay small; the index check is repeated
+*     after half of them are removed. The broadcast id table gets RREQs
+*     from every source of the subnet to one destination, as many as fit
+*     in its largest size.
+*     - void hash_probes(odr_hash *h, double *mean, uint *longest)
+*         [Probe lengths of a hash index]
+*     - int hash_check(const char *what, odr_hash *h, in_addr_t base, uint n, uint step)
+*         [Find the keys and check the probe lengths]
+*     - int btable_check(odr_btable *b, in_addr_t base, uint n, in_addr_t dst)
+*         [Find the pairs and check the probe lengths]
+*     + int main(int argc, char **argv)
+*         [Test entry function]
+*/
+
+#include "np.h"
+
+// one /16, in network byte order
+#define TEST_HASH_NET       "10.1.0.0"
+#define TEST_HASH_KEYS      65536
+// RREQ sources kept by a broadcast id table of the largest size
+#define TEST_BTABLE_KEYS    (ODR_BTABLE_MAXSIZE / 4)
+#define TEST_BTABLE_STALENESS 60
+// a table at most half full averages well under 2 probes
+#define TEST_HASH_MEAN      2.0
+#define TEST_HASH_LONGEST   64
+
+/* --------------------------------------------------------------------------
+ *  hash_probes
+ *
+ *  Probe lengths of a hash index
+ *
+ *  @param  : odr_hash  *h          [hash index]
+ *            double    *mean       [mean distance from the home slot]
+ *            uint      *longest    [longest distance from the home slot]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void hash_probes(odr_hash *h, double *mean, uint *longest) {
+    uint    i, d;
+    ulong   sum = 0;
+
+    *longest = 0;
+    for (i = 0; i < h->size; i++) {
+        if (h->slots[i].val == NULL)
+            continue;
+        d = (i - hash_slot(h, h->slots[i].key)) & (h->size - 1);
+        sum += d;
+        *longest = max(*longest, d);
+    }
+    *mean = h->count ? (double)sum / h->count : 0;
+}
+
+/* --------------------------------------------------------------------------
+ *  hash_check
+ *
+ *  Find the keys and check the probe lengths
+ *
+ *  @param  : const char    *what   [name of the check]
+ *            odr_hash      *h      [hash index]
+ *            in_addr_t     base    [first address, host byte order]
+ *            uint          n       [addresses]
+ *            uint          step    [only every step-th address is in h]
+ *  @return : int                   [0 if passed, 1 if failed]
+ * --------------------------------------------------------------------------
+ */
+int hash_check(const char *what, odr_hash *h, in_addr_t base, uint n, uint step) {
+    uint    i, longest, missing = 0;
+    double  mean;
+    void    *val;
+
+    for (i = 0; i < n; i++) {
+        val = hash_find(h, htonl(base + i));
+        if ((i % step == 0) != (val == (void *)(ulong)(i + 1)))
+            missing++;
+    }
+    hash_probes(h, &mean, &longest);
+    printf("test_hash: %s: %u keys in %u slots, probe mean %.2f longest %u, %u wrong lookups\n",
+           what, h->count, h->size, mean, longest, missing);
+    return (missing || mean > TEST_HASH_MEAN || longest > TEST_HASH_LONGEST) ? 1 : 0;
+}
+
+/* --------------------------------------------------------------------------
+ *  btable_check
+ *
+ *  Find the pairs and check the probe lengths
+ *
+ *  @param  : odr_btable    *b      [broadcast id table]
+ *            in_addr_t     base    [first source address, host byte order]
+ *            uint          n       [sources]
+ *            in_addr_t     dst     [destination of every pair]
+ *  @return : int                   [0 if passed, 1 if failed]
+ *
+ *  Source i has broadcast id i + 1
+ * --------------------------------------------------------------------------
+ */
+int btable_check(odr_btable *b, in_addr_t base, uint n, in_addr_t dst) {
+    uint    i, d, longest = 0, missing = 0;
+    ulong   sum = 0;
+    double  mean;
+
+    for (i = 0; i < n; i++)
+        if (btable_get(b, htonl(base + i), dst) != i + 1)
+            missing++;
+    for (i = 0; i < b->size; i++) {
+        if (b->slots[i].src == 0)
+            continue;
+        d = (i - btable_slot(b, b->slots[i].src, b->slots[i].dst)) & (b->size - 1);
+        sum += d;
+        longest = max(longest, d);
+    }
+    mean = b->count ? (double)sum / b->count : 0;
+    printf("test_hash: broadcast id table, one subnet to one node: %u pairs in %u slots, probe mean %.2f longest %u, %u wrong lookups\n",
+           b->count, b->size, mean, longest, missing);
+    return (missing || mean > TEST_HASH_MEAN || longest > TEST_HASH_LONGEST) ? 1 : 0;
+}
+
+/* --------------------------------------------------------------------------
+ *  main
+ *
+ *  Test entry function
+ *
+ *  @param  : int   argc
+ *            char  **argv
+ *  @return : int   [0 if every check passed, 1 otherwise]
+ * --------------------------------------------------------------------------
+ */
+int main(int argc, char **argv) {
+    int         failed = 0;
+    uint        i;
+    in_addr_t   base = ntohl(inet_addr(TEST_HASH_NET));
+    odr_hash    h;
+    odr_btable  b;
+
+    hash_init(&h, 0);
+    for (i = 0; i < TEST_HASH_KEYS; i++)
+        hash_insert(&h, htonl(base + i), (void *)(ulong)(i + 1));
+    failed |= hash_check("route index, one /16", &h, base, TEST_HASH_KEYS, 1);
+
+    for (i = 1; i < TEST_HASH_KEYS; i += 2)
+        hash_remove(&h, htonl(base + i));
+    failed |= hash_check("route index, every other removed", &h, base, TEST_HASH_KEYS, 2);
+    hash_free(&h);
+
+    btable_init(&b, TEST_BTABLE_STALENESS);
+    for (i = 0; i < TEST_BTABLE_KEYS; i++)
+        btable_set(&b, htonl(base + i), inet_addr(TEST_HASH_NET), i + 1);
+    failed |= btable_check(&b, base, TEST_BTABLE_KEYS, inet_addr(TEST_HASH_NET));
+    btable_free(&b);
+
+    printf("test_hash: %s\n", failed ? "FAILED" : "passed");
+    return failed;
+}
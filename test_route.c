@@ -1,36 +1,241 @@
 /*
-* @Author: Yinlong Su
-* @Date:   2015-11-19 10:53:06
-* @Last Modified by:   Yinlong Su
-* @Last Modified time: 2015-11-22 19:45:03
+* @File: test_route.c
+* @Date: 2015-11-19 10:53:06
+* @Last Modified time: 2026-10-17 21:59:30
+* @Description:
+*     Print the route, port and interface tables of the local ODR service.
+*     The tables are read page by page on the query socket (odr_query.c),
+*     so nothing is sent on the network and a large table does not hold
+*     the service up.
+*     - int query_page(int sockfd, odr_query *q, char *buf)
+*         [Read one page of a table]
+*     - void print_route(odr_query_reply *r)
+*         [Print a page of the route table]
+*     - void print_port(odr_query_reply *r)
+*         [Print a page of the port table]
+*     - void print_interface(odr_query_reply *r)
+*         [Print a page of the interface table]
+*     - int query_table(int sockfd, int table, int max)
+*         [Read and print a whole table]
+*     + int main(int argc, char **argv)
+*         [Test route entry function]
 */
 
 #include "np.h"
 
-int main() {
-    char ipaddr[IPADDR_BUFFSIZE];
-    bzero(ipaddr, IPADDR_BUFFSIZE);
+/* --------------------------------------------------------------------------
+ *  query_page
+ *
+ *  Read one page of a table
+ *
+ *  @param  : int       sockfd  [Socket file descriptor, bound]
+ *            odr_query *q      [request]
+ *            char      *buf    [reply buffer, ODR_QUERY_MAXLEN bytes]
+ *  @return : int               [reply length, -1 if ODR does not answer]
+ *
+ *  The request is sent again if no reply comes within MSG_RECV_TIMEOUT
+ *  seconds (ODR drops a page it cannot send right away). Only a reply that
+ *  echoes the table and cursor of the request is taken, so a late reply to
+ *  an earlier request does not repeat or skip records
+ * --------------------------------------------------------------------------
+ */
+int query_page(int sockfd, odr_query *q, char *buf) {
+    int                 n, retry;
+    fd_set              rset;
+    struct timeval      timeout;
+    struct sockaddr_un  odraddr;
 
-    char data[ODR_FRAME_PAYLOAD];
-    bzero(data, ODR_FRAME_PAYLOAD);
+    bzero(&odraddr, sizeof(odraddr));
+    odraddr.sun_family = AF_LOCAL;
+    strcpy(odraddr.sun_path, ODR_QUERY_PATH);
 
-    odr_itable *itable = Get_hw_addrs(ipaddr);
-    odr_itable *item;
+    for (retry = 0; retry < 2; retry++) {
+        if (sendto(sockfd, q, sizeof(odr_query), 0, (SA *)&odraddr, sizeof(odraddr)) < 0)
+            return -1;
+        while (1) {
+            FD_ZERO(&rset);
+            FD_SET(sockfd, &rset);
+            timeout.tv_sec = MSG_RECV_TIMEOUT;
+            timeout.tv_usec = 0;
+            if (Select(sockfd + 1, &rset, NULL, NULL, &timeout) == 0)
+                break;
+            n = Recvfrom(sockfd, buf, ODR_QUERY_MAXLEN, 0, NULL, NULL);
+            // skip a late reply for another table or page
+            if (n >= (int)sizeof(odr_query_reply) && ((odr_query_reply *)buf)->table == q->table &&
+                ((odr_query_reply *)buf)->start == q->cursor)
+                return n;
+        }
+    }
+    return -1;
+}
+
+/* --------------------------------------------------------------------------
+ *  print_route
+ *
+ *  Print a page of the route table
+ *
+ *  @param  : odr_query_reply   *r  [reply]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void print_route(odr_query_reply *r) {
+    int             i, j;
+    odr_route_rec   *rec = (odr_route_rec *)r->data;
+
+    for (i = 0; i < r->count; i++, rec++) {
+        printf("| %-*s | ", IPADDR_BUFFSIZE, util_ntop(rec->dst));
+        for (j = 0; j < 6; j++)
+            printf("%.2x%s", rec->nexthop[j], (j < 5) ? ":" : " | ");
+        printf("%3d | %3d | %5u |\n", rec->index, rec->hopcnt, rec->age);
+    }
+}
 
-    int sockfd = Socket(PF_PACKET, SOCK_RAW, htons(PROTOCOL_ID));
+/* --------------------------------------------------------------------------
+ *  print_port
+ *
+ *  Print a page of the port table
+ *
+ *  @param  : odr_query_reply   *r  [reply]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void print_port(odr_query_reply *r) {
+    int             i;
+    odr_port_rec    *rec = (odr_port_rec *)r->data;
 
-    odr_frame frame;
-    bzero(&frame, sizeof(frame));
-    // Send interface and route broadcast frame to nodes
-    // nodes will print the interface and route tables
-    for (item = itable; item != NULL; item = item->hwa_next) {
-        build_bcast_frame(&frame, item->if_haddr, ODR_FRAME_INTERFACE, data);
-        send_frame(sockfd, item->if_index, &frame, PACKET_BROADCAST);
+    for (i = 0; i < r->count; i++, rec++) {
+        rec->path[PATHNAME_BUFFSIZE - 1] = 0;
+        printf("| %5d | %-40s | %3s | ", rec->port, rec->path, rec->shm ? "shm" : "");
+        if (rec->age)
+            printf("%5u |\n", rec->age);
+        else
+            printf("perm. |\n");
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  print_interface
+ *
+ *  Print a page of the interface table
+ *
+ *  @param  : odr_query_reply   *r  [reply]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void print_interface(odr_query_reply *r) {
+    int             i, j;
+    odr_iface_rec   *rec = (odr_iface_rec *)r->data;
 
-        build_bcast_frame(&frame, item->if_haddr, ODR_FRAME_ROUTE, data);
-        send_frame(sockfd, item->if_index, &frame, PACKET_BROADCAST);
+    for (i = 0; i < r->count; i++, rec++) {
+        rec->name[IF_NAME - 1] = 0;
+        printf("| %-*s | ", IF_NAME, rec->name);
+        for (j = 0; j < 6; j++)
+            printf("%.2x%s", rec->haddr[j], (j < 5) ? ":" : " | ");
+        printf("%3d | v%d | %4d |\n", rec->index, rec->version, rec->mtu);
     }
+}
+
+/* --------------------------------------------------------------------------
+ *  query_table
+ *
+ *  Read and print a whole table
+ *
+ *  @param  : int   sockfd  [Socket file descriptor, bound]
+ *            int   table   [ODR_QUERY_*]
+ *            int   max     [records per page, 0 for as many as fit]
+ *  @return : int           [0 if succeed, -1 if ODR does not answer]
+ *
+ *  Ask for the pages one after another, following the cursor of each
+ *  reply until the last one
+ * --------------------------------------------------------------------------
+ */
+int query_table(int sockfd, int table, int max) {
+    int             pages = 0;
+    char            buf[ODR_QUERY_MAXLEN];
+    odr_query       q;
+    odr_query_reply *r = (odr_query_reply *)buf;
+
+    bzero(&q, sizeof(q));
+    q.table = table;
+    q.max = max;
 
-    free_hwa_info(itable);
+    printf("\n");
+    if (table == ODR_QUERY_ROUTE)
+        printf("+----- IP address -----+---- Next hop -----+- I -+- H -+- Age -+\n");
+    else if (table == ODR_QUERY_PORT)
+        printf("+ Port -+------------------ Path ------------------+-----+- Age -+\n");
+    else
+        printf("+- Interface name -+--- MAC address ---+- I -+ V  + MTU  +\n");
+
+    do {
+        if (query_page(sockfd, &q, buf) < 0) {
+            printf("ODR service does not answer on %s\n", ODR_QUERY_PATH);
+            return -1;
+        }
+        if (table == ODR_QUERY_ROUTE)
+            print_route(r);
+        else if (table == ODR_QUERY_PORT)
+            print_port(r);
+        else
+            print_interface(r);
+        q.cursor = r->cursor;
+        pages++;
+    } while (q.cursor != ODR_QUERY_END);
+
+    if (table == ODR_QUERY_ROUTE)
+        printf("+----------------------+-------------------+-----+-----+-------+\n");
+    else if (table == ODR_QUERY_PORT)
+        printf("+-------+------------------------------------------+-----+-------+\n");
+    else
+        printf("+------------------+-------------------+-----+----+------+\n");
+    printf("%u entries, %d page%s\n", r->total, pages, pages > 1 ? "s" : "");
     return 0;
 }
+
+/* --------------------------------------------------------------------------
+ *  main
+ *
+ *  Test route entry function
+ *
+ *  @param  : int   argc
+ *            char  **argv
+ *  @return : int
+ *
+ *  test_route [-n records per page] [route|port|interface]
+ *  Bind a temporary path, then print the tables asked for, all three by
+ *  default
+ * --------------------------------------------------------------------------
+ */
+int main(int argc, char **argv) {
+    int     c, sockfd, fd, max = 0, all, r = 0;
+    struct sockaddr_un cliaddr;
+
+    while ((c = getopt(argc, argv, "n:")) != -1) {
+        if (c != 'n' || (max = atoi(optarg)) <= 0)
+            err_quit("usage: test_route [-n records per page] [route|port|interface]");
+    }
+    all = (optind == argc);
+    if (!all && strcmp(argv[optind], "route") && strcmp(argv[optind], "port") && strcmp(argv[optind], "interface"))
+        err_quit("usage: test_route [-n records per page] [route|port|interface]");
+
+    bzero(&cliaddr, sizeof(cliaddr));
+    cliaddr.sun_family = AF_LOCAL;
+    strcpy(cliaddr.sun_path, ODR_QUERYCLIE_PATH);
+
+    fd = mkstemp(cliaddr.sun_path);
+    close(fd);
+    unlink(cliaddr.sun_path);
+
+    sockfd = Socket(AF_LOCAL, SOCK_DGRAM, 0);
+    Bind(sockfd, (SA *)&cliaddr, sizeof(cliaddr));
+
+    if (all || strcmp(argv[optind], "interface") == 0)
+        r |= query_table(sockfd, ODR_QUERY_INTERFACE, max);
+    if (r == 0 && (all || strcmp(argv[optind], "port") == 0))
+        r |= query_table(sockfd, ODR_QUERY_PORT, max);
+    if (r == 0 && (all || strcmp(argv[optind], "route") == 0))
+        r |= query_table(sockfd, ODR_QUERY_ROUTE, max);
+
+    unlink(cliaddr.sun_path);
+    return r ? 1 : 0;
+}
@@ -0,0 +1,145 @@
+/*
+* @File: test_sim.c
+* @Date: 2026-10-17 21:11:48
+* @Last Modified time: 2026-10-17 22:05:36
+* @Description:
+*     Run ODR on a simulated network (odr_sim.c) and report what the
+*     protocol did: messages are sent between random nodes at a virtual
+*     rate, then the network is left to drain; frames per type, discovery
+*     latency and delivery latency are summed over all nodes. Nothing is
+*     sent on a real network and no privileges are needed, so routing
+*     changes can be tried on hundreds of nodes, and a seed repeats a run
+*     exactly.
+*     - long sim_wall(void)
+*         [Wall clock]
+*     - void sim_report(odr_sim *sim, long wall)
+*         [Print the results]
+*     + int main(int argc, char **argv)
+*         [Simulation entry function]
+*/
+
+#include "np.h"
+
+#define SIM_USAGE "usage: test_sim [-n messages] [-m message bytes] [-r rate] [-f forced discovery ratio] [-l latency us] [-s staleness] [-S seed] [-v level] topology|grid:WxH"
+
+static const char *sim_frame_names[] = { "rreq", "rrep", "appmsg", "route", "interface", "appfrag" };
+
+/* --------------------------------------------------------------------------
+ *  sim_wall
+ *
+ *  Wall clock
+ *
+ *  @param  : void
+ *  @return : long  [monotonic time (us)]
+ *
+ *  timer_usec() follows the virtual clock during a simulation
+ * --------------------------------------------------------------------------
+ */
+long sim_wall(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/* --------------------------------------------------------------------------
+ *  sim_report
+ *
+ *  Print the results
+ *
+ *  @param  : odr_sim   *sim    [simulator, run]
+ *            long      wall    [wall time of the run (us)]
+ *  @return : void
+ * --------------------------------------------------------------------------
+ */
+void sim_report(odr_sim *sim, long wall) {
+    int         i;
+    double      vsecs = (sim->now - ODR_SIM_EPOCH * 1000000L) / 1e6, wsecs = max(wall, 1) / 1e6;
+    odr_stats   *s = (odr_stats *)Calloc(1, sizeof(odr_stats));
+
+    sim_stats(sim, s);
+    printf("test_sim: %d nodes, %d segments, %.1f s virtual in %.3f s wall (%.0fx)\n",
+           sim->nnodes, sim->nlinks, vsecs, wsecs, vsecs / wsecs);
+    printf("  %lu events, %lu frames received (%.0f/s wall)\n", sim->events, sim->frames, sim->frames / wsecs);
+    printf("  sent frames:");
+    for (i = 0; i <= ODR_FRAME_APPFRAG; i++)
+        printf(" %s %lu", sim_frame_names[i], s->tx[i]);
+    printf(", %lu RREQs suppressed\n", s->rreq_suppressed);
+    printf("  %lu discoveries started, %lu completed, latency p50 %lu us p99 %lu us max %lu us\n",
+           s->disc_started, s->disc_completed, hist_quantile(&s->disc_latency, 0.5),
+           hist_quantile(&s->disc_latency, 0.99), s->disc_latency.max);
+    printf("  %lu of %lu messages delivered (%lu with their request id), %lu queue timeouts, latency p50 %lu us p99 %lu us max %lu us\n",
+           sim->delivered, sim->sent, sim->req_kept, s->queue_timeouts, hist_quantile(&sim->msg_latency, 0.5),
+           hist_quantile(&sim->msg_latency, 0.99), sim->msg_latency.max);
+    free(s);
+}
+
+/* --------------------------------------------------------------------------
+ *  main
+ *
+ *  Simulation entry function
+ *
+ *  @param  : int   argc
+ *            char  **argv
+ *  @return : int   [0 if every message was delivered intact, and kept its
+ *                   request id unless old nodes may drop it, 1 otherwise]
+ *
+ *  1. Parse the options, load the topology and create the nodes
+ *  2. Send the messages, each from a random node to another, at the rate
+ *     of virtual time; each is scheduled when the simulation reaches it
+ *  3. Run QUEUE_TIMEOUT + 1 more seconds, so every message is delivered
+ *     or timed out, and print the results
+ * --------------------------------------------------------------------------
+ */
+int main(int argc, char **argv) {
+    int     c, i, src, dst, msglen = 0, level = ODR_LOG_WARN;
+    long    n = 1000, rate = 100, latency = ODR_SIM_LATENCY, seed = 1, due, wall;
+    ulong   staleness = 60;
+    double  forced = 0;
+    odr_sim *sim = (odr_sim *)Calloc(1, sizeof(odr_sim));
+
+    while ((c = getopt(argc, argv, "n:m:r:f:l:s:S:v:")) != -1) {
+        switch (c) {
+        case 'n': n = atol(optarg); break;
+        case 'm': msglen = atoi(optarg); break;
+        case 'r': rate = atol(optarg); break;
+        case 'f': forced = atof(optarg); break;
+        case 'l': latency = atol(optarg); break;
+        case 's': staleness = strtoul(optarg, NULL, 10); break;
+        case 'S': seed = atol(optarg); break;
+        case 'v': level = atoi(optarg); break;
+        default: err_quit(SIM_USAGE);
+        }
+    }
+    if (optind + 1 != argc || n < 0 || msglen < 0 || msglen > ODR_MSG_MAXLEN || rate <= 0 || forced < 0 || forced > 1 || latency <= 0)
+        err_quit(SIM_USAGE);
+
+    log_init(level);
+    if (sim_load(sim, argv[optind], latency) < 0)
+        err_quit("test_sim: invalid topology %s", argv[optind]);
+    sim->msglen = msglen;
+    sim_start(sim, staleness);
+    srand48(seed);
+
+    wall = sim_wall();
+    for (i = 0; i < n; i++) {
+        due = ODR_SIM_EPOCH * 1000000L + (long)(i * (1000000.0 / rate));
+        sim_run(sim, due);
+        src = 1 + lrand48() % sim->nnodes;
+        dst = 1 + lrand48() % (sim->nnodes - 1);
+        if (dst >= src)
+            dst++;
+        sim_message(sim, due, src, dst, drand48() < forced);
+    }
+    sim_run(sim, sim->now + (QUEUE_TIMEOUT + 1) * 1000000L);
+    wall = sim_wall() - wall;
+
+    sim_report(sim, wall);
+    for (i = 1, c = 0; i <= sim->nnodes; i++)
+        c |= sim->nodes[i]->version;
+    i = (sim->delivered == sim->sent && (c || sim->req_kept == sim->delivered)) ? 0 : 1;
+    sim_free(sim);
+    free(sim);
+    log_free();
+    return i;
+}
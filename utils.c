@@ -1,46 +1,296 @@
 /*
 * @File: utils.c
 * @Date: 2015-11-10 22:56:21
-* @Last Modified time: 2015-11-23 20:11:50
+* @Last Modified time: 2026-10-17 20:56:13
 * @Description:
 *     Util function library, some miscellaneous helper functions
-*     + int util_ip_to_hostname(const char *ipaddr, char *hostname)
+*     Name lookups go through a small cache (ODR_RESOLV_SIZE entries),
+*     preloaded from ODR_HOSTS_PATH. A miss is resolved by a background
+*     thread; the caller waits for it only as long as it asks to, so the
+*     server never blocks on a slow resolver while answering a request.
+*     An expired answer is still used while it is refreshed, a failed
+*     lookup is remembered ODR_RESOLV_NEG_TTL seconds
+*     - odr_resolv *resolv_find(int type, const char *name, in_addr_t addr)
+*         [Cache lookup]
+*     - odr_resolv *resolv_slot(void)
+*         [Free or oldest cache entry]
+*     - void resolv_hosts(void)
+*         [Preload the hosts file]
+*     - void *resolv_thread(void *arg)
+*         [Resolver thread]
+*     - int util_resolve(int type, const char *name, in_addr_t addr, int wait, odr_resolv *res)
+*         [Cached name lookup]
+*     + int util_ip_to_hostname(const char *ipaddr, char *hostname, int wait)
 *         [Convert IP address to hostname]
-*     + int util_hostname_to_ip(const char *hostname, char *ipaddr)
+*     + int util_hostname_to_ip(const char *hostname, char *ipaddr, int wait)
 *         [Convert hostname to IP address]
-*     + int util_ip_to_index(const char *ipaddr)
-*         [Convert IP address to index]
+*     + const char *util_ntop(in_addr_t ipaddr)
+*         [Convert binary IP address to string]
 */
 
 #include "np.h"
 
+static odr_resolv       resolv_cache[ODR_RESOLV_SIZE];
+static int              resolv_started;     /* hosts loaded, thread running */
+static pthread_mutex_t  resolv_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   resolv_wake = PTHREAD_COND_INITIALIZER;    /* work */
+static pthread_cond_t   resolv_done = PTHREAD_COND_INITIALIZER;    /* answers */
+
+/* --------------------------------------------------------------------------
+ *  resolv_find
+ *
+ *  Cache lookup
+ *
+ *  @param  : int           type    [ODR_RESOLV_FWD or ODR_RESOLV_REV]
+ *            const char    *name   [hostname (forward)]
+ *            in_addr_t     addr    [IP address (reverse)]
+ *  @return : odr_resolv *          [entry, NULL if not cached]
+ *
+ *  Called with resolv_lock
+ * --------------------------------------------------------------------------
+ */
+odr_resolv *resolv_find(int type, const char *name, in_addr_t addr) {
+    int         i;
+    odr_resolv  *r;
+
+    for (i = 0; i < ODR_RESOLV_SIZE; i++) {
+        r = &resolv_cache[i];
+        if ((r->answer == ODR_RESOLV_NONE && r->queued == 0) || r->type != type)
+            continue;
+        if (type == ODR_RESOLV_REV ? r->addr == addr : strncmp(r->name, name, HOSTNAME_BUFFSIZE - 1) == 0)
+            return r;
+    }
+    return NULL;
+}
+
+/* --------------------------------------------------------------------------
+ *  resolv_slot
+ *
+ *  Free or oldest cache entry
+ *
+ *  @param  : void
+ *  @return : odr_resolv *  [entry to reuse, NULL if all are busy]
+ *
+ *  Hosts file entries and lookups in progress are never evicted. Called
+ *  with resolv_lock
+ * --------------------------------------------------------------------------
+ */
+odr_resolv *resolv_slot(void) {
+    int         i;
+    odr_resolv  *r, *oldest = NULL;
+
+    for (i = 0; i < ODR_RESOLV_SIZE; i++) {
+        r = &resolv_cache[i];
+        if (r->answer == ODR_RESOLV_NONE && r->queued == 0)
+            return r;
+        if (r->expires && r->queued == 0 && (oldest == NULL || r->expires < oldest->expires))
+            oldest = r;
+    }
+    return oldest;
+}
+
+/* --------------------------------------------------------------------------
+ *  resolv_hosts
+ *
+ *  Preload the hosts file
+ *
+ *  @param  : void
+ *  @return : void
+ *
+ *  Every IPv4 line gives a reverse entry for the address (first name) and
+ *  a forward entry per name; they never expire. Called with resolv_lock
+ * --------------------------------------------------------------------------
+ */
+void resolv_hosts(void) {
+    int         i, n = 0;
+    char        line[256], *ip, *name, *save;
+    in_addr_t   addr;
+    FILE        *fp;
+
+    if ((fp = fopen(ODR_HOSTS_PATH, "r")) == NULL)
+        return;
+    while (fgets(line, sizeof(line), fp) && n < ODR_RESOLV_SIZE / 2) {
+        if ((save = strchr(line, '#')) != NULL)
+            *save = 0;
+        if ((ip = strtok_r(line, " \t\r\n", &save)) == NULL || inet_pton(AF_INET, ip, &addr) != 1)
+            continue;
+        for (i = 0; (name = strtok_r(NULL, " \t\r\n", &save)) != NULL && n < ODR_RESOLV_SIZE / 2; i++) {
+            if (i == 0 && resolv_find(ODR_RESOLV_REV, NULL, addr) == NULL) {
+                resolv_cache[n].type = ODR_RESOLV_REV;
+                resolv_cache[n].answer = ODR_RESOLV_OK;
+                resolv_cache[n].addr = addr;
+                strncpy(resolv_cache[n].name, name, HOSTNAME_BUFFSIZE - 1);
+                n++;
+            }
+            if (n < ODR_RESOLV_SIZE / 2 && resolv_find(ODR_RESOLV_FWD, name, 0) == NULL) {
+                resolv_cache[n].type = ODR_RESOLV_FWD;
+                resolv_cache[n].answer = ODR_RESOLV_OK;
+                resolv_cache[n].addr = addr;
+                strncpy(resolv_cache[n].name, name, HOSTNAME_BUFFSIZE - 1);
+                n++;
+            }
+        }
+    }
+    fclose(fp);
+}
+
+/* --------------------------------------------------------------------------
+ *  resolv_thread
+ *
+ *  Resolver thread
+ *
+ *  @param  : void  *arg    [unused]
+ *  @return : void *
+ *
+ *  Take the queued entries one by one and resolve them with the lock
+ *  released (getaddrinfo/getnameinfo are thread safe), then wake the
+ *  waiting callers
+ * --------------------------------------------------------------------------
+ */
+void *resolv_thread(void *arg) {
+    int                 i, ok;
+    char                host[NI_MAXHOST], name[HOSTNAME_BUFFSIZE];
+    in_addr_t           addr;
+    odr_resolv          *r;
+    struct addrinfo     hints, *ai;
+    struct sockaddr_in  sa;
+
+    pthread_mutex_lock(&resolv_lock);
+    while (1) {
+        for (i = 0, r = NULL; i < ODR_RESOLV_SIZE && r == NULL; i++)
+            if (resolv_cache[i].queued == 1)
+                r = &resolv_cache[i];
+        if (r == NULL) {
+            pthread_cond_wait(&resolv_wake, &resolv_lock);
+            continue;
+        }
+        r->queued = 2;
+        memcpy(name, r->name, HOSTNAME_BUFFSIZE);
+        addr = r->addr;
+        pthread_mutex_unlock(&resolv_lock);
+
+        if (r->type == ODR_RESOLV_FWD) {
+            bzero(&hints, sizeof(hints));
+            hints.ai_family = AF_INET;
+            hints.ai_socktype = SOCK_DGRAM;
+            ok = getaddrinfo(name, NULL, &hints, &ai) == 0;
+            if (ok) {
+                addr = ((struct sockaddr_in *)ai->ai_addr)->sin_addr.s_addr;
+                freeaddrinfo(ai);
+            }
+        } else {
+            bzero(&sa, sizeof(sa));
+            sa.sin_family = AF_INET;
+            sa.sin_addr.s_addr = addr;
+            ok = getnameinfo((SA *)&sa, sizeof(sa), host, sizeof(host), NULL, 0, NI_NAMEREQD) == 0;
+            if (ok)
+                strncpy(name, host, HOSTNAME_BUFFSIZE - 1);
+        }
+
+        pthread_mutex_lock(&resolv_lock);
+        r->queued = 0;
+        r->answer = ok ? ODR_RESOLV_OK : ODR_RESOLV_FAIL;
+        r->expires = time(NULL) + (ok ? ODR_RESOLV_TTL : ODR_RESOLV_NEG_TTL);
+        memcpy(r->name, name, HOSTNAME_BUFFSIZE);
+        r->addr = addr;
+        pthread_cond_broadcast(&resolv_done);
+    }
+    return NULL;
+}
+
+/* --------------------------------------------------------------------------
+ *  util_resolve
+ *
+ *  Cached name lookup
+ *
+ *  @param  : int           type    [ODR_RESOLV_FWD or ODR_RESOLV_REV]
+ *            const char    *name   [hostname (forward)]
+ *            in_addr_t     addr    [IP address (reverse)]
+ *            int           wait    [milliseconds to wait on a miss,
+ *                                   ODR_RESOLV_NOWAIT never blocks]
+ *            odr_resolv    *res    [answer]
+ *  @return : int           [0 if answered, -1 if failed or not known yet]
+ *
+ *  The first call loads the hosts file and starts the resolver thread. A
+ *  miss, or an expired failure, queues a lookup; an expired answer is
+ *  returned and refreshed in the background
+ * --------------------------------------------------------------------------
+ */
+int util_resolve(int type, const char *name, in_addr_t addr, int wait, odr_resolv *res) {
+    int             ret = -1;
+    pthread_t       tid;
+    odr_resolv      *r;
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += wait / 1000;
+    deadline.tv_nsec += (wait % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&resolv_lock);
+    if (!resolv_started) {
+        resolv_started = 1;
+        resolv_hosts();
+        if (pthread_create(&tid, NULL, resolv_thread, NULL) == 0)
+            pthread_detach(tid);
+    }
+
+    if ((r = resolv_find(type, name, addr)) == NULL && (r = resolv_slot()) != NULL) {
+        bzero(r, sizeof(odr_resolv));
+        r->type = type;
+        r->addr = addr;
+        if (name)
+            strncpy(r->name, name, HOSTNAME_BUFFSIZE - 1);
+    }
+
+    while (r) {
+        if (r->answer == ODR_RESOLV_OK || (r->answer == ODR_RESOLV_FAIL && r->expires >= time(NULL))) {
+            if (r->expires && r->expires < time(NULL) && r->queued == 0) {
+                r->queued = 1;
+                pthread_cond_signal(&resolv_wake);
+            }
+            *res = *r;
+            ret = (r->answer == ODR_RESOLV_OK) ? 0 : -1;
+            break;
+        }
+        if (r->queued == 0) {
+            r->queued = 1;
+            pthread_cond_signal(&resolv_wake);
+        }
+        if (wait <= 0 || pthread_cond_timedwait(&resolv_done, &resolv_lock, &deadline) != 0)
+            break;
+        // the entry may have been reused while we slept
+        if (r->type != type || (type == ODR_RESOLV_REV ? r->addr != addr : strncmp(r->name, name, HOSTNAME_BUFFSIZE - 1) != 0))
+            break;
+    }
+    pthread_mutex_unlock(&resolv_lock);
+    return ret;
+}
+
 /* --------------------------------------------------------------------------
  *  util_ip_to_hostname
  *
  *  Util function
  *
  *  @param  : const char    *ipaddr     [IP address]
- *            char          *hostname   [Hostname]
+ *            char          *hostname   [Hostname, empty if unknown]
+ *            int           wait        [milliseconds to wait on a miss]
  *  @return : int           [ -1 if failed ]
  *
  *  Convert IP address to hostname
  * --------------------------------------------------------------------------
  */
-int util_ip_to_hostname(const char *ipaddr, char *hostname) {
-    struct sockaddr_in  sockaddr;
-    struct hostent      *he;
-
-    bzero(&sockaddr, sizeof(sockaddr));
-    sockaddr.sin_family = AF_INET;
+int util_ip_to_hostname(const char *ipaddr, char *hostname, int wait) {
+    in_addr_t   addr;
+    odr_resolv  res;
 
-    inet_pton(AF_INET, ipaddr, &sockaddr.sin_addr);
-    he = gethostbyaddr(&sockaddr.sin_addr, sizeof(sockaddr.sin_addr), AF_INET);
-    if (he == NULL) {
-        printf("util_ip_to_hostname error: gethostbyaddr error for %s\n", ipaddr);
+    hostname[0] = 0;
+    if (inet_pton(AF_INET, ipaddr, &addr) != 1 || util_resolve(ODR_RESOLV_REV, NULL, addr, wait, &res) < 0)
         return -1;
-    }
-    strncpy(hostname, he->h_name, HOSTNAME_BUFFSIZE);
-
+    memcpy(hostname, res.name, HOSTNAME_BUFFSIZE);
     return 0;
 }
 
@@ -50,35 +300,41 @@ int util_ip_to_hostname(const char *ipaddr, char *hostname) {
  *  Util function
  *
  *  @param  : const char    *hostname   [Hostname]
- *            char          *ipaddr     [IP address]
+ *            char          *ipaddr     [IP address, empty if unknown]
+ *            int           wait        [milliseconds to wait on a miss]
  *  @return : int           [ -1 if failed ]
  *
- *  Convert hostname to IP address
+ *  Convert hostname to IP address. Only the vm nodes are looked up
  * --------------------------------------------------------------------------
  */
-int util_hostname_to_ip(const char *hostname, char *ipaddr) {
-    struct hostent      *he;
-    he = gethostbyname(hostname);
-    if (he == NULL || hostname[0] != 'v' || hostname[1] != 'm') {
-        printf("util_hostname_to_ip error: gethostbyname error for %s\n", hostname);
+int util_hostname_to_ip(const char *hostname, char *ipaddr, int wait) {
+    odr_resolv  res;
+
+    ipaddr[0] = 0;
+    if (hostname[0] != 'v' || hostname[1] != 'm' || util_resolve(ODR_RESOLV_FWD, hostname, 0, wait, &res) < 0)
         return -1;
-    }
-    strncpy(ipaddr, inet_ntoa(*(struct in_addr*)he->h_addr), IPADDR_BUFFSIZE);
+    inet_ntop(AF_INET, &res.addr, ipaddr, IPADDR_BUFFSIZE);
     return 0;
 }
 
 /* --------------------------------------------------------------------------
- *  util_ip_to_index
+ *  util_ntop
  *
  *  Util function
  *
- *  @param  : const char    *ipaddr     [IP address]
- *  @return : int           [ index in bcast_id table ]
+ *  @param  : in_addr_t     ipaddr      [IP address, network byte order]
+ *  @return : const char *  [dotted-quad string]
  *
- *  Convert IP address to index
- *  vm1 -> 1, vm2 -> 2, ..., vm9 -> 9, vm10 -> 0
+ *  Convert binary IP address to string for printing. The result lives in
+ *  one of a few rotating per-thread buffers, so several calls can be used
+ *  in the same printf()
  * --------------------------------------------------------------------------
  */
-int util_ip_to_index(const char *ipaddr) {
-    return (ipaddr[strlen(ipaddr)-1] - '0');
+const char *util_ntop(in_addr_t ipaddr) {
+    static __thread char buff[4][IPADDR_BUFFSIZE];
+    static __thread int  n = 0;
+    char *p = buff[n++ & 3];
+
+    inet_ntop(AF_INET, &ipaddr, p, IPADDR_BUFFSIZE);
+    return p;
 }